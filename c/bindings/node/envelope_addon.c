@@ -0,0 +1,359 @@
+/**
+ * Binding Node (N-API) do codec de envelope
+ *
+ *   encode(service, data, pack) -> Buffer
+ *   decode(buffer, unpack) -> {service, data}
+ *
+ * Escalares (null, boolean, number, bigint, string, Buffer) são codificados
+ * em C; objetos e arrays passam por pack (ex.: msgpack.encode), que deve
+ * devolver o Buffer serializado, e na leitura por unpack (ex.: msgpack.decode).
+ * Números seguem o msgpack-lite: inteiros como int, os demais como float64.
+ * data.clock sai sempre como uint64, como no broker e nos servidores Python.
+ */
+
+#define NAPI_VERSION 6
+#include <node_api.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../common_utils/envelope.h"
+
+#define KEY_MAX 256               // Maior chave de data aceita
+
+// Maior inteiro representado exatamente por um number (2^53)
+#define SAFE_INTEGER 9007199254740992.0
+
+#define CHECK(call) do { if ((call) != napi_ok) return -1; } while (0)
+
+/**
+ * Strings copiadas do V8 durante uma codificação (liberadas ao final)
+ */
+typedef struct {
+    char *blocks[ENVELOPE_MAX_FIELDS * 2 + 1];
+    int count;
+} Scratch;
+
+static char *scratch_copy(napi_env env, Scratch *scratch, napi_value value, size_t *length) {
+    if (scratch->count == (int)(sizeof(scratch->blocks) / sizeof(scratch->blocks[0])) ||
+        napi_get_value_string_utf8(env, value, NULL, 0, length) != napi_ok) {
+        return NULL;
+    }
+    char *copy = malloc(*length + 1);
+    if (!copy) {
+        return NULL;
+    }
+    scratch->blocks[scratch->count++] = copy;
+    napi_get_value_string_utf8(env, value, copy, *length + 1, length);
+    return copy;
+}
+
+static void scratch_free(Scratch *scratch) {
+    for (int i = 0; i < scratch->count; i++) {
+        free(scratch->blocks[i]);
+    }
+}
+
+static int throw_error(napi_env env, const char *message) {
+    napi_throw_error(env, NULL, message);
+    return -1;
+}
+
+static int set_number(EnvelopeField *field, double number) {
+    if (number == floor(number) && fabs(number) < SAFE_INTEGER) {
+        if (number < 0) {
+            field->type = ENVELOPE_INT;
+            field->value.sint = (int64_t)number;
+        } else {
+            field->type = ENVELOPE_UINT;
+            field->value.uint = (uint64_t)number;
+        }
+    } else {
+        field->type = ENVELOPE_DOUBLE;
+        field->value.real = number;
+    }
+    return 0;
+}
+
+/**
+ * Preenche o campo a partir do valor JS
+ * Buffers devolvidos por pack continuam vivos no escopo da chamada
+ */
+static int set_field(napi_env env, EnvelopeField *field, napi_value value, napi_value pack,
+                     Scratch *scratch) {
+    napi_valuetype type;
+    CHECK(napi_typeof(env, value, &type));
+    
+    switch (type) {
+        case napi_null:
+        case napi_undefined:
+            field->type = ENVELOPE_NIL;
+            return 0;
+        case napi_boolean: {
+            bool boolean;
+            CHECK(napi_get_value_bool(env, value, &boolean));
+            field->type = ENVELOPE_BOOL;
+            field->value.boolean = boolean;
+            return 0;
+        }
+        case napi_number: {
+            double number;
+            CHECK(napi_get_value_double(env, value, &number));
+            return set_number(field, number);
+        }
+        case napi_bigint: {
+            bool lossless;
+            CHECK(napi_get_value_bigint_uint64(env, value, &field->value.uint, &lossless));
+            if (lossless) {
+                field->type = ENVELOPE_UINT;
+                return 0;
+            }
+            CHECK(napi_get_value_bigint_int64(env, value, &field->value.sint, &lossless));
+            if (!lossless) {
+                return throw_error(env, "bigint fora do intervalo de 64 bits");
+            }
+            field->type = ENVELOPE_INT;
+            return 0;
+        }
+        case napi_string: {
+            size_t length;
+            const char *str = scratch_copy(env, scratch, value, &length);
+            if (!str) {
+                return throw_error(env, "falha ao copiar string");
+            }
+            field->type = ENVELOPE_STR;
+            field->value.bytes.data = str;
+            field->value.bytes.length = (uint32_t)length;
+            return 0;
+        }
+        default:
+            break;
+    }
+    
+    bool is_buffer;
+    CHECK(napi_is_buffer(env, value, &is_buffer));
+    field->type = ENVELOPE_BIN;
+    if (!is_buffer) {
+        napi_valuetype pack_type;
+        CHECK(napi_typeof(env, pack, &pack_type));
+        if (pack_type != napi_function) {
+            return throw_error(env, "objeto em data sem função pack");
+        }
+        napi_value global;
+        CHECK(napi_get_global(env, &global));
+        CHECK(napi_call_function(env, global, pack, 1, &value, &value));
+        CHECK(napi_is_buffer(env, value, &is_buffer));
+        if (!is_buffer) {
+            return throw_error(env, "pack deve devolver um Buffer");
+        }
+        field->type = ENVELOPE_RAW;
+    }
+    
+    void *data;
+    size_t length;
+    CHECK(napi_get_buffer_info(env, value, &data, &length));
+    field->value.bytes.data = data;
+    field->value.bytes.length = (uint32_t)length;
+    return 0;
+}
+
+static int fill_envelope(napi_env env, Envelope *envelope, napi_value data, napi_value pack,
+                         Scratch *scratch) {
+    napi_value keys;
+    uint32_t count;
+    CHECK(napi_get_property_names(env, data, &keys));
+    CHECK(napi_get_array_length(env, keys, &count));
+    
+    for (uint32_t i = 0; i < count; i++) {
+        napi_value key, value;
+        napi_valuetype type;
+        CHECK(napi_get_element(env, keys, i, &key));
+        CHECK(napi_get_property(env, data, key, &value));
+        CHECK(napi_typeof(env, value, &type));
+        
+        char name[KEY_MAX];
+        size_t length;
+        CHECK(napi_get_value_string_utf8(env, key, name, sizeof(name), &length));
+        if (length == sizeof(name) - 1) {
+            return throw_error(env, "chave de data longa demais");
+        }
+        
+        if (type == napi_number && length == 9 && memcmp(name, "timestamp", 9) == 0) {
+            CHECK(napi_get_value_double(env, value, &envelope->timestamp));
+            envelope->has_timestamp = 1;
+            continue;
+        }
+        if (type == napi_number && length == 5 && memcmp(name, "clock", 5) == 0) {
+            double clock;
+            CHECK(napi_get_value_double(env, value, &clock));
+            if (clock >= 0 && clock == floor(clock) && clock < SAFE_INTEGER) {
+                envelope->has_clock = 1;
+                envelope->clock = (uint64_t)clock;
+                continue;
+            }
+        }
+        
+        if (envelope->field_count == ENVELOPE_MAX_FIELDS) {
+            return throw_error(env, "data tem campos demais");
+        }
+        const char *stored = scratch_copy(env, scratch, key, &length);
+        if (!stored) {
+            return throw_error(env, "falha ao copiar chave");
+        }
+        EnvelopeField *field = envelope_add(envelope, stored, length, ENVELOPE_NIL);
+        if (set_field(env, field, value, pack, scratch) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static napi_value addon_encode(napi_env env, napi_callback_info info) {
+    size_t argc = 3;
+    napi_value argv[3];
+    napi_value result = NULL;
+    if (napi_get_cb_info(env, info, &argc, argv, NULL, NULL) != napi_ok || argc < 2) {
+        throw_error(env, "uso: encode(service, data, pack)");
+        return NULL;
+    }
+    napi_value pack = argv[2];    // Argumentos ausentes chegam como undefined
+    
+    Scratch scratch = { .count = 0 };
+    Envelope envelope;
+    size_t service_length;
+    const char *service = scratch_copy(env, &scratch, argv[0], &service_length);
+    if (!service) {
+        throw_error(env, "service deve ser uma string");
+        goto out;
+    }
+    envelope_init(&envelope, service, service_length);
+    if (fill_envelope(env, &envelope, argv[1], pack, &scratch) < 0) {
+        goto out;
+    }
+    
+    size_t capacity = envelope_max_size(&envelope);
+    void *buffer;
+    napi_value output;
+    if (napi_create_buffer(env, capacity, &buffer, &output) != napi_ok) {
+        goto out;
+    }
+    size_t size = envelope_encode(&envelope, buffer, capacity);
+    if (size == 0) {
+        throw_error(env, "falha ao codificar envelope");
+        goto out;
+    }
+    
+    // Visão do tamanho exato sobre o mesmo ArrayBuffer
+    napi_value subarray, bounds[2];
+    napi_get_named_property(env, output, "subarray", &subarray);
+    napi_create_uint32(env, 0, &bounds[0]);
+    napi_create_uint32(env, (uint32_t)size, &bounds[1]);
+    napi_call_function(env, output, subarray, 2, bounds, &result);
+    
+out:
+    scratch_free(&scratch);
+    return result;
+}
+
+static int field_value(napi_env env, const EnvelopeField *field, napi_value unpack,
+                       napi_value *value) {
+    switch (field->type) {
+        case ENVELOPE_NIL: CHECK(napi_get_null(env, value)); return 0;
+        case ENVELOPE_BOOL: CHECK(napi_get_boolean(env, field->value.boolean, value)); return 0;
+        case ENVELOPE_UINT: CHECK(napi_create_double(env, (double)field->value.uint, value)); return 0;
+        case ENVELOPE_INT: CHECK(napi_create_double(env, (double)field->value.sint, value)); return 0;
+        case ENVELOPE_DOUBLE: CHECK(napi_create_double(env, field->value.real, value)); return 0;
+        case ENVELOPE_STR:
+            CHECK(napi_create_string_utf8(env, field->value.bytes.data, field->value.bytes.length,
+                                          value));
+            return 0;
+        case ENVELOPE_BIN:
+            CHECK(napi_create_buffer_copy(env, field->value.bytes.length, field->value.bytes.data,
+                                          NULL, value));
+            return 0;
+        case ENVELOPE_RAW: {
+            napi_valuetype type;
+            CHECK(napi_create_buffer_copy(env, field->value.bytes.length, field->value.bytes.data,
+                                          NULL, value));
+            CHECK(napi_typeof(env, unpack, &type));
+            if (type == napi_function) {
+                napi_value global;
+                CHECK(napi_get_global(env, &global));
+                CHECK(napi_call_function(env, global, unpack, 1, value, value));
+            }
+            return 0;
+        }
+    }
+    return throw_error(env, "tipo de campo inválido");
+}
+
+static int set_named(napi_env env, napi_value object, const char *key, size_t length,
+                     napi_value value) {
+    napi_value name;
+    CHECK(napi_create_string_utf8(env, key, length, &name));
+    CHECK(napi_set_property(env, object, name, value));
+    return 0;
+}
+
+static napi_value addon_decode(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[2];
+    bool is_buffer = false;
+    if (napi_get_cb_info(env, info, &argc, argv, NULL, NULL) != napi_ok || argc < 1 ||
+        napi_is_buffer(env, argv[0], &is_buffer) != napi_ok || !is_buffer) {
+        throw_error(env, "uso: decode(buffer, unpack)");
+        return NULL;
+    }
+    napi_value unpack = argv[1];
+    
+    void *raw;
+    size_t size;
+    napi_get_buffer_info(env, argv[0], &raw, &size);
+    Envelope envelope;
+    int rc = envelope_decode(&envelope, raw, size);
+    if (rc != ENVELOPE_OK) {
+        throw_error(env, rc == ENVELOPE_TOO_MANY ? "data tem campos demais" :
+                    "envelope MessagePack inválido");
+        return NULL;
+    }
+    
+    napi_value message, data, value;
+    if (napi_create_object(env, &message) != napi_ok || napi_create_object(env, &data) != napi_ok) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < envelope.field_count; i++) {
+        const EnvelopeField *field = &envelope.fields[i];
+        if (field_value(env, field, unpack, &value) < 0 ||
+            set_named(env, data, field->key, field->key_length, value) < 0) {
+            return NULL;
+        }
+    }
+    if (envelope.has_timestamp) {
+        if (napi_create_double(env, envelope.timestamp, &value) != napi_ok ||
+            set_named(env, data, "timestamp", 9, value) < 0) {
+            return NULL;
+        }
+    }
+    if (envelope.has_clock) {
+        if (napi_create_double(env, (double)envelope.clock, &value) != napi_ok ||
+            set_named(env, data, "clock", 5, value) < 0) {
+            return NULL;
+        }
+    }
+    if (napi_create_string_utf8(env, envelope.service, envelope.service_length, &value) != napi_ok ||
+        set_named(env, message, "service", 7, value) < 0 ||
+        set_named(env, message, "data", 4, data) < 0) {
+        return NULL;
+    }
+    return message;
+}
+
+static napi_value addon_init(napi_env env, napi_value exports) {
+    napi_property_descriptor methods[] = {
+        { "encode", NULL, addon_encode, NULL, NULL, NULL, napi_default, NULL },
+        { "decode", NULL, addon_decode, NULL, NULL, NULL, napi_default, NULL },
+    };
+    napi_define_properties(env, exports, 2, methods);
+    return exports;
+}
+
+NAPI_MODULE(bbs_envelope, addon_init)
@@ -0,0 +1,276 @@
+/**
+ * Binding Python do codec de envelope (módulo bbs_envelope)
+ *
+ *   encode(service, data, pack=None) -> bytes
+ *   decode(raw, unpack=None) -> {'service': ..., 'data': {...}}
+ *
+ * Escalares (None, bool, int, float, str, bytes) são codificados em C;
+ * valores compostos passam por pack (ex.: msgpack.packb), que deve devolver
+ * o objeto já serializado, e na leitura por unpack (ex.: msgpack.unpackb).
+ * Sem pack/unpack, compostos geram TypeError na escrita e voltam como bytes
+ * na leitura. data['clock'] sai sempre como uint64, como em messaging.py.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "../../common_utils/envelope.h"
+
+/**
+ * Preenche o campo a partir do valor Python
+ * Objetos criados por pack ficam em keep até o fim da codificação
+ */
+static int set_field(EnvelopeField *field, PyObject *value, PyObject *pack, PyObject *keep) {
+    if (value == Py_None) {
+        field->type = ENVELOPE_NIL;
+        return 0;
+    }
+    if (PyBool_Check(value)) {
+        field->type = ENVELOPE_BOOL;
+        field->value.boolean = value == Py_True;
+        return 0;
+    }
+    if (PyLong_Check(value)) {
+        int overflow;
+        long long sint = PyLong_AsLongLongAndOverflow(value, &overflow);
+        if (overflow == 0 && sint < 0) {
+            field->type = ENVELOPE_INT;
+            field->value.sint = sint;
+            return 0;
+        }
+        unsigned long long uint = PyLong_AsUnsignedLongLong(value);
+        if (PyErr_Occurred()) {
+            return -1;
+        }
+        field->type = ENVELOPE_UINT;
+        field->value.uint = uint;
+        return 0;
+    }
+    if (PyFloat_Check(value)) {
+        field->type = ENVELOPE_DOUBLE;
+        field->value.real = PyFloat_AS_DOUBLE(value);
+        return 0;
+    }
+    
+    const char *data;
+    Py_ssize_t length;
+    if (PyUnicode_Check(value)) {
+        data = PyUnicode_AsUTF8AndSize(value, &length);
+        if (!data) {
+            return -1;
+        }
+        field->type = ENVELOPE_STR;
+    } else if (PyBytes_Check(value)) {
+        PyBytes_AsStringAndSize(value, (char **)&data, &length);
+        field->type = ENVELOPE_BIN;
+    } else if (pack != Py_None) {
+        PyObject *packed = PyObject_CallOneArg(pack, value);
+        if (!packed) {
+            return -1;
+        }
+        int rc = PyList_Append(keep, packed);
+        Py_DECREF(packed);  // keep mantém a referência
+        if (rc < 0) {
+            return -1;
+        }
+        if (PyBytes_AsStringAndSize(packed, (char **)&data, &length) < 0) {
+            return -1;
+        }
+        field->type = ENVELOPE_RAW;
+    } else {
+        PyErr_Format(PyExc_TypeError, "%s: %s", "tipo não suportado sem pack", Py_TYPE(value)->tp_name);
+        return -1;
+    }
+    
+    if ((size_t)length > UINT32_MAX) {
+        PyErr_SetString(PyExc_ValueError, "valor grande demais");
+        return -1;
+    }
+    field->value.bytes.data = data;
+    field->value.bytes.length = (uint32_t)length;
+    return 0;
+}
+
+static int fill_envelope(Envelope *envelope, PyObject *data, PyObject *pack, PyObject *keep) {
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(data, &pos, &key, &value)) {
+        Py_ssize_t key_length;
+        const char *key_str = PyUnicode_Check(key) ? PyUnicode_AsUTF8AndSize(key, &key_length) : NULL;
+        if (!key_str) {
+            if (!PyErr_Occurred()) {
+                PyErr_SetString(PyExc_TypeError, "chaves de data devem ser str");
+            }
+            return -1;
+        }
+        
+        if (key_length == 9 && memcmp(key_str, "timestamp", 9) == 0 && PyFloat_Check(value)) {
+            envelope->has_timestamp = 1;
+            envelope->timestamp = PyFloat_AS_DOUBLE(value);
+            continue;
+        }
+        if (key_length == 5 && memcmp(key_str, "clock", 5) == 0 && PyLong_Check(value) &&
+            !PyBool_Check(value)) {
+            unsigned long long clock = PyLong_AsUnsignedLongLong(value);
+            if (!PyErr_Occurred()) {
+                envelope->has_clock = 1;
+                envelope->clock = clock;
+                continue;
+            }
+            PyErr_Clear();  // Clock negativo: vai como campo comum
+        }
+        
+        EnvelopeField *field = envelope_add(envelope, key_str, (size_t)key_length, ENVELOPE_NIL);
+        if (!field) {
+            PyErr_Format(PyExc_ValueError, "data tem mais de %d campos", ENVELOPE_MAX_FIELDS);
+            return -1;
+        }
+        if (set_field(field, value, pack, keep) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static PyObject *envelope_py_encode(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void)self;
+    static char *keywords[] = { "service", "data", "pack", NULL };
+    const char *service;
+    Py_ssize_t service_length;
+    PyObject *data, *pack = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#O!|O", keywords, &service, &service_length,
+                                     &PyDict_Type, &data, &pack)) {
+        return NULL;
+    }
+    
+    Envelope envelope;
+    envelope_init(&envelope, service, (size_t)service_length);
+    PyObject *keep = PyList_New(0);
+    if (!keep) {
+        return NULL;
+    }
+    if (fill_envelope(&envelope, data, pack, keep) < 0) {
+        Py_DECREF(keep);
+        return NULL;
+    }
+    
+    size_t capacity = envelope_max_size(&envelope);
+    PyObject *result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)capacity);
+    if (!result) {
+        Py_DECREF(keep);
+        return NULL;
+    }
+    size_t size = envelope_encode(&envelope, PyBytes_AS_STRING(result), capacity);
+    Py_DECREF(keep);
+    if (size == 0) {
+        Py_DECREF(result);
+        PyErr_SetString(PyExc_ValueError, "falha ao codificar envelope");
+        return NULL;
+    }
+    _PyBytes_Resize(&result, (Py_ssize_t)size);
+    return result;
+}
+
+static PyObject *field_value(const EnvelopeField *field, PyObject *unpack) {
+    switch (field->type) {
+        case ENVELOPE_NIL: Py_RETURN_NONE;
+        case ENVELOPE_BOOL: return PyBool_FromLong(field->value.boolean);
+        case ENVELOPE_UINT: return PyLong_FromUnsignedLongLong(field->value.uint);
+        case ENVELOPE_INT: return PyLong_FromLongLong(field->value.sint);
+        case ENVELOPE_DOUBLE: return PyFloat_FromDouble(field->value.real);
+        case ENVELOPE_STR:
+            return PyUnicode_DecodeUTF8(field->value.bytes.data, field->value.bytes.length, NULL);
+        case ENVELOPE_BIN:
+            return PyBytes_FromStringAndSize(field->value.bytes.data, field->value.bytes.length);
+        case ENVELOPE_RAW: {
+            PyObject *raw = PyBytes_FromStringAndSize(field->value.bytes.data, field->value.bytes.length);
+            if (!raw || unpack == Py_None) {
+                return raw;
+            }
+            PyObject *value = PyObject_CallOneArg(unpack, raw);
+            Py_DECREF(raw);
+            return value;
+        }
+    }
+    PyErr_SetString(PyExc_ValueError, "tipo de campo inválido");
+    return NULL;
+}
+
+/**
+ * data[key] = value, consumindo a referência de value
+ */
+static int set_item(PyObject *dict, const char *key, size_t length, PyObject *value) {
+    if (!value) {
+        return -1;
+    }
+    PyObject *name = PyUnicode_DecodeUTF8(key, (Py_ssize_t)length, NULL);
+    int rc = name ? PyDict_SetItem(dict, name, value) : -1;
+    Py_XDECREF(name);
+    Py_DECREF(value);
+    return rc;
+}
+
+static PyObject *envelope_py_decode(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void)self;
+    static char *keywords[] = { "raw", "unpack", NULL };
+    Py_buffer raw;
+    PyObject *unpack = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|O", keywords, &raw, &unpack)) {
+        return NULL;
+    }
+    
+    Envelope envelope;
+    int rc = envelope_decode(&envelope, raw.buf, (size_t)raw.len);
+    if (rc != ENVELOPE_OK) {
+        PyBuffer_Release(&raw);
+        PyErr_SetString(PyExc_ValueError, rc == ENVELOPE_TOO_MANY ?
+                        "data tem campos demais" : "envelope MessagePack inválido");
+        return NULL;
+    }
+    
+    PyObject *data = PyDict_New();
+    PyObject *message = PyDict_New();
+    int failed = !data || !message;
+    for (uint32_t i = 0; i < envelope.field_count && !failed; i++) {
+        const EnvelopeField *field = &envelope.fields[i];
+        failed = set_item(data, field->key, field->key_length, field_value(field, unpack)) < 0;
+    }
+    if (!failed && envelope.has_timestamp) {
+        failed = set_item(data, "timestamp", 9, PyFloat_FromDouble(envelope.timestamp)) < 0;
+    }
+    if (!failed && envelope.has_clock) {
+        failed = set_item(data, "clock", 5, PyLong_FromUnsignedLongLong(envelope.clock)) < 0;
+    }
+    if (!failed) {
+        failed = set_item(message, "service", 7,
+                          PyUnicode_DecodeUTF8(envelope.service, envelope.service_length, NULL)) < 0;
+    }
+    if (!failed) {
+        Py_INCREF(data);
+        failed = set_item(message, "data", 4, data) < 0;
+    }
+    
+    PyBuffer_Release(&raw);
+    Py_XDECREF(data);
+    if (failed) {
+        Py_XDECREF(message);
+        return NULL;
+    }
+    return message;
+}
+
+static PyMethodDef envelope_methods[] = {
+    { "encode", (PyCFunction)(void (*)(void))envelope_py_encode, METH_VARARGS | METH_KEYWORDS,
+      "encode(service, data, pack=None) -> bytes" },
+    { "decode", (PyCFunction)(void (*)(void))envelope_py_decode, METH_VARARGS | METH_KEYWORDS,
+      "decode(raw, unpack=None) -> dict" },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef envelope_module = {
+    PyModuleDef_HEAD_INIT, "bbs_envelope", "Codec do envelope das mensagens do BBS", -1,
+    envelope_methods, NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_bbs_envelope(void) {
+    return PyModule_Create(&envelope_module);
+}
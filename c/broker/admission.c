@@ -0,0 +1,165 @@
+/**
+ * Broker - Controle de admissão no frontend
+ *
+ * Cada cliente (identidade do ROUTER) tem um balde de tokens com
+ * BROKER_RATE_LIMIT tokens/s e capacidade BROKER_RATE_BURST; uma requisição
+ * sem token é respondida na hora pelo broker com status 'erro' e
+ * data.retry_after (ms até o próximo token), em vez de entrar na fila dos
+ * servidores. Com BROKER_MAX_INFLIGHT, requisições além desse total nos
+ * servidores recebem a mesma resposta com BROKER_RETRY_AFTER ms: a fila dos
+ * servidores (e a latência de quem foi aceito) fica limitada sob sobrecarga.
+ *
+ * Um cliente REQ tem no máximo uma requisição em trânsito, então o total é
+ * o número de clientes marcados entre o envio ao servidor e a resposta.
+ * Uma resposta que não vem (servidor caiu) deixa de contar após
+ * ADMISSION_INFLIGHT_TIMEOUT ms.
+ *
+ * Usado apenas pelo loop principal (sem locks).
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include "broker.h"
+
+#define SWEEP_INTERVAL_NS 1000000000ULL
+
+void admission_init(Admission *admission, const BrokerConfig *config) {
+    memset(admission, 0, sizeof(*admission));
+    admission->config = config;
+}
+
+/**
+ * Entrada do cliente do primeiro frame no seu conjunto de ADMISSION_WAYS
+ * @param create Ocupa um slot livre ou o do cliente parado há mais tempo
+ *               (sem requisição em trânsito) se o cliente não tem entrada
+ * @return Entrada ou NULL se o cliente não pode ser acompanhado
+ */
+static AdmissionClient *client_find(Admission *admission, Multipart *mp, int create, uint64_t now) {
+    zmq_msg_t *id = &mp->frames[0];
+    size_t size = mp->count > 0 ? zmq_msg_size(id) : 0;
+    if (size == 0 || size > PENDING_ID_SIZE) {
+        if (create) {
+            admission->untracked++;
+        }
+        return NULL;
+    }
+    
+    AdmissionClient *set = &admission->clients[multipart_hash(mp) % (ADMISSION_SLOTS / ADMISSION_WAYS) *
+                                               ADMISSION_WAYS];
+    AdmissionClient *victim = NULL;
+    for (int i = 0; i < ADMISSION_WAYS; i++) {
+        AdmissionClient *client = &set[i];
+        if (client->id_size == size && memcmp(client->id, zmq_msg_data(id), size) == 0) {
+            return client;
+        }
+        if (client->id_size == 0) {
+            if (!victim || victim->id_size != 0) {
+                victim = client;
+            }
+        } else if (client->sent_ns == 0 && (!victim || (victim->id_size != 0 &&
+                                                         client->refilled_ns < victim->refilled_ns))) {
+            victim = client;
+        }
+    }
+    
+    if (!create) {
+        return NULL;
+    }
+    if (!victim) {
+        admission->untracked++;  // Todos os clientes do conjunto aguardam resposta
+        return NULL;
+    }
+    memcpy(victim->id, zmq_msg_data(id), size);
+    victim->id_size = size;
+    victim->tokens = admission->config->rate_burst;
+    victim->refilled_ns = now;
+    victim->sent_ns = 0;
+    return victim;
+}
+
+int admission_allow(Admission *admission, Multipart *mp, int *retry_after) {
+    *retry_after = 0;
+    int rate = admission->config->rate_limit;
+    if (rate == 0) {
+        return 1;
+    }
+    
+    uint64_t now = monotonic_ns();
+    AdmissionClient *client = client_find(admission, mp, 1, now);
+    if (!client) {
+        return 1;
+    }
+    
+    double burst = admission->config->rate_burst;
+    client->tokens += (double)(now - client->refilled_ns) * rate / 1e9;
+    if (client->tokens > burst) {
+        client->tokens = burst;
+    }
+    client->refilled_ns = now;
+    
+    if (client->tokens >= 1.0) {
+        client->tokens -= 1.0;
+        return 1;
+    }
+    *retry_after = (int)((1.0 - client->tokens) * 1000.0 / rate) + 1;
+    admission->rate_limited++;
+    return 0;
+}
+
+int admission_saturated(Admission *admission) {
+    int limit = admission->config->max_inflight;
+    if (limit == 0 || admission->inflight < limit) {
+        return 0;
+    }
+    admission->saturated++;
+    return 1;
+}
+
+void admission_sent(Admission *admission, Multipart *mp) {
+    if (admission->config->max_inflight == 0) {
+        return;
+    }
+    
+    uint64_t now = monotonic_ns();
+    AdmissionClient *client = client_find(admission, mp, 1, now);
+    if (!client) {
+        return;
+    }
+    // Uma requisição anterior ainda marcada foi abandonada pelo cliente
+    if (client->sent_ns == 0) {
+        admission->inflight++;
+    }
+    client->sent_ns = now;
+}
+
+void admission_completed(Admission *admission, Multipart *mp) {
+    if (admission->inflight == 0) {
+        return;
+    }
+    
+    AdmissionClient *client = client_find(admission, mp, 0, 0);
+    if (client && client->sent_ns != 0) {
+        client->sent_ns = 0;
+        admission->inflight--;
+    }
+}
+
+void admission_expire(Admission *admission) {
+    if (admission->inflight == 0) {
+        return;
+    }
+    uint64_t now = monotonic_ns();
+    if (now < admission->next_sweep_ns) {
+        return;
+    }
+    
+    admission->next_sweep_ns = now + SWEEP_INTERVAL_NS;
+    uint64_t timeout = (uint64_t)ADMISSION_INFLIGHT_TIMEOUT * 1000000u;
+    for (int i = 0; i < ADMISSION_SLOTS && admission->inflight > 0; i++) {
+        AdmissionClient *client = &admission->clients[i];
+        if (client->sent_ns != 0 && now - client->sent_ns > timeout) {
+            client->sent_ns = 0;
+            admission->inflight--;
+            admission->expired++;
+        }
+    }
+}
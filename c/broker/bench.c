@@ -0,0 +1,406 @@
+/**
+ * Broker - Gerador de carga para medir o broker isolado
+ *
+ * Para cada combinação de modo de validação e número de threads, inicia o
+ * binário do broker com as variáveis de ambiente correspondentes, conecta
+ * servidores "echo" no backend (DEALER que se anuncia com 'ready' e devolve
+ * o payload) e clientes REQ no frontend, em malha fechada, com mensagens no
+ * formato real {service, data} dos clientes. Ao final de cada rodada relata
+ * vazão e latência p50/p99/p99.9.
+ *
+ * Uso: ./broker_bench [-c clientes] [-w servidores] [-s bytes] [-p formato]
+ *                     [-d segundos] [-m modos] [-t threads] [-b broker] [-x]
+ *   -p login | publish | message   formato do envelope (padrão: publish)
+ *   -m off,sampled,full,strict      modos de validação a medir
+ *   -t 1,2,4                        valores de BROKER_THREADS a medir
+ *   -x                              usa um broker já em execução (uma rodada)
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <zmq.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "../common_utils/msgpack_lite.h"
+#include "../common_utils/histogram.h"
+
+#define BENCH_FRONTEND "tcp://localhost:5555"
+#define BENCH_BACKEND "tcp://localhost:5556"
+#define BENCH_MAX_CLIENTS 1024
+#define BENCH_MAX_SERVERS 64
+#define BENCH_MAX_PAYLOAD (1024 * 1024)
+#define BENCH_RECV_TIMEOUT 2000        // ms sem resposta até contar timeout
+#define BENCH_STARTUP_NS 500000000L    // Espera o broker fazer bind (500ms)
+
+typedef struct {
+    int clients;
+    int servers;
+    int size;                 // Tamanho do campo 'message'
+    const char *shape;
+    int duration;             // Segundos por rodada
+    const char *modes;
+    const char *threads;
+    const char *broker;
+    int external;
+} BenchOptions;
+
+typedef struct {
+    pthread_t thread;
+    void *context;
+    const uint8_t *payload;
+    size_t payload_size;
+    double deadline;          // Fim da rodada (CLOCK_MONOTONIC, segundos)
+    Histogram latency;        // µs
+    unsigned long requests;
+    unsigned long errors;     // Timeouts e respostas diferentes do enviado
+} BenchClient;
+
+typedef struct {
+    pthread_t thread;
+    void *context;
+    int index;
+} BenchServer;
+
+static double now_monotonic(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Monta uma requisição no formato de create_message():
+ * {service, data: {..., timestamp, clock}}
+ * Retorna o tamanho serializado ou 0 se não coube
+ */
+static size_t build_payload(uint8_t *buffer, size_t capacity, const char *shape, int size) {
+    char *text = malloc((size_t)size + 1);
+    if (!text) {
+        return 0;
+    }
+    memset(text, 'x', (size_t)size);
+    text[size] = '\0';
+    
+    MpWriter writer;
+    mp_writer_init(&writer, buffer, capacity);
+    mp_write_map(&writer, 2);
+    mp_write_str(&writer, "service", 7);
+    
+    if (strcmp(shape, "login") == 0) {
+        mp_write_str(&writer, "login", 5);
+        mp_write_str(&writer, "data", 4);
+        mp_write_map(&writer, 3);
+        mp_write_str(&writer, "user", 4);
+        mp_write_str(&writer, "bench_user", 10);
+    } else if (strcmp(shape, "message") == 0) {
+        mp_write_str(&writer, "message", 7);
+        mp_write_str(&writer, "data", 4);
+        mp_write_map(&writer, 5);
+        mp_write_str(&writer, "src", 3);
+        mp_write_str(&writer, "bench_user", 10);
+        mp_write_str(&writer, "dst", 3);
+        mp_write_str(&writer, "bench_peer", 10);
+        mp_write_str(&writer, "message", 7);
+        mp_write_str(&writer, text, (size_t)size);
+    } else {
+        mp_write_str(&writer, "publish", 7);
+        mp_write_str(&writer, "data", 4);
+        mp_write_map(&writer, 5);
+        mp_write_str(&writer, "user", 4);
+        mp_write_str(&writer, "bench_user", 10);
+        mp_write_str(&writer, "channel", 7);
+        mp_write_str(&writer, "geral", 5);
+        mp_write_str(&writer, "message", 7);
+        mp_write_str(&writer, text, (size_t)size);
+    }
+    
+    mp_write_str(&writer, "timestamp", 9);
+    mp_write_double(&writer, now_seconds());
+    mp_write_str(&writer, "clock", 5);
+    mp_write_uint(&writer, 1);
+    
+    free(text);
+    return writer.error ? 0 : writer.pos;
+}
+
+/**
+ * Servidor echo: anuncia-se com 'ready' e devolve cada requisição com o
+ * envelope recebido, como server.py faria com uma resposta do mesmo tamanho
+ * Termina quando o contexto é desligado (ETERM)
+ */
+static void *server_main(void *arg) {
+    BenchServer *server = (BenchServer *)arg;
+    void *socket = zmq_socket(server->context, ZMQ_DEALER);
+    char identity[32];
+    int linger = 0;
+    
+    snprintf(identity, sizeof(identity), "bench_echo_%d", server->index);
+    zmq_setsockopt(socket, ZMQ_IDENTITY, identity, strlen(identity));
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    if (zmq_connect(socket, BENCH_BACKEND) != 0) {
+        zmq_close(socket);
+        return NULL;
+    }
+    
+    uint8_t ready[64];
+    MpWriter writer;
+    mp_writer_init(&writer, ready, sizeof(ready));
+    mp_write_map(&writer, 1);
+    mp_write_str(&writer, "service", 7);
+    mp_write_str(&writer, "ready", 5);
+    zmq_send(socket, "", 0, ZMQ_SNDMORE);
+    zmq_send(socket, ready, writer.pos, 0);
+    
+    zmq_msg_t frames[16];
+    while (1) {
+        int count = 0;
+        int more = 1;
+        while (more && count < 16) {
+            zmq_msg_init(&frames[count]);
+            if (zmq_msg_recv(&frames[count], socket, 0) < 0) {
+                zmq_msg_close(&frames[count]);
+                for (int i = 0; i < count; i++) zmq_msg_close(&frames[i]);
+                zmq_close(socket);
+                return NULL;  // ETERM
+            }
+            more = zmq_msg_more(&frames[count]);
+            count++;
+        }
+        
+        for (int i = 0; i < count; i++) {
+            zmq_msg_send(&frames[i], socket, i < count - 1 ? ZMQ_SNDMORE : 0);
+            zmq_msg_close(&frames[i]);
+        }
+    }
+}
+
+static void *open_client(void *context) {
+    void *socket = zmq_socket(context, ZMQ_REQ);
+    int timeout = BENCH_RECV_TIMEOUT;
+    int linger = 0;
+    zmq_setsockopt(socket, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_connect(socket, BENCH_FRONTEND);
+    return socket;
+}
+
+/**
+ * Cliente em malha fechada: envia, espera a resposta, registra a latência
+ */
+static void *client_main(void *arg) {
+    BenchClient *client = (BenchClient *)arg;
+    void *socket = open_client(client->context);
+    uint8_t *reply = malloc(client->payload_size + 1);
+    
+    while (reply && now_monotonic() < client->deadline) {
+        double start = now_monotonic();
+        if (zmq_send(socket, client->payload, client->payload_size, 0) < 0) {
+            client->errors++;
+            break;
+        }
+        
+        int size = zmq_recv(socket, reply, client->payload_size + 1, 0);
+        if (size < 0) {
+            // Sem resposta: o REQ fica preso esperando, então é recriado
+            client->errors++;
+            zmq_close(socket);
+            socket = open_client(client->context);
+            continue;
+        }
+        
+        if ((size_t)size != client->payload_size) {
+            client->errors++;  // Ex: resposta de erro do broker
+        }
+        histogram_record(&client->latency, (uint64_t)((now_monotonic() - start) * 1e6));
+        client->requests++;
+    }
+    
+    free(reply);
+    zmq_close(socket);
+    return NULL;
+}
+
+/**
+ * Inicia o broker com o modo e o número de threads da rodada
+ * A saída do broker vai para /dev/null; métricas HTTP ficam desligadas
+ */
+static pid_t start_broker(const char *path, const char *mode, const char *threads) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+    
+    setenv("BROKER_VALIDATION", mode, 1);
+    setenv("BROKER_THREADS", threads, 1);
+    setenv("BROKER_STATS_ENDPOINT", "off", 1);
+    setenv("BROKER_LOG_LEVEL", "error", 1);
+    if (!freopen("/dev/null", "w", stdout)) {
+        _exit(127);
+    }
+    execl(path, path, (char *)NULL);
+    fprintf(stderr, "[BENCH] Erro ao executar %s\n", path);
+    _exit(127);
+}
+
+static void stop_broker(pid_t pid) {
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+/**
+ * Uma rodada: servidores echo + clientes por options->duration segundos
+ */
+static int run_round(const BenchOptions *options, const uint8_t *payload, size_t payload_size,
+                     const char *mode, const char *threads) {
+    static BenchClient clients[BENCH_MAX_CLIENTS];
+    static BenchServer servers[BENCH_MAX_SERVERS];
+    static Histogram total;
+    
+    pid_t pid = -1;
+    if (!options->external) {
+        pid = start_broker(options->broker, mode, threads);
+        if (pid < 0) {
+            fprintf(stderr, "[BENCH] Erro ao iniciar o broker\n");
+            return -1;
+        }
+        nanosleep(&(struct timespec){ 0, BENCH_STARTUP_NS }, NULL);
+    }
+    
+    void *context = zmq_ctx_new();
+    for (int i = 0; i < options->servers; i++) {
+        servers[i] = (BenchServer){ .context = context, .index = i };
+        pthread_create(&servers[i].thread, NULL, server_main, &servers[i]);
+    }
+    // Dá tempo para os anúncios 'ready' chegarem antes da carga
+    nanosleep(&(struct timespec){ 0, BENCH_STARTUP_NS }, NULL);
+    
+    double started = now_monotonic();
+    for (int i = 0; i < options->clients; i++) {
+        BenchClient *client = &clients[i];
+        memset(client, 0, sizeof(*client));
+        client->context = context;
+        client->payload = payload;
+        client->payload_size = payload_size;
+        client->deadline = started + options->duration;
+        histogram_init(&client->latency);
+        pthread_create(&client->thread, NULL, client_main, client);
+    }
+    
+    unsigned long requests = 0;
+    unsigned long errors = 0;
+    histogram_init(&total);
+    for (int i = 0; i < options->clients; i++) {
+        pthread_join(clients[i].thread, NULL);
+        histogram_merge(&total, &clients[i].latency);
+        requests += clients[i].requests;
+        errors += clients[i].errors;
+    }
+    double elapsed = now_monotonic() - started;
+    
+    zmq_ctx_shutdown(context);
+    for (int i = 0; i < options->servers; i++) {
+        pthread_join(servers[i].thread, NULL);
+    }
+    zmq_ctx_term(context);
+    stop_broker(pid);
+    
+    printf("%-8s %7s %8d %9lu %12.0f %9llu %9llu %9llu %9llu %7lu\n",
+           mode, threads, options->clients, requests, (double)requests / elapsed,
+           (unsigned long long)histogram_percentile(&total, 50.0),
+           (unsigned long long)histogram_percentile(&total, 99.0),
+           (unsigned long long)histogram_percentile(&total, 99.9),
+           (unsigned long long)total.max, errors);
+    fflush(stdout);
+    return 0;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Uso: %s [-c clientes] [-w servidores] [-s bytes] [-p login|publish|message]\n"
+                    "       [-d segundos] [-m off,sampled,full,strict] [-t 1,2,4] [-b ./broker] [-x]\n",
+            program);
+}
+
+/**
+ * Inteiro positivo de um argumento de linha de comando
+ */
+static int parse_count(const char *value, int max, int *out) {
+    char *end = NULL;
+    long parsed = strtol(value, &end, 10);
+    if (*end != '\0' || parsed <= 0 || parsed > max) {
+        return -1;
+    }
+    *out = (int)parsed;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options = { 16, 3, 64, "publish", 5, "off,sampled,full,strict", "1,2,4", "./broker", 0 };
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "c:w:s:p:d:m:t:b:xh")) != -1) {
+        int ok = 0;
+        switch (opt) {
+            case 'c': ok = parse_count(optarg, BENCH_MAX_CLIENTS, &options.clients) == 0; break;
+            case 'w': ok = parse_count(optarg, BENCH_MAX_SERVERS, &options.servers) == 0; break;
+            case 's': ok = parse_count(optarg, BENCH_MAX_PAYLOAD - 1024, &options.size) == 0; break;
+            case 'd': ok = parse_count(optarg, 3600, &options.duration) == 0; break;
+            case 'p': options.shape = optarg; ok = 1; break;
+            case 'm': options.modes = optarg; ok = 1; break;
+            case 't': options.threads = optarg; ok = 1; break;
+            case 'b': options.broker = optarg; ok = 1; break;
+            case 'x': options.external = 1; ok = 1; break;
+            default: break;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    static uint8_t payload[BENCH_MAX_PAYLOAD];
+    size_t payload_size = build_payload(payload, sizeof(payload), options.shape, options.size);
+    if (payload_size == 0) {
+        fprintf(stderr, "[BENCH] Erro ao montar a mensagem\n");
+        return 1;
+    }
+    
+    // Conexões encerradas pelo broker entre rodadas não devem derrubar o gerador
+    signal(SIGPIPE, SIG_IGN);
+    
+    printf("[BENCH] %d clientes, %d servidores echo, formato %s, %zu bytes por requisição, %ds por rodada\n",
+           options.clients, options.servers, options.shape, payload_size, options.duration);
+    printf("%-8s %7s %8s %9s %12s %9s %9s %9s %9s %7s\n",
+           "modo", "threads", "clientes", "reqs", "reqs/s", "p50(us)", "p99(us)", "p999(us)", "max(us)", "erros");
+    
+    if (options.external) {
+        return run_round(&options, payload, payload_size, "externo", "-") == 0 ? 0 : 1;
+    }
+    
+    // Produto cartesiano modos x threads
+    char modes[256];
+    snprintf(modes, sizeof(modes), "%s", options.modes);
+    for (char *mode_save = NULL, *mode = strtok_r(modes, ",", &mode_save); mode;
+         mode = strtok_r(NULL, ",", &mode_save)) {
+        char threads[256];
+        snprintf(threads, sizeof(threads), "%s", options.threads);
+        for (char *thread_save = NULL, *count = strtok_r(threads, ",", &thread_save); count;
+             count = strtok_r(NULL, ",", &thread_save)) {
+            if (run_round(&options, payload, payload_size, mode, count) != 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
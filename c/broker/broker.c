@@ -1,28 +1,47 @@
 /**
- * Broker - Intermediário REQ-REP usando padrão ROUTER-DEALER
- * Faz balanceamento de carga round-robin entre os servidores
+ * Broker - Intermediário REQ-REP usando padrão ROUTER-ROUTER
+ * (com BROKER_MODE=proxy o mesmo binário é o proxy PUB-SUB, ver pubsub.c)
+ * Faz balanceamento por carga: cada requisição vai ao servidor com menos
+ * requisições pendentes (servidores se anunciam com 'ready')
  * Porta: 5555 (frontend para clientes), 5556 (backend para servidores)
  * 
  * ATUALIZAÇÃO: Agora valida MessagePack para conformidade com Parte 3
  * Mantém comportamento de roteamento transparente, mas verifica formato
+ * Modo de validação selecionável em tempo de execução (BROKER_VALIDATION)
+ * Métricas em formato Prometheus via HTTP (BROKER_STATS_ENDPOINT)
  */
 #define _POSIX_C_SOURCE 200809L
 #include <zmq.h>
-#include <msgpack.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdlib.h>
-#include "../common_utils/logical_clock.h"
-
-#define FRONTEND_PORT "tcp://*:5555"
-#define BACKEND_PORT "tcp://*:5556"
-#define MSGPACK_VALIDATION_ENABLED 1  // Ativar/desativar validação
+#include "broker.h"
 
 // Flag para controlar o loop principal
 static volatile int s_interrupted = 0;
 
+/**
+ * Estado do loop principal
+ */
+typedef struct {
+    void *frontend;
+    void *backend;
+    BrokerConfig config;
+    Inspector inspector;   // Usado quando BROKER_THREADS=1 (inspeção no próprio loop)
+    WorkerPool pool;       // Usado quando BROKER_THREADS>1
+    Scheduler scheduler;   // Servidores do backend e requisições pendentes
+    void *stats_socket;    // ZMQ_STREAM do endpoint de métricas (NULL = desligado)
+    BrokerStats stats;
+    ReadCache cache;       // Respostas de leituras (BROKER_CACHE)
+    Admission admission;   // Limites por cliente e global (BROKER_RATE_LIMIT, BROKER_MAX_INFLIGHT)
+    Failover failover;     // Requisições nos servidores, para reenvio se um deles cair
+    void *monitor;         // Eventos de desconexão do backend (NULL = sem monitor)
+    uint64_t next_heartbeat_ns;
+    Cluster cluster;       // Gossip da saúde do backend com os outros brokers (BROKER_PEERS)
+} Broker;
+
 /**
  * Handler para sinais de interrupção (SIGINT, SIGTERM)
  */
@@ -30,6 +49,13 @@ static void s_signal_handler(int signal_value) {
     s_interrupted = 1;
 }
 
+/**
+ * Handler para troca do nível de log (SIGUSR1 mais detalhado, SIGUSR2 menos)
+ */
+static void s_log_level_handler(int signal_value) {
+    log_shift_level(signal_value == SIGUSR1 ? -1 : 1);
+}
+
 /**
  * Instala handlers de sinais
  */
@@ -40,55 +66,504 @@ static void s_catch_signals(void) {
     sigemptyset(&action.sa_mask);
     sigaction(SIGINT, &action, NULL);
     sigaction(SIGTERM, &action, NULL);
+    
+    action.sa_handler = s_log_level_handler;
+    sigaction(SIGUSR1, &action, NULL);
+    sigaction(SIGUSR2, &action, NULL);
 }
 
 /**
- * Valida se uma mensagem está em formato MessagePack válido
- * Retorna 1 se válida, 0 se inválida
- * Nota: Esta validação é um sanity check, não modifica a mensagem
+ * Lê uma mensagem do socket TCP da direção
+ * Mensagens do backend chegam com a identidade do servidor na frente: ela é
+ * removida e a requisição correspondente é dada como concluída. Anúncios
+ * 'ready' ([servidor][""][ready], sem cliente no envelope) registram o
+ * servidor e são consumidos aqui, assim como os pongs. Respostas atrasadas de
+ * uma requisição já reenviada ou respondida pelo broker são descartadas.
+ * Retorna 1 se há mensagem a encaminhar, 2 se foi consumida, 0 se não havia, -1 em erro
  */
-static int validate_msgpack(const char *data, size_t size) {
-    if (!MSGPACK_VALIDATION_ENABLED) {
-        return 1;  // Validação desabilitada, sempre válido
+static int receive_message(Broker *broker, Direction direction, Multipart *mp) {
+    void *from = direction == FRONTEND_TO_BACKEND ? broker->frontend : broker->backend;
+    
+    int rc = multipart_recv(mp, from, ZMQ_DONTWAIT);
+    if (rc <= 0) {
+        return rc;
+    }
+    if (direction == FRONTEND_TO_BACKEND) {
+        stats_received(&broker->stats, mp, direction);
+        return rc;
     }
     
-    if (!data || size == 0) {
-        return 0;
+    zmq_msg_t *id = &mp->frames[0];
+    int index = scheduler_find(&broker->scheduler, zmq_msg_data(id), zmq_msg_size(id));
+    if (index < 0) {
+        index = scheduler_register(&broker->scheduler, zmq_msg_data(id), zmq_msg_size(id));
+        if (index >= 0) {
+            log_message(LOG_INFO, "Servidor %.*s registrado (%d ativos)",
+                        (int)zmq_msg_size(id), (const char *)zmq_msg_data(id), broker->scheduler.count);
+            cluster_server_registered(&broker->cluster, zmq_msg_data(id), zmq_msg_size(id));
+        }
+    }
+    if (index >= 0) {
+        broker->scheduler.servers[index].seen_ns = monotonic_ns();
+        broker->scheduler.servers[index].suspect_ns = 0;  // Respondeu: a suspeita de um peer não vale
+    }
+    multipart_pop_front(mp);
+    
+    if (mp->count == 2 && zmq_msg_size(&mp->frames[0]) == 0) {
+        multipart_close(mp);  // Anúncio 'ready' ou pong
+        return 2;
+    }
+    if (index >= 0 && !failover_reply(&broker->failover, mp, broker->scheduler.servers[index].serial)) {
+        multipart_close(mp);
+        return 2;
+    }
+    
+    stats_received(&broker->stats, mp, direction);
+    stats_reply_received(&broker->stats, mp, index >= 0 ? &broker->scheduler.servers[index] : NULL);
+    if (index >= 0) {
+        scheduler_completed(&broker->scheduler, index);
+    }
+    return 1;
+}
+
+/**
+ * Tira o servidor do escalonamento; as suas requisições pendentes são
+ * reenviadas ou respondidas em failover_process
+ */
+static void lose_server(Broker *broker, int index, const char *reason) {
+    BackendServer *server = &broker->scheduler.servers[index];
+    log_message(LOG_WARNING, "Servidor %.*s %s, removido do escalonamento",
+                (int)server->id_size, (const char *)server->id, reason);
+    failover_server_lost(&broker->failover, server->serial);
+    cluster_server_lost(&broker->cluster, server->id, server->id_size);
+    scheduler_remove(&broker->scheduler, index);
+}
+
+/**
+ * Envia a requisição ao servidor menos carregado (dentre os da rota do serviço)
+ * A identidade do servidor é colocada na frente do envelope do cliente.
+ * Com ZMQ_ROUTER_MANDATORY, um servidor desconectado falha com EHOSTUNREACH:
+ * ele sai da tabela e a requisição vai para o próximo.
+ * Sem servidores, mp passa a ser a resposta de erro ao cliente (não enviada).
+ * Retorna 0 se enviou ao backend, 1 se mp é a resposta de erro, -1 em erro
+ */
+static int send_to_backend(Broker *broker, Multipart *mp, const RequestInfo *info) {
+    while (1) {
+        int index = scheduler_pick(&broker->scheduler, info->route);
+        if (index < 0) {
+            return inspector_reply_error(&broker->inspector, mp, "Nenhum servidor disponível") == 0 ? 1 : -1;
+        }
+        
+        // Ainda com o cliente no primeiro frame (o envio move os frames)
+        BackendServer *server = &broker->scheduler.servers[index];
+        stats_request_sent(&broker->stats, mp, info->service);
+        admission_sent(&broker->admission, mp);
+        failover_sent(&broker->failover, mp, server->serial, info);
+        
+        if (multipart_push_front(mp, &broker->inspector.pool, server->id, server->id_size) < 0) {
+            admission_completed(&broker->admission, mp);
+            failover_forget(&broker->failover, mp);
+            return -1;
+        }
+        if (multipart_send(mp, broker->backend) == 0) {
+            scheduler_assigned(&broker->scheduler, index);
+            return 0;
+        }
+        
+        int err = errno;
+        multipart_pop_front(mp);
+        admission_completed(&broker->admission, mp);
+        failover_forget(&broker->failover, mp);
+        if (err != EHOSTUNREACH) {
+            errno = err;
+            return -1;
+        }
+        lose_server(broker, index, "desconectado");
+    }
+}
+
+/**
+ * Envia ao cliente uma resposta dada pelo cache (guardada ou de uma
+ * requisição idêntica), com o data.clock carimbado como nas demais
+ */
+static void deliver_cached(void *arg, Multipart *reply, int service) {
+    Broker *broker = (Broker *)arg;
+    inspector_stamp(&broker->inspector, &reply->frames[reply->count - 1]);
+    stats_reply_cached(&broker->stats, reply, service);
+    if (multipart_send_flags(reply, broker->frontend, ZMQ_DONTWAIT) < 0) {
+        stats_reply_dropped(&broker->stats, reply);
+    }
+}
+
+/**
+ * Recusa a requisição com uma resposta 'erro' + data.retry_after, sem fila
+ */
+static void reply_busy(Broker *broker, Multipart *mp, const char *description, int retry_after) {
+    if (inspector_reply_busy(&broker->inspector, mp, description, retry_after) == 0 &&
+        multipart_send_flags(mp, broker->frontend, ZMQ_DONTWAIT) < 0) {
+        stats_reply_dropped(&broker->stats, mp);
+    }
+}
+
+/**
+ * Cliente em espera de uma requisição idêntica que o cache abandonou: erro
+ * com retry_after, para que ele repita em vez de esperar pelo seu timeout
+ */
+static void refuse_cached(void *arg, Multipart *reply, int service) {
+    (void)service;
+    Broker *broker = (Broker *)arg;
+    reply_busy(broker, reply, "Requisição idêntica sem resposta", broker->config.retry_after);
+}
+
+/**
+ * Envia uma resposta ao cliente
+ * Nunca bloqueia o loop por um cliente: fila cheia (EAGAIN) ou cliente
+ * desconectado (EHOSTUNREACH) descartam só esta resposta
+ */
+static void reply_to_frontend(Broker *broker, Multipart *mp) {
+    if (multipart_send_flags(mp, broker->frontend, ZMQ_DONTWAIT) < 0) {
+        if (errno != EAGAIN && errno != EHOSTUNREACH) {
+            log_message(LOG_ERROR, "Erro ao encaminhar mensagem (%s): %s",
+                        direction_name(BACKEND_TO_FRONTEND), zmq_strerror(errno));
+        }
+        stats_reply_dropped(&broker->stats, mp);
+    }
+}
+
+/**
+ * Entrega uma mensagem já inspecionada ao seu destino
+ */
+static void deliver_message(Broker *broker, Multipart *mp, Direction direction, const RequestInfo *info) {
+    if (info->route == ROUTE_REJECTED) {
+        // Recusada na validação: não entrou na admissão nem no cache, e a
+        // resposta de erro não pode fechar a leitura em trânsito do cliente
+        reply_to_frontend(broker, mp);
+        return;
+    }
+    if (direction == BACKEND_TO_FRONTEND) {
+        // Clientes aguardando a mesma leitura recebem cópias antes
+        admission_completed(&broker->admission, mp);
+        cache_reply(&broker->cache, mp);
+        reply_to_frontend(broker, mp);
+        return;
     }
     
-    msgpack_unpacked msg;
-    msgpack_unpacked_init(&msg);
+    int retry_after;
+    if (!admission_allow(&broker->admission, mp, &retry_after)) {
+        reply_busy(broker, mp, "Limite de requisições por cliente atingido", retry_after);
+        return;
+    }
     
-    msgpack_unpack_return ret = msgpack_unpack_next(&msg, data, size, NULL);
+    int flight;
+    switch (cache_request(&broker->cache, mp, info->service, &flight)) {
+        case CACHE_HIT:
+            deliver_cached(broker, mp, info->service);
+            return;
+        case CACHE_JOINED:
+            return;  // Responde junto com a requisição idêntica em trânsito
+        case CACHE_MISS:
+            break;
+    }
     
-    msgpack_unpacked_destroy(&msg);
+    if (admission_saturated(&broker->admission)) {
+        cache_abandon(&broker->cache, flight);
+        reply_busy(broker, mp, "Servidores ocupados", broker->config.retry_after);
+        return;
+    }
     
-    return (ret == MSGPACK_UNPACK_SUCCESS) ? 1 : 0;
+    int rc = send_to_backend(broker, mp, info);
+    if (rc == 1) {
+        // Resposta de erro do broker: vai também aos clientes agrupados no cache
+        deliver_message(broker, mp, BACKEND_TO_FRONTEND, info);
+    } else if (rc < 0) {
+        cache_abandon(&broker->cache, flight);
+        log_message(LOG_ERROR, "Erro ao encaminhar mensagem (%s): %s",
+                    direction_name(direction), zmq_strerror(errno));
+    }
 }
 
 /**
- * Processa e roteia mensagem com validação MessagePack
- * Mantém comportamento transparente: encaminha mesmo se inválida (com warning)
+ * Requisição de um servidor perdido (failover_process): uma leitura vai a
+ * outro servidor, as demais recebem erro, já que podem ter sido aplicadas
  */
-static void process_message(zmq_msg_t *msg, const char *direction, unsigned long *msg_count) {
-    size_t size = zmq_msg_size(msg);
-    void *data = zmq_msg_data(msg);
+static void resend_request(void *arg, Multipart *request, const RequestInfo *info, int retry) {
+    Broker *broker = (Broker *)arg;
+    if (retry) {
+        int rc = send_to_backend(broker, request, info);
+        if (rc == 1) {
+            deliver_message(broker, request, BACKEND_TO_FRONTEND, info);
+        } else if (rc < 0) {
+            log_message(LOG_ERROR, "Erro ao reenviar requisição: %s", zmq_strerror(errno));
+        }
+    } else if (inspector_reply_error(&broker->inspector, request,
+                                     "Servidor indisponível; a requisição pode não ter sido aplicada") == 0) {
+        deliver_message(broker, request, BACKEND_TO_FRONTEND, info);
+    }
+    multipart_close(request);
+}
+
+/**
+ * Heartbeat do backend a cada BROKER_HEARTBEAT_IVL ms: remove os servidores
+ * que não mandaram nada em BROKER_HEARTBEAT_TIMEOUT ms após o último ping
+ * (um quarto disso, mas não menos que BROKER_HEARTBEAT_IVL ms, se um peer
+ * já o removeu) e envia um ping aos
+ * demais (um servidor já desconectado falha na hora); depois publica o
+ * gossip da rodada
+ */
+static void check_servers(Broker *broker) {
+    uint64_t now = monotonic_ns();
+    if (now < broker->next_heartbeat_ns) {
+        return;
+    }
+    broker->next_heartbeat_ns = now + (uint64_t)broker->config.heartbeat_ivl * 1000000u;
     
-    // Valida MessagePack (apenas para frames de dados, ignora identidades)
-    if (size > 0 && MSGPACK_VALIDATION_ENABLED) {
-        if (!validate_msgpack((const char*)data, size)) {
-            fprintf(stderr, "[BROKER] WARNING: Mensagem #%lu (%s) não é MessagePack válido (%zu bytes)\n",
-                    *msg_count, direction, size);
-            // Continua encaminhando (comportamento tolerante a falhas)
-        } else {
-            if (*msg_count % 1000 == 0) {  // Log periódico
-                printf("[BROKER] Mensagem #%lu (%s) validada: MessagePack OK (%zu bytes)\n",
-                       *msg_count, direction, size);
+    uint8_t ping[64];
+    size_t size = failover_ping(ping, sizeof(ping));
+    uint64_t timeout = (uint64_t)broker->config.heartbeat_timeout * 1000000u;
+    uint64_t suspect_timeout = timeout / CLUSTER_SUSPECT_DIVISOR;
+    if (suspect_timeout < (uint64_t)broker->config.heartbeat_ivl * 1000000u) {
+        suspect_timeout = (uint64_t)broker->config.heartbeat_ivl * 1000000u;
+    }
+    Scheduler *scheduler = &broker->scheduler;
+    
+    // Do fim para o início: scheduler_remove move o último para o índice removido
+    for (int i = scheduler->count - 1; i >= 0; i--) {
+        BackendServer *server = &scheduler->servers[i];
+        uint64_t limit = server->suspect_ns && suspect_timeout < timeout ? suspect_timeout : timeout;
+        if (server->ping_ns != 0 && server->seen_ns < server->ping_ns && now - server->ping_ns > limit) {
+            lose_server(broker, i, server->suspect_ns ? "sem resposta (removido também por um peer)" : "sem resposta");
+            continue;
+        }
+        
+        Multipart mp;
+        mp.count = 3;
+        pool_msg_init(&broker->inspector.pool, &mp.frames[0], server->id, server->id_size);
+        zmq_msg_init(&mp.frames[1]);
+        pool_msg_init(&broker->inspector.pool, &mp.frames[2], ping, size);
+        if (multipart_send_flags(&mp, broker->backend, ZMQ_DONTWAIT) == 0) {
+            if (server->ping_ns == 0 || server->seen_ns >= server->ping_ns) {
+                server->ping_ns = now;  // Mede desde o primeiro ping sem resposta
             }
+        } else if (errno == EHOSTUNREACH) {
+            lose_server(broker, i, "desconectado");
         }
+        multipart_close(&mp);
+    }
+    cluster_gossip(&broker->cluster, scheduler->count);
+}
+
+/**
+ * Um peer removeu o servidor: se ele está registrado aqui, leva um ping na
+ * hora e tem BROKER_HEARTBEAT_IVL ms para responder
+ */
+static int suspect_server(void *arg, const void *id, size_t size, const char *peer, size_t peer_length) {
+    Broker *broker = (Broker *)arg;
+    int index = scheduler_find(&broker->scheduler, id, size);
+    if (index < 0) {
+        return 0;
+    }
+    BackendServer *server = &broker->scheduler.servers[index];
+    if (server->suspect_ns == 0) {
+        server->suspect_ns = monotonic_ns();
+        broker->next_heartbeat_ns = 0;
+        log_message(LOG_INFO, "Servidor %.*s removido pelo broker %.*s, verificando",
+                    (int)size, (const char *)id, (int)peer_length, peer);
+    }
+    return 1;
+}
+
+/**
+ * Uma conexão do backend fechou: antecipa o heartbeat para achar o servidor
+ */
+static void drain_monitor(Broker *broker) {
+    Multipart event;
+    while (multipart_recv(&event, broker->monitor, ZMQ_DONTWAIT) > 0) {
+        multipart_close(&event);
+        broker->next_heartbeat_ns = 0;
+    }
+}
+
+/**
+ * Encaminha uma mensagem multipart completa de um socket para outro
+ * Os frames são movidos do socket de origem para o de destino sem cópia;
+ * a inspeção acontece no próprio loop (BROKER_THREADS=1).
+ * Retorna 1 se encaminhou (ou rejeitou), 0 se não havia mensagem, -1 em erro
+ */
+static int forward_message(Broker *broker, Direction direction) {
+    Multipart mp;
+    int rc = receive_message(broker, direction, &mp);
+    if (rc != 1) {
+        return rc;
     }
     
-    (*msg_count)++;
+    RequestInfo info;
+    Direction next = inspect_message(&broker->inspector, &mp, direction, &info);
+    deliver_message(broker, &mp, next, &info);
+    
+    multipart_close(&mp);
+    return 1;
+}
+
+/**
+ * Repassa uma mensagem de um socket TCP para o worker responsável pelo
+ * cliente (BROKER_THREADS>1); a inspeção acontece no worker
+ * Retorna 1 se repassou, 0 se não havia mensagem, -1 em erro
+ */
+static int dispatch_message(Broker *broker, Direction direction) {
+    Multipart mp;
+    int rc = receive_message(broker, direction, &mp);
+    if (rc != 1) {
+        return rc;
+    }
+    
+    int index = (int)(multipart_hash(&mp) % (unsigned int)broker->pool.count);
+    void *pipe = direction == FRONTEND_TO_BACKEND ? broker->pool.up[index] : broker->pool.down[index];
+    if (multipart_send(&mp, pipe) < 0) {
+        log_message(LOG_ERROR, "Erro ao repassar mensagem ao worker %d: %s",
+                    index, zmq_strerror(errno));
+    }
+    
+    multipart_close(&mp);
+    return 1;
+}
+
+/**
+ * Envia ao destino as mensagens já inspecionadas por um worker
+ * Requisições (pipe "up") trazem a rota e o serviço no primeiro frame
+ */
+static void collect_messages(Broker *broker, void *pipe, Direction direction) {
+    Multipart mp;
+    for (int i = 0; i < broker->config.batch_size; i++) {
+        if (multipart_recv(&mp, pipe, ZMQ_DONTWAIT) <= 0) {
+            break;
+        }
+        
+        RequestInfo info = { ROUTE_NONE, STATS_SERVICE_OTHER };
+        if (direction == FRONTEND_TO_BACKEND) {
+            const uint8_t *tag = zmq_msg_data(&mp.frames[0]);
+            info.route = (int)tag[0] - 2;
+            info.service = tag[1] < STATS_SERVICES ? tag[1] : STATS_SERVICE_OTHER;
+            multipart_pop_front(&mp);
+        }
+        
+        deliver_message(broker, &mp, direction, &info);
+        multipart_close(&mp);
+    }
+}
+
+/**
+ * Soma os contadores de inspeção do loop principal e de todos os workers
+ */
+static void count_inspected(Broker *broker, InspectorTotals *totals) {
+    memset(totals, 0, sizeof(*totals));
+    inspector_accumulate(&broker->inspector, totals);
+    for (int i = 0; i < broker->pool.count; i++) {
+        inspector_accumulate(&broker->pool.workers[i].inspector, totals);
+    }
+    pool_accumulate(&broker->cache.pool, &totals->pool);
+}
+
+/**
+ * Métricas do broker REQ-REP para o endpoint HTTP
+ */
+static size_t render_stats(void *arg, char *buffer, size_t capacity) {
+    Broker *broker = (Broker *)arg;
+    InspectorTotals inspected;
+    count_inspected(broker, &inspected);
+    return stats_render(&broker->stats, &broker->scheduler, &inspected, &broker->cache,
+                        &broker->admission, &broker->failover, &broker->cluster, buffer, capacity);
+}
+
+/**
+ * Loop principal: poll nos sockets TCP e, com workers, nos pipes inproc
+ */
+static void run_loop(Broker *broker) {
+    int workers = broker->config.threads > 1 ? broker->pool.count : 0;
+    zmq_pollitem_t items[5 + 2 * MAX_WORKERS];
+    int timeout = broker->config.heartbeat_ivl < 1000 ? broker->config.heartbeat_ivl : 1000;
+    
+    // Proxy manual com validação MessagePack
+    // Mantém comportamento equivalente a zmq_proxy() mas com inspeção
+    items[0] = (zmq_pollitem_t){ broker->frontend, 0, ZMQ_POLLIN, 0 };
+    items[1] = (zmq_pollitem_t){ broker->backend, 0, ZMQ_POLLIN, 0 };
+    int nitems = 2;
+    int stats_item = broker->stats_socket ? nitems++ : -1;
+    int monitor_item = broker->monitor ? nitems++ : -1;
+    int cluster_item = broker->cluster.sub ? nitems++ : -1;
+    if (stats_item >= 0) {
+        items[stats_item] = (zmq_pollitem_t){ broker->stats_socket, 0, ZMQ_POLLIN, 0 };
+    }
+    if (monitor_item >= 0) {
+        items[monitor_item] = (zmq_pollitem_t){ broker->monitor, 0, ZMQ_POLLIN, 0 };
+    }
+    if (cluster_item >= 0) {
+        items[cluster_item] = (zmq_pollitem_t){ broker->cluster.sub, 0, ZMQ_POLLIN, 0 };
+    }
+    int first_worker = nitems;
+    nitems += 2 * workers;
+    for (int i = 0; i < workers; i++) {
+        items[first_worker + 2 * i] = (zmq_pollitem_t){ broker->pool.up[i], 0, ZMQ_POLLIN, 0 };
+        items[first_worker + 2 * i + 1] = (zmq_pollitem_t){ broker->pool.down[i], 0, ZMQ_POLLIN, 0 };
+    }
+    
+    int (*handle)(Broker *, Direction) = workers ? dispatch_message : forward_message;
+    
+    while (!s_interrupted) {
+        // Sem servidores registrados as requisições ficam na fila do ROUTER
+        items[0].events = broker->scheduler.count > 0 ? ZMQ_POLLIN : 0;
+        
+        // Poll com timeout de 1 segundo (ou o intervalo do heartbeat, se menor)
+        int rc = zmq_poll(items, nitems, timeout);
+        if (rc < 0) {
+            if (errno == EINTR && !s_interrupted) {
+                continue;  // SIGUSR1/SIGUSR2 (nível de log)
+            }
+            break;  // Erro ou interrupção
+        }
+        
+        // Drena os dois sockets em lote, alternando uma mensagem de cada
+        // direção para que um lado não monopolize o wakeup do outro
+        int frontend_ready = items[0].revents & ZMQ_POLLIN;
+        int backend_ready = items[1].revents & ZMQ_POLLIN;
+        
+        for (int i = 0; i < broker->config.batch_size && (frontend_ready || backend_ready); i++) {
+            // Mensagens do frontend (clientes) para backend (servidores)
+            if (frontend_ready) {
+                frontend_ready = handle(broker, FRONTEND_TO_BACKEND) > 0;
+            }
+            
+            // Mensagens do backend (servidores) para frontend (clientes)
+            if (backend_ready) {
+                backend_ready = handle(broker, BACKEND_TO_FRONTEND) > 0;
+            }
+        }
+        
+        // Mensagens já inspecionadas pelos workers
+        for (int i = 0; i < workers; i++) {
+            if (items[first_worker + 2 * i].revents & ZMQ_POLLIN) {
+                collect_messages(broker, broker->pool.up[i], FRONTEND_TO_BACKEND);
+            }
+            if (items[first_worker + 2 * i + 1].revents & ZMQ_POLLIN) {
+                collect_messages(broker, broker->pool.down[i], BACKEND_TO_FRONTEND);
+            }
+        }
+        
+        if (stats_item >= 0 && (items[stats_item].revents & ZMQ_POLLIN)) {
+            stats_serve(broker->stats_socket, render_stats, broker);
+        }
+        
+        if (monitor_item >= 0 && (items[monitor_item].revents & ZMQ_POLLIN)) {
+            drain_monitor(broker);
+        }
+        if (cluster_item >= 0 && (items[cluster_item].revents & ZMQ_POLLIN)) {
+            cluster_receive(&broker->cluster, suspect_server, broker);
+        }
+        check_servers(broker);
+        failover_process(&broker->failover, resend_request, broker);
+        
+        cache_expire(&broker->cache);
+        admission_expire(&broker->admission);
+    }
 }
 
 /**
@@ -96,18 +571,48 @@ static void process_message(zmq_msg_t *msg, const char *direction, unsigned long
  * Conecta frontend (ROUTER) com backend (DEALER) fazendo proxy das mensagens
  */
 int main(void) {
-    printf("[BROKER] Iniciando broker REQ-REP...\n");
+    // Estático: histogramas e tabela de requisições não cabem bem na pilha
+    static Broker broker;
+    load_config(&broker.config);
+    if (broker.config.mode == MODE_BROKER) {
+        printf("[BROKER] Iniciando broker REQ-REP...\n");
+    }
+    
+    // Log assíncrono: as threads de encaminhamento não escrevem em stdio
+    if (log_start(&broker.config) != 0) {
+        fprintf(stderr, "[BROKER] WARNING: Thread de log não iniciada, mensagens só serão escritas no encerramento\n");
+    }
+    atexit(log_stop);
     
     // Instala handlers de sinais
     s_catch_signals();
     
     // Inicializa contexto ZeroMQ
+    int rc;
     void *context = zmq_ctx_new();
     if (!context) {
         fprintf(stderr, "[BROKER] Erro ao criar contexto ZeroMQ\n");
         return 1;
     }
     
+    // Threads de I/O do ZeroMQ (devem ser configuradas antes de criar sockets)
+    zmq_ctx_set(context, ZMQ_IO_THREADS, broker.config.io_threads);
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+    for (int i = 0; i < broker.config.cpu_count; i++) {
+        zmq_ctx_set(context, ZMQ_THREAD_AFFINITY_CPU_ADD, broker.config.cpus[i]);
+    }
+#endif
+    
+    // Modo proxy (BROKER_MODE=proxy): XSUB-XPUB no lugar do REQ-REP
+    if (broker.config.mode == MODE_PROXY) {
+        if (broker.config.cpu_count > 0) {
+            pin_current_thread(broker.config.cpus[0]);
+        }
+        rc = pubsub_run(context, &broker.config, &s_interrupted);
+        zmq_ctx_destroy(context);
+        return rc == 0 ? 0 : 1;
+    }
+    
     // Socket ROUTER para clientes (frontend)
     void *frontend = zmq_socket(context, ZMQ_ROUTER);
     if (!frontend) {
@@ -116,8 +621,8 @@ int main(void) {
         return 1;
     }
     
-    // Socket DEALER para servidores (backend)
-    void *backend = zmq_socket(context, ZMQ_DEALER);
+    // Socket ROUTER para servidores (backend), endereçados pela identidade
+    void *backend = zmq_socket(context, ZMQ_ROUTER);
     if (!backend) {
         fprintf(stderr, "[BROKER] Erro ao criar socket backend\n");
         zmq_close(frontend);
@@ -125,8 +630,21 @@ int main(void) {
         return 1;
     }
     
+    // Filas por conexão e política de clientes lentos; com ROUTER_MANDATORY o
+    // envio de resposta falha em vez de descartar em silêncio e o descarte é
+    // contado por cliente
+    configure_socket(frontend, &broker.config);
+    configure_socket(backend, &broker.config);
+#ifdef ZMQ_HEARTBEAT_IVL
+    // Heartbeats ZMTP: derrubam conexões meio abertas (servidor sem rede)
+    zmq_setsockopt(backend, ZMQ_HEARTBEAT_IVL, &broker.config.heartbeat_ivl, sizeof(int));
+    zmq_setsockopt(backend, ZMQ_HEARTBEAT_TIMEOUT, &broker.config.heartbeat_timeout, sizeof(int));
+#endif
+    int mandatory = 1;
+    zmq_setsockopt(frontend, ZMQ_ROUTER_MANDATORY, &mandatory, sizeof(mandatory));
+    
     // Bind nos sockets
-    int rc = zmq_bind(frontend, FRONTEND_PORT);
+    rc = zmq_bind(frontend, FRONTEND_PORT);
     if (rc != 0) {
         fprintf(stderr, "[BROKER] Erro ao fazer bind no frontend: %s\n", zmq_strerror(errno));
         zmq_close(frontend);
@@ -144,97 +662,181 @@ int main(void) {
         zmq_ctx_destroy(context);
         return 1;
     }
-    printf("[BROKER] Backend (DEALER) escutando em %s\n", BACKEND_PORT);
+    printf("[BROKER] Backend (ROUTER) escutando em %s\n", BACKEND_PORT);
+    
+    // Falha imediata (EHOSTUNREACH) ao enviar para servidor desconectado
+    zmq_setsockopt(backend, ZMQ_ROUTER_MANDATORY, &mandatory, sizeof(mandatory));
+    
+    broker.frontend = frontend;
+    broker.backend = backend;
+    stats_init(&broker.stats);
+    admission_init(&broker.admission, &broker.config);
+    failover_init(&broker.failover, &broker.config);
+    
+    // Desconexões do backend pelo monitor do socket (opcional: o heartbeat basta)
+    if (zmq_socket_monitor(backend, BACKEND_MONITOR, ZMQ_EVENT_DISCONNECTED) == 0) {
+        broker.monitor = zmq_socket(context, ZMQ_PAIR);
+        if (broker.monitor && zmq_connect(broker.monitor, BACKEND_MONITOR) != 0) {
+            zmq_close(broker.monitor);
+            broker.monitor = NULL;
+        }
+    }
     
-    // Inicializa relógio lógico
-    LogicalClock clock;
-    logical_clock_init(&clock);
+    // Gossip com os outros brokers (falha deixa o broker isolado, ainda roteando)
+    if (cluster_start(&broker.cluster, context, &broker.config) != 0) {
+        fprintf(stderr, "[BROKER] WARNING: Gossip em %s indisponível: %s\n",
+                broker.config.cluster_endpoint, zmq_strerror(errno));
+    }
+    if (cache_init(&broker.cache, &broker.config, deliver_cached, refuse_cached, &broker) != 0) {
+        fprintf(stderr, "[BROKER] WARNING: Sem memória para o cache de leituras, desligado\n");
+    }
+    
+    // Endpoint HTTP de métricas (falha não impede o broker de rotear)
+    if (broker.config.stats_endpoint[0] != '\0') {
+        broker.stats_socket = zmq_socket(context, ZMQ_STREAM);
+        if (broker.stats_socket && zmq_bind(broker.stats_socket, broker.config.stats_endpoint) == 0) {
+            printf("[BROKER] Métricas (HTTP) em %s\n", broker.config.stats_endpoint);
+        } else {
+            fprintf(stderr, "[BROKER] WARNING: Endpoint de métricas %s indisponível: %s\n",
+                    broker.config.stats_endpoint, zmq_strerror(errno));
+            if (broker.stats_socket) zmq_close(broker.stats_socket);
+            broker.stats_socket = NULL;
+        }
+    }
+    
+    // Inspeção no próprio loop ou em threads dedicadas
+    inspector_init(&broker.inspector, &broker.config);
+    scheduler_init(&broker.scheduler, &broker.config.routes);
+    if (broker.config.cpu_count > 0) {
+        pin_current_thread(broker.config.cpus[0]);
+    }
+    if (broker.config.threads > 1 && workers_start(&broker.pool, context, &broker.config) != 0) {
+        fprintf(stderr, "[BROKER] Erro ao iniciar threads de inspeção\n");
+        zmq_ctx_shutdown(context);
+        workers_join(&broker.pool);
+        if (broker.stats_socket) zmq_close(broker.stats_socket);
+        if (broker.monitor) zmq_close(broker.monitor);
+        cluster_stop(&broker.cluster);
+        zmq_close(frontend);
+        zmq_close(backend);
+        zmq_ctx_destroy(context);
+        failover_destroy(&broker.failover);
+        return 1;
+    }
     
     printf("[BROKER] Broker pronto para rotear mensagens\n");
     printf("[BROKER] Clientes conectam em %s\n", FRONTEND_PORT);
     printf("[BROKER] Servidores conectam em %s\n", BACKEND_PORT);
-    printf("[BROKER] Validação MessagePack: %s\n", 
-           MSGPACK_VALIDATION_ENABLED ? "ATIVADA" : "DESATIVADA");
-    
-    // Contadores de mensagens
-    unsigned long frontend_msg_count = 0;
-    unsigned long backend_msg_count = 0;
-    
-    // Proxy manual com validação MessagePack
-    // Mantém comportamento equivalente a zmq_proxy() mas com inspeção
-    zmq_pollitem_t items[] = {
-        { frontend, 0, ZMQ_POLLIN, 0 },
-        { backend, 0, ZMQ_POLLIN, 0 }
+    if (broker.config.validation == VALIDATION_SAMPLED) {
+        printf("[BROKER] Validação MessagePack: sampled (1 a cada %d mensagens)\n",
+               broker.config.sample_rate);
+    } else {
+        printf("[BROKER] Validação MessagePack: %s\n", validation_mode_name(broker.config.validation));
+    }
+    printf("[BROKER] Lote máximo por direção: %d mensagens\n", broker.config.batch_size);
+    printf("[BROKER] Threads de inspeção: %d, threads de I/O: %d\n",
+           broker.config.threads, broker.config.io_threads);
+    printf("[BROKER] Log: nível %s, até %d mensagens/s (SIGUSR1/SIGUSR2 alteram o nível)\n",
+           log_level_name(broker.config.log_level), broker.config.log_rate);
+    static const char *const clock_modes[] = {
+        "off", "carimba data.clock (Lamport)", "carimba data.clock (híbrido, HLC)"
     };
-    
-    while (!s_interrupted) {
-        // Poll com timeout de 1 segundo
-        int rc = zmq_poll(items, 2, 1000);
-        if (rc < 0) {
-            break;  // Erro ou interrupção
+    printf("[BROKER] Relógio lógico: %s\n", clock_modes[broker.config.clock]);
+    printf("[BROKER] Filas por conexão: envio %d, recepção %d; clientes lentos: %s\n",
+           broker.config.sndhwm, broker.config.rcvhwm, slow_policy_name(broker.config.slow_policy));
+    printf("[BROKER] Pool de buffers: até %d KiB por thread\n", broker.config.pool_memory);
+    printf("[BROKER] Heartbeat dos servidores: ping a cada %d ms, removidos após %d ms sem resposta; "
+           "leituras reenviadas até %d vez(es)\n",
+           broker.config.heartbeat_ivl, broker.config.heartbeat_timeout, broker.config.retries);
+    if (broker.cluster.pub) {
+        printf("[BROKER] Cluster: broker %s, gossip em %s, peers:", broker.config.name,
+               broker.config.cluster_endpoint);
+        for (int i = 0; i < broker.config.peer_count; i++) {
+            printf(" %s", broker.config.peers[i]);
         }
-        
-        // Mensagens do frontend (clientes) para backend (servidores)
-        if (items[0].revents & ZMQ_POLLIN) {
-            zmq_msg_t msg;
-            while (1) {
-                zmq_msg_init(&msg);
-                int size = zmq_msg_recv(&msg, frontend, 0);
-                if (size < 0) {
-                    zmq_msg_close(&msg);
-                    break;
-                }
-                
-                // Valida MessagePack se for frame de dados
-                int more = zmq_msg_more(&msg);
-                if (!more && size > 0) {  // Último frame = mensagem de dados
-                    process_message(&msg, "frontend->backend", &frontend_msg_count);
-                }
-                
-                // Encaminha para backend
-                zmq_msg_send(&msg, backend, more ? ZMQ_SNDMORE : 0);
-                zmq_msg_close(&msg);
-                
-                if (!more) break;
+        printf("\n");
+    }
+    if (broker.config.rate_limit > 0) {
+        printf("[BROKER] Limite por cliente: %d requisições/s (rajada de %d)\n",
+               broker.config.rate_limit, broker.config.rate_burst);
+    }
+    if (broker.config.max_inflight > 0) {
+        printf("[BROKER] Limite global: %d requisições nos servidores (retry_after %d ms)\n",
+               broker.config.max_inflight, broker.config.retry_after);
+    }
+    if (broker.cache.entries) {
+        printf("[BROKER] Cache de leituras:");
+        for (int i = 0; i < CACHE_GROUPS; i++) {
+            if (broker.config.cache_groups & (1u << i)) {
+                printf(" %s", cache_group_name(i));
             }
         }
-        
-        // Mensagens do backend (servidores) para frontend (clientes)
-        if (items[1].revents & ZMQ_POLLIN) {
-            zmq_msg_t msg;
-            while (1) {
-                zmq_msg_init(&msg);
-                int size = zmq_msg_recv(&msg, backend, 0);
-                if (size < 0) {
-                    zmq_msg_close(&msg);
-                    break;
-                }
-                
-                // Valida MessagePack se for frame de dados
-                int more = zmq_msg_more(&msg);
-                if (!more && size > 0) {  // Último frame = mensagem de dados
-                    process_message(&msg, "backend->frontend", &backend_msg_count);
-                }
-                
-                // Encaminha para frontend
-                zmq_msg_send(&msg, frontend, more ? ZMQ_SNDMORE : 0);
-                zmq_msg_close(&msg);
-                
-                if (!more) break;
-            }
+        printf(" (TTL %d ms, até %d respostas / %d KiB)\n", broker.config.cache_ttl,
+               broker.config.cache_entries, broker.config.cache_memory);
+    }
+    for (int i = 0; i < broker.config.routes.count; i++) {
+        const Route *route = &broker.config.routes.routes[i];
+        printf("[BROKER] Rota: %s ->", route->service);
+        for (int j = 0; j < route->server_count; j++) {
+            printf(" %s", route->servers[j]);
         }
+        printf("\n");
     }
     
+    run_loop(&broker);
+    
+    // Desliga o contexto para acordar os workers (ETERM) antes de juntá-los
+    zmq_ctx_shutdown(context);
+    workers_join(&broker.pool);
+    log_stop();
+    
     // Estatísticas finais
+    InspectorTotals inspected;
+    count_inspected(&broker, &inspected);
     printf("\n[BROKER] Estatísticas:\n");
-    printf("[BROKER]   Mensagens frontend->backend: %lu\n", frontend_msg_count);
-    printf("[BROKER]   Mensagens backend->frontend: %lu\n", backend_msg_count);
+    printf("[BROKER]   Mensagens frontend->backend: %lu (%lu bytes)\n",
+           broker.stats.messages[FRONTEND_TO_BACKEND], broker.stats.bytes[FRONTEND_TO_BACKEND]);
+    printf("[BROKER]   Mensagens backend->frontend: %lu (%lu bytes)\n",
+           broker.stats.messages[BACKEND_TO_FRONTEND], broker.stats.bytes[BACKEND_TO_FRONTEND]);
+    printf("[BROKER]   Mensagens MessagePack inválidas: %lu (rejeitadas: %lu)\n",
+           inspected.invalid, inspected.rejected);
+    if (broker.config.clock != CLOCK_OFF) {
+        printf("[BROKER]   Clocks carimbados: %lu (sem espaço no frame: %lu), relógio em %llu\n",
+               inspected.stamped, inspected.unstamped, (unsigned long long)inspected.clock);
+    }
+    printf("[BROKER]   Respostas descartadas: %lu (%d clientes)\n", broker.stats.dropped, broker.stats.peer_count);
+    if (broker.cache.entries) {
+        printf("[BROKER]   Cache de leituras: %lu acertos, %lu agrupadas, %lu enviadas ao backend\n",
+               broker.cache.hits, broker.cache.coalesced, broker.cache.misses);
+    }
+    if (broker.config.rate_limit > 0 || broker.config.max_inflight > 0) {
+        printf("[BROKER]   Requisições recusadas: %lu por limite do cliente, %lu por limite global\n",
+               broker.admission.rate_limited, broker.admission.saturated);
+    }
+    printf("[BROKER]   Servidores perdidos: %lu (leituras reenviadas: %lu, respondidas com erro: %lu, "
+           "respostas atrasadas descartadas: %lu)\n", broker.failover.servers_lost,
+           broker.failover.retried, broker.failover.failed, broker.failover.stale);
+    if (broker.cluster.pub) {
+        printf("[BROKER]   Gossip: %lu enviados, %lu recebidos (%lu inválidos), %lu servidores suspeitos\n",
+               broker.cluster.sent, broker.cluster.received, broker.cluster.invalid, broker.cluster.suspected);
+    }
+    printf("[BROKER]   Pool de buffers: %lu alocações do pool, %lu com malloc, %zu KiB em slabs\n",
+           inspected.pool.hits, inspected.pool.misses, inspected.pool.slab_bytes / 1024);
     
     // Cleanup
     printf("[BROKER] Encerrando broker...\n");
+    if (broker.stats_socket) zmq_close(broker.stats_socket);
+    if (broker.monitor) zmq_close(broker.monitor);
+    cluster_stop(&broker.cluster);
     zmq_close(frontend);
     zmq_close(backend);
     zmq_ctx_destroy(context);
     
+    // Depois do contexto: até aqui o ZeroMQ ainda podia liberar buffers dos pools
+    failover_destroy(&broker.failover);
+    cache_destroy(&broker.cache);
+    inspector_destroy(&broker.inspector);
+    workers_destroy(&broker.pool);
+    
     return 0;
 }
@@ -0,0 +1,1034 @@
+/**
+ * Broker - Definições compartilhadas entre os módulos do broker
+ * (configuração, mensagens multipart, inspeção e threads de encaminhamento)
+ */
+
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <zmq.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "../common_utils/logical_clock.h"
+#include "../common_utils/hybrid_clock.h"
+#include "../common_utils/histogram.h"
+
+#define FRONTEND_PORT "tcp://*:5555"
+#define BACKEND_PORT "tcp://*:5556"
+#define XSUB_PORT "tcp://*:5557"          // Modo proxy: publicadores (servidores)
+#define XPUB_PORT "tcp://*:5558"          // Modo proxy: assinantes (clientes/bots)
+#define MSGPACK_MAX_DEPTH 16          // Aninhamento máximo aceito na validação
+#define DEFAULT_BATCH_SIZE 64         // Mensagens por direção a cada wakeup do poll
+#define DEFAULT_SAMPLE_RATE 100       // Modo sampled: valida 1 a cada N mensagens
+#define MAX_FRAMES 16                 // Frames por mensagem multipart (envelope + dados)
+#define ERROR_REPLY_SIZE 256          // Buffer da resposta de erro do modo strict
+#define MAX_WORKERS 64                // Limite de threads de encaminhamento
+#define MAX_CPUS 256                  // Limite de CPUs em BROKER_CPUS
+#define WORKER_BACKLOG 1000           // Mensagens em trânsito por worker antes de pausar a leitura
+#define MAX_SERVERS 64                // Servidores do backend acompanhados pelo escalonador
+#define SERVER_ID_SIZE 255            // Tamanho máximo de uma identidade ZeroMQ
+#define MAX_ROUTES 32                 // Serviços com rota dedicada em BROKER_ROUTES
+#define MAX_ROUTE_SERVERS 8           // Servidores por rota
+#define ROUTE_NAME_SIZE 64            // Tamanho máximo de nome de serviço/servidor em rotas
+#define ROUTE_NONE -1                 // Sem rota: qualquer servidor
+#define ROUTE_REJECTED -2             // Requisição recusada na validação: volta direto ao cliente
+#define DEFAULT_STATS_ENDPOINT "tcp://*:5560"  // Métricas HTTP (formato Prometheus)
+#define ENDPOINT_SIZE 128             // Tamanho máximo de um endpoint ZeroMQ
+#define STATS_SERVICES 9              // Serviços conhecidos + "outros" (ver stats.c)
+#define STATS_SERVICE_OTHER (STATS_SERVICES - 1)
+#define PENDING_SLOTS 8192            // Requisições em trânsito acompanhadas para latência
+#define PENDING_ID_SIZE 32            // Identidades de cliente maiores não são acompanhadas
+#define STATS_BUFFER_SIZE (256 * 1024)  // Resposta do endpoint de métricas
+#define MAX_TOPICS 4096               // Tópicos acompanhados pelo proxy (potência de 2)
+#define TOPIC_SIZE 128                // Tamanho máximo de um tópico acompanhado
+#define STATS_TOP_TOPICS 100          // Tópicos mais publicados exportados nas métricas
+#define LOG_RING_SIZE 1024            // Mensagens de log pendentes (potência de 2)
+#define LOG_MESSAGE_SIZE 256          // Tamanho máximo de uma mensagem de log
+#define DEFAULT_LOG_RATE 100          // Mensagens de log por segundo antes de suprimir
+#define DEFAULT_HWM 1000              // Mensagens enfileiradas por conexão (padrão do ZeroMQ)
+#define DEFAULT_SLOW_TIMEOUT 5000     // ms sem o peer ler antes de desconectar (política disconnect)
+#define PEER_SLOTS 1024               // Clientes com respostas descartadas acompanhados (potência de 2)
+#define STATS_TOP_PEERS 20            // Clientes com mais descartes exportados nas métricas
+#define CACHE_GROUPS 3                // Serviços de leitura cacheáveis (ver cache.c)
+#define CACHE_KEY_SIZE 512            // Maior requisição (serviço + argumentos) cacheável
+#define CACHE_WAYS 4                  // Entradas candidatas para cada chave
+#define CACHE_FLIGHTS 64              // Requisições acompanhadas aguardando resposta do backend
+#define CACHE_WAITERS 32              // Clientes aguardando a mesma requisição em trânsito
+#define CACHE_GENERATIONS 256         // Grupos de invalidação (serviço, canal) (potência de 2)
+#define CACHE_FLIGHT_TIMEOUT 5000     // ms sem resposta antes de abandonar uma requisição acompanhada
+#define DEFAULT_CACHE_TTL 1000        // ms de validade de uma resposta guardada
+#define DEFAULT_CACHE_ENTRIES 1024    // Respostas guardadas
+#define DEFAULT_CACHE_MEMORY 16384    // KiB de respostas guardadas
+#define POOL_CLASSES 9                // Classes de tamanho do pool de buffers (64 B a 16 KiB)
+#define POOL_MIN_BLOCK 64             // Menor classe (as demais dobram)
+#define POOL_SLAB_SIZE (64 * 1024)    // Memória pedida ao sistema de cada vez para uma classe
+#define POOL_INLINE_SIZE 32           // Frames até este tamanho ficam no próprio zmq_msg_t
+#define DEFAULT_POOL_MEMORY 4096      // KiB de slabs por thread (BROKER_POOL_MEMORY)
+#define ADMISSION_SLOTS 4096          // Clientes com balde de tokens acompanhados (múltiplo de ADMISSION_WAYS)
+#define ADMISSION_WAYS 8              // Entradas candidatas para cada cliente
+#define ADMISSION_INFLIGHT_TIMEOUT 30000  // ms sem resposta antes de não contar mais a requisição
+#define DEFAULT_RETRY_AFTER 100       // ms sugeridos ao cliente quando o limite global é atingido
+#define FAILOVER_SLOTS 4096           // Requisições nos servidores acompanhadas (múltiplo de FAILOVER_WAYS)
+#define FAILOVER_WAYS 8               // Entradas candidatas para cada cliente
+#define DEFAULT_HEARTBEAT_IVL 500     // ms entre pings a cada servidor
+#define DEFAULT_HEARTBEAT_TIMEOUT 10000  // ms sem mensagem do servidor após um ping antes de removê-lo
+#define DEFAULT_RETRIES 1             // Reenvios de uma leitura cujo servidor caiu
+#define BACKEND_MONITOR "inproc://broker-backend-monitor"  // Eventos de desconexão do backend
+#define DEFAULT_CLUSTER_ENDPOINT "tcp://*:5562"  // Gossip entre brokers (com BROKER_PEERS)
+#define MAX_PEERS 16                  // Brokers em BROKER_PEERS / acompanhados
+#define BROKER_NAME_SIZE 64           // Tamanho máximo de BROKER_NAME
+#define CLUSTER_LOSS_ROUNDS 5         // Rodadas de gossip que anunciam um servidor removido
+#define CLUSTER_PEER_ROUNDS 3         // Rodadas sem gossip antes de dar o peer como fora do ar
+#define CLUSTER_SUSPECT_DIVISOR 4     // Suspeito por um peer: prazo de BROKER_HEARTBEAT_TIMEOUT / 4
+#define CLUSTER_LOST_SIZE (MAX_SERVERS * (SERVER_ID_SIZE + 2) + 5)  // Lista de removidos serializada
+
+/**
+ * Modos de validação MessagePack
+ */
+typedef enum {
+    VALIDATION_OFF,      // Não inspeciona o payload
+    VALIDATION_SAMPLED,  // Valida 1 a cada N mensagens, encaminha inválidas com warning
+    VALIDATION_FULL,     // Valida todas, encaminha inválidas com warning
+    VALIDATION_STRICT    // Valida todas, rejeita inválidas com resposta de erro ao cliente
+} ValidationMode;
+
+/**
+ * Papel do processo (BROKER_MODE)
+ */
+typedef enum {
+    MODE_BROKER,   // REQ-REP: clientes -> servidores (5555/5556)
+    MODE_PROXY     // PUB-SUB: servidores -> assinantes (5557/5558)
+} BrokerMode;
+
+/**
+ * O que fazer com um peer que não lê rápido o bastante (fila da conexão cheia)
+ */
+typedef enum {
+    SLOW_DROP_NEWEST,   // Descarta as mensagens novas só para esse peer
+    SLOW_DISCONNECT     // Idem, e derruba a conexão parada há BROKER_SLOW_TIMEOUT ms
+} SlowPolicy;
+
+/**
+ * Carimbo do relógio lógico do broker em data.clock (BROKER_CLOCK)
+ */
+typedef enum {
+    CLOCK_OFF,      // data.clock passa sem alteração
+    CLOCK_STAMP,    // data.clock = max(broker, recebido) + 1, reescrito no frame
+    CLOCK_HLC       // Idem com o relógio híbrido (ms físicos << 16 | contador)
+} ClockMode;
+
+/**
+ * Níveis de log
+ */
+typedef enum {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARNING,
+    LOG_ERROR
+} LogLevel;
+
+/**
+ * Rota de um serviço para um grupo de servidores (por nome/identidade)
+ */
+typedef struct {
+    char service[ROUTE_NAME_SIZE];                     // "*" = serviços sem rota própria
+    char servers[MAX_ROUTE_SERVERS][ROUTE_NAME_SIZE];
+    int server_count;
+} Route;
+
+typedef struct {
+    Route routes[MAX_ROUTES];
+    int count;
+    int default_route;   // Índice da rota "*" ou ROUTE_NONE
+} RouteTable;
+
+/**
+ * Configuração do broker lida de variáveis de ambiente
+ */
+typedef struct {
+    BrokerMode mode;             // BROKER_MODE: broker | proxy
+    int batch_size;              // BROKER_BATCH_SIZE: orçamento de mensagens por direção por wakeup
+    ValidationMode validation;   // BROKER_VALIDATION: off | sampled | full | strict
+    int sample_rate;             // BROKER_VALIDATION_SAMPLE: N do modo sampled
+    int threads;                 // BROKER_THREADS: threads de inspeção (1 = loop único)
+    int io_threads;              // BROKER_IO_THREADS: threads de I/O do contexto ZeroMQ
+    int cpus[MAX_CPUS];          // BROKER_CPUS: lista de CPUs para fixar as threads
+    int cpu_count;               // Quantidade de CPUs em cpus (0 = sem fixação)
+    RouteTable routes;           // BROKER_ROUTES: serviço -> grupo de servidores
+    char stats_endpoint[ENDPOINT_SIZE];  // BROKER_STATS_ENDPOINT: métricas HTTP ("" = desligado)
+    LogLevel log_level;          // BROKER_LOG_LEVEL: debug | info | warning | error
+    int log_rate;                // BROKER_LOG_RATE: mensagens de log por segundo
+    int sndhwm;                  // BROKER_SNDHWM: fila de envio por conexão (mensagens)
+    int rcvhwm;                  // BROKER_RCVHWM: fila de recepção por conexão (mensagens)
+    SlowPolicy slow_policy;      // BROKER_SLOW_POLICY: drop-newest | disconnect
+    int slow_timeout;            // BROKER_SLOW_TIMEOUT: ms (política disconnect)
+    ClockMode clock;             // BROKER_CLOCK: off | stamp | hlc
+    unsigned int cache_groups;   // BROKER_CACHE: serviços de leitura cacheados (bits, 0 = desligado)
+    int cache_ttl;               // BROKER_CACHE_TTL: ms
+    int cache_entries;           // BROKER_CACHE_ENTRIES: respostas guardadas
+    int cache_memory;            // BROKER_CACHE_MEMORY: KiB de respostas guardadas
+    int pool_memory;             // BROKER_POOL_MEMORY: KiB de slabs do pool de buffers por thread
+    int rate_limit;              // BROKER_RATE_LIMIT: requisições/s por cliente (0 = sem limite)
+    int rate_burst;              // BROKER_RATE_BURST: rajada máxima por cliente
+    int max_inflight;            // BROKER_MAX_INFLIGHT: requisições nos servidores (0 = sem limite)
+    int retry_after;             // BROKER_RETRY_AFTER: ms sugeridos com o limite global atingido
+    int heartbeat_ivl;           // BROKER_HEARTBEAT_IVL: ms entre pings aos servidores
+    int heartbeat_timeout;       // BROKER_HEARTBEAT_TIMEOUT: ms sem resposta antes de remover o servidor
+    int retries;                 // BROKER_RETRIES: reenvios de leituras de um servidor que caiu
+    char name[BROKER_NAME_SIZE]; // BROKER_NAME: nome no gossip (padrão: hostname)
+    char cluster_endpoint[ENDPOINT_SIZE];  // BROKER_CLUSTER_ENDPOINT: PUB do gossip
+    char peers[MAX_PEERS][ENDPOINT_SIZE];  // BROKER_PEERS: gossip dos outros brokers
+    int peer_count;              // Quantidade de peers (0 = broker isolado, sem gossip)
+} BrokerConfig;
+
+/**
+ * Direções de encaminhamento
+ */
+typedef enum {
+    FRONTEND_TO_BACKEND,
+    BACKEND_TO_FRONTEND
+} Direction;
+
+/**
+ * Mensagem multipart recebida: envelope de identidades + frame de dados
+ * Os zmq_msg_t apenas guardam referências aos buffers do ZeroMQ; nada é copiado
+ */
+typedef struct {
+    zmq_msg_t frames[MAX_FRAMES];
+    int count;
+} Multipart;
+
+/**
+ * Resultado da inspeção de uma requisição
+ */
+typedef struct {
+    int route;     // Rota do serviço (BROKER_ROUTES), ROUTE_NONE ou ROUTE_REJECTED
+    int service;   // Índice do serviço nas estatísticas (stats_service_index)
+} RequestInfo;
+
+/**
+ * Cabeçalho de um buffer do pool, logo antes dos dados
+ */
+typedef struct PoolBlock {
+    struct PoolBlock *next;        // Lista de livres
+    struct BufferPool *pool;       // Dono (o buffer pode ser liberado por outra thread)
+    uint32_t size_class;           // POOL_CLASSES = alocado com malloc, fora das slabs
+} PoolBlock;
+
+/**
+ * Pool de buffers de uma thread: slabs divididas em blocos de tamanho fixo
+ * por classe, obtidas sob demanda até o limite e nunca devolvidas ao sistema
+ * antes de pool_destroy. Só a thread dona aloca; a liberação pode vir de
+ * qualquer thread (as threads de I/O do ZeroMQ liberam os buffers enviados)
+ */
+typedef struct BufferPool {
+    size_t limit;                                 // Bytes de slabs permitidos
+    void *slabs;                                  // Slabs obtidas (lista encadeada)
+    PoolBlock *local[POOL_CLASSES];               // Livres, acessados só pela thread dona
+    _Atomic(PoolBlock *) returned[POOL_CLASSES];  // Liberados por qualquer thread
+    atomic_size_t slab_bytes;
+    atomic_ulong hits;             // Alocações atendidas pelas slabs
+    atomic_ulong misses;           // Alocações feitas com malloc (grandes ou pool esgotado)
+} BufferPool;
+
+/**
+ * Contadores somados dos pools
+ */
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    size_t slab_bytes;
+} PoolTotals;
+
+/**
+ * Estado de inspeção de uma thread: cada thread tem o seu, sem locks
+ * Os contadores de inválidas são atômicos para o endpoint de métricas
+ * poder lê-los enquanto os workers rodam (são incrementados raramente)
+ */
+typedef struct {
+    const BrokerConfig *config;
+    unsigned long msg_count[2];   // Indexado por Direction
+    atomic_ulong invalid_count;
+    atomic_ulong rejected_count;
+    atomic_ulong stamped_count;   // data.clock reescrito (BROKER_CLOCK=stamp)
+    atomic_ulong unstamped_count; // data.clock presente mas sem largura para o novo valor
+    BufferPool pool;              // Frames criados por esta thread (respostas de erro, identidades)
+} Inspector;
+
+/**
+ * Contadores somados de todos os inspetores (loop principal e workers)
+ */
+typedef struct {
+    unsigned long invalid;
+    unsigned long rejected;
+    unsigned long stamped;
+    unsigned long unstamped;
+    uint64_t clock;               // Valor atual do relógio lógico do broker
+    PoolTotals pool;              // Pools de buffers de todas as threads
+} InspectorTotals;
+
+/* ---- config.c ---- */
+
+/**
+ * Carrega a configuração do broker a partir do ambiente
+ */
+void load_config(BrokerConfig *config);
+
+const char *validation_mode_name(ValidationMode mode);
+const char *direction_name(Direction direction);
+const char *slow_policy_name(SlowPolicy policy);
+
+/**
+ * Aplica as filas (HWM) e a política de peers lentos a um socket voltado
+ * para a rede (antes do bind)
+ */
+void configure_socket(void *socket, const BrokerConfig *config);
+
+/**
+ * Rota de um serviço (rota "*" se o serviço não tem rota própria)
+ * @return Índice em routes->routes ou ROUTE_NONE
+ */
+int route_lookup(const RouteTable *routes, const char *service, size_t length);
+
+/**
+ * Máscara de bits das rotas que incluem o servidor com esta identidade
+ */
+unsigned int route_mask_for_server(const RouteTable *routes, const void *id, size_t size);
+
+/* ---- multipart.c ---- */
+
+/**
+ * Recebe uma mensagem multipart completa
+ * @param flags Flags do primeiro frame (ZMQ_DONTWAIT para leitura não bloqueante)
+ * @return 1 se recebeu, 0 se não havia mensagem (EAGAIN), -1 em erro ou descarte
+ */
+int multipart_recv(Multipart *mp, void *socket, int flags);
+
+/**
+ * Envia todos os frames, transferindo a posse dos buffers para o socket
+ * @return 0 em sucesso, -1 em erro
+ */
+int multipart_send(Multipart *mp, void *socket);
+
+/**
+ * Como multipart_send, com flags no primeiro frame (ZMQ_DONTWAIT: falha com
+ * EAGAIN em vez de bloquear se a fila do destino está cheia)
+ */
+int multipart_send_flags(Multipart *mp, void *socket, int flags);
+
+/**
+ * Fecha todos os frames de uma mensagem multipart
+ */
+void multipart_close(Multipart *mp);
+
+/**
+ * Insere um frame no início da mensagem (ex: identidade do servidor de destino)
+ * O buffer do frame vem do pool da thread chamadora
+ * @return 0 em sucesso, -1 se não há espaço ou falta memória
+ */
+int multipart_push_front(Multipart *mp, BufferPool *pool, const void *data, size_t size);
+
+/**
+ * Remove e descarta o primeiro frame da mensagem
+ */
+void multipart_pop_front(Multipart *mp);
+
+/**
+ * Soma dos tamanhos de todos os frames
+ */
+size_t multipart_size(Multipart *mp);
+
+/**
+ * Hash do primeiro frame (identidade do cliente), usado para distribuir
+ * mensagens entre threads mantendo a ordem por cliente
+ */
+unsigned int multipart_hash(const Multipart *mp);
+
+/* ---- pool.c ---- */
+
+/**
+ * @param limit Bytes de slabs que o pool pode obter do sistema
+ */
+void pool_init(BufferPool *pool, size_t limit);
+
+/**
+ * Libera as slabs; só depois de zmq_ctx_destroy, quando o ZeroMQ já
+ * devolveu todos os buffers enviados
+ */
+void pool_destroy(BufferPool *pool);
+
+/**
+ * Buffer de pelo menos size bytes (da thread dona do pool)
+ * Tamanhos acima da maior classe, ou com o pool esgotado, vêm do malloc
+ * @return Buffer ou NULL sem memória
+ */
+void *pool_alloc(BufferPool *pool, size_t size);
+
+/**
+ * Devolve um buffer de pool_alloc ao seu pool (de qualquer thread)
+ */
+void pool_release(void *data);
+
+/**
+ * Inicializa um frame de size bytes com buffer do pool (zmq_msg_init_data,
+ * devolvido ao pool quando o ZeroMQ libera a mensagem), copiando data se
+ * não for NULL. Frames pequenos ficam no próprio zmq_msg_t e frames maiores
+ * que a maior classe usam zmq_msg_init_size
+ * @return 0 em sucesso, -1 sem memória (msg fica vazio)
+ */
+int pool_msg_init(BufferPool *pool, zmq_msg_t *msg, const void *data, size_t size);
+
+/**
+ * Soma os contadores do pool em totals (leituras atômicas)
+ */
+void pool_accumulate(const BufferPool *pool, PoolTotals *totals);
+
+/* ---- inspect.c ---- */
+
+void inspector_init(Inspector *inspector, const BrokerConfig *config);
+
+/**
+ * Libera o pool do inspetor (após zmq_ctx_destroy)
+ */
+void inspector_destroy(Inspector *inspector);
+
+/**
+ * Inspeciona a mensagem de acordo com o modo de validação
+ * No modo strict, uma mensagem inválida tem o frame de dados substituído
+ * por uma resposta de erro e deve ser enviada de volta ao frontend; em uma
+ * requisição, info->route vira ROUTE_REJECTED (a resposta não fecha nada
+ * no cache nem na admissão, pelos quais a requisição não passou)
+ * @param info Recebe a rota e o serviço da requisição (frontend->backend)
+ * @return Direção em que a mensagem deve seguir
+ */
+Direction inspect_message(Inspector *inspector, Multipart *mp, Direction direction, RequestInfo *info);
+
+/**
+ * Lê apenas a chave 'service' do envelope {service, data}, sem decodificar
+ * o restante; *service aponta para dentro do frame
+ * @return 0 em sucesso, -1 se o frame não tem o formato esperado
+ */
+int peek_service(const void *data, size_t size, const char **service, uint32_t *length);
+
+/**
+ * Substitui o frame de dados por uma resposta de erro ao cliente, no formato
+ * de create_response() dos servidores, mantendo o envelope
+ * @return 0 se a resposta foi montada, -1 se a mensagem deve ser descartada
+ */
+int inspector_reply_error(Inspector *inspector, Multipart *mp, const char *description);
+
+/**
+ * Como inspector_reply_error, com data.retry_after: ms que o cliente deve
+ * esperar antes de repetir a requisição
+ */
+int inspector_reply_busy(Inspector *inspector, Multipart *mp, const char *description, int retry_after);
+
+/**
+ * Passa o data.clock do frame pelo relógio do broker (BROKER_CLOCK), como
+ * inspect_message faz com as mensagens encaminhadas
+ */
+void inspector_stamp(Inspector *inspector, zmq_msg_t *msg);
+
+/**
+ * Soma os contadores de um inspetor em totals (leituras atômicas)
+ */
+void inspector_accumulate(const Inspector *inspector, InspectorTotals *totals);
+
+/* ---- scheduler.c ---- */
+
+/**
+ * Servidor do backend conhecido pelo broker
+ */
+typedef struct {
+    unsigned char id[SERVER_ID_SIZE];  // Identidade ZeroMQ (routing id do servidor)
+    size_t id_size;
+    unsigned long outstanding;         // Requisições enviadas ainda sem resposta
+    unsigned long requests;            // Total de requisições enviadas
+    unsigned long last_assigned;       // Sequência da última requisição (desempate LRU)
+    unsigned int routes;               // Rotas (bits) que incluem este servidor
+    unsigned long replies;             // Total de respostas recebidas
+    Histogram latency;                 // Envio ao servidor -> resposta (µs)
+    uint32_t serial;                   // Único por registro (um servidor removido volta com outro)
+    uint64_t seen_ns;                  // Última mensagem recebida do servidor
+    uint64_t ping_ns;                  // Último ping enviado (0 = nenhum)
+    uint64_t suspect_ns;               // Dado como perdido por outro broker (0 = não)
+} BackendServer;
+
+typedef struct {
+    BackendServer servers[MAX_SERVERS];
+    int count;
+    unsigned long sequence;
+    uint32_t serials;                  // Último serial atribuído
+    const RouteTable *route_table;
+} Scheduler;
+
+void scheduler_init(Scheduler *scheduler, const RouteTable *routes);
+
+/**
+ * Procura um servidor pela identidade
+ * @return Índice do servidor ou -1 se desconhecido
+ */
+int scheduler_find(const Scheduler *scheduler, const void *id, size_t size);
+
+/**
+ * Registra um servidor (idempotente)
+ * @return Índice do servidor ou -1 se a tabela está cheia
+ */
+int scheduler_register(Scheduler *scheduler, const void *id, size_t size);
+
+/**
+ * Remove um servidor (ex: desconectado); índices posteriores podem mudar
+ */
+void scheduler_remove(Scheduler *scheduler, int index);
+
+/**
+ * Escolhe o servidor com menos requisições pendentes dentre os da rota
+ * Se nenhum servidor da rota está registrado, escolhe entre todos
+ * @param route Índice da rota ou ROUTE_NONE (qualquer servidor)
+ * @return Índice do servidor ou -1 se nenhum está registrado
+ */
+int scheduler_pick(const Scheduler *scheduler, int route);
+
+void scheduler_assigned(Scheduler *scheduler, int index);
+void scheduler_completed(Scheduler *scheduler, int index);
+
+/* ---- cache.c ---- */
+
+/**
+ * Resposta guardada de um serviço de leitura
+ */
+typedef struct {
+    uint64_t hash;                 // Hash da chave (0 = slot livre)
+    uint8_t *key;                  // Chave seguida da resposta, em um único bloco
+    uint32_t key_size;
+    uint8_t *reply;
+    size_t reply_size;
+    unsigned int bucket;           // Grupo de invalidação
+    uint64_t generation;           // Geração do grupo quando a resposta foi guardada
+    uint64_t expires_ns;
+    uint64_t used_ns;              // Último acerto (substituição LRU)
+} CacheEntry;
+
+typedef struct {
+    unsigned char id[PENDING_ID_SIZE];
+    size_t id_size;
+} CacheWaiter;
+
+/**
+ * Entrega uma resposta do cache a um cliente ([cliente][""][resposta]); em
+ * refuse o frame de resposta vem vazio, para ser substituído pelo erro
+ */
+typedef void (*CacheDeliverFn)(void *arg, Multipart *reply, int service);
+
+/**
+ * Requisição enviada ao backend e acompanhada até a resposta, indexada pela
+ * identidade do cliente que a enviou (um cliente REQ tem uma por vez):
+ * leituras juntam os clientes com a mesma chave; escritas invalidam de novo
+ * o grupo quando concluem
+ */
+typedef struct {
+    int used;
+    int write;
+    int group;
+    uint64_t hash;
+    uint8_t key[CACHE_KEY_SIZE];
+    uint32_t key_size;
+    unsigned int bucket;
+    uint64_t generation;           // Geração do grupo no envio da leitura
+    uint64_t started_ns;
+    CacheWaiter leader;
+    CacheWaiter waiters[CACHE_WAITERS];
+    int waiter_count;
+} CacheFlight;
+
+typedef struct {
+    const BrokerConfig *config;
+    int read_group[STATS_SERVICES];     // Serviço -> grupo que ele lê (-1 = nenhum)
+    int write_group[STATS_SERVICES];    // Serviço -> grupo que ele invalida (-1 = nenhum)
+    CacheEntry *entries;
+    size_t entry_count;                 // Múltiplo de CACHE_WAYS
+    size_t memory;                      // Bytes guardados (chaves + respostas)
+    uint64_t generations[CACHE_GENERATIONS];
+    CacheFlight flights[CACHE_FLIGHTS];
+    int flight_count;
+    uint64_t next_sweep_ns;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long coalesced;            // Clientes atendidos por uma requisição idêntica em trânsito
+    unsigned long stored;
+    unsigned long invalidations;
+    unsigned long abandoned;            // Requisições acompanhadas sem resposta
+    unsigned long refused;              // Clientes em espera respondidos com erro (abandono)
+    CacheDeliverFn deliver;             // Cópias da resposta aos clientes em espera
+    CacheDeliverFn refuse;              // Erro aos clientes em espera de uma requisição abandonada
+    void *deliver_arg;
+    BufferPool pool;                    // Respostas guardadas e cópias entregues aos clientes
+} ReadCache;
+
+typedef enum {
+    CACHE_MISS,     // Segue para o backend
+    CACHE_HIT,      // Frame de dados substituído pela resposta guardada
+    CACHE_JOINED    // O cliente aguarda a resposta de uma requisição idêntica
+} CacheOutcome;
+
+/**
+ * Grupo de um serviço de leitura cacheável pelo nome (BROKER_CACHE)
+ * @return Índice do grupo ou -1
+ */
+int cache_group_index(const char *name, size_t length);
+const char *cache_group_name(int group);
+
+/**
+ * @param deliver Envia aos clientes em espera a resposta da requisição idêntica
+ * @param refuse Responde com erro os clientes em espera de uma requisição
+ *               abandonada (sem resposta em CACHE_FLIGHT_TIMEOUT, reenviada
+ *               pelo cliente que a fez ou com resposta que não é a dela)
+ * @return 0 em sucesso (ou cache desligado), -1 sem memória
+ */
+int cache_init(ReadCache *cache, const BrokerConfig *config, CacheDeliverFn deliver,
+               CacheDeliverFn refuse, void *arg);
+
+/**
+ * Libera as entradas e o pool do cache (após zmq_ctx_destroy: as cópias
+ * entregues aos clientes usam buffers do pool)
+ */
+void cache_destroy(ReadCache *cache);
+
+/**
+ * Consulta uma requisição [cliente][""][dados] antes do envio ao backend
+ * Escritas invalidam o grupo que alteram; leituras podem ser respondidas
+ * pelo cache ou juntar-se a uma requisição idêntica em trânsito
+ * @param flight Recebe a requisição acompanhada aberta para esta mensagem
+ *               (-1 se nenhuma), a abandonar se o envio ao backend falhar
+ */
+CacheOutcome cache_request(ReadCache *cache, Multipart *mp, int service, int *flight);
+
+/**
+ * Descarta uma requisição acompanhada; os clientes em espera recebem erro (refuse)
+ */
+void cache_abandon(ReadCache *cache, int flight);
+
+/**
+ * Resposta do backend [cliente][""][dados] a caminho do cliente: conclui a
+ * requisição acompanhada do cliente, guarda a resposta se ainda válida e a
+ * entrega aos clientes em espera
+ */
+void cache_reply(ReadCache *cache, Multipart *mp);
+
+/**
+ * Libera respostas expiradas e requisições abandonadas (chamada periódica)
+ */
+void cache_expire(ReadCache *cache);
+
+/* ---- admission.c ---- */
+
+/**
+ * Cliente do frontend: balde de tokens e requisição em trânsito
+ */
+typedef struct {
+    unsigned char id[PENDING_ID_SIZE];
+    size_t id_size;                // 0 = slot livre
+    double tokens;
+    uint64_t refilled_ns;          // Última atualização de tokens
+    uint64_t sent_ns;              // Requisição enviada ao backend (0 = nenhuma)
+} AdmissionClient;
+
+typedef struct {
+    const BrokerConfig *config;
+    AdmissionClient clients[ADMISSION_SLOTS];
+    int inflight;                  // Clientes com requisição nos servidores
+    uint64_t next_sweep_ns;
+    unsigned long rate_limited;    // Requisições recusadas pelo balde do cliente
+    unsigned long saturated;       // Requisições recusadas por BROKER_MAX_INFLIGHT
+    unsigned long untracked;       // Consultas de clientes sem slot (identidade grande ou conjunto cheio)
+    unsigned long expired;         // Requisições sem resposta após ADMISSION_INFLIGHT_TIMEOUT
+} Admission;
+
+void admission_init(Admission *admission, const BrokerConfig *config);
+
+/**
+ * Balde de tokens do cliente do primeiro frame (BROKER_RATE_LIMIT): consome
+ * um token se houver
+ * @param retry_after Recebe os ms até o próximo token quando recusada
+ * @return 1 se a requisição segue, 0 se o cliente excedeu o limite
+ */
+int admission_allow(Admission *admission, Multipart *mp, int *retry_after);
+
+/**
+ * Limite global de requisições nos servidores (BROKER_MAX_INFLIGHT)
+ * @return 1 se a requisição deve ser recusada
+ */
+int admission_saturated(Admission *admission);
+
+/**
+ * A requisição do cliente do primeiro frame foi entregue a um servidor
+ */
+void admission_sent(Admission *admission, Multipart *mp);
+
+/**
+ * Resposta do servidor a caminho do cliente do primeiro frame
+ */
+void admission_completed(Admission *admission, Multipart *mp);
+
+/**
+ * Deixa de contar requisições sem resposta há ADMISSION_INFLIGHT_TIMEOUT ms
+ * (chamada periodicamente pelo loop)
+ */
+void admission_expire(Admission *admission);
+
+/* ---- failover.c ---- */
+
+/**
+ * Requisição entregue a um servidor e ainda sem resposta
+ */
+typedef struct {
+    unsigned char id[PENDING_ID_SIZE];  // Cliente
+    size_t id_size;                     // 0 = slot livre
+    uint32_t server;                    // Serial do servidor (0 = já respondida pelo broker)
+    RequestInfo info;
+    int attempts;                       // Reenvios já feitos
+    int has_request;                    // request guarda uma cópia do frame de dados
+    zmq_msg_t request;                  // zmq_msg_copy: compartilha o buffer, sem copiar o payload
+} FailoverEntry;
+
+typedef struct {
+    const BrokerConfig *config;
+    int idempotent[STATS_SERVICES];     // Serviços que podem ser reenviados a outro servidor
+    FailoverEntry entries[FAILOVER_SLOTS];
+    uint32_t lost[MAX_SERVERS];         // Servidores removidos a tratar em failover_process
+    int lost_count;
+    int attempt;                        // Tentativa da requisição sendo reenviada
+    unsigned long servers_lost;
+    unsigned long retried;              // Leituras reenviadas a outro servidor
+    unsigned long failed;               // Requisições respondidas com erro pelo broker
+    unsigned long stale;                // Respostas atrasadas de um servidor já substituído
+    unsigned long untracked;
+} Failover;
+
+/**
+ * Reenvia (retry=1) ou responde com erro (retry=0) a requisição
+ * [cliente][""][dados] de um servidor perdido; fecha request
+ */
+typedef void (*FailoverResendFn)(void *arg, Multipart *request, const RequestInfo *info, int retry);
+
+void failover_init(Failover *failover, const BrokerConfig *config);
+void failover_destroy(Failover *failover);
+
+/**
+ * Registra a requisição [cliente][""][dados] antes do envio ao servidor
+ * Leituras (idempotentes) guardam uma cópia para um possível reenvio
+ */
+void failover_sent(Failover *failover, Multipart *mp, uint32_t server, const RequestInfo *info);
+
+/**
+ * Esquece a requisição do cliente do primeiro frame (o envio falhou)
+ */
+void failover_forget(Failover *failover, Multipart *mp);
+
+/**
+ * Resposta [cliente][""][dados] do servidor
+ * @return 1 se deve seguir ao cliente, 0 se a requisição já foi reenviada
+ *         ou respondida pelo broker (resposta atrasada a descartar)
+ */
+int failover_reply(Failover *failover, Multipart *mp, uint32_t server);
+
+/**
+ * O servidor saiu do escalonamento: as suas requisições serão reenviadas
+ * ou respondidas com erro na próxima chamada de failover_process
+ */
+void failover_server_lost(Failover *failover, uint32_t server);
+
+void failover_process(Failover *failover, FailoverResendFn resend, void *arg);
+
+/**
+ * Ping aos servidores: {service: 'ping', data: {timestamp}}
+ * @return Tamanho serializado ou 0 se não coube
+ */
+size_t failover_ping(uint8_t *buffer, size_t capacity);
+
+/* ---- cluster.c ---- */
+
+/**
+ * Outro broker, conhecido pelo gossip que ele publica
+ */
+typedef struct {
+    char name[BROKER_NAME_SIZE];       // BROKER_NAME do peer ("" = slot livre)
+    uint64_t seen_ns;                  // Último gossip recebido
+    unsigned long servers;             // Servidores registrados no peer
+    unsigned long gossips;
+} ClusterPeer;
+
+/**
+ * Servidor removido por este broker, anunciado aos peers
+ */
+typedef struct {
+    unsigned char id[SERVER_ID_SIZE];
+    size_t id_size;
+    int rounds;                        // Rodadas de gossip que ainda o anunciam
+} ClusterLoss;
+
+typedef struct {
+    const BrokerConfig *config;
+    void *pub;                         // Gossip deste broker (NULL = sem peers)
+    void *sub;                         // Gossip dos peers
+    ClusterPeer peers[MAX_PEERS];
+    ClusterLoss losses[MAX_SERVERS];
+    int loss_count;
+    unsigned long sent;
+    unsigned long received;
+    unsigned long invalid;             // Mensagens de gossip sem o formato esperado
+    unsigned long suspected;           // Servidores dados como perdidos por um peer e registrados aqui
+} Cluster;
+
+/**
+ * Um peer removeu o servidor com esta identidade
+ * @return 1 se o servidor está registrado aqui (e passa a ser suspeito)
+ */
+typedef int (*ClusterSuspectFn)(void *arg, const void *id, size_t size, const char *peer, size_t peer_length);
+
+/**
+ * Cria os sockets do gossip (nada a fazer sem BROKER_PEERS)
+ * @return 0 em sucesso, -1 em erro (errno do ZeroMQ)
+ */
+int cluster_start(Cluster *cluster, void *context, const BrokerConfig *config);
+void cluster_stop(Cluster *cluster);
+
+/**
+ * O servidor saiu do escalonamento: entra nos próximos gossips
+ */
+void cluster_server_lost(Cluster *cluster, const void *id, size_t size);
+
+/**
+ * O servidor (re)registrou-se: deixa de ser anunciado como removido
+ */
+void cluster_server_registered(Cluster *cluster, const void *id, size_t size);
+
+/**
+ * Publica o gossip da rodada (a cada BROKER_HEARTBEAT_IVL ms)
+ * @param servers Servidores registrados neste broker
+ */
+void cluster_gossip(Cluster *cluster, int servers);
+
+/**
+ * Trata os gossips recebidos dos peers
+ */
+void cluster_receive(Cluster *cluster, ClusterSuspectFn suspect, void *arg);
+
+/**
+ * @return 1 se o peer publicou nas últimas CLUSTER_PEER_ROUNDS rodadas
+ */
+int cluster_peer_up(const Cluster *cluster, const ClusterPeer *peer);
+
+/* ---- stats.c ---- */
+
+/**
+ * Requisição em trânsito, indexada pela identidade do cliente (frame 0 do
+ * envelope do ROUTER); um cliente REQ tem no máximo uma por vez
+ */
+typedef struct {
+    unsigned char id[PENDING_ID_SIZE];
+    size_t id_size;          // 0 = slot livre
+    uint64_t received_ns;    // Chegada no frontend
+    uint64_t sent_ns;        // Envio ao backend (0 = ainda no broker)
+    int service;
+} PendingRequest;
+
+/**
+ * Respostas descartadas para um cliente (fila cheia ou cliente desconectado)
+ */
+typedef struct {
+    unsigned char id[PENDING_ID_SIZE];
+    size_t id_size;              // 0 = slot livre
+    unsigned long dropped;
+} PeerDrops;
+
+/**
+ * Métricas do loop principal (apenas o main thread escreve)
+ */
+typedef struct {
+    unsigned long messages[2];                    // Indexado por Direction
+    unsigned long bytes[2];
+    unsigned long service_requests[STATS_SERVICES];
+    Histogram service_latency[STATS_SERVICES];    // Chegada no frontend -> resposta do backend (µs)
+    Histogram broker_latency;                     // Chegada no frontend -> envio ao backend (µs)
+    PendingRequest pending[PENDING_SLOTS];
+    unsigned long unmatched;                      // Respostas sem requisição acompanhada
+    unsigned long evicted;                        // Requisições sobrescritas por colisão
+    PeerDrops peers[PEER_SLOTS];
+    int peer_count;
+    unsigned long dropped;                        // Respostas descartadas (todos os clientes)
+    uint64_t started_ns;
+} BrokerStats;
+
+uint64_t monotonic_ns(void);
+
+void stats_init(BrokerStats *stats);
+
+/**
+ * Índice de um serviço nas estatísticas (serviços desconhecidos = "outros")
+ */
+int stats_service_index(const char *service, size_t length);
+
+/**
+ * Conta uma mensagem recebida em um socket TCP; requisições abrem uma
+ * entrada em trânsito para o cliente do primeiro frame
+ */
+void stats_received(BrokerStats *stats, Multipart *mp, Direction direction);
+
+/**
+ * Marca a requisição do cliente do primeiro frame como enviada ao backend
+ */
+void stats_request_sent(BrokerStats *stats, Multipart *mp, int service);
+
+/**
+ * Fecha a requisição respondida pelo servidor e registra as latências
+ * (mp já sem a identidade do servidor: o primeiro frame é o cliente)
+ */
+void stats_reply_received(BrokerStats *stats, Multipart *mp, BackendServer *server);
+
+/**
+ * Fecha a requisição do cliente do primeiro frame respondida pelo cache
+ */
+void stats_reply_cached(BrokerStats *stats, Multipart *mp, int service);
+
+/**
+ * Conta uma resposta que não pôde ser entregue ao cliente do primeiro frame
+ */
+void stats_reply_dropped(BrokerStats *stats, Multipart *mp);
+
+/**
+ * Escreve as métricas no formato texto do Prometheus
+ * @return Bytes escritos (a saída é truncada se não couber)
+ */
+size_t stats_render(const BrokerStats *stats, const Scheduler *scheduler,
+                    const InspectorTotals *inspected, const ReadCache *cache,
+                    const Admission *admission, const Failover *failover,
+                    const Cluster *cluster, char *buffer, size_t capacity);
+
+/**
+ * Gera o corpo da resposta de métricas
+ * @return Bytes escritos em buffer
+ */
+typedef size_t (*StatsRenderFn)(void *arg, char *buffer, size_t capacity);
+
+/**
+ * Responde às conexões HTTP pendentes em um socket ZMQ_STREAM
+ * Qualquer requisição recebe as métricas e a conexão é fechada em seguida
+ * (resposta HTTP/1.0)
+ */
+void stats_serve(void *socket, StatsRenderFn render, void *arg);
+
+/* ---- log.c ---- */
+
+/**
+ * Inicia a thread de escrita do log (antes de qualquer log_message)
+ * @return 0 em sucesso, -1 em erro (mensagens ficam no buffer até log_stop)
+ */
+int log_start(const BrokerConfig *config);
+
+/**
+ * Escreve o que restou no buffer e encerra a thread de escrita
+ */
+void log_stop(void);
+
+/**
+ * Registra uma mensagem sem bloquear (descartada se o buffer está cheio ou
+ * se o limite por segundo foi atingido); o prefixo [BROKER] é adicionado
+ */
+void log_message(LogLevel level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+int log_enabled(LogLevel level);
+void log_set_level(LogLevel level);
+
+/**
+ * Ajusta o nível em delta passos (seguro em handler de sinal)
+ */
+void log_shift_level(int delta);
+
+const char *log_level_name(LogLevel level);
+
+/* ---- topics.c ---- */
+
+/**
+ * Tópico (canal ou usuário) visto pelo proxy PUB-SUB
+ */
+typedef struct {
+    char name[TOPIC_SIZE];
+    size_t length;
+    int used;
+    unsigned long subscribers;      // Assinaturas ativas (de todos os assinantes)
+    unsigned long subscribe_events; // Assinaturas recebidas, incluindo duplicadas
+    unsigned long publications;
+    unsigned long deliveries;       // Estimativa de fan-out: publicações x assinantes
+    unsigned long bytes;
+} Topic;
+
+typedef struct {
+    Topic topics[MAX_TOPICS];
+    int count;
+} TopicTable;
+
+void topics_init(TopicTable *table);
+
+/**
+ * Procura um tópico pelo nome (bytes, sem '\0')
+ * @param create Cria a entrada se não existir
+ * @return Tópico ou NULL se não existe / não pode ser acompanhado
+ */
+Topic *topics_lookup(TopicTable *table, const void *name, size_t length, int create);
+
+/**
+ * Remove um tópico da tabela (o ponteiro e os de outros tópicos deixam de
+ * valer)
+ */
+void topics_remove(TopicTable *table, Topic *topic);
+
+/* ---- pubsub.c ---- */
+
+/**
+ * Executa o proxy XSUB-XPUB até *interrupted (BROKER_MODE=proxy)
+ * @return 0 ao encerrar normalmente, -1 se não foi possível iniciar
+ */
+int pubsub_run(void *context, const BrokerConfig *config, volatile int *interrupted);
+
+/* ---- workers.c ---- */
+
+typedef struct {
+    pthread_t thread;
+    void *up;        // Pipe frontend->backend (main envia requisições, worker devolve)
+    void *down;      // Pipe backend->frontend (main envia respostas, worker devolve)
+    Inspector inspector;
+    int cpu;         // CPU fixada (-1 = sem fixação)
+} Worker;
+
+typedef struct {
+    Worker workers[MAX_WORKERS];
+    int count;
+    void *up[MAX_WORKERS];    // Pontas do main thread para cada worker
+    void *down[MAX_WORKERS];
+} WorkerPool;
+
+/**
+ * Cria os pipes inproc e inicia as threads de inspeção
+ * @return 0 em sucesso, -1 em erro
+ */
+int workers_start(WorkerPool *pool, void *context, const BrokerConfig *config);
+
+/**
+ * Aguarda o término das threads (após zmq_ctx_shutdown) e fecha os pipes
+ */
+void workers_join(WorkerPool *pool);
+
+/**
+ * Libera o estado dos workers (após zmq_ctx_destroy)
+ */
+void workers_destroy(WorkerPool *pool);
+
+/**
+ * Fixa a thread atual em uma CPU
+ */
+int pin_current_thread(int cpu);
+
+#endif /* BROKER_H */
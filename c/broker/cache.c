@@ -0,0 +1,514 @@
+/**
+ * Broker - Cache de respostas dos serviços de leitura (BROKER_CACHE)
+ *
+ * users, channels e get_history podem ser respondidos pelo broker: a chave
+ * é o serviço mais os argumentos da requisição (data sem timestamp e clock,
+ * reserializado pelo codec de envelope), e a resposta 'sucesso' do backend
+ * fica guardada por BROKER_CACHE_TTL ms. Requisições idênticas que chegam
+ * enquanto a primeira está no backend não são enviadas: os clientes esperam
+ * e recebem uma cópia da mesma resposta (single-flight). Se a primeira é
+ * abandonada, os que esperavam recebem uma resposta de erro com retry_after.
+ *
+ * As escritas correspondentes (login -> users, channel -> channels,
+ * publish -> get_history do mesmo canal) invalidam o grupo ao passar pelo
+ * broker e de novo quando concluem. A invalidação só incrementa a geração do
+ * grupo; entradas e leituras em trânsito de uma geração anterior deixam de
+ * valer sem percorrer a tabela. Escritas aplicadas por replicação entre os
+ * servidores não passam pelo broker: o TTL limita o atraso nesse caso.
+ *
+ * Usado apenas pelo loop principal (sem locks).
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include "broker.h"
+#include "../common_utils/envelope.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static const struct {
+    const char *read;      // Serviço cacheado
+    const char *write;     // Serviço que invalida as respostas guardadas
+    int by_channel;        // Invalidação só das respostas do mesmo data.channel
+} GROUPS[CACHE_GROUPS] = {
+    { "users", "login", 0 },
+    { "channels", "channel", 0 },
+    { "get_history", "publish", 1 },
+};
+
+int cache_group_index(const char *name, size_t length) {
+    for (int i = 0; i < CACHE_GROUPS; i++) {
+        if (strlen(GROUPS[i].read) == length && memcmp(GROUPS[i].read, name, length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *cache_group_name(int group) {
+    return GROUPS[group].read;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t ms_to_ns(int ms) {
+    return (uint64_t)ms * 1000000u;
+}
+
+int cache_init(ReadCache *cache, const BrokerConfig *config, CacheDeliverFn deliver,
+               CacheDeliverFn refuse, void *arg) {
+    memset(cache, 0, sizeof(*cache));
+    cache->config = config;
+    cache->deliver = deliver;
+    cache->refuse = refuse;
+    cache->deliver_arg = arg;
+    pool_init(&cache->pool, (size_t)config->cache_memory * 1024);
+    for (int i = 0; i < STATS_SERVICES; i++) {
+        cache->read_group[i] = -1;
+        cache->write_group[i] = -1;
+    }
+    if (config->cache_groups == 0) {
+        return 0;
+    }
+    
+    size_t count = ((size_t)config->cache_entries + CACHE_WAYS - 1) / CACHE_WAYS * CACHE_WAYS;
+    cache->entries = calloc(count, sizeof(CacheEntry));
+    if (!cache->entries) {
+        return -1;
+    }
+    cache->entry_count = count;
+    
+    for (int i = 0; i < CACHE_GROUPS; i++) {
+        if (config->cache_groups & (1u << i)) {
+            cache->read_group[stats_service_index(GROUPS[i].read, strlen(GROUPS[i].read))] = i;
+            cache->write_group[stats_service_index(GROUPS[i].write, strlen(GROUPS[i].write))] = i;
+        }
+    }
+    return 0;
+}
+
+static void entry_free(ReadCache *cache, CacheEntry *entry) {
+    if (entry->hash != 0) {
+        cache->memory -= entry->key_size + entry->reply_size;
+        pool_release(entry->key);
+        memset(entry, 0, sizeof(*entry));
+    }
+}
+
+void cache_destroy(ReadCache *cache) {
+    for (size_t i = 0; i < cache->entry_count; i++) {
+        entry_free(cache, &cache->entries[i]);
+    }
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->entry_count = 0;
+    pool_destroy(&cache->pool);
+}
+
+static int entry_valid(const ReadCache *cache, const CacheEntry *entry, uint64_t now) {
+    return entry->hash != 0 && entry->expires_ns > now &&
+           entry->generation == cache->generations[entry->bucket];
+}
+
+/**
+ * Primeira entrada do conjunto de CACHE_WAYS entradas da chave
+ */
+static CacheEntry *entry_set(ReadCache *cache, uint64_t hash) {
+    return &cache->entries[hash % (cache->entry_count / CACHE_WAYS) * CACHE_WAYS];
+}
+
+static CacheEntry *entry_find(ReadCache *cache, uint64_t hash, const uint8_t *key, uint32_t size,
+                              uint64_t now) {
+    CacheEntry *set = entry_set(cache, hash);
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        CacheEntry *entry = &set[i];
+        if (entry->hash == hash && entry->key_size == size && memcmp(entry->key, key, size) == 0) {
+            if (entry_valid(cache, entry, now)) {
+                return entry;
+            }
+            entry_free(cache, entry);
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Guarda a resposta no conjunto da chave, no lugar da mesma chave, de uma
+ * entrada livre ou inválida, ou da usada há mais tempo
+ */
+static void entry_store(ReadCache *cache, const CacheFlight *flight, const void *reply, size_t size,
+                        uint64_t now) {
+    size_t limit = (size_t)cache->config->cache_memory * 1024;
+    size_t need = flight->key_size + size;
+    if (need > limit) {
+        return;
+    }
+    
+    CacheEntry *set = entry_set(cache, flight->hash);
+    CacheEntry *victim = &set[0];
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        CacheEntry *entry = &set[i];
+        if (entry->hash == flight->hash && entry->key_size == flight->key_size &&
+            memcmp(entry->key, flight->key, flight->key_size) == 0) {
+            victim = entry;
+            break;
+        }
+        if (!entry_valid(cache, entry, now)) {
+            victim = entry;
+        } else if (entry_valid(cache, victim, now) && entry->used_ns < victim->used_ns) {
+            victim = entry;
+        }
+    }
+    entry_free(cache, victim);
+    if (cache->memory + need > limit) {
+        return;  // Sem espaço até as entradas atuais expirarem
+    }
+    
+    uint8_t *block = pool_alloc(&cache->pool, need);
+    if (!block) {
+        return;
+    }
+    memcpy(block, flight->key, flight->key_size);
+    memcpy(block + flight->key_size, reply, size);
+    victim->hash = flight->hash;
+    victim->key = block;
+    victim->key_size = flight->key_size;
+    victim->reply = block + flight->key_size;
+    victim->reply_size = size;
+    victim->bucket = flight->bucket;
+    victim->generation = flight->generation;
+    victim->expires_ns = now + ms_to_ns(cache->config->cache_ttl);
+    victim->used_ns = now;
+    cache->memory += need;
+    cache->stored++;
+}
+
+/**
+ * Grupo de invalidação da requisição: o serviço e, em grupos por canal,
+ * data.channel (colisões só invalidam a mais)
+ */
+static unsigned int bucket_of(int group, const Envelope *request) {
+    uint64_t hash = hash_bytes(FNV_OFFSET, &group, sizeof(group));
+    const EnvelopeField *channel = envelope_get(request, "channel", 7);
+    if (GROUPS[group].by_channel && channel && channel->type == ENVELOPE_STR) {
+        hash = hash_bytes(hash, channel->value.bytes.data, channel->value.bytes.length);
+    }
+    return (unsigned int)(hash & (CACHE_GENERATIONS - 1));
+}
+
+static void invalidate(ReadCache *cache, unsigned int bucket) {
+    cache->generations[bucket]++;
+    cache->invalidations++;
+}
+
+/**
+ * Chave da leitura: o envelope reserializado sem timestamp e clock
+ * @return 0 em sucesso, -1 se não cabe em CACHE_KEY_SIZE
+ */
+static int build_key(const Envelope *request, uint8_t *key, uint32_t *size) {
+    Envelope args;
+    envelope_init(&args, request->service, request->service_length);
+    for (uint32_t i = 0; i < request->field_count; i++) {
+        const EnvelopeField *field = &request->fields[i];
+        if ((field->key_length == 9 && memcmp(field->key, "timestamp", 9) == 0) ||
+            (field->key_length == 5 && memcmp(field->key, "clock", 5) == 0)) {
+            continue;
+        }
+        *envelope_add(&args, field->key, field->key_length, field->type) = *field;
+    }
+    
+    size_t written = envelope_encode(&args, key, CACHE_KEY_SIZE);
+    if (written == 0) {
+        return -1;
+    }
+    *size = (uint32_t)written;
+    return 0;
+}
+
+static int same_client(const CacheWaiter *waiter, const zmq_msg_t *id) {
+    return waiter->id_size == zmq_msg_size(id) &&
+           memcmp(waiter->id, zmq_msg_data((zmq_msg_t *)id), waiter->id_size) == 0;
+}
+
+static void set_client(CacheWaiter *waiter, zmq_msg_t *id) {
+    waiter->id_size = zmq_msg_size(id);
+    memcpy(waiter->id, zmq_msg_data(id), waiter->id_size);
+}
+
+static void flight_close(ReadCache *cache, int index) {
+    cache->flights[index].used = 0;
+    cache->flight_count--;
+}
+
+static int flight_service(const CacheFlight *flight) {
+    return stats_service_index(GROUPS[flight->group].read, strlen(GROUPS[flight->group].read));
+}
+
+/**
+ * Monta [cliente][""][resposta] para o cliente em espera e o passa a fn;
+ * sem reply o frame de resposta fica vazio (refuse o substitui pelo erro)
+ */
+static void deliver_copy(ReadCache *cache, CacheWaiter *waiter, const void *reply, size_t size,
+                         int service, CacheDeliverFn fn) {
+    Multipart out = { .count = 0 };
+    if (pool_msg_init(&cache->pool, &out.frames[0], waiter->id, waiter->id_size) != 0) {
+        return;
+    }
+    out.count = 1;
+    zmq_msg_init(&out.frames[out.count++]);
+    if (!reply) {
+        zmq_msg_init(&out.frames[out.count++]);
+        fn(cache->deliver_arg, &out, service);
+    } else if (pool_msg_init(&cache->pool, &out.frames[2], reply, size) == 0) {
+        out.count = 3;
+        fn(cache->deliver_arg, &out, service);
+    }
+    multipart_close(&out);
+}
+
+void cache_abandon(ReadCache *cache, int flight) {
+    if (flight < 0 || !cache->flights[flight].used) {
+        return;
+    }
+    // Sem a requisição de cada um não há o que reenviar: um erro com
+    // retry_after faz o cliente REQ repetir em vez de esperar até o timeout
+    CacheFlight *abandoned = &cache->flights[flight];
+    for (int i = 0; i < abandoned->waiter_count; i++) {
+        deliver_copy(cache, &abandoned->waiters[i], NULL, 0, flight_service(abandoned), cache->refuse);
+        cache->refused++;
+    }
+    flight_close(cache, flight);
+    cache->abandoned++;
+}
+
+/**
+ * Requisição acompanhada do cliente (pela identidade), ou -1
+ */
+static int flight_by_client(const ReadCache *cache, zmq_msg_t *id) {
+    for (int i = 0; i < CACHE_FLIGHTS; i++) {
+        if (cache->flights[i].used && same_client(&cache->flights[i].leader, id)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void sweep_flights(ReadCache *cache, uint64_t now) {
+    for (int i = 0; i < CACHE_FLIGHTS && cache->flight_count > 0; i++) {
+        if (cache->flights[i].used && now - cache->flights[i].started_ns > ms_to_ns(CACHE_FLIGHT_TIMEOUT)) {
+            cache_abandon(cache, i);
+        }
+    }
+}
+
+/**
+ * Abre a requisição acompanhada do cliente do primeiro frame
+ * @return Índice ou -1 se a tabela está cheia
+ */
+static int flight_open(ReadCache *cache, Multipart *mp, int write, int group, unsigned int bucket,
+                       uint64_t now) {
+    // Uma resposta anterior do mesmo cliente que não veio não virá mais
+    cache_abandon(cache, flight_by_client(cache, &mp->frames[0]));
+    if (cache->flight_count == CACHE_FLIGHTS) {
+        sweep_flights(cache, now);
+    }
+    
+    for (int i = 0; i < CACHE_FLIGHTS; i++) {
+        CacheFlight *flight = &cache->flights[i];
+        if (!flight->used) {
+            flight->used = 1;
+            flight->write = write;
+            flight->group = group;
+            flight->bucket = bucket;
+            flight->generation = cache->generations[bucket];
+            flight->started_ns = now;
+            flight->waiter_count = 0;
+            flight->key_size = 0;
+            set_client(&flight->leader, &mp->frames[0]);
+            cache->flight_count++;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Leitura idêntica em trânsito à qual um novo cliente ainda pode se juntar
+ * (mesma geração: nenhuma escrita do grupo passou depois do envio)
+ */
+static int flight_find(ReadCache *cache, uint64_t hash, const uint8_t *key, uint32_t size,
+                       unsigned int bucket, uint64_t now) {
+    for (int i = 0; i < CACHE_FLIGHTS; i++) {
+        CacheFlight *flight = &cache->flights[i];
+        if (flight->used && !flight->write && flight->hash == hash && flight->key_size == size &&
+            memcmp(flight->key, key, size) == 0) {
+            if (flight->generation == cache->generations[bucket] &&
+                now - flight->started_ns <= ms_to_ns(CACHE_FLIGHT_TIMEOUT)) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * Une o cliente à leitura em trânsito
+ * @return 0 se vai receber a resposta dela, -1 se deve seguir sozinho
+ */
+static int flight_join(ReadCache *cache, CacheFlight *flight, zmq_msg_t *id) {
+    if (flight->waiter_count == CACHE_WAITERS || same_client(&flight->leader, id)) {
+        return -1;
+    }
+    for (int i = 0; i < flight->waiter_count; i++) {
+        if (same_client(&flight->waiters[i], id)) {
+            return -1;
+        }
+    }
+    set_client(&flight->waiters[flight->waiter_count++], id);
+    cache->coalesced++;
+    return 0;
+}
+
+CacheOutcome cache_request(ReadCache *cache, Multipart *mp, int service, int *flight) {
+    *flight = -1;
+    if (!cache->entries || service < 0 || service >= STATS_SERVICES) {
+        return CACHE_MISS;
+    }
+    int read = cache->read_group[service];
+    int write = cache->write_group[service];
+    if (read < 0 && write < 0) {
+        return CACHE_MISS;
+    }
+    
+    // Só o envelope de um cliente REQ ([cliente][""][dados]) é acompanhado
+    if (mp->count != 3 || zmq_msg_size(&mp->frames[1]) != 0 ||
+        zmq_msg_size(&mp->frames[0]) > PENDING_ID_SIZE) {
+        return CACHE_MISS;
+    }
+    
+    zmq_msg_t *data = &mp->frames[2];
+    Envelope request;
+    if (envelope_decode(&request, zmq_msg_data(data), zmq_msg_size(data)) != ENVELOPE_OK) {
+        return CACHE_MISS;
+    }
+    
+    uint64_t now = monotonic_ns();
+    if (write >= 0) {
+        unsigned int bucket = bucket_of(write, &request);
+        invalidate(cache, bucket);
+        *flight = flight_open(cache, mp, 1, write, bucket, now);
+        return CACHE_MISS;
+    }
+    
+    uint8_t key[CACHE_KEY_SIZE];
+    uint32_t key_size;
+    if (build_key(&request, key, &key_size) < 0) {
+        return CACHE_MISS;
+    }
+    uint64_t hash = hash_bytes(FNV_OFFSET, key, key_size) | 1;  // 0 marca slot livre
+    unsigned int bucket = bucket_of(read, &request);
+    
+    CacheEntry *entry = entry_find(cache, hash, key, key_size, now);
+    if (entry) {
+        zmq_msg_t reply;
+        if (pool_msg_init(&cache->pool, &reply, entry->reply, entry->reply_size) == 0) {
+            zmq_msg_move(data, &reply);
+            zmq_msg_close(&reply);
+            entry->used_ns = now;
+            cache->hits++;
+            return CACHE_HIT;
+        }
+    }
+    
+    int index = flight_find(cache, hash, key, key_size, bucket, now);
+    if (index >= 0 && flight_join(cache, &cache->flights[index], &mp->frames[0]) == 0) {
+        return CACHE_JOINED;
+    }
+    
+    cache->misses++;
+    if (index < 0) {
+        *flight = flight_open(cache, mp, 0, read, bucket, now);
+        if (*flight >= 0) {
+            CacheFlight *opened = &cache->flights[*flight];
+            opened->hash = hash;
+            memcpy(opened->key, key, key_size);
+            opened->key_size = key_size;
+        }
+    }
+    return CACHE_MISS;
+}
+
+void cache_reply(ReadCache *cache, Multipart *mp) {
+    if (cache->flight_count == 0 || mp->count == 0) {
+        return;
+    }
+    int index = flight_by_client(cache, &mp->frames[0]);
+    if (index < 0) {
+        return;
+    }
+    
+    CacheFlight *flight = &cache->flights[index];
+    if (flight->write) {
+        invalidate(cache, flight->bucket);  // Leituras enviadas antes da conclusão não são guardadas
+        flight_close(cache, index);
+        return;
+    }
+    
+    zmq_msg_t *data = &mp->frames[mp->count - 1];
+    const void *reply = zmq_msg_data(data);
+    size_t size = zmq_msg_size(data);
+    Envelope response;
+    int service = flight_service(flight);
+    
+    // Uma resposta de outro serviço não é a desta leitura (o cliente desistiu dela);
+    // um erro do broker (servidor perdido, nenhum disponível) vale para todos
+    if (mp->count != 3 || envelope_decode(&response, reply, size) != ENVELOPE_OK) {
+        cache_abandon(cache, index);
+        return;
+    }
+    int error = response.service_length == 5 && memcmp(response.service, "error", 5) == 0;
+    if (!error && stats_service_index(response.service, response.service_length) != service) {
+        cache_abandon(cache, index);
+        return;
+    }
+    
+    const EnvelopeField *status = envelope_get(&response, "status", 6);
+    if (!error && status && status->type == ENVELOPE_STR && status->value.bytes.length == 7 &&
+        memcmp(status->value.bytes.data, "sucesso", 7) == 0 &&
+        flight->generation == cache->generations[flight->bucket]) {
+        entry_store(cache, flight, reply, size, monotonic_ns());
+    }
+    
+    for (int i = 0; i < flight->waiter_count; i++) {
+        deliver_copy(cache, &flight->waiters[i], reply, size, service, cache->deliver);
+    }
+    flight_close(cache, index);
+}
+
+void cache_expire(ReadCache *cache) {
+    if (!cache->entries) {
+        return;
+    }
+    uint64_t now = monotonic_ns();
+    if (now < cache->next_sweep_ns) {
+        return;
+    }
+    
+    int interval = cache->config->cache_ttl < CACHE_FLIGHT_TIMEOUT ?
+                   cache->config->cache_ttl : CACHE_FLIGHT_TIMEOUT;
+    cache->next_sweep_ns = now + ms_to_ns(interval);
+    for (size_t i = 0; i < cache->entry_count; i++) {
+        if (cache->entries[i].hash != 0 && !entry_valid(cache, &cache->entries[i], now)) {
+            entry_free(cache, &cache->entries[i]);
+        }
+    }
+    sweep_flights(cache, now);
+}
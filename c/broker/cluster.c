@@ -0,0 +1,240 @@
+/**
+ * Broker - Gossip da saúde do backend entre brokers (BROKER_PEERS)
+ *
+ * Vários brokers podem atender os mesmos servidores: cada servidor conecta
+ * o backend de todos e os clientes se dividem entre eles por hash
+ * consistente do nome do usuário. O caminho das requisições não tem estado
+ * compartilhado; cada broker escalona apenas os servidores que ele mesmo vê.
+ *
+ * A cada BROKER_HEARTBEAT_IVL ms o broker publica (PUB em
+ * BROKER_CLUSTER_ENDPOINT) o seu nome, quantos servidores tem registrados e
+ * os servidores que removeu nas últimas CLUSTER_LOSS_ROUNDS rodadas, e
+ * assina (SUB) os demais brokers. Um servidor removido por um peer é só uma
+ * suspeita: aqui ele recebe um ping na hora e sai se não responder em um
+ * quarto de BROKER_HEARTBEAT_TIMEOUT (no mínimo BROKER_HEARTBEAT_IVL ms, em
+ * vez do prazo inteiro). Um gossip
+ * perdido ou atrasado deixa só a detecção local, como em um broker isolado.
+ *
+ * Usado apenas pelo loop principal (sem locks).
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "broker.h"
+#include "../common_utils/envelope.h"
+#include "../common_utils/msgpack_lite.h"
+
+int cluster_start(Cluster *cluster, void *context, const BrokerConfig *config) {
+    memset(cluster, 0, sizeof(*cluster));
+    cluster->config = config;
+    if (config->peer_count == 0) {
+        return 0;
+    }
+    
+    int linger = 0;
+    cluster->pub = zmq_socket(context, ZMQ_PUB);
+    cluster->sub = zmq_socket(context, ZMQ_SUB);
+    if (!cluster->pub || !cluster->sub) {
+        cluster_stop(cluster);
+        return -1;
+    }
+    zmq_setsockopt(cluster->pub, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(cluster->sub, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(cluster->sub, ZMQ_SUBSCRIBE, "", 0);
+    if (zmq_bind(cluster->pub, config->cluster_endpoint) != 0) {
+        cluster_stop(cluster);
+        return -1;
+    }
+    
+    // Peers ainda fora do ar são conectados quando subirem (reconexão do ZeroMQ)
+    for (int i = 0; i < config->peer_count; i++) {
+        if (zmq_connect(cluster->sub, config->peers[i]) != 0) {
+            fprintf(stderr, "[BROKER] WARNING: Peer %s inválido: %s\n", config->peers[i], zmq_strerror(errno));
+        }
+    }
+    return 0;
+}
+
+void cluster_stop(Cluster *cluster) {
+    if (cluster->pub) zmq_close(cluster->pub);
+    if (cluster->sub) zmq_close(cluster->sub);
+    cluster->pub = NULL;
+    cluster->sub = NULL;
+}
+
+static int loss_find(const Cluster *cluster, const void *id, size_t size) {
+    for (int i = 0; i < cluster->loss_count; i++) {
+        if (cluster->losses[i].id_size == size && memcmp(cluster->losses[i].id, id, size) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void loss_remove(Cluster *cluster, int index) {
+    cluster->loss_count--;
+    if (index != cluster->loss_count) {
+        cluster->losses[index] = cluster->losses[cluster->loss_count];
+    }
+}
+
+void cluster_server_lost(Cluster *cluster, const void *id, size_t size) {
+    if (!cluster->pub || size > SERVER_ID_SIZE) {
+        return;
+    }
+    int index = loss_find(cluster, id, size);
+    if (index < 0) {
+        if (cluster->loss_count == MAX_SERVERS) {
+            return;
+        }
+        index = cluster->loss_count++;
+        memcpy(cluster->losses[index].id, id, size);
+        cluster->losses[index].id_size = size;
+    }
+    cluster->losses[index].rounds = CLUSTER_LOSS_ROUNDS;
+}
+
+void cluster_server_registered(Cluster *cluster, const void *id, size_t size) {
+    int index = loss_find(cluster, id, size);
+    if (index >= 0) {
+        loss_remove(cluster, index);
+    }
+}
+
+void cluster_gossip(Cluster *cluster, int servers) {
+    if (!cluster->pub) {
+        return;
+    }
+    
+    // Lista de removidos: array de strings, levado como objeto já serializado
+    // (CLUSTER_LOST_SIZE comporta MAX_SERVERS identidades)
+    uint8_t lost[CLUSTER_LOST_SIZE];
+    MpWriter writer;
+    mp_writer_init(&writer, lost, sizeof(lost));
+    mp_write_array(&writer, (uint32_t)cluster->loss_count);
+    for (int i = 0; i < cluster->loss_count; i++) {
+        mp_write_str(&writer, (const char *)cluster->losses[i].id, cluster->losses[i].id_size);
+    }
+    
+    // Cada perda é anunciada por CLUSTER_LOSS_ROUNDS rodadas
+    for (int i = cluster->loss_count - 1; i >= 0; i--) {
+        if (--cluster->losses[i].rounds <= 0) {
+            loss_remove(cluster, i);
+        }
+    }
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    Envelope envelope;
+    envelope_init(&envelope, "gossip", 6);
+    envelope.has_timestamp = 1;
+    envelope.timestamp = (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+    envelope_add_str(&envelope, "broker", cluster->config->name);
+    envelope_add_uint(&envelope, "servers", (uint64_t)servers);
+    EnvelopeField *field = envelope_add(&envelope, "lost", 4, ENVELOPE_RAW);
+    if (field) {
+        field->value.bytes.data = lost;
+        field->value.bytes.length = (uint32_t)writer.pos;
+    }
+    
+    uint8_t buffer[CLUSTER_LOST_SIZE + 256];
+    size_t size = envelope_encode(&envelope, buffer, sizeof(buffer));
+    if (size > 0 && zmq_send(cluster->pub, buffer, size, ZMQ_DONTWAIT) >= 0) {
+        cluster->sent++;
+    }
+}
+
+/**
+ * Peer pelo nome, ocupando um slot livre se ainda não conhecido
+ * @return Peer ou NULL se a tabela está cheia
+ */
+static ClusterPeer *peer_find(Cluster *cluster, const char *name, size_t length) {
+    if (length == 0 || length >= BROKER_NAME_SIZE) {
+        return NULL;
+    }
+    ClusterPeer *free_slot = NULL;
+    for (int i = 0; i < MAX_PEERS; i++) {
+        ClusterPeer *peer = &cluster->peers[i];
+        if (strlen(peer->name) == length && memcmp(peer->name, name, length) == 0) {
+            return peer;
+        }
+        if (!free_slot && peer->name[0] == '\0') {
+            free_slot = peer;
+        }
+    }
+    if (free_slot) {
+        memcpy(free_slot->name, name, length);
+        free_slot->name[length] = '\0';
+    }
+    return free_slot;
+}
+
+/**
+ * Trata um gossip recebido
+ * @return 0 em sucesso, -1 se a mensagem não tem o formato esperado
+ */
+static int handle_gossip(Cluster *cluster, const void *data, size_t size, ClusterSuspectFn suspect, void *arg) {
+    Envelope envelope;
+    if (envelope_decode(&envelope, data, size) != ENVELOPE_OK ||
+        envelope.service_length != 6 || memcmp(envelope.service, "gossip", 6) != 0) {
+        return -1;
+    }
+    const EnvelopeField *broker = envelope_get(&envelope, "broker", 6);
+    const EnvelopeField *servers = envelope_get(&envelope, "servers", 7);
+    const EnvelopeField *lost = envelope_get(&envelope, "lost", 4);
+    if (!broker || broker->type != ENVELOPE_STR || !lost || lost->type != ENVELOPE_RAW) {
+        return -1;
+    }
+    const char *name = broker->value.bytes.data;
+    size_t name_length = broker->value.bytes.length;
+    if (strlen(cluster->config->name) == name_length && memcmp(cluster->config->name, name, name_length) == 0) {
+        return 0;  // O próprio broker listado em BROKER_PEERS
+    }
+    
+    ClusterPeer *peer = peer_find(cluster, name, name_length);
+    if (peer) {
+        peer->seen_ns = monotonic_ns();
+        peer->servers = servers && servers->type == ENVELOPE_UINT ? (unsigned long)servers->value.uint : 0;
+        peer->gossips++;
+    }
+    
+    MpReader reader;
+    uint32_t count;
+    mp_reader_init(&reader, lost->value.bytes.data, lost->value.bytes.length);
+    if (mp_read_array(&reader, &count) != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        const char *id;
+        uint32_t length;
+        if (mp_read_str(&reader, &id, &length) != 0) {
+            return -1;
+        }
+        if (suspect(arg, id, length, name, name_length)) {
+            cluster->suspected++;
+        }
+    }
+    return 0;
+}
+
+void cluster_receive(Cluster *cluster, ClusterSuspectFn suspect, void *arg) {
+    if (!cluster->sub) {
+        return;
+    }
+    zmq_msg_t msg;
+    zmq_msg_init(&msg);
+    while (zmq_msg_recv(&msg, cluster->sub, ZMQ_DONTWAIT) >= 0) {
+        cluster->received++;
+        if (zmq_msg_more(&msg) ||
+            handle_gossip(cluster, zmq_msg_data(&msg), zmq_msg_size(&msg), suspect, arg) != 0) {
+            cluster->invalid++;
+        }
+    }
+    zmq_msg_close(&msg);
+}
+
+int cluster_peer_up(const Cluster *cluster, const ClusterPeer *peer) {
+    uint64_t limit = (uint64_t)CLUSTER_PEER_ROUNDS * (uint64_t)cluster->config->heartbeat_ivl * 1000000u;
+    return peer->seen_ns != 0 && monotonic_ns() - peer->seen_ns <= limit;
+}
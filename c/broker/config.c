@@ -0,0 +1,429 @@
+/**
+ * Broker - Leitura da configuração a partir de variáveis de ambiente
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "broker.h"
+
+const char *validation_mode_name(ValidationMode mode) {
+    switch (mode) {
+        case VALIDATION_OFF: return "off";
+        case VALIDATION_SAMPLED: return "sampled";
+        case VALIDATION_FULL: return "full";
+        case VALIDATION_STRICT: return "strict";
+    }
+    return "?";
+}
+
+const char *direction_name(Direction direction) {
+    return direction == FRONTEND_TO_BACKEND ? "frontend->backend" : "backend->frontend";
+}
+
+const char *slow_policy_name(SlowPolicy policy) {
+    return policy == SLOW_DISCONNECT ? "disconnect" : "drop-newest";
+}
+
+/**
+ * Lê uma variável de ambiente inteira entre minimum e 1000000
+ * Retorna o valor padrão se ausente ou inválida
+ */
+static int env_int_min(const char *name, int default_value, int minimum) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0') {
+        return default_value;
+    }
+    
+    char *end = NULL;
+    long parsed = strtol(value, &end, 10);
+    if (*end != '\0' || parsed < minimum || parsed > 1000000) {
+        fprintf(stderr, "[BROKER] WARNING: %s=%s inválido, usando %d\n", name, value, default_value);
+        return default_value;
+    }
+    return (int)parsed;
+}
+
+/**
+ * Lê uma variável de ambiente inteira positiva
+ * Retorna o valor padrão se ausente ou inválida
+ */
+static int env_int(const char *name, int default_value) {
+    return env_int_min(name, default_value, 1);
+}
+
+/**
+ * Lê o modo de validação do ambiente (padrão: full)
+ */
+static ValidationMode env_validation_mode(const char *name) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0') {
+        return VALIDATION_FULL;
+    }
+    
+    for (int mode = VALIDATION_OFF; mode <= VALIDATION_STRICT; mode++) {
+        if (strcasecmp(value, validation_mode_name((ValidationMode)mode)) == 0) {
+            return (ValidationMode)mode;
+        }
+    }
+    
+    fprintf(stderr, "[BROKER] WARNING: %s=%s inválido, usando full\n", name, value);
+    return VALIDATION_FULL;
+}
+
+/**
+ * Lê o papel do processo do ambiente (padrão: broker)
+ */
+static BrokerMode env_mode(const char *name) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0' || strcasecmp(value, "broker") == 0) {
+        return MODE_BROKER;
+    }
+    if (strcasecmp(value, "proxy") == 0) {
+        return MODE_PROXY;
+    }
+    
+    fprintf(stderr, "[BROKER] WARNING: %s=%s inválido, usando broker\n", name, value);
+    return MODE_BROKER;
+}
+
+/**
+ * Lê o nível de log do ambiente (padrão: info)
+ */
+static LogLevel env_log_level(const char *name) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0') {
+        return LOG_INFO;
+    }
+    
+    for (int level = LOG_DEBUG; level <= LOG_ERROR; level++) {
+        if (strcasecmp(value, log_level_name((LogLevel)level)) == 0) {
+            return (LogLevel)level;
+        }
+    }
+    
+    fprintf(stderr, "[BROKER] WARNING: %s=%s inválido, usando info\n", name, value);
+    return LOG_INFO;
+}
+
+/**
+ * Lê a política de peers lentos do ambiente (padrão: drop-newest)
+ * drop-oldest não existe no ZeroMQ para sockets multipart (ZMQ_CONFLATE só
+ * vale para mensagens de um frame) e cai em drop-newest
+ */
+static SlowPolicy env_slow_policy(const char *name) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0' || strcasecmp(value, "drop-newest") == 0) {
+        return SLOW_DROP_NEWEST;
+    }
+    if (strcasecmp(value, "disconnect") == 0) {
+        return SLOW_DISCONNECT;
+    }
+    
+    fprintf(stderr, "[BROKER] WARNING: %s=%s inválido ou não suportado, usando drop-newest\n", name, value);
+    return SLOW_DROP_NEWEST;
+}
+
+/**
+ * Lê o modo do relógio lógico do ambiente (padrão: off)
+ */
+static ClockMode env_clock_mode(const char *name) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0' || strcasecmp(value, "off") == 0) {
+        return CLOCK_OFF;
+    }
+    if (strcasecmp(value, "stamp") == 0) {
+        return CLOCK_STAMP;
+    }
+    if (strcasecmp(value, "hlc") == 0) {
+        return CLOCK_HLC;
+    }
+    
+    fprintf(stderr, "[BROKER] WARNING: %s=%s inválido, usando off\n", name, value);
+    return CLOCK_OFF;
+}
+
+/**
+ * Lê os serviços de leitura cacheados: "off" (padrão), "on" (todos) ou uma
+ * lista separada por vírgula (ex: "users,get_history")
+ * Retorna a máscara de bits dos grupos (cache_group_index)
+ */
+static unsigned int env_cache_groups(const char *name) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0' || strcasecmp(value, "off") == 0) {
+        return 0;
+    }
+    if (strcasecmp(value, "on") == 0) {
+        return (1u << CACHE_GROUPS) - 1;
+    }
+    
+    unsigned int groups = 0;
+    const char *start = value;
+    while (*start) {
+        const char *end = strchr(start, ',');
+        if (!end) {
+            end = start + strlen(start);
+        }
+        int group = cache_group_index(start, (size_t)(end - start));
+        if (group < 0) {
+            fprintf(stderr, "[BROKER] WARNING: %s: serviço '%.*s' não é cacheável, ignorado\n",
+                    name, (int)(end - start), start);
+        } else {
+            groups |= 1u << group;
+        }
+        start = *end ? end + 1 : end;
+    }
+    return groups;
+}
+
+/**
+ * Lê um endpoint ZeroMQ do ambiente; "off" desliga (string vazia)
+ */
+static void env_endpoint(const char *name, char *dest, const char *default_value) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0') {
+        value = default_value;
+    } else if (strcasecmp(value, "off") == 0) {
+        value = "";
+    } else if (strlen(value) >= ENDPOINT_SIZE) {
+        fprintf(stderr, "[BROKER] WARNING: %s=%s longo demais, usando %s\n", name, value, default_value);
+        value = default_value;
+    }
+    snprintf(dest, ENDPOINT_SIZE, "%s", value);
+}
+
+/**
+ * Lê uma lista de CPUs separadas por vírgula (ex: "0,2,4")
+ * Retorna a quantidade lida; 0 se ausente ou inválida
+ */
+static int env_cpu_list(const char *name, int *cpus, int max_cpus) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0') {
+        return 0;
+    }
+    
+    int count = 0;
+    const char *p = value;
+    while (*p && count < max_cpus) {
+        char *end = NULL;
+        long cpu = strtol(p, &end, 10);
+        if (end == p || cpu < 0 || cpu >= MAX_CPUS || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "[BROKER] WARNING: %s=%s inválido, threads não serão fixadas\n", name, value);
+            return 0;
+        }
+        cpus[count++] = (int)cpu;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return count;
+}
+
+/**
+ * Copia um nome de [start, end) removendo espaços nas pontas
+ * Retorna 0 em sucesso, -1 se vazio ou longo demais
+ */
+static int copy_name(char *dest, const char *start, const char *end) {
+    while (start < end && *start == ' ') start++;
+    while (end > start && end[-1] == ' ') end--;
+    
+    size_t length = (size_t)(end - start);
+    if (length == 0 || length >= ROUTE_NAME_SIZE) {
+        return -1;
+    }
+    memcpy(dest, start, length);
+    dest[length] = '\0';
+    return 0;
+}
+
+/**
+ * Lê as rotas por serviço no formato
+ *   servico[,servico...]=servidor[,servidor...];...
+ * ex: "get_history,get_private_history=server_3;*=server_1,server_2"
+ * A rota "*" vale para os serviços sem rota própria
+ */
+static void env_routes(const char *name, RouteTable *table) {
+    table->count = 0;
+    table->default_route = ROUTE_NONE;
+    
+    const char *value = getenv(name);
+    if (!value || *value == '\0') {
+        return;
+    }
+    
+    const char *entry = value;
+    while (*entry) {
+        const char *entry_end = strchr(entry, ';');
+        if (!entry_end) entry_end = entry + strlen(entry);
+        const char *equals = memchr(entry, '=', (size_t)(entry_end - entry));
+        
+        if (!equals) {
+            fprintf(stderr, "[BROKER] WARNING: %s: rota sem '=' ignorada\n", name);
+        } else {
+            // Lista de servidores compartilhada pelos serviços da entrada
+            Route servers;
+            servers.server_count = 0;
+            for (const char *p = equals + 1; p < entry_end && servers.server_count < MAX_ROUTE_SERVERS; ) {
+                const char *comma = memchr(p, ',', (size_t)(entry_end - p));
+                const char *item_end = comma ? comma : entry_end;
+                if (copy_name(servers.servers[servers.server_count], p, item_end) == 0) {
+                    servers.server_count++;
+                }
+                p = comma ? comma + 1 : entry_end;
+            }
+            
+            for (const char *p = entry; p < equals && servers.server_count > 0; ) {
+                const char *comma = memchr(p, ',', (size_t)(equals - p));
+                const char *item_end = comma ? comma : equals;
+                if (table->count == MAX_ROUTES) {
+                    fprintf(stderr, "[BROKER] WARNING: %s: limite de %d rotas\n", name, MAX_ROUTES);
+                    return;
+                }
+                
+                Route *route = &table->routes[table->count];
+                *route = servers;
+                if (copy_name(route->service, p, item_end) == 0) {
+                    if (strcmp(route->service, "*") == 0) {
+                        table->default_route = table->count;
+                    }
+                    table->count++;
+                }
+                p = comma ? comma + 1 : equals;
+            }
+        }
+        
+        entry = *entry_end ? entry_end + 1 : entry_end;
+    }
+}
+
+/**
+ * Lê a lista de endpoints de gossip dos outros brokers, separados por
+ * vírgula (ex: "tcp://broker_2:5562,tcp://broker_3:5562")
+ * Retorna a quantidade lida; 0 se ausente
+ */
+static int env_peers(const char *name, char peers[][ENDPOINT_SIZE], int max_peers) {
+    const char *value = getenv(name);
+    if (!value || *value == '\0') {
+        return 0;
+    }
+    
+    int count = 0;
+    for (const char *p = value; *p; ) {
+        const char *comma = strchr(p, ',');
+        const char *end = comma ? comma : p + strlen(p);
+        while (p < end && *p == ' ') p++;
+        size_t length = (size_t)(end - p);
+        while (length > 0 && p[length - 1] == ' ') length--;
+        
+        if (length >= ENDPOINT_SIZE) {
+            fprintf(stderr, "[BROKER] WARNING: %s: endpoint %.*s longo demais, ignorado\n", name, (int)length, p);
+        } else if (length > 0) {
+            if (count == max_peers) {
+                fprintf(stderr, "[BROKER] WARNING: %s: limite de %d peers\n", name, max_peers);
+                break;
+            }
+            memcpy(peers[count], p, length);
+            peers[count][length] = '\0';
+            count++;
+        }
+        p = comma ? comma + 1 : end;
+    }
+    return count;
+}
+
+/**
+ * Nome do broker no gossip (BROKER_NAME, ou o hostname)
+ */
+static void env_name(const char *name, char *dest) {
+    const char *value = getenv(name);
+    if (value && *value != '\0' && strlen(value) < BROKER_NAME_SIZE) {
+        snprintf(dest, BROKER_NAME_SIZE, "%s", value);
+        return;
+    }
+    if (gethostname(dest, BROKER_NAME_SIZE) != 0) {
+        snprintf(dest, BROKER_NAME_SIZE, "broker");
+    }
+    dest[BROKER_NAME_SIZE - 1] = '\0';
+}
+
+int route_lookup(const RouteTable *routes, const char *service, size_t length) {
+    for (int i = 0; i < routes->count; i++) {
+        const char *name = routes->routes[i].service;
+        if (strlen(name) == length && memcmp(name, service, length) == 0) {
+            return i;
+        }
+    }
+    return routes->default_route;
+}
+
+unsigned int route_mask_for_server(const RouteTable *routes, const void *id, size_t size) {
+    unsigned int mask = 0;
+    for (int i = 0; i < routes->count; i++) {
+        const Route *route = &routes->routes[i];
+        for (int j = 0; j < route->server_count; j++) {
+            if (strlen(route->servers[j]) == size && memcmp(route->servers[j], id, size) == 0) {
+                mask |= 1u << i;
+            }
+        }
+    }
+    return mask;
+}
+
+void load_config(BrokerConfig *config) {
+    config->mode = env_mode("BROKER_MODE");
+    config->batch_size = env_int("BROKER_BATCH_SIZE", DEFAULT_BATCH_SIZE);
+    config->validation = env_validation_mode("BROKER_VALIDATION");
+    config->sample_rate = env_int("BROKER_VALIDATION_SAMPLE", DEFAULT_SAMPLE_RATE);
+    config->threads = env_int("BROKER_THREADS", 1);
+    config->io_threads = env_int("BROKER_IO_THREADS", 1);
+    config->cpu_count = env_cpu_list("BROKER_CPUS", config->cpus, MAX_CPUS);
+    env_routes("BROKER_ROUTES", &config->routes);
+    env_endpoint("BROKER_STATS_ENDPOINT", config->stats_endpoint, DEFAULT_STATS_ENDPOINT);
+    config->log_level = env_log_level("BROKER_LOG_LEVEL");
+    config->log_rate = env_int("BROKER_LOG_RATE", DEFAULT_LOG_RATE);
+    config->sndhwm = env_int("BROKER_SNDHWM", DEFAULT_HWM);
+    config->rcvhwm = env_int("BROKER_RCVHWM", DEFAULT_HWM);
+    config->slow_policy = env_slow_policy("BROKER_SLOW_POLICY");
+    config->slow_timeout = env_int("BROKER_SLOW_TIMEOUT", DEFAULT_SLOW_TIMEOUT);
+    config->clock = env_clock_mode("BROKER_CLOCK");
+    config->cache_groups = env_cache_groups("BROKER_CACHE");
+    config->cache_ttl = env_int("BROKER_CACHE_TTL", DEFAULT_CACHE_TTL);
+    config->cache_entries = env_int("BROKER_CACHE_ENTRIES", DEFAULT_CACHE_ENTRIES);
+    config->cache_memory = env_int("BROKER_CACHE_MEMORY", DEFAULT_CACHE_MEMORY);
+    config->pool_memory = env_int("BROKER_POOL_MEMORY", DEFAULT_POOL_MEMORY);
+    config->rate_limit = env_int_min("BROKER_RATE_LIMIT", 0, 0);
+    config->rate_burst = env_int("BROKER_RATE_BURST", config->rate_limit);
+    config->max_inflight = env_int_min("BROKER_MAX_INFLIGHT", 0, 0);
+    config->retry_after = env_int("BROKER_RETRY_AFTER", DEFAULT_RETRY_AFTER);
+    config->heartbeat_ivl = env_int("BROKER_HEARTBEAT_IVL", DEFAULT_HEARTBEAT_IVL);
+    config->heartbeat_timeout = env_int("BROKER_HEARTBEAT_TIMEOUT", DEFAULT_HEARTBEAT_TIMEOUT);
+    config->retries = env_int_min("BROKER_RETRIES", DEFAULT_RETRIES, 0);
+    env_name("BROKER_NAME", config->name);
+    env_endpoint("BROKER_CLUSTER_ENDPOINT", config->cluster_endpoint, DEFAULT_CLUSTER_ENDPOINT);
+    config->peer_count = env_peers("BROKER_PEERS", config->peers, MAX_PEERS);
+    if (config->cluster_endpoint[0] == '\0') {
+        config->peer_count = 0;  // BROKER_CLUSTER_ENDPOINT=off desliga o gossip
+    }
+    
+    if (config->threads > MAX_WORKERS) {
+        fprintf(stderr, "[BROKER] WARNING: BROKER_THREADS limitado a %d\n", MAX_WORKERS);
+        config->threads = MAX_WORKERS;
+    }
+}
+
+/**
+ * As filas são por conexão: um peer lento enche só a sua, e o ROUTER/XPUB
+ * descarta as mensagens dele sem atrasar os demais. Na política disconnect,
+ * ZMQ_TCP_MAXRT (TCP_USER_TIMEOUT) faz o kernel derrubar a conexão cujo peer
+ * não lê (janela TCP fechada) por mais de slow_timeout ms.
+ */
+void configure_socket(void *socket, const BrokerConfig *config) {
+    zmq_setsockopt(socket, ZMQ_SNDHWM, &config->sndhwm, sizeof(config->sndhwm));
+    zmq_setsockopt(socket, ZMQ_RCVHWM, &config->rcvhwm, sizeof(config->rcvhwm));
+    
+#ifdef ZMQ_TCP_MAXRT
+    if (config->slow_policy == SLOW_DISCONNECT) {
+        zmq_setsockopt(socket, ZMQ_TCP_MAXRT, &config->slow_timeout, sizeof(config->slow_timeout));
+    }
+#endif
+}
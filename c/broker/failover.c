@@ -0,0 +1,204 @@
+/**
+ * Broker - Detecção de servidores mortos e reenvio de requisições
+ *
+ * O broker envia um ping ({service: 'ping'}) a cada servidor a cada
+ * BROKER_HEARTBEAT_IVL ms. Com ZMQ_ROUTER_MANDATORY, o envio para um
+ * servidor cuja conexão caiu falha na hora (EHOSTUNREACH), e um servidor
+ * que não manda nenhuma mensagem em BROKER_HEARTBEAT_TIMEOUT ms depois do
+ * ping é dado como travado (os servidores respondem o ping fora da fila de
+ * requisições, então o prazo só precisa cobrir pausas do processo, não a
+ * requisição mais lenta). Em ambos os casos ele sai do escalonamento (volta
+ * ao mandar qualquer mensagem, com outro serial). Os heartbeats ZMTP do
+ * socket derrubam conexões meio abertas, e o monitor do socket antecipa o
+ * ping quando uma conexão fecha, então um processo que morre é removido em
+ * milissegundos.
+ *
+ * Cada requisição entregue a um servidor fica registrada aqui pela
+ * identidade do cliente. Quando o servidor é perdido, as leituras
+ * (idempotentes) vão para outro servidor até BROKER_RETRIES vezes, a partir
+ * de uma cópia do frame feita com zmq_msg_copy (o buffer é compartilhado,
+ * não copiado). As escritas recebem uma resposta de erro em vez de deixar o
+ * cliente REQ bloqueado. Uma resposta que o servidor antigo ainda envie
+ * depois disso é descartada, para não ser tomada pela resposta da próxima
+ * requisição do cliente.
+ *
+ * Usado apenas pelo loop principal (sem locks).
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include "broker.h"
+#include "../common_utils/envelope.h"
+
+// Leituras: repetir não altera o estado dos servidores
+static const char *const IDEMPOTENT[] = { "users", "channels", "get_history", "get_private_history" };
+
+void failover_init(Failover *failover, const BrokerConfig *config) {
+    memset(failover, 0, sizeof(*failover));
+    failover->config = config;
+    for (size_t i = 0; i < sizeof(IDEMPOTENT) / sizeof(IDEMPOTENT[0]); i++) {
+        failover->idempotent[stats_service_index(IDEMPOTENT[i], strlen(IDEMPOTENT[i]))] = 1;
+    }
+}
+
+static void entry_clear(FailoverEntry *entry) {
+    if (entry->has_request) {
+        zmq_msg_close(&entry->request);
+    }
+    entry->has_request = 0;
+    entry->id_size = 0;
+}
+
+void failover_destroy(Failover *failover) {
+    for (int i = 0; i < FAILOVER_SLOTS; i++) {
+        entry_clear(&failover->entries[i]);
+    }
+}
+
+/**
+ * Entrada do cliente do primeiro frame
+ * @param create Ocupa um slot livre ou de requisição já respondida pelo broker
+ */
+static FailoverEntry *entry_find(Failover *failover, Multipart *mp, int create) {
+    zmq_msg_t *id = &mp->frames[0];
+    size_t size = mp->count > 0 ? zmq_msg_size(id) : 0;
+    if (size == 0 || size > PENDING_ID_SIZE) {
+        return NULL;
+    }
+    
+    FailoverEntry *set = &failover->entries[multipart_hash(mp) % (FAILOVER_SLOTS / FAILOVER_WAYS) *
+                                            FAILOVER_WAYS];
+    FailoverEntry *victim = NULL;
+    for (int i = 0; i < FAILOVER_WAYS; i++) {
+        FailoverEntry *entry = &set[i];
+        if (entry->id_size == size && memcmp(entry->id, zmq_msg_data(id), size) == 0) {
+            return entry;
+        }
+        if (!victim && (entry->id_size == 0 || entry->server == 0)) {
+            victim = entry;
+        }
+    }
+    if (!create || !victim) {
+        return NULL;
+    }
+    
+    entry_clear(victim);
+    memcpy(victim->id, zmq_msg_data(id), size);
+    victim->id_size = size;
+    victim->attempts = 0;
+    return victim;
+}
+
+void failover_sent(Failover *failover, Multipart *mp, uint32_t server, const RequestInfo *info) {
+    FailoverEntry *entry = mp->count == 3 ? entry_find(failover, mp, 1) : NULL;
+    if (!entry) {
+        failover->untracked++;
+        return;
+    }
+    
+    if (entry->has_request) {
+        zmq_msg_close(&entry->request);
+        entry->has_request = 0;
+    }
+    entry->server = server;
+    entry->info = *info;
+    entry->attempts = failover->attempt;
+    if (failover->idempotent[info->service]) {
+        zmq_msg_init(&entry->request);
+        entry->has_request = zmq_msg_copy(&entry->request, &mp->frames[2]) == 0;
+        if (!entry->has_request) {
+            zmq_msg_close(&entry->request);
+        }
+    }
+}
+
+void failover_forget(Failover *failover, Multipart *mp) {
+    FailoverEntry *entry = entry_find(failover, mp, 0);
+    if (entry) {
+        entry_clear(entry);
+    }
+}
+
+int failover_reply(Failover *failover, Multipart *mp, uint32_t server) {
+    FailoverEntry *entry = entry_find(failover, mp, 0);
+    if (!entry) {
+        return 1;
+    }
+    if (entry->server != server) {
+        failover->stale++;
+        return 0;
+    }
+    entry_clear(entry);
+    return 1;
+}
+
+void failover_server_lost(Failover *failover, uint32_t server) {
+    failover->servers_lost++;
+    if (failover->lost_count < MAX_SERVERS) {
+        failover->lost[failover->lost_count++] = server;
+    }
+}
+
+/**
+ * Monta [cliente][""][cópia do frame de dados] da entrada
+ * @return 0 em sucesso, -1 sem memória
+ */
+static int rebuild_request(FailoverEntry *entry, Multipart *mp) {
+    mp->count = 0;
+    if (zmq_msg_init_size(&mp->frames[0], entry->id_size) != 0) {
+        return -1;
+    }
+    memcpy(zmq_msg_data(&mp->frames[0]), entry->id, entry->id_size);
+    zmq_msg_init(&mp->frames[1]);
+    zmq_msg_init(&mp->frames[2]);
+    mp->count = 3;
+    if (entry->has_request && zmq_msg_copy(&mp->frames[2], &entry->request) != 0) {
+        multipart_close(mp);
+        return -1;
+    }
+    return 0;
+}
+
+void failover_process(Failover *failover, FailoverResendFn resend, void *arg) {
+    while (failover->lost_count > 0) {
+        uint32_t server = failover->lost[--failover->lost_count];
+        for (int i = 0; i < FAILOVER_SLOTS; i++) {
+            FailoverEntry *entry = &failover->entries[i];
+            if (entry->id_size == 0 || entry->server != server) {
+                continue;
+            }
+            
+            Multipart mp;
+            if (rebuild_request(entry, &mp) < 0) {
+                entry_clear(entry);
+                continue;
+            }
+            RequestInfo info = entry->info;
+            int retry = entry->has_request && entry->attempts < failover->config->retries;
+            if (retry) {
+                failover->retried++;
+                failover->attempt = entry->attempts + 1;  // Lida por failover_sent no reenvio
+            } else {
+                failover->failed++;
+                entry->server = 0;  // Uma resposta atrasada do servidor perdido é descartada
+                if (entry->has_request) {
+                    zmq_msg_close(&entry->request);
+                    entry->has_request = 0;
+                }
+            }
+            resend(arg, &mp, &info, retry);
+            failover->attempt = 0;
+        }
+    }
+}
+
+size_t failover_ping(uint8_t *buffer, size_t capacity) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    
+    Envelope envelope;
+    envelope_init(&envelope, "ping", 4);
+    envelope.has_timestamp = 1;
+    envelope.timestamp = (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+    return envelope_encode(&envelope, buffer, capacity);
+}
@@ -0,0 +1,269 @@
+/**
+ * Broker - Inspeção das mensagens encaminhadas (validação MessagePack e
+ * leitura do serviço para roteamento)
+ * Executada no loop principal ou nas threads de inspeção (BROKER_THREADS)
+ *
+ * Com BROKER_CLOCK=stamp, o data.clock de cada mensagem passa pelo relógio
+ * de Lamport do broker (compartilhado por todas as threads) e o novo valor
+ * é escrito no lugar do antigo, sem remontar o frame: só cabe se a
+ * codificação original tem largura suficiente (messaging.py sempre usa
+ * uint64), senão a mensagem segue como veio. Com BROKER_CLOCK=hlc o relógio
+ * é o híbrido (hybrid_clock.h): o valor continua crescente e maior que o
+ * recebido, então os relógios de Lamport dos servidores Python o aceitam
+ * como está. Os valores (~2^57) passam de 2^53: o cliente Node os lê como
+ * Number arredondado (até 16 unidades de erro) e não consegue mais somar 1,
+ * e o msgpack-lite os devolve como float64. O broker reescreve esse float64
+ * como uint64 ao carimbar, então os servidores continuam recebendo inteiros
+ * crescentes; só os valores vistos no cliente Node são aproximados.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "broker.h"
+#include "../common_utils/envelope.h"
+#include "../common_utils/msgpack_lite.h"
+
+// Relógios do broker; zero-inicializados, compartilhados pelos inspetores
+static LogicalClock s_clock;
+static HybridClock s_hybrid;
+
+void inspector_init(Inspector *inspector, const BrokerConfig *config) {
+    memset(inspector, 0, sizeof(*inspector));
+    inspector->config = config;
+    pool_init(&inspector->pool, (size_t)config->pool_memory * 1024);
+}
+
+void inspector_destroy(Inspector *inspector) {
+    pool_destroy(&inspector->pool);
+}
+
+void inspector_accumulate(const Inspector *inspector, InspectorTotals *totals) {
+    totals->invalid += atomic_load_explicit(&inspector->invalid_count, memory_order_relaxed);
+    totals->rejected += atomic_load_explicit(&inspector->rejected_count, memory_order_relaxed);
+    totals->stamped += atomic_load_explicit(&inspector->stamped_count, memory_order_relaxed);
+    totals->unstamped += atomic_load_explicit(&inspector->unstamped_count, memory_order_relaxed);
+    totals->clock = inspector->config->clock == CLOCK_HLC ?
+        atomic_load_explicit(&s_hybrid.last, memory_order_relaxed) : logical_clock_now(&s_clock);
+    pool_accumulate(&inspector->pool, &totals->pool);
+}
+
+/**
+ * Valida se uma mensagem está em formato MessagePack válido
+ * Retorna 1 se válida, 0 se inválida
+ * Nota: Esta validação é um sanity check, não modifica a mensagem.
+ * Percorre o buffer sem montar objetos nem alocar (msgpack_lite), com
+ * profundidade limitada e comprimentos conferidos contra o tamanho do frame
+ */
+static int validate_msgpack(const char *data, size_t size) {
+    return mp_validate(data, size, MSGPACK_MAX_DEPTH);
+}
+
+/**
+ * Decide se a mensagem atual deve ser validada de acordo com o modo
+ */
+static int should_validate(const Inspector *inspector, unsigned long msg_count) {
+    switch (inspector->config->validation) {
+        case VALIDATION_OFF: return 0;
+        case VALIDATION_SAMPLED: return msg_count % (unsigned long)inspector->config->sample_rate == 0;
+        case VALIDATION_FULL:
+        case VALIDATION_STRICT: return 1;
+    }
+    return 0;
+}
+
+/**
+ * Processa mensagem com validação MessagePack
+ * Retorna 1 se a mensagem deve ser encaminhada, 0 se deve ser rejeitada
+ * (apenas no modo strict; nos demais encaminha mesmo se inválida, com warning)
+ */
+static int process_message(Inspector *inspector, zmq_msg_t *msg, Direction direction) {
+    unsigned long *msg_count = &inspector->msg_count[direction];
+    size_t size = zmq_msg_size(msg);
+    void *data = zmq_msg_data(msg);
+    int forward = 1;
+    
+    // Valida MessagePack (apenas para frames de dados, ignora identidades)
+    if (size > 0 && should_validate(inspector, *msg_count)) {
+        if (!validate_msgpack((const char*)data, size)) {
+            atomic_fetch_add_explicit(&inspector->invalid_count, 1, memory_order_relaxed);
+            if (inspector->config->validation == VALIDATION_STRICT) {
+                log_message(LOG_WARNING, "Mensagem #%lu (%s) não é MessagePack válido (%zu bytes), rejeitada",
+                            *msg_count, direction_name(direction), size);
+                forward = 0;
+            } else {
+                log_message(LOG_WARNING, "Mensagem #%lu (%s) não é MessagePack válido (%zu bytes)",
+                            *msg_count, direction_name(direction), size);
+                // Continua encaminhando (comportamento tolerante a falhas)
+            }
+        } else {
+            if (*msg_count % 1000 == 0) {  // Log periódico
+                log_message(LOG_DEBUG, "Mensagem #%lu (%s) validada: MessagePack OK (%zu bytes)",
+                            *msg_count, direction_name(direction), size);
+            }
+        }
+    }
+    
+    (*msg_count)++;
+    return forward;
+}
+
+/**
+ * Timestamp Unix em segundos (mesmo formato de time.time() no Python)
+ */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * Monta a resposta de erro no mesmo formato de create_response() dos servidores:
+ * {service: 'error', data: {status: 'erro', timestamp, clock, description}}
+ * mais data.retry_after se retry_after > 0
+ * Retorna o tamanho serializado ou 0 se não coube no buffer
+ */
+static size_t build_error_reply(uint8_t *buffer, size_t capacity, const char *description, int retry_after) {
+    Envelope envelope;
+    envelope_init(&envelope, "error", 5);
+    envelope_add_str(&envelope, "status", "erro");
+    envelope_add_str(&envelope, "description", description);
+    if (retry_after > 0) {
+        envelope_add_uint(&envelope, "retry_after", (uint64_t)retry_after);
+    }
+    envelope.has_timestamp = 1;
+    envelope.timestamp = now_seconds();
+    envelope.has_clock = 1;
+    envelope.clock = logical_clock_tick(&s_clock);
+    
+    return envelope_encode(&envelope, buffer, capacity);
+}
+
+/**
+ * Reaproveita o envelope (identidade + delimitador) já recebido; em ambas as
+ * direções o envelope identifica o cliente REQ que aguarda a resposta
+ */
+int inspector_reply_busy(Inspector *inspector, Multipart *mp, const char *description, int retry_after) {
+    uint8_t reply[ERROR_REPLY_SIZE];
+    size_t size = build_error_reply(reply, sizeof(reply), description, retry_after);
+    if (size == 0 || mp->count < 2) {
+        return -1;  // Sem envelope não há a quem responder
+    }
+    
+    zmq_msg_t *data = &mp->frames[mp->count - 1];
+    zmq_msg_close(data);
+    return pool_msg_init(&inspector->pool, data, reply, size);
+}
+
+int inspector_reply_error(Inspector *inspector, Multipart *mp, const char *description) {
+    return inspector_reply_busy(inspector, mp, description, 0);
+}
+
+int peek_service(const void *data, size_t size, const char **service, uint32_t *length) {
+    MpReader reader;
+    uint32_t count;
+    mp_reader_init(&reader, data, size);
+    
+    // create_message() coloca 'service' como primeira chave: em geral a busca
+    // termina sem pular nada; caso contrário o valor de 'data' é só pulado
+    if (mp_read_map(&reader, &count) < 0 ||
+        mp_find_key(&reader, count, "service", 7, MSGPACK_MAX_DEPTH) < 0 ||
+        mp_read_str(&reader, service, length) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Serviço da requisição (estatísticas) e rota de acordo com BROKER_ROUTES
+ */
+static void classify_request(const Inspector *inspector, Multipart *mp, RequestInfo *info) {
+    const RouteTable *routes = &inspector->config->routes;
+    zmq_msg_t *data = &mp->frames[mp->count - 1];
+    const char *service;
+    uint32_t length;
+    
+    if (peek_service(zmq_msg_data(data), zmq_msg_size(data), &service, &length) < 0) {
+        info->route = routes->default_route;
+        info->service = STATS_SERVICE_OTHER;
+        return;
+    }
+    info->route = route_lookup(routes, service, length);
+    info->service = stats_service_index(service, length);
+}
+
+/**
+ * Atualiza o relógio do broker com data.clock e reescreve o campo no frame
+ * Mensagens sem data.clock (ou com clock que não é inteiro nem float64 inteiro) não são alteradas
+ */
+static void stamp_clock(Inspector *inspector, zmq_msg_t *msg) {
+    uint8_t *data = zmq_msg_data(msg);
+    size_t size = zmq_msg_size(msg);
+    MpReader reader;
+    uint32_t count;
+    uint64_t received;
+    mp_reader_init(&reader, data, size);
+    
+    if (mp_read_map(&reader, &count) < 0 ||
+        mp_find_key(&reader, count, "data", 4, MSGPACK_MAX_DEPTH) < 0 ||
+        mp_read_map(&reader, &count) < 0 ||
+        mp_find_key(&reader, count, "clock", 5, MSGPACK_MAX_DEPTH) < 0) {
+        return;
+    }
+    
+    size_t slot = reader.pos;
+    if (mp_read_uint(&reader, &received) < 0) {
+        // msgpack-lite serializa inteiros acima de 32 bits como float64, que
+        // tem a mesma largura do uint64: o clock volta a ser inteiro no lugar
+        double real;
+        reader.pos = slot;
+        if (data[slot] != 0xcb || mp_read_double(&reader, &real) < 0 ||
+            real < 0 || real >= 18446744073709551616.0 || real != (double)(uint64_t)real) {
+            return;
+        }
+        received = (uint64_t)real;
+        data[slot] = 0xcf;
+    }
+    
+    uint64_t stamped = inspector->config->clock == CLOCK_HLC ?
+        hybrid_clock_update(&s_hybrid, received) : logical_clock_merge(&s_clock, received);
+    if (mp_patch_uint(data + slot, size - slot, stamped) == MP_OK) {
+        atomic_fetch_add_explicit(&inspector->stamped_count, 1, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&inspector->unstamped_count, 1, memory_order_relaxed);
+    }
+}
+
+void inspector_stamp(Inspector *inspector, zmq_msg_t *msg) {
+    if (inspector->config->clock != CLOCK_OFF) {
+        stamp_clock(inspector, msg);
+    }
+}
+
+/**
+ * No modo off o payload não é validado; de requisições só é lida a chave
+ * 'service' (em geral a primeira), para rotas e estatísticas
+ */
+Direction inspect_message(Inspector *inspector, Multipart *mp, Direction direction, RequestInfo *info) {
+    info->route = ROUTE_NONE;
+    info->service = STATS_SERVICE_OTHER;
+    
+    if (inspector->config->validation == VALIDATION_OFF) {
+        inspector->msg_count[direction]++;  // Fast path: payload nunca é validado
+    } else if (!process_message(inspector, &mp->frames[mp->count - 1], direction)) {
+        atomic_fetch_add_explicit(&inspector->rejected_count, 1, memory_order_relaxed);
+        if (inspector_reply_error(inspector, mp, "Mensagem inválida") < 0) {
+            multipart_close(mp);  // Nada a enviar
+        }
+        if (direction == FRONTEND_TO_BACKEND) {
+            info->route = ROUTE_REJECTED;
+        }
+        return BACKEND_TO_FRONTEND;
+    }
+    
+    if (direction == FRONTEND_TO_BACKEND) {
+        classify_request(inspector, mp, info);
+    }
+    inspector_stamp(inspector, &mp->frames[mp->count - 1]);
+    return direction;
+}
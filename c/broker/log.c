@@ -0,0 +1,197 @@
+/**
+ * Broker - Log assíncrono fora do caminho de encaminhamento
+ *
+ * As threads de encaminhamento nunca chamam stdio: cada mensagem é formatada
+ * direto em um slot de um ring buffer lock-free (fila limitada MPMC com
+ * número de sequência por slot) e uma thread de fundo escreve os slots em
+ * stdout/stderr. Com o ring cheio a mensagem é descartada, nunca bloqueia.
+ *
+ * O limite de mensagens por segundo (BROKER_LOG_RATE) evita que uma rajada de
+ * frames inválidos vire uma enxurrada de escrita; as mensagens suprimidas e
+ * descartadas são contadas e relatadas pela thread de fundo.
+ * O nível (BROKER_LOG_LEVEL) pode ser alterado em execução com SIGUSR1 (mais
+ * detalhado) e SIGUSR2 (menos detalhado).
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "broker.h"
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define LOG_IDLE_NS 10000000L   // Espera da thread de fundo com o ring vazio (10ms)
+
+typedef struct {
+    atomic_size_t sequence;   // == posição: livre; == posição + 1: pronto para escrita
+    LogLevel level;
+    char text[LOG_MESSAGE_SIZE];
+} LogSlot;
+
+static LogSlot s_ring[LOG_RING_SIZE];
+static atomic_size_t s_head;          // Próxima posição dos produtores
+static size_t s_tail;                 // Próxima posição da thread de fundo
+
+static atomic_int s_level = LOG_INFO;
+static int s_rate = DEFAULT_LOG_RATE;
+static atomic_long s_window;          // Segundo da janela atual do limite
+static atomic_int s_window_count;     // Mensagens aceitas na janela
+static atomic_ulong s_suppressed;     // Acima do limite por segundo
+static atomic_ulong s_dropped;        // Ring cheio
+
+static const char *s_prefix = "[BROKER]";
+
+static pthread_t s_thread;
+static atomic_int s_running;
+
+static const char *const LEVEL_NAMES[] = { "debug", "info", "warning", "error" };
+static const char *const LEVEL_LABELS[] = { "DEBUG: ", "", "WARNING: ", "" };
+
+const char *log_level_name(LogLevel level) {
+    return LEVEL_NAMES[level];
+}
+
+void log_set_level(LogLevel level) {
+    atomic_store_explicit(&s_level, (int)level, memory_order_relaxed);
+}
+
+void log_shift_level(int delta) {
+    int level = atomic_load_explicit(&s_level, memory_order_relaxed) + delta;
+    if (level < LOG_DEBUG) level = LOG_DEBUG;
+    if (level > LOG_ERROR) level = LOG_ERROR;
+    atomic_store_explicit(&s_level, level, memory_order_relaxed);
+}
+
+int log_enabled(LogLevel level) {
+    return (int)level >= atomic_load_explicit(&s_level, memory_order_relaxed);
+}
+
+/**
+ * Limite global de mensagens por segundo
+ * A troca de janela é feita por quem chegar primeiro (CAS); uma corrida na
+ * virada do segundo aceita no máximo algumas mensagens a mais
+ */
+static int log_admit(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    
+    long window = atomic_load_explicit(&s_window, memory_order_relaxed);
+    if (window != (long)ts.tv_sec &&
+        atomic_compare_exchange_strong_explicit(&s_window, &window, (long)ts.tv_sec,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        atomic_store_explicit(&s_window_count, 0, memory_order_relaxed);
+    }
+    
+    if (atomic_fetch_add_explicit(&s_window_count, 1, memory_order_relaxed) >= s_rate) {
+        atomic_fetch_add_explicit(&s_suppressed, 1, memory_order_relaxed);
+        return 0;
+    }
+    return 1;
+}
+
+void log_message(LogLevel level, const char *format, ...) {
+    if (!log_enabled(level) || !log_admit()) {
+        return;
+    }
+    
+    // Reserva um slot: a posição só avança se o slot dela está livre
+    size_t pos = atomic_load_explicit(&s_head, memory_order_relaxed);
+    LogSlot *slot;
+    while (1) {
+        slot = &s_ring[pos & LOG_RING_MASK];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        long diff = (long)(sequence - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&s_head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);  // Ring cheio
+            return;
+        } else {
+            pos = atomic_load_explicit(&s_head, memory_order_relaxed);
+        }
+    }
+    
+    slot->level = level;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot->text, sizeof(slot->text), format, args);
+    va_end(args);
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+}
+
+/**
+ * Escreve tudo o que está pronto no ring (apenas a thread de fundo ou, no
+ * encerramento, quem chamou log_stop)
+ * Retorna quantas mensagens foram escritas
+ */
+static int log_drain(void) {
+    int written = 0;
+    
+    while (1) {
+        LogSlot *slot = &s_ring[s_tail & LOG_RING_MASK];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != s_tail + 1) {
+            break;
+        }
+        
+        FILE *out = slot->level >= LOG_WARNING ? stderr : stdout;
+        fprintf(out, "%s %s%s\n", s_prefix, LEVEL_LABELS[slot->level], slot->text);
+        atomic_store_explicit(&slot->sequence, s_tail + LOG_RING_SIZE, memory_order_release);
+        s_tail++;
+        written++;
+    }
+    
+    unsigned long suppressed = atomic_exchange_explicit(&s_suppressed, 0, memory_order_relaxed);
+    unsigned long dropped = atomic_exchange_explicit(&s_dropped, 0, memory_order_relaxed);
+    if (suppressed > 0 || dropped > 0) {
+        fprintf(stderr, "%s WARNING: %lu mensagens de log suprimidas (limite de %d/s), %lu descartadas (buffer cheio)\n",
+                s_prefix, suppressed, s_rate, dropped);
+        written++;
+    }
+    
+    if (written > 0) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return written;
+}
+
+static void *log_main(void *arg) {
+    (void)arg;
+    struct timespec idle = { 0, LOG_IDLE_NS };
+    
+    while (atomic_load_explicit(&s_running, memory_order_acquire)) {
+        if (log_drain() == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+int log_start(const BrokerConfig *config) {
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_init(&s_ring[i].sequence, i);
+    }
+    atomic_store(&s_head, 0);
+    s_tail = 0;
+    s_rate = config->log_rate;
+    s_prefix = config->mode == MODE_PROXY ? "[PROXY]" : "[BROKER]";
+    log_set_level(config->log_level);
+    
+    atomic_store(&s_running, 1);
+    if (pthread_create(&s_thread, NULL, log_main, NULL) != 0) {
+        atomic_store(&s_running, 0);
+        return -1;
+    }
+    return 0;
+}
+
+void log_stop(void) {
+    if (atomic_exchange(&s_running, 0)) {
+        pthread_join(s_thread, NULL);
+    }
+    log_drain();
+}
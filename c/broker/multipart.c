@@ -0,0 +1,138 @@
+/**
+ * Broker - Recepção e envio de mensagens multipart sem cópia de payload
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "broker.h"
+
+void multipart_close(Multipart *mp) {
+    for (int i = 0; i < mp->count; i++) {
+        zmq_msg_close(&mp->frames[i]);
+    }
+    mp->count = 0;
+}
+
+/**
+ * O primeiro frame é lido com as flags do chamador; os demais chegam juntos
+ * (multipart é atômico no ZeroMQ) e nunca bloqueiam.
+ * Mensagens com mais de MAX_FRAMES frames são descartadas por inteiro.
+ */
+int multipart_recv(Multipart *mp, void *socket, int flags) {
+    mp->count = 0;
+    
+    while (1) {
+        if (mp->count == MAX_FRAMES) {
+            // Envelope anormal: drena o restante e descarta
+            zmq_msg_t excess;
+            zmq_msg_init(&excess);
+            int more = 1;
+            while (more && zmq_msg_recv(&excess, socket, 0) >= 0) {
+                more = zmq_msg_more(&excess);
+            }
+            zmq_msg_close(&excess);
+            multipart_close(mp);
+            log_message(LOG_WARNING, "Mensagem com mais de %d frames descartada", MAX_FRAMES);
+            return -1;
+        }
+        
+        zmq_msg_t *frame = &mp->frames[mp->count];
+        zmq_msg_init(frame);
+        if (zmq_msg_recv(frame, socket, flags) < 0) {
+            int err = errno;
+            zmq_msg_close(frame);
+            multipart_close(mp);
+            errno = err;
+            return (err == EAGAIN) ? 0 : -1;
+        }
+        mp->count++;
+        flags = 0;
+        
+        if (!zmq_msg_more(frame)) {
+            return 1;
+        }
+    }
+}
+
+/**
+ * zmq_msg_send transfere a posse de cada buffer para o socket de destino
+ * (sem cópia do payload) e deixa o zmq_msg_t vazio
+ */
+int multipart_send_flags(Multipart *mp, void *socket, int flags) {
+    for (int i = 0; i < mp->count; i++) {
+        int more = i < mp->count - 1;
+        if (zmq_msg_send(&mp->frames[i], socket, (more ? ZMQ_SNDMORE : 0) | flags) < 0) {
+            return -1;
+        }
+        flags = 0;
+    }
+    return 0;
+}
+
+int multipart_send(Multipart *mp, void *socket) {
+    return multipart_send_flags(mp, socket, 0);
+}
+
+/**
+ * Desloca os frames com zmq_msg_move (apenas referências, sem copiar payload)
+ */
+int multipart_push_front(Multipart *mp, BufferPool *pool, const void *data, size_t size) {
+    if (mp->count == MAX_FRAMES) {
+        return -1;
+    }
+    
+    zmq_msg_init(&mp->frames[mp->count]);
+    for (int i = mp->count; i > 0; i--) {
+        zmq_msg_move(&mp->frames[i], &mp->frames[i - 1]);
+    }
+    mp->count++;
+    
+    zmq_msg_close(&mp->frames[0]);
+    if (pool_msg_init(pool, &mp->frames[0], data, size) != 0) {
+        multipart_pop_front(mp);
+        return -1;
+    }
+    return 0;
+}
+
+void multipart_pop_front(Multipart *mp) {
+    if (mp->count == 0) {
+        return;
+    }
+    
+    for (int i = 0; i < mp->count - 1; i++) {
+        zmq_msg_move(&mp->frames[i], &mp->frames[i + 1]);
+    }
+    zmq_msg_close(&mp->frames[mp->count - 1]);
+    mp->count--;
+}
+
+/**
+ * FNV-1a sobre o frame de identidade
+ */
+unsigned int multipart_hash(const Multipart *mp) {
+    uint32_t hash = 2166136261u;
+    if (mp->count == 0) {
+        return hash;
+    }
+    
+    zmq_msg_t *identity = (zmq_msg_t *)&mp->frames[0];
+    const uint8_t *data = zmq_msg_data(identity);
+    size_t size = zmq_msg_size(identity);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Soma dos tamanhos de todos os frames
+ */
+size_t multipart_size(Multipart *mp) {
+    size_t size = 0;
+    for (int i = 0; i < mp->count; i++) {
+        size += zmq_msg_size(&mp->frames[i]);
+    }
+    return size;
+}
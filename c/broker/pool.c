@@ -0,0 +1,176 @@
+/**
+ * Broker - Pool de buffers para os frames criados pelo broker
+ *
+ * O ZeroMQ aloca um buffer a cada zmq_msg_init_size acima de ~32 bytes.
+ * Os frames que o broker monta (respostas de erro, identidades de servidor,
+ * respostas do cache) usam aqui blocos de tamanho fixo tirados de slabs de
+ * POOL_SLAB_SIZE bytes, entregues ao ZeroMQ com zmq_msg_init_data. Depois do
+ * aquecimento as slabs só circulam: o loop não chama malloc/free para eles.
+ *
+ * Cada thread tem o seu pool e só ela aloca dele. O buffer enviado é liberado
+ * pela thread de I/O do ZeroMQ (callback de zmq_msg_init_data), então a
+ * devolução vai para uma pilha atômica por classe (push com CAS, de qualquer
+ * thread) que a dona esvazia de uma vez com atomic_exchange quando a sua
+ * lista local acaba. Como só a dona retira, não há o problema de ABA.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include "broker.h"
+
+// Dados alinhados em 16 bytes depois do cabeçalho
+#define BLOCK_HEADER ((sizeof(PoolBlock) + 15) & ~(size_t)15)
+#define MAX_BLOCK ((size_t)POOL_MIN_BLOCK << (POOL_CLASSES - 1))
+
+static void *block_data(PoolBlock *block) {
+    return (uint8_t *)block + BLOCK_HEADER;
+}
+
+static PoolBlock *data_block(void *data) {
+    return (PoolBlock *)((uint8_t *)data - BLOCK_HEADER);
+}
+
+/**
+ * Menor classe que comporta size (size <= MAX_BLOCK)
+ */
+static int size_class(size_t size) {
+    int index = 0;
+    while (((size_t)POOL_MIN_BLOCK << index) < size) {
+        index++;
+    }
+    return index;
+}
+
+void pool_init(BufferPool *pool, size_t limit) {
+    memset(pool, 0, sizeof(*pool));
+    pool->limit = limit;
+}
+
+void pool_destroy(BufferPool *pool) {
+    void *slab = pool->slabs;
+    while (slab) {
+        void *next = *(void **)slab;
+        free(slab);
+        slab = next;
+    }
+    memset(pool, 0, sizeof(*pool));
+}
+
+/**
+ * Obtém uma slab para a classe e a divide em blocos na lista local
+ * @return 0 em sucesso, -1 se o limite foi atingido ou falta memória
+ */
+static int pool_grow(BufferPool *pool, int index) {
+    size_t used = atomic_load_explicit(&pool->slab_bytes, memory_order_relaxed);
+    if (used + POOL_SLAB_SIZE > pool->limit) {
+        return -1;
+    }
+    uint8_t *slab = malloc(POOL_SLAB_SIZE);
+    if (!slab) {
+        return -1;
+    }
+    *(void **)slab = pool->slabs;
+    pool->slabs = slab;
+    atomic_store_explicit(&pool->slab_bytes, used + POOL_SLAB_SIZE, memory_order_relaxed);
+    
+    size_t stride = BLOCK_HEADER + ((size_t)POOL_MIN_BLOCK << index);
+    for (size_t offset = BLOCK_HEADER; offset + stride <= POOL_SLAB_SIZE; offset += stride) {
+        PoolBlock *block = (PoolBlock *)(slab + offset);
+        block->pool = pool;
+        block->size_class = (uint32_t)index;
+        block->next = pool->local[index];
+        pool->local[index] = block;
+    }
+    return 0;
+}
+
+static PoolBlock *heap_block(BufferPool *pool, size_t size) {
+    PoolBlock *block = malloc(BLOCK_HEADER + size);
+    if (block) {
+        block->pool = pool;
+        block->size_class = POOL_CLASSES;
+    }
+    atomic_fetch_add_explicit(&pool->misses, 1, memory_order_relaxed);
+    return block;
+}
+
+void *pool_alloc(BufferPool *pool, size_t size) {
+    if (size > MAX_BLOCK) {
+        PoolBlock *block = heap_block(pool, size);
+        return block ? block_data(block) : NULL;
+    }
+    
+    int index = size_class(size);
+    if (!pool->local[index]) {
+        pool->local[index] = atomic_exchange_explicit(&pool->returned[index], NULL, memory_order_acquire);
+    }
+    if (!pool->local[index] && pool_grow(pool, index) < 0) {
+        PoolBlock *block = heap_block(pool, size);
+        return block ? block_data(block) : NULL;
+    }
+    
+    PoolBlock *block = pool->local[index];
+    pool->local[index] = block->next;
+    atomic_fetch_add_explicit(&pool->hits, 1, memory_order_relaxed);
+    return block_data(block);
+}
+
+void pool_release(void *data) {
+    if (!data) {
+        return;
+    }
+    PoolBlock *block = data_block(data);
+    if (block->size_class == POOL_CLASSES) {
+        free(block);
+        return;
+    }
+    
+    _Atomic(PoolBlock *) *head = &block->pool->returned[block->size_class];
+    PoolBlock *next = atomic_load_explicit(head, memory_order_relaxed);
+    do {
+        block->next = next;
+    } while (!atomic_compare_exchange_weak_explicit(head, &next, block, memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+/**
+ * Callback de zmq_msg_init_data (thread de I/O do ZeroMQ ou zmq_msg_close)
+ */
+static void release_frame(void *data, void *hint) {
+    (void)hint;
+    pool_release(data);
+}
+
+int pool_msg_init(BufferPool *pool, zmq_msg_t *msg, const void *data, size_t size) {
+    if (size <= POOL_INLINE_SIZE || size > MAX_BLOCK) {
+        if (zmq_msg_init_size(msg, size) != 0) {
+            zmq_msg_init(msg);
+            return -1;
+        }
+        if (data) {
+            memcpy(zmq_msg_data(msg), data, size);
+        }
+        return 0;
+    }
+    
+    void *buffer = pool_alloc(pool, size);
+    if (!buffer) {
+        zmq_msg_init(msg);
+        return -1;
+    }
+    if (data) {
+        memcpy(buffer, data, size);
+    }
+    if (zmq_msg_init_data(msg, buffer, size, release_frame, NULL) != 0) {
+        pool_release(buffer);
+        zmq_msg_init(msg);
+        return -1;
+    }
+    return 0;
+}
+
+void pool_accumulate(const BufferPool *pool, PoolTotals *totals) {
+    totals->hits += atomic_load_explicit(&pool->hits, memory_order_relaxed);
+    totals->misses += atomic_load_explicit(&pool->misses, memory_order_relaxed);
+    totals->slab_bytes += atomic_load_explicit(&pool->slab_bytes, memory_order_relaxed);
+}
@@ -0,0 +1,333 @@
+/**
+ * Broker - Proxy PUB-SUB usando padrão XSUB-XPUB (BROKER_MODE=proxy)
+ * Substitui javascript/proxy/proxy.js no mesmo binário do broker
+ * Porta 5557: XSUB (backend - recebe de publicadores)
+ * Porta 5558: XPUB (frontend - envia para assinantes)
+ *
+ * Usa as mesmas peças do broker REQ-REP: os frames são movidos entre os
+ * sockets sem cópia (Multipart) e cada wakeup do poll drena até
+ * BROKER_BATCH_SIZE mensagens por direção, alternando as direções.
+ *
+ * O XPUB é verboso (todas as assinaturas e cancelamentos chegam ao proxy) e
+ * a tabela de tópicos conta as assinaturas de cada tópico: só a primeira
+ * assinatura e o último cancelamento seguem para os servidores, então
+ * centenas de bots reconectando não viram centenas de eventos upstream.
+ * Tópicos fora da tabela (cheia ou nome longo) repassam todos os eventos.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <zmq.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "broker.h"
+
+/**
+ * Estado do proxy
+ */
+typedef struct {
+    void *xsub;
+    void *xpub;
+    void *stats_socket;            // ZMQ_STREAM do endpoint de métricas (NULL = desligado)
+    const BrokerConfig *config;
+    TopicTable topics;
+    unsigned long messages;        // Publicações roteadas
+    unsigned long bytes;
+    unsigned long subscriptions;   // Eventos de assinatura vindos dos assinantes
+    unsigned long unsubscriptions;
+    unsigned long upstream;        // Eventos repassados aos servidores
+    unsigned long untracked;       // Eventos de tópicos fora da tabela (repassados sempre)
+} PubSub;
+
+/**
+ * Encaminha uma publicação do XSUB para o XPUB
+ * Retorna 1 se encaminhou, 0 se não havia mensagem, -1 em erro
+ */
+static int forward_publication(PubSub *proxy) {
+    Multipart mp;
+    int rc = multipart_recv(&mp, proxy->xsub, ZMQ_DONTWAIT);
+    if (rc <= 0) {
+        return rc;
+    }
+    
+    size_t size = multipart_size(&mp);
+    proxy->messages++;
+    proxy->bytes += size;
+    
+    // Tópico = primeiro frame; assinantes de "" (todos) também recebem.
+    // Publicações não criam entradas: só tópicos assinados são contados
+    zmq_msg_t *name = &mp.frames[0];
+    Topic *topic = topics_lookup(&proxy->topics, zmq_msg_data(name), zmq_msg_size(name), 0);
+    if (topic) {
+        Topic *all = topics_lookup(&proxy->topics, "", 0, 0);
+        topic->publications++;
+        topic->bytes += size;
+        topic->deliveries += topic->subscribers + (all && all != topic ? all->subscribers : 0);
+    }
+    
+    if (proxy->messages % 1000 == 0) {
+        log_message(LOG_DEBUG, "%lu mensagens roteadas", proxy->messages);
+    }
+    
+    if (multipart_send(&mp, proxy->xpub) < 0) {
+        log_message(LOG_ERROR, "Erro ao encaminhar publicação: %s", zmq_strerror(errno));
+    }
+    multipart_close(&mp);
+    return 1;
+}
+
+/**
+ * Encaminha um evento de assinatura do XPUB para o XSUB
+ * (byte 0 = 1 indica subscribe, 0 indica unsubscribe; o resto é o tópico)
+ * Retorna 1 se encaminhou, 0 se não havia mensagem, -1 em erro
+ */
+static int forward_subscription(PubSub *proxy) {
+    Multipart mp;
+    int rc = multipart_recv(&mp, proxy->xpub, ZMQ_DONTWAIT);
+    if (rc <= 0) {
+        return rc;
+    }
+    
+    zmq_msg_t *event = &mp.frames[0];
+    size_t size = zmq_msg_size(event);
+    const char *data = zmq_msg_data(event);
+    if (size == 0 || (data[0] != 0 && data[0] != 1)) {
+        multipart_close(&mp);  // Não é evento de assinatura
+        return 1;
+    }
+    
+    int subscribe = data[0] == 1;
+    const char *name = size > 1 ? data + 1 : "(todos)";
+    int length = size > 1 ? (int)(size - 1) : 7;
+    if (subscribe) {
+        proxy->subscriptions++;
+    } else {
+        proxy->unsubscriptions++;
+    }
+    
+    // Só a primeira assinatura e o último cancelamento de cada tópico sobem;
+    // o tópico fica na tabela enquanto tiver assinaturas
+    int forward = 1;
+    unsigned long subscribers = 0;
+    Topic *topic = topics_lookup(&proxy->topics, data + 1, size - 1, subscribe);
+    if (topic && subscribe) {
+        topic->subscribe_events++;
+        forward = topic->subscribers++ == 0;
+        subscribers = topic->subscribers;
+    } else if (topic) {
+        subscribers = --topic->subscribers;
+        forward = subscribers == 0;
+        if (forward) {
+            topics_remove(&proxy->topics, topic);
+        }
+    } else {
+        // Fora da tabela: sem contagem, o evento segue sempre (inclusive o
+        // cancelamento, para a assinatura upstream não ficar pendurada)
+        proxy->untracked++;
+    }
+    
+    if (!forward) {
+        log_message(LOG_DEBUG, "%s no tópico: %.*s (%lu assinaturas, não repassado)",
+                    subscribe ? "Assinatura" : "Cancelamento", length, name, subscribers);
+        multipart_close(&mp);
+        return 1;
+    }
+    
+    log_message(LOG_INFO, "%s no tópico: %.*s", subscribe ? "Nova assinatura" : "Cancelamento de assinatura",
+                length, name);
+    proxy->upstream++;
+    if (multipart_send(&mp, proxy->xsub) < 0) {
+        log_message(LOG_ERROR, "Erro ao encaminhar assinatura: %s", zmq_strerror(errno));
+    }
+    multipart_close(&mp);
+    return 1;
+}
+
+/**
+ * Ordena tópicos por publicações (decrescente)
+ */
+static int compare_publications(const void *a, const void *b) {
+    const Topic *x = *(const Topic *const *)a;
+    const Topic *y = *(const Topic *const *)b;
+    return (x->publications < y->publications) - (x->publications > y->publications);
+}
+
+/**
+ * Métricas do proxy no formato texto do Prometheus
+ * Por tópico, apenas os STATS_TOP_TOPICS mais publicados
+ */
+static size_t render_stats(void *arg, char *buffer, size_t capacity) {
+    static const Topic *hot[MAX_TOPICS];
+    PubSub *proxy = (PubSub *)arg;
+    size_t pos = 0;
+    int count = 0;
+    unsigned long active = 0;
+    
+    for (int i = 0; i < MAX_TOPICS; i++) {
+        const Topic *topic = &proxy->topics.topics[i];
+        if (topic->used) {
+            hot[count++] = topic;
+            active += topic->subscribers > 0;
+        }
+    }
+    qsort(hot, (size_t)count, sizeof(hot[0]), compare_publications);
+    
+    pos += (size_t)snprintf(buffer + pos, capacity - pos,
+                            "# TYPE bbs_proxy_messages_total counter\nbbs_proxy_messages_total %lu\n"
+                            "# TYPE bbs_proxy_bytes_total counter\nbbs_proxy_bytes_total %lu\n"
+                            "# TYPE bbs_proxy_subscribe_events_total counter\nbbs_proxy_subscribe_events_total %lu\n"
+                            "# TYPE bbs_proxy_unsubscribe_events_total counter\nbbs_proxy_unsubscribe_events_total %lu\n"
+                            "# TYPE bbs_proxy_upstream_events_total counter\nbbs_proxy_upstream_events_total %lu\n"
+                            "# TYPE bbs_proxy_untracked_events_total counter\nbbs_proxy_untracked_events_total %lu\n"
+                            "# TYPE bbs_proxy_topics gauge\nbbs_proxy_topics %d\n"
+                            "# TYPE bbs_proxy_subscribed_topics gauge\nbbs_proxy_subscribed_topics %lu\n",
+                            proxy->messages, proxy->bytes, proxy->subscriptions, proxy->unsubscriptions,
+                            proxy->upstream, proxy->untracked, proxy->topics.count, active);
+    
+    static const char *const metrics[][2] = {
+        { "bbs_proxy_topic_subscribers", "gauge" },
+        { "bbs_proxy_topic_publications_total", "counter" },
+        { "bbs_proxy_topic_deliveries_total", "counter" },
+        { "bbs_proxy_topic_bytes_total", "counter" }
+    };
+    int top = count < STATS_TOP_TOPICS ? count : STATS_TOP_TOPICS;
+    for (int m = 0; m < 4 && pos < capacity; m++) {
+        pos += (size_t)snprintf(buffer + pos, capacity - pos, "# TYPE %s %s\n", metrics[m][0], metrics[m][1]);
+        for (int i = 0; i < top && pos < capacity; i++) {
+            const Topic *topic = hot[i];
+            unsigned long values[4] = { topic->subscribers, topic->publications, topic->deliveries, topic->bytes };
+            char label[TOPIC_SIZE];
+            
+            // Tópicos são nomes de canais/usuários; aspas e controles viram '_'
+            for (size_t c = 0; c <= topic->length; c++) {
+                char ch = topic->name[c];
+                label[c] = (c < topic->length && (ch == '"' || ch == '\\' || (unsigned char)ch < 0x20)) ? '_' : ch;
+            }
+            pos += (size_t)snprintf(buffer + pos, capacity - pos, "%s{topic=\"%s\"} %lu\n",
+                                    metrics[m][0], label, values[m]);
+        }
+    }
+    return pos < capacity ? pos : capacity;
+}
+
+/**
+ * Loop do proxy: drena os dois sockets em lote a cada wakeup
+ */
+static void pubsub_loop(PubSub *proxy, volatile int *interrupted) {
+    zmq_pollitem_t items[] = {
+        { proxy->xsub, 0, ZMQ_POLLIN, 0 },
+        { proxy->xpub, 0, ZMQ_POLLIN, 0 },
+        { proxy->stats_socket, 0, ZMQ_POLLIN, 0 }
+    };
+    int nitems = proxy->stats_socket ? 3 : 2;
+    
+    while (!*interrupted) {
+        if (zmq_poll(items, nitems, 1000) < 0) {
+            if (errno == EINTR && !*interrupted) {
+                continue;  // SIGUSR1/SIGUSR2 (nível de log)
+            }
+            break;
+        }
+        
+        int publications = items[0].revents & ZMQ_POLLIN;
+        int subscriptions = items[1].revents & ZMQ_POLLIN;
+        
+        for (int i = 0; i < proxy->config->batch_size && (publications || subscriptions); i++) {
+            if (publications) {
+                publications = forward_publication(proxy) > 0;
+            }
+            if (subscriptions) {
+                subscriptions = forward_subscription(proxy) > 0;
+            }
+        }
+        
+        if (nitems == 3 && (items[2].revents & ZMQ_POLLIN)) {
+            stats_serve(proxy->stats_socket, render_stats, proxy);
+        }
+    }
+}
+
+int pubsub_run(void *context, const BrokerConfig *config, volatile int *interrupted) {
+    // Estático: a tabela de tópicos não cabe bem na pilha
+    static PubSub proxy;
+    memset(&proxy, 0, sizeof(proxy));
+    proxy.config = config;
+    topics_init(&proxy.topics);
+    
+    printf("[PROXY] Iniciando proxy PUB-SUB...\n");
+    
+    // Socket XSUB para receber publicações dos servidores (backend)
+    proxy.xsub = zmq_socket(context, ZMQ_XSUB);
+    // Socket XPUB para enviar publicações aos clientes/bots (frontend)
+    proxy.xpub = zmq_socket(context, ZMQ_XPUB);
+    if (!proxy.xsub || !proxy.xpub) {
+        fprintf(stderr, "[PROXY] Erro ao criar sockets\n");
+        if (proxy.xsub) zmq_close(proxy.xsub);
+        if (proxy.xpub) zmq_close(proxy.xpub);
+        return -1;
+    }
+    
+    // Cada assinante tem a sua fila (BROKER_SNDHWM): o XPUB descarta só as
+    // publicações de quem está com a fila cheia (sem ZMQ_XPUB_NODROP, que
+    // bloquearia todos pelo mais lento)
+    configure_socket(proxy.xsub, config);
+    configure_socket(proxy.xpub, config);
+    
+#ifdef ZMQ_XPUB_VERBOSER
+    // Todas as assinaturas e cancelamentos (inclusive na desconexão) chegam
+    // ao proxy, que faz a deduplicação pela tabela de tópicos
+    int verbose = 1;
+    zmq_setsockopt(proxy.xpub, ZMQ_XPUB_VERBOSER, &verbose, sizeof(verbose));
+#endif
+    
+    if (zmq_bind(proxy.xsub, XSUB_PORT) != 0) {
+        fprintf(stderr, "[PROXY] Erro ao fazer bind no XSUB: %s\n", zmq_strerror(errno));
+        zmq_close(proxy.xsub);
+        zmq_close(proxy.xpub);
+        return -1;
+    }
+    printf("[PROXY] XSUB (backend) escutando em %s\n", XSUB_PORT);
+    
+    if (zmq_bind(proxy.xpub, XPUB_PORT) != 0) {
+        fprintf(stderr, "[PROXY] Erro ao fazer bind no XPUB: %s\n", zmq_strerror(errno));
+        zmq_close(proxy.xsub);
+        zmq_close(proxy.xpub);
+        return -1;
+    }
+    printf("[PROXY] XPUB (frontend) escutando em %s\n", XPUB_PORT);
+    
+    printf("[PROXY] Proxy pronto para rotear publicações\n");
+    printf("[PROXY] Servidores publicam em %s\n", XSUB_PORT);
+    printf("[PROXY] Clientes/Bots assinam em %s\n", XPUB_PORT);
+    printf("[PROXY] Lote máximo por direção: %d mensagens\n", config->batch_size);
+    printf("[PROXY] Filas por conexão: envio %d, recepção %d; assinantes lentos: %s\n",
+           config->sndhwm, config->rcvhwm, slow_policy_name(config->slow_policy));
+    
+    // Endpoint HTTP de métricas (falha não impede o proxy de rotear)
+    if (config->stats_endpoint[0] != '\0') {
+        proxy.stats_socket = zmq_socket(context, ZMQ_STREAM);
+        if (proxy.stats_socket && zmq_bind(proxy.stats_socket, config->stats_endpoint) == 0) {
+            printf("[PROXY] Métricas (HTTP) em %s\n", config->stats_endpoint);
+        } else {
+            fprintf(stderr, "[PROXY] WARNING: Endpoint de métricas %s indisponível: %s\n",
+                    config->stats_endpoint, zmq_strerror(errno));
+            if (proxy.stats_socket) zmq_close(proxy.stats_socket);
+            proxy.stats_socket = NULL;
+        }
+    }
+    fflush(stdout);
+    
+    pubsub_loop(&proxy, interrupted);
+    
+    log_stop();
+    printf("\n[PROXY] Estatísticas:\n");
+    printf("[PROXY]   Publicações roteadas: %lu (%lu bytes)\n", proxy.messages, proxy.bytes);
+    printf("[PROXY]   Assinaturas: %lu, cancelamentos: %lu (repassados aos servidores: %lu)\n",
+           proxy.subscriptions, proxy.unsubscriptions, proxy.upstream);
+    printf("[PROXY]   Tópicos: %d\n", proxy.topics.count);
+    printf("[PROXY] Encerrando proxy...\n");
+    
+    if (proxy.stats_socket) zmq_close(proxy.stats_socket);
+    zmq_close(proxy.xsub);
+    zmq_close(proxy.xpub);
+    return 0;
+}
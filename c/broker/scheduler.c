@@ -0,0 +1,104 @@
+/**
+ * Broker - Escalonamento dos servidores do backend por carga
+ *
+ * Substitui o round-robin do DEALER: os servidores se anunciam ('ready') e o
+ * broker conta as requisições pendentes de cada identidade, enviando cada nova
+ * requisição ao servidor menos carregado. Em caso de empate vence o que está
+ * há mais tempo sem receber requisição (fila LRU).
+ * Com BROKER_ROUTES, cada serviço pode ser restrito a um grupo de servidores.
+ */
+#include <string.h>
+#include "broker.h"
+
+void scheduler_init(Scheduler *scheduler, const RouteTable *routes) {
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->route_table = routes;
+}
+
+int scheduler_find(const Scheduler *scheduler, const void *id, size_t size) {
+    for (int i = 0; i < scheduler->count; i++) {
+        const BackendServer *server = &scheduler->servers[i];
+        if (server->id_size == size && memcmp(server->id, id, size) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int scheduler_register(Scheduler *scheduler, const void *id, size_t size) {
+    int index = scheduler_find(scheduler, id, size);
+    if (index >= 0) {
+        return index;
+    }
+    
+    if (scheduler->count == MAX_SERVERS || size == 0 || size > SERVER_ID_SIZE) {
+        return -1;
+    }
+    
+    index = scheduler->count++;
+    BackendServer *server = &scheduler->servers[index];
+    memset(server, 0, sizeof(*server));
+    memcpy(server->id, id, size);
+    server->id_size = size;
+    server->routes = route_mask_for_server(scheduler->route_table, id, size);
+    server->serial = ++scheduler->serials;
+    server->seen_ns = monotonic_ns();
+    return index;
+}
+
+void scheduler_remove(Scheduler *scheduler, int index) {
+    if (index < 0 || index >= scheduler->count) {
+        return;
+    }
+    
+    // Mantém o array compacto: o último ocupa a posição removida
+    scheduler->count--;
+    if (index != scheduler->count) {
+        scheduler->servers[index] = scheduler->servers[scheduler->count];
+    }
+}
+
+/**
+ * Menor carga dentre os servidores cujas rotas casam com a máscara
+ * (máscara 0 = todos os servidores)
+ */
+static int pick_among(const Scheduler *scheduler, unsigned int mask) {
+    int best = -1;
+    for (int i = 0; i < scheduler->count; i++) {
+        const BackendServer *server = &scheduler->servers[i];
+        if (mask && !(server->routes & mask)) {
+            continue;
+        }
+        if (best < 0 ||
+            server->outstanding < scheduler->servers[best].outstanding ||
+            (server->outstanding == scheduler->servers[best].outstanding &&
+             server->last_assigned < scheduler->servers[best].last_assigned)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+int scheduler_pick(const Scheduler *scheduler, int route) {
+    int best = -1;
+    if (route != ROUTE_NONE) {
+        best = pick_among(scheduler, 1u << route);
+    }
+    
+    // Rota sem servidores registrados: qualquer servidor atende
+    return best >= 0 ? best : pick_among(scheduler, 0);
+}
+
+void scheduler_assigned(Scheduler *scheduler, int index) {
+    BackendServer *server = &scheduler->servers[index];
+    server->outstanding++;
+    server->requests++;
+    server->last_assigned = ++scheduler->sequence;
+}
+
+void scheduler_completed(Scheduler *scheduler, int index) {
+    BackendServer *server = &scheduler->servers[index];
+    if (server->outstanding > 0) {
+        server->outstanding--;
+    }
+}
@@ -0,0 +1,471 @@
+/**
+ * Broker - Métricas de encaminhamento e latência
+ *
+ * Cada requisição é correlacionada com a sua resposta pela identidade do
+ * cliente no envelope do ROUTER: a entrada em trânsito guarda o instante de
+ * chegada no frontend e o de envio ao backend. Na resposta são registrados
+ * dois histogramas: o do servidor (envio -> resposta, tempo gasto fora do
+ * broker) e o do serviço (chegada -> resposta). O histograma broker_latency
+ * mede só o tempo dentro do broker (chegada -> envio), incluindo a fila dos
+ * workers, para separar atrasos do broker dos atrasos dos servidores Python.
+ *
+ * As métricas são servidas em texto no formato do Prometheus pelo endpoint
+ * BROKER_STATS_ENDPOINT (ver broker.c).
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "broker.h"
+
+// Serviços atendidos pelos servidores (server.py); o último agrupa os demais
+static const char *const SERVICE_NAMES[STATS_SERVICES] = {
+    "login", "users", "channel", "channels", "publish", "message",
+    "get_history", "get_private_history", "outros"
+};
+
+// Quantis exportados por histograma
+static const double QUANTILES[] = { 50.0, 90.0, 99.0, 99.9 };
+
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void stats_init(BrokerStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->started_ns = monotonic_ns();
+}
+
+int stats_service_index(const char *service, size_t length) {
+    for (int i = 0; i < STATS_SERVICE_OTHER; i++) {
+        if (strlen(SERVICE_NAMES[i]) == length && memcmp(SERVICE_NAMES[i], service, length) == 0) {
+            return i;
+        }
+    }
+    return STATS_SERVICE_OTHER;
+}
+
+/**
+ * Slot da tabela de requisições em trânsito para o cliente do primeiro frame
+ * Tabela de endereçamento direto: uma colisão sobrescreve a entrada antiga
+ * (perde-se uma amostra, não a requisição)
+ * Retorna NULL se a identidade não pode ser acompanhada
+ */
+static PendingRequest *pending_slot(BrokerStats *stats, Multipart *mp) {
+    if (mp->count == 0 || zmq_msg_size(&mp->frames[0]) > PENDING_ID_SIZE) {
+        return NULL;
+    }
+    return &stats->pending[multipart_hash(mp) % PENDING_SLOTS];
+}
+
+/**
+ * Entrada em trânsito do cliente do primeiro frame, se existir
+ */
+static PendingRequest *pending_find(BrokerStats *stats, Multipart *mp) {
+    PendingRequest *slot = pending_slot(stats, mp);
+    if (!slot || slot->id_size == 0) {
+        return NULL;
+    }
+    
+    zmq_msg_t *id = &mp->frames[0];
+    if (slot->id_size != zmq_msg_size(id) || memcmp(slot->id, zmq_msg_data(id), slot->id_size) != 0) {
+        return NULL;
+    }
+    return slot;
+}
+
+void stats_received(BrokerStats *stats, Multipart *mp, Direction direction) {
+    stats->messages[direction]++;
+    stats->bytes[direction] += multipart_size(mp);
+    if (direction != FRONTEND_TO_BACKEND) {
+        return;
+    }
+    
+    PendingRequest *slot = pending_slot(stats, mp);
+    if (!slot) {
+        return;
+    }
+    
+    zmq_msg_t *id = &mp->frames[0];
+    size_t size = zmq_msg_size(id);
+    if (slot->id_size != 0 && (slot->id_size != size || memcmp(slot->id, zmq_msg_data(id), size) != 0)) {
+        stats->evicted++;
+    }
+    memcpy(slot->id, zmq_msg_data(id), size);
+    slot->id_size = size;
+    slot->received_ns = monotonic_ns();
+    slot->sent_ns = 0;
+    slot->service = STATS_SERVICE_OTHER;
+}
+
+void stats_request_sent(BrokerStats *stats, Multipart *mp, int service) {
+    PendingRequest *slot = pending_find(stats, mp);
+    if (!slot) {
+        return;
+    }
+    
+    slot->sent_ns = monotonic_ns();
+    slot->service = service;
+    stats->service_requests[slot->service]++;
+    histogram_record(&stats->broker_latency, (slot->sent_ns - slot->received_ns) / 1000);
+}
+
+void stats_reply_received(BrokerStats *stats, Multipart *mp, BackendServer *server) {
+    PendingRequest *slot = pending_find(stats, mp);
+    if (!slot || slot->sent_ns == 0) {
+        stats->unmatched++;
+        return;
+    }
+    
+    uint64_t now = monotonic_ns();
+    if (server) {
+        server->replies++;
+        histogram_record(&server->latency, (now - slot->sent_ns) / 1000);
+    }
+    histogram_record(&stats->service_latency[slot->service], (now - slot->received_ns) / 1000);
+    slot->id_size = 0;
+}
+
+void stats_reply_cached(BrokerStats *stats, Multipart *mp, int service) {
+    PendingRequest *slot = pending_find(stats, mp);
+    if (!slot) {
+        return;
+    }
+    
+    stats->service_requests[service]++;
+    histogram_record(&stats->service_latency[service], (monotonic_ns() - slot->received_ns) / 1000);
+    slot->id_size = 0;
+}
+
+/**
+ * Tabela de clientes com respostas descartadas (sondagem linear, entradas
+ * nunca removidas); cheia, os descartes de clientes novos só entram no total
+ */
+void stats_reply_dropped(BrokerStats *stats, Multipart *mp) {
+    stats->dropped++;
+    if (mp->count == 0 || zmq_msg_size(&mp->frames[0]) > PENDING_ID_SIZE) {
+        return;
+    }
+    
+    zmq_msg_t *id = &mp->frames[0];
+    size_t size = zmq_msg_size(id);
+    unsigned int index = multipart_hash(mp) & (PEER_SLOTS - 1);
+    for (int probe = 0; probe < PEER_SLOTS; probe++) {
+        PeerDrops *peer = &stats->peers[index];
+        if (peer->id_size == 0) {
+            if (stats->peer_count >= PEER_SLOTS - PEER_SLOTS / 8) {
+                return;
+            }
+            memcpy(peer->id, zmq_msg_data(id), size);
+            peer->id_size = size;
+            stats->peer_count++;
+        }
+        if (peer->id_size == size && memcmp(peer->id, zmq_msg_data(id), size) == 0) {
+            peer->dropped++;
+            return;
+        }
+        index = (index + 1) & (PEER_SLOTS - 1);
+    }
+}
+
+/**
+ * Saída em um buffer de tamanho fixo; o que não couber é descartado
+ */
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t pos;
+} StatsOutput;
+
+static void output_printf(StatsOutput *out, const char *format, ...) {
+    if (out->pos >= out->capacity) {
+        return;
+    }
+    
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(out->data + out->pos, out->capacity - out->pos, format, args);
+    va_end(args);
+    
+    if (written < 0 || (size_t)written >= out->capacity - out->pos) {
+        out->pos = out->capacity;  // Truncado
+    } else {
+        out->pos += (size_t)written;
+    }
+}
+
+/**
+ * Copia uma identidade para uso como valor de label (apenas caracteres seguros)
+ */
+static void label_value(char *dest, size_t capacity, const unsigned char *id, size_t size) {
+    size_t n = size < capacity - 1 ? size : capacity - 1;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = id[i];
+        int safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                   c == '_' || c == '-' || c == '.';
+        dest[i] = safe ? (char)c : '_';
+    }
+    dest[n] = '\0';
+}
+
+/**
+ * Identidade em hexadecimal (as do REQ são binárias, geradas pelo ZeroMQ)
+ */
+static void label_hex(char *dest, const unsigned char *id, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < size; i++) {
+        dest[2 * i] = digits[id[i] >> 4];
+        dest[2 * i + 1] = digits[id[i] & 0x0f];
+    }
+    dest[2 * size] = '\0';
+}
+
+static int compare_dropped(const void *a, const void *b) {
+    const PeerDrops *x = *(const PeerDrops *const *)a;
+    const PeerDrops *y = *(const PeerDrops *const *)b;
+    return (x->dropped < y->dropped) - (x->dropped > y->dropped);
+}
+
+/**
+ * Um histograma como summary do Prometheus (quantis em segundos, _sum e _count)
+ */
+static void output_summary(StatsOutput *out, const char *name, const char *label,
+                           const char *value, const Histogram *histogram) {
+    for (size_t i = 0; i < sizeof(QUANTILES) / sizeof(QUANTILES[0]); i++) {
+        output_printf(out, "%s{%s=\"%s\",quantile=\"%g\"} %.6f\n", name, label, value,
+                      QUANTILES[i] / 100.0, (double)histogram_percentile(histogram, QUANTILES[i]) / 1e6);
+    }
+    output_printf(out, "%s_sum{%s=\"%s\"} %.6f\n", name, label, value, (double)histogram->sum / 1e6);
+    output_printf(out, "%s_count{%s=\"%s\"} %llu\n", name, label, value, (unsigned long long)histogram->total);
+}
+
+size_t stats_render(const BrokerStats *stats, const Scheduler *scheduler,
+                    const InspectorTotals *inspected, const ReadCache *cache,
+                    const Admission *admission, const Failover *failover,
+                    const Cluster *cluster, char *buffer, size_t capacity) {
+    StatsOutput out = { buffer, capacity, 0 };
+    const char *directions[2] = { "frontend_backend", "backend_frontend" };
+    
+    output_printf(&out, "# TYPE bbs_broker_uptime_seconds gauge\n");
+    output_printf(&out, "bbs_broker_uptime_seconds %.3f\n", (double)(monotonic_ns() - stats->started_ns) / 1e9);
+    
+    output_printf(&out, "# TYPE bbs_broker_messages_total counter\n");
+    for (int d = 0; d < 2; d++) {
+        output_printf(&out, "bbs_broker_messages_total{direction=\"%s\"} %lu\n", directions[d], stats->messages[d]);
+    }
+    output_printf(&out, "# TYPE bbs_broker_bytes_total counter\n");
+    for (int d = 0; d < 2; d++) {
+        output_printf(&out, "bbs_broker_bytes_total{direction=\"%s\"} %lu\n", directions[d], stats->bytes[d]);
+    }
+    
+    output_printf(&out, "# TYPE bbs_broker_invalid_messages_total counter\n");
+    output_printf(&out, "bbs_broker_invalid_messages_total %lu\n", inspected->invalid);
+    output_printf(&out, "# TYPE bbs_broker_rejected_messages_total counter\n");
+    output_printf(&out, "bbs_broker_rejected_messages_total %lu\n", inspected->rejected);
+    output_printf(&out, "# TYPE bbs_broker_clock_stamped_total counter\n");
+    output_printf(&out, "bbs_broker_clock_stamped_total %lu\n", inspected->stamped);
+    output_printf(&out, "# TYPE bbs_broker_clock_unstamped_total counter\n");
+    output_printf(&out, "bbs_broker_clock_unstamped_total %lu\n", inspected->unstamped);
+    output_printf(&out, "# TYPE bbs_broker_logical_clock gauge\n");
+    output_printf(&out, "bbs_broker_logical_clock %llu\n", (unsigned long long)inspected->clock);
+    output_printf(&out, "# TYPE bbs_broker_unmatched_replies_total counter\n");
+    output_printf(&out, "bbs_broker_unmatched_replies_total %lu\n", stats->unmatched);
+    output_printf(&out, "# TYPE bbs_broker_evicted_requests_total counter\n");
+    output_printf(&out, "bbs_broker_evicted_requests_total %lu\n", stats->evicted);
+    output_printf(&out, "# TYPE bbs_broker_dropped_replies_total counter\n");
+    output_printf(&out, "bbs_broker_dropped_replies_total %lu\n", stats->dropped);
+    
+    // Cache de leituras (BROKER_CACHE)
+    output_printf(&out, "# TYPE bbs_broker_cache_hits_total counter\n");
+    output_printf(&out, "bbs_broker_cache_hits_total %lu\n", cache->hits);
+    output_printf(&out, "# TYPE bbs_broker_cache_misses_total counter\n");
+    output_printf(&out, "bbs_broker_cache_misses_total %lu\n", cache->misses);
+    output_printf(&out, "# TYPE bbs_broker_cache_coalesced_total counter\n");
+    output_printf(&out, "bbs_broker_cache_coalesced_total %lu\n", cache->coalesced);
+    output_printf(&out, "# TYPE bbs_broker_cache_stored_total counter\n");
+    output_printf(&out, "bbs_broker_cache_stored_total %lu\n", cache->stored);
+    output_printf(&out, "# TYPE bbs_broker_cache_invalidations_total counter\n");
+    output_printf(&out, "bbs_broker_cache_invalidations_total %lu\n", cache->invalidations);
+    output_printf(&out, "# TYPE bbs_broker_cache_abandoned_total counter\n");
+    output_printf(&out, "bbs_broker_cache_abandoned_total %lu\n", cache->abandoned);
+    output_printf(&out, "# TYPE bbs_broker_cache_refused_total counter\n");
+    output_printf(&out, "bbs_broker_cache_refused_total %lu\n", cache->refused);
+    output_printf(&out, "# TYPE bbs_broker_cache_bytes gauge\n");
+    output_printf(&out, "bbs_broker_cache_bytes %zu\n", cache->memory);
+    
+    // Controle de admissão (BROKER_RATE_LIMIT, BROKER_MAX_INFLIGHT)
+    output_printf(&out, "# TYPE bbs_broker_busy_replies_total counter\n");
+    output_printf(&out, "bbs_broker_busy_replies_total{reason=\"rate_limit\"} %lu\n", admission->rate_limited);
+    output_printf(&out, "bbs_broker_busy_replies_total{reason=\"max_inflight\"} %lu\n", admission->saturated);
+    output_printf(&out, "# TYPE bbs_broker_inflight_expired_total counter\n");
+    output_printf(&out, "bbs_broker_inflight_expired_total %lu\n", admission->expired);
+    // Em trânsito segundo o controle de admissão (não conta respostas do cache)
+    output_printf(&out, "# TYPE bbs_broker_admission_inflight_requests gauge\n");
+    output_printf(&out, "bbs_broker_admission_inflight_requests %d\n", admission->inflight);
+    output_printf(&out, "# TYPE bbs_broker_admission_untracked_total counter\n");
+    output_printf(&out, "bbs_broker_admission_untracked_total %lu\n", admission->untracked);
+    
+    // Heartbeat e failover do backend (BROKER_HEARTBEAT_IVL, BROKER_RETRIES)
+    output_printf(&out, "# TYPE bbs_broker_servers_lost_total counter\n");
+    output_printf(&out, "bbs_broker_servers_lost_total %lu\n", failover->servers_lost);
+    output_printf(&out, "# TYPE bbs_broker_failover_retried_total counter\n");
+    output_printf(&out, "bbs_broker_failover_retried_total %lu\n", failover->retried);
+    output_printf(&out, "# TYPE bbs_broker_failover_failed_total counter\n");
+    output_printf(&out, "bbs_broker_failover_failed_total %lu\n", failover->failed);
+    output_printf(&out, "# TYPE bbs_broker_stale_replies_total counter\n");
+    output_printf(&out, "bbs_broker_stale_replies_total %lu\n", failover->stale);
+    output_printf(&out, "# TYPE bbs_broker_failover_untracked_total counter\n");
+    output_printf(&out, "bbs_broker_failover_untracked_total %lu\n", failover->untracked);
+    
+    // Gossip com os outros brokers (BROKER_PEERS)
+    output_printf(&out, "# TYPE bbs_broker_gossip_sent_total counter\n");
+    output_printf(&out, "bbs_broker_gossip_sent_total %lu\n", cluster->sent);
+    output_printf(&out, "# TYPE bbs_broker_gossip_received_total counter\n");
+    output_printf(&out, "bbs_broker_gossip_received_total %lu\n", cluster->received);
+    output_printf(&out, "# TYPE bbs_broker_gossip_invalid_total counter\n");
+    output_printf(&out, "bbs_broker_gossip_invalid_total %lu\n", cluster->invalid);
+    output_printf(&out, "# TYPE bbs_broker_gossip_suspected_total counter\n");
+    output_printf(&out, "bbs_broker_gossip_suspected_total %lu\n", cluster->suspected);
+    char peer_name[BROKER_NAME_SIZE];
+    output_printf(&out, "# TYPE bbs_broker_cluster_peer_up gauge\n");
+    for (int i = 0; i < MAX_PEERS; i++) {
+        if (cluster->peers[i].name[0] != '\0') {
+            label_value(peer_name, sizeof(peer_name), (const unsigned char *)cluster->peers[i].name, strlen(cluster->peers[i].name));
+            output_printf(&out, "bbs_broker_cluster_peer_up{peer=\"%s\"} %d\n", peer_name,
+                          cluster_peer_up(cluster, &cluster->peers[i]));
+        }
+    }
+    output_printf(&out, "# TYPE bbs_broker_cluster_peer_servers gauge\n");
+    for (int i = 0; i < MAX_PEERS; i++) {
+        if (cluster->peers[i].name[0] != '\0') {
+            label_value(peer_name, sizeof(peer_name), (const unsigned char *)cluster->peers[i].name, strlen(cluster->peers[i].name));
+            output_printf(&out, "bbs_broker_cluster_peer_servers{peer=\"%s\"} %lu\n", peer_name,
+                          cluster->peers[i].servers);
+        }
+    }
+    
+    // Pools de buffers dos frames criados pelo broker
+    output_printf(&out, "# TYPE bbs_broker_pool_allocations_total counter\n");
+    output_printf(&out, "bbs_broker_pool_allocations_total{source=\"slab\"} %lu\n", inspected->pool.hits);
+    output_printf(&out, "bbs_broker_pool_allocations_total{source=\"malloc\"} %lu\n", inspected->pool.misses);
+    output_printf(&out, "# TYPE bbs_broker_pool_slab_bytes gauge\n");
+    output_printf(&out, "bbs_broker_pool_slab_bytes %zu\n", inspected->pool.slab_bytes);
+    
+    // Clientes lentos ou desconectados com mais respostas descartadas
+    static const PeerDrops *peers[PEER_SLOTS];
+    int peer_count = 0;
+    for (int i = 0; i < PEER_SLOTS; i++) {
+        if (stats->peers[i].id_size > 0) {
+            peers[peer_count++] = &stats->peers[i];
+        }
+    }
+    qsort(peers, (size_t)peer_count, sizeof(peers[0]), compare_dropped);
+    
+    char peer[2 * PENDING_ID_SIZE + 1];
+    output_printf(&out, "# TYPE bbs_broker_peer_dropped_replies_total counter\n");
+    for (int i = 0; i < peer_count && i < STATS_TOP_PEERS; i++) {
+        label_hex(peer, peers[i]->id, peers[i]->id_size);
+        output_printf(&out, "bbs_broker_peer_dropped_replies_total{peer=\"%s\"} %lu\n", peer, peers[i]->dropped);
+    }
+    
+    unsigned long inflight = 0;
+    for (int i = 0; i < scheduler->count; i++) {
+        inflight += scheduler->servers[i].outstanding;
+    }
+    output_printf(&out, "# TYPE bbs_broker_servers gauge\n");
+    output_printf(&out, "bbs_broker_servers %d\n", scheduler->count);
+    output_printf(&out, "# TYPE bbs_broker_inflight_requests gauge\n");
+    output_printf(&out, "bbs_broker_inflight_requests %lu\n", inflight);
+    
+    // Por servidor do backend
+    char server[SERVER_ID_SIZE + 1];
+    output_printf(&out, "# TYPE bbs_broker_server_inflight_requests gauge\n");
+    for (int i = 0; i < scheduler->count; i++) {
+        const BackendServer *backend = &scheduler->servers[i];
+        label_value(server, sizeof(server), backend->id, backend->id_size);
+        output_printf(&out, "bbs_broker_server_inflight_requests{server=\"%s\"} %lu\n", server, backend->outstanding);
+    }
+    output_printf(&out, "# TYPE bbs_broker_server_requests_total counter\n");
+    for (int i = 0; i < scheduler->count; i++) {
+        const BackendServer *backend = &scheduler->servers[i];
+        label_value(server, sizeof(server), backend->id, backend->id_size);
+        output_printf(&out, "bbs_broker_server_requests_total{server=\"%s\"} %lu\n", server, backend->requests);
+    }
+    output_printf(&out, "# TYPE bbs_broker_server_latency_seconds summary\n");
+    for (int i = 0; i < scheduler->count; i++) {
+        const BackendServer *backend = &scheduler->servers[i];
+        label_value(server, sizeof(server), backend->id, backend->id_size);
+        output_summary(&out, "bbs_broker_server_latency_seconds", "server", server, &backend->latency);
+    }
+    
+    // Por serviço
+    output_printf(&out, "# TYPE bbs_broker_service_requests_total counter\n");
+    for (int i = 0; i < STATS_SERVICES; i++) {
+        output_printf(&out, "bbs_broker_service_requests_total{service=\"%s\"} %lu\n",
+                      SERVICE_NAMES[i], stats->service_requests[i]);
+    }
+    output_printf(&out, "# TYPE bbs_broker_service_latency_seconds summary\n");
+    for (int i = 0; i < STATS_SERVICES; i++) {
+        output_summary(&out, "bbs_broker_service_latency_seconds", "service", SERVICE_NAMES[i],
+                       &stats->service_latency[i]);
+    }
+    
+    // Tempo dentro do broker (chegada no frontend -> envio ao backend)
+    output_printf(&out, "# TYPE bbs_broker_queue_latency_seconds summary\n");
+    for (size_t i = 0; i < sizeof(QUANTILES) / sizeof(QUANTILES[0]); i++) {
+        output_printf(&out, "bbs_broker_queue_latency_seconds{quantile=\"%g\"} %.6f\n", QUANTILES[i] / 100.0,
+                      (double)histogram_percentile(&stats->broker_latency, QUANTILES[i]) / 1e6);
+    }
+    output_printf(&out, "bbs_broker_queue_latency_seconds_sum %.6f\n", (double)stats->broker_latency.sum / 1e6);
+    output_printf(&out, "bbs_broker_queue_latency_seconds_count %llu\n",
+                  (unsigned long long)stats->broker_latency.total);
+    
+    return out.pos < capacity ? out.pos : capacity;
+}
+
+/**
+ * Envia a resposta HTTP em um único frame (ZMQ_STREAM trata cada frame após
+ * a identidade como dados brutos da conexão) e fecha a conexão
+ */
+static void http_reply(void *socket, zmq_msg_t *connection, const char *body, size_t size) {
+    char header[128];
+    int header_size = snprintf(header, sizeof(header),
+                               "HTTP/1.0 200 OK\r\n"
+                               "Content-Type: text/plain; version=0.0.4\r\n"
+                               "Content-Length: %zu\r\n\r\n", size);
+    
+    zmq_msg_t response;
+    if (zmq_msg_init_size(&response, (size_t)header_size + size) != 0) {
+        return;
+    }
+    memcpy(zmq_msg_data(&response), header, (size_t)header_size);
+    memcpy((char *)zmq_msg_data(&response) + header_size, body, size);
+    
+    void *id = zmq_msg_data(connection);
+    size_t id_size = zmq_msg_size(connection);
+    zmq_send(socket, id, id_size, ZMQ_SNDMORE);
+    zmq_msg_send(&response, socket, 0);
+    zmq_msg_close(&response);
+    
+    // Frame vazio fecha a conexão
+    zmq_send(socket, id, id_size, ZMQ_SNDMORE);
+    zmq_send(socket, "", 0, 0);
+}
+
+void stats_serve(void *socket, StatsRenderFn render, void *arg) {
+    static char body[STATS_BUFFER_SIZE];
+    Multipart mp;
+    
+    // [conexão][bytes]; um frame vazio indica conexão aberta ou fechada
+    while (multipart_recv(&mp, socket, ZMQ_DONTWAIT) > 0) {
+        if (mp.count == 2 && zmq_msg_size(&mp.frames[1]) > 0) {
+            size_t size = render(arg, body, sizeof(body));
+            http_reply(socket, &mp.frames[0], body, size);
+        }
+        multipart_close(&mp);
+    }
+}
@@ -0,0 +1,74 @@
+/**
+ * Broker - Tabela de tópicos do proxy PUB-SUB
+ *
+ * Índice hash (endereçamento aberto, sondagem linear) dos tópicos assinados
+ * e publicados. Cada tópico guarda quantas assinaturas ativas tem, o que
+ * permite ao proxy repassar aos servidores só a primeira assinatura e o
+ * último cancelamento, além das contagens de publicações e de fan-out.
+ * Só tópicos assinados ocupam entradas: o último cancelamento remove o
+ * tópico (com seus contadores); com a tabela cheia, tópicos novos ficam sem
+ * acompanhamento.
+ */
+#include <string.h>
+#include "broker.h"
+
+void topics_init(TopicTable *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+static uint32_t topic_hash(const void *name, size_t length) {
+    const uint8_t *data = (const uint8_t *)name;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+Topic *topics_lookup(TopicTable *table, const void *name, size_t length, int create) {
+    if (length >= TOPIC_SIZE) {
+        return NULL;
+    }
+    
+    uint32_t index = topic_hash(name, length) & (MAX_TOPICS - 1);
+    for (int probe = 0; probe < MAX_TOPICS; probe++) {
+        Topic *topic = &table->topics[index];
+        if (!topic->used) {
+            // A tabela é mantida abaixo da capacidade para que a busca pare
+            // sempre em um slot livre
+            if (!create || table->count >= MAX_TOPICS - MAX_TOPICS / 8) {
+                return NULL;
+            }
+            topic->used = 1;
+            memcpy(topic->name, name, length);
+            topic->name[length] = '\0';
+            topic->length = length;
+            table->count++;
+            return topic;
+        }
+        if (topic->length == length && memcmp(topic->name, name, length) == 0) {
+            return topic;
+        }
+        index = (index + 1) & (MAX_TOPICS - 1);
+    }
+    return NULL;
+}
+
+void topics_remove(TopicTable *table, Topic *topic) {
+    uint32_t hole = (uint32_t)(topic - table->topics);
+    uint32_t index = (hole + 1) & (MAX_TOPICS - 1);
+    
+    // Sondagem linear sem lápides: as entradas seguintes que deixariam de ser
+    // encontradas voltam para o buraco
+    while (table->topics[index].used) {
+        Topic *next = &table->topics[index];
+        uint32_t home = topic_hash(next->name, next->length) & (MAX_TOPICS - 1);
+        if (((index - home) & (MAX_TOPICS - 1)) >= ((index - hole) & (MAX_TOPICS - 1))) {
+            table->topics[hole] = *next;
+            hole = index;
+        }
+        index = (index + 1) & (MAX_TOPICS - 1);
+    }
+    memset(&table->topics[hole], 0, sizeof(table->topics[hole]));
+    table->count--;
+}
@@ -0,0 +1,176 @@
+/**
+ * Broker - Threads de inspeção ligadas ao loop principal por pipes inproc
+ *
+ * Um socket ZeroMQ não pode ser usado por várias threads e cada porta TCP
+ * aceita um único bind, então os ROUTERs (5555 e 5556) continuam no
+ * loop principal, que apenas move frames (sem cópia: inproc repassa os
+ * próprios zmq_msg_t). A inspeção, que é o custo de CPU do broker, roda em
+ * BROKER_THREADS workers. Cada mensagem vai para o worker escolhido pelo
+ * hash da identidade do cliente, preservando a ordem por cliente.
+ *
+ * Cada worker tem dois pipes PAIR: "up" (frontend->backend) e "down"
+ * (backend->frontend). O worker devolve a mensagem inspecionada pelo pipe da
+ * direção em que ela deve seguir. Requisições devolvidas pelo "up" levam na
+ * frente um frame de 2 bytes com a rota do serviço (rota + 2; 1 = sem rota)
+ * e o índice do serviço nas estatísticas, que o loop principal remove. Uma
+ * requisição rejeitada também volta pelo "up", com a rota 0
+ * (ROUTE_REJECTED), para que o loop principal a responda direto sem
+ * confundi-la com uma resposta de servidor.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "broker.h"
+
+int pin_current_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0) {
+        log_message(LOG_WARNING, "Não foi possível fixar thread na CPU %d: %s", cpu, strerror(rc));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Loop de um worker: inspeciona e devolve tudo o que chega pelos pipes
+ * Termina quando o contexto é desligado (zmq_ctx_shutdown -> ETERM)
+ */
+static void *worker_main(void *arg) {
+    Worker *worker = (Worker *)arg;
+    
+    if (worker->cpu >= 0) {
+        pin_current_thread(worker->cpu);
+    }
+    
+    zmq_pollitem_t items[] = {
+        { worker->up, 0, ZMQ_POLLIN, 0 },
+        { worker->down, 0, ZMQ_POLLIN, 0 }
+    };
+    
+    while (1) {
+        if (zmq_poll(items, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;  // Sinal entregue a esta thread
+            }
+            break;  // ETERM: broker encerrando
+        }
+        
+        for (int i = 0; i < 2; i++) {
+            if (!(items[i].revents & ZMQ_POLLIN)) {
+                continue;
+            }
+            
+            Direction direction = (i == 0) ? FRONTEND_TO_BACKEND : BACKEND_TO_FRONTEND;
+            Multipart mp;
+            for (int n = 0; n < worker->inspector.config->batch_size; n++) {
+                if (multipart_recv(&mp, items[i].socket, ZMQ_DONTWAIT) <= 0) {
+                    break;
+                }
+                
+                RequestInfo info;
+                Direction next = inspect_message(&worker->inspector, &mp, direction, &info);
+                if (next == FRONTEND_TO_BACKEND || info.route == ROUTE_REJECTED) {
+                    uint8_t tag[2] = { (uint8_t)(info.route + 2), (uint8_t)info.service };
+                    if (multipart_push_front(&mp, &worker->inspector.pool, tag, sizeof(tag)) == 0) {
+                        multipart_send(&mp, worker->up);
+                    }
+                } else {
+                    multipart_send(&mp, worker->down);
+                }
+                multipart_close(&mp);
+            }
+        }
+    }
+    
+    zmq_close(worker->up);
+    zmq_close(worker->down);
+    return NULL;
+}
+
+/**
+ * Cria um pipe PAIR inproc: a ponta do main thread faz bind, a do worker connect
+ * O sentido main->worker é limitado a WORKER_BACKLOG mensagens (o main bloqueia,
+ * o que segura a leitura dos sockets TCP); o sentido worker->main é ilimitado
+ * para que o worker nunca bloqueie e os dois lados não travem um ao outro
+ */
+static int create_pipe(void *context, const char *endpoint, void **main_end, void **worker_end) {
+    int backlog = WORKER_BACKLOG;
+    int unlimited = 0;
+    
+    *main_end = zmq_socket(context, ZMQ_PAIR);
+    *worker_end = zmq_socket(context, ZMQ_PAIR);
+    if (!*main_end || !*worker_end) {
+        return -1;
+    }
+    
+    zmq_setsockopt(*main_end, ZMQ_SNDHWM, &backlog, sizeof(backlog));
+    zmq_setsockopt(*main_end, ZMQ_RCVHWM, &unlimited, sizeof(unlimited));
+    zmq_setsockopt(*worker_end, ZMQ_RCVHWM, &backlog, sizeof(backlog));
+    zmq_setsockopt(*worker_end, ZMQ_SNDHWM, &unlimited, sizeof(unlimited));
+    
+    if (zmq_bind(*main_end, endpoint) != 0 || zmq_connect(*worker_end, endpoint) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int workers_start(WorkerPool *pool, void *context, const BrokerConfig *config) {
+    memset(pool, 0, sizeof(*pool));
+    
+    for (int i = 0; i < config->threads; i++) {
+        Worker *worker = &pool->workers[i];
+        char up[64];
+        char down[64];
+        
+        snprintf(up, sizeof(up), "inproc://broker-worker-%d-up", i);
+        snprintf(down, sizeof(down), "inproc://broker-worker-%d-down", i);
+        if (create_pipe(context, up, &pool->up[i], &worker->up) != 0 ||
+            create_pipe(context, down, &pool->down[i], &worker->down) != 0) {
+            fprintf(stderr, "[BROKER] Erro ao criar pipes do worker %d: %s\n", i, zmq_strerror(errno));
+            break;
+        }
+        
+        inspector_init(&worker->inspector, config);
+        // CPU 0 da lista fica com o loop principal
+        worker->cpu = config->cpu_count > 0 ? config->cpus[(i + 1) % config->cpu_count] : -1;
+        
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            fprintf(stderr, "[BROKER] Erro ao criar thread do worker %d\n", i);
+            break;
+        }
+        pool->count++;
+    }
+    
+    if (pool->count == config->threads) {
+        return 0;
+    }
+    
+    // Falha: fecha as pontas do worker que não chegou a iniciar
+    Worker *failed = &pool->workers[pool->count];
+    if (failed->up) zmq_close(failed->up);
+    if (failed->down) zmq_close(failed->down);
+    return -1;
+}
+
+void workers_destroy(WorkerPool *pool) {
+    for (int i = 0; i < pool->count; i++) {
+        inspector_destroy(&pool->workers[i].inspector);
+    }
+}
+
+void workers_join(WorkerPool *pool) {
+    for (int i = 0; i < pool->count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        if (pool->up[i]) zmq_close(pool->up[i]);
+        if (pool->down[i]) zmq_close(pool->down[i]);
+    }
+}
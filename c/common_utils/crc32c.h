@@ -0,0 +1,23 @@
+/**
+ * CRC-32C (Castagnoli) em C
+ * Usado para detectar registros corrompidos ou gravados pela metade em
+ * arquivos de log. Usa a instrução crc32 do SSE4.2 quando o compilador a
+ * habilita (-msse4.2 ou -march com SSE4.2); senão, uma tabela de 256 entradas.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Continua um CRC-32C sobre mais bytes
+ * @param crc Valor anterior (0 para começar)
+ * @param data Bytes a acumular
+ * @param size Quantidade de bytes
+ * @return CRC acumulado
+ */
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t size);
+
+#endif /* CRC32C_H */
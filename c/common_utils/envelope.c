@@ -0,0 +1,255 @@
+/**
+ * Implementação do codec de envelope
+ */
+
+#include "envelope.h"
+#include "msgpack_lite.h"
+#include <string.h>
+
+// Maior cabeçalho MessagePack (tipo + comprimento de 4 bytes) e maior escalar
+#define HEADER_MAX 5
+#define SCALAR_MAX 9
+
+void envelope_init(Envelope *envelope, const char *service, size_t length) {
+    envelope->service = service;
+    envelope->service_length = (uint32_t)length;
+    envelope->has_timestamp = 0;
+    envelope->has_clock = 0;
+    envelope->timestamp = 0;
+    envelope->clock = 0;
+    envelope->field_count = 0;
+}
+
+EnvelopeField *envelope_add(Envelope *envelope, const char *key, size_t length, EnvelopeType type) {
+    if (envelope->field_count == ENVELOPE_MAX_FIELDS) {
+        return NULL;
+    }
+    EnvelopeField *field = &envelope->fields[envelope->field_count++];
+    memset(field, 0, sizeof(*field));
+    field->key = key;
+    field->key_length = (uint32_t)length;
+    field->type = type;
+    return field;
+}
+
+int envelope_add_str(Envelope *envelope, const char *key, const char *value) {
+    EnvelopeField *field = envelope_add(envelope, key, strlen(key), ENVELOPE_STR);
+    if (!field) {
+        return ENVELOPE_TOO_MANY;
+    }
+    field->value.bytes.data = value;
+    field->value.bytes.length = (uint32_t)strlen(value);
+    return ENVELOPE_OK;
+}
+
+int envelope_add_uint(Envelope *envelope, const char *key, uint64_t value) {
+    EnvelopeField *field = envelope_add(envelope, key, strlen(key), ENVELOPE_UINT);
+    if (!field) {
+        return ENVELOPE_TOO_MANY;
+    }
+    field->value.uint = value;
+    return ENVELOPE_OK;
+}
+
+const EnvelopeField *envelope_get(const Envelope *envelope, const char *key, size_t length) {
+    for (uint32_t i = 0; i < envelope->field_count; i++) {
+        const EnvelopeField *field = &envelope->fields[i];
+        if (field->key_length == length && memcmp(field->key, key, length) == 0) {
+            return field;
+        }
+    }
+    return NULL;
+}
+
+static int key_equals(const char *key, uint32_t length, const char *name, size_t name_length) {
+    return length == name_length && memcmp(key, name, length) == 0;
+}
+
+/**
+ * Lê um valor de data no campo, pelo byte de tipo
+ */
+static int decode_value(MpReader *reader, EnvelopeField *field) {
+    uint8_t type = reader->data[reader->pos];
+    
+    if (type == 0xc0) {
+        field->type = ENVELOPE_NIL;
+        return mp_read_nil(reader);
+    }
+    if (type == 0xc2 || type == 0xc3) {
+        field->type = ENVELOPE_BOOL;
+        return mp_read_bool(reader, &field->value.boolean);
+    }
+    if (type <= 0x7f || (type >= 0xcc && type <= 0xcf)) {
+        field->type = ENVELOPE_UINT;
+        return mp_read_uint(reader, &field->value.uint);
+    }
+    if (type >= 0xe0 || (type >= 0xd0 && type <= 0xd3)) {
+        field->type = ENVELOPE_INT;
+        return mp_read_int(reader, &field->value.sint);
+    }
+    if (type == 0xca || type == 0xcb) {
+        field->type = ENVELOPE_DOUBLE;
+        return mp_read_double(reader, &field->value.real);
+    }
+    if ((type >= 0xa0 && type <= 0xbf) || (type >= 0xd9 && type <= 0xdb)) {
+        const char *str;
+        field->type = ENVELOPE_STR;
+        if (mp_read_str(reader, &str, &field->value.bytes.length) < 0) {
+            return MP_ERROR;
+        }
+        field->value.bytes.data = str;
+        return MP_OK;
+    }
+    if (type >= 0xc4 && type <= 0xc6) {
+        field->type = ENVELOPE_BIN;
+        return mp_read_bin(reader, &field->value.bytes.data, &field->value.bytes.length);
+    }
+    
+    // Mapas, arrays e ext: o objeto serializado, como veio
+    size_t start = reader->pos;
+    if (mp_skip(reader, MP_MAX_DEPTH) < 0) {
+        return MP_ERROR;
+    }
+    field->type = ENVELOPE_RAW;
+    field->value.bytes.data = reader->data + start;
+    field->value.bytes.length = (uint32_t)(reader->pos - start);
+    return MP_OK;
+}
+
+static int decode_data(Envelope *envelope, MpReader *reader) {
+    uint32_t count;
+    if (mp_read_map(reader, &count) < 0) {
+        return ENVELOPE_ERROR;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        const char *key;
+        uint32_t length;
+        if (mp_read_str(reader, &key, &length) < 0 || reader->pos == reader->size) {
+            return ENVELOPE_ERROR;
+        }
+        
+        // timestamp e clock vão para os campos próprios quando têm o tipo esperado
+        if (key_equals(key, length, "timestamp", 9) &&
+            mp_read_double(reader, &envelope->timestamp) == MP_OK) {
+            envelope->has_timestamp = 1;
+            continue;
+        }
+        if (key_equals(key, length, "clock", 5) &&
+            mp_read_uint(reader, &envelope->clock) == MP_OK) {
+            envelope->has_clock = 1;
+            continue;
+        }
+        
+        EnvelopeField *field = envelope_add(envelope, key, length, ENVELOPE_NIL);
+        if (!field) {
+            return ENVELOPE_TOO_MANY;
+        }
+        if (decode_value(reader, field) < 0) {
+            return ENVELOPE_ERROR;
+        }
+    }
+    return ENVELOPE_OK;
+}
+
+int envelope_decode(Envelope *envelope, const void *data, size_t size) {
+    envelope_init(envelope, NULL, 0);
+    
+    MpReader reader;
+    uint32_t count;
+    mp_reader_init(&reader, data, size);
+    if (mp_read_map(&reader, &count) < 0) {
+        return ENVELOPE_ERROR;
+    }
+    
+    int has_data = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const char *key;
+        uint32_t length;
+        if (mp_read_str(&reader, &key, &length) < 0) {
+            return ENVELOPE_ERROR;
+        }
+        
+        if (key_equals(key, length, "service", 7)) {
+            if (mp_read_str(&reader, &envelope->service, &envelope->service_length) < 0) {
+                return ENVELOPE_ERROR;
+            }
+        } else if (key_equals(key, length, "data", 4) && !has_data) {
+            int rc = decode_data(envelope, &reader);
+            if (rc != ENVELOPE_OK) {
+                return rc;
+            }
+            has_data = 1;
+        } else if (mp_skip(&reader, MP_MAX_DEPTH) < 0) {
+            return ENVELOPE_ERROR;
+        }
+    }
+    
+    return envelope->service && reader.pos == size ? ENVELOPE_OK : ENVELOPE_ERROR;
+}
+
+size_t envelope_max_size(const Envelope *envelope) {
+    // {service: ..., data: {...}} mais timestamp e clock
+    size_t size = 1 + (1 + 7) + HEADER_MAX + envelope->service_length + (1 + 4) + HEADER_MAX +
+                  (1 + 9) + SCALAR_MAX + (1 + 5) + SCALAR_MAX;
+    for (uint32_t i = 0; i < envelope->field_count; i++) {
+        const EnvelopeField *field = &envelope->fields[i];
+        size += HEADER_MAX + field->key_length;
+        switch (field->type) {
+            case ENVELOPE_STR:
+            case ENVELOPE_BIN:
+                size += HEADER_MAX + field->value.bytes.length;
+                break;
+            case ENVELOPE_RAW:
+                size += field->value.bytes.length;
+                break;
+            default:
+                size += SCALAR_MAX;
+        }
+    }
+    return size;
+}
+
+static void encode_value(MpWriter *writer, const EnvelopeField *field) {
+    switch (field->type) {
+        case ENVELOPE_NIL: mp_write_nil(writer); break;
+        case ENVELOPE_BOOL: mp_write_bool(writer, field->value.boolean); break;
+        case ENVELOPE_UINT: mp_write_uint(writer, field->value.uint); break;
+        case ENVELOPE_INT: mp_write_int(writer, field->value.sint); break;
+        case ENVELOPE_DOUBLE: mp_write_double(writer, field->value.real); break;
+        case ENVELOPE_STR:
+            mp_write_str(writer, (const char *)field->value.bytes.data, field->value.bytes.length);
+            break;
+        case ENVELOPE_BIN: mp_write_bin(writer, field->value.bytes.data, field->value.bytes.length); break;
+        case ENVELOPE_RAW: mp_write_raw(writer, field->value.bytes.data, field->value.bytes.length); break;
+        default: writer->error = 1;
+    }
+}
+
+size_t envelope_encode(const Envelope *envelope, void *buffer, size_t capacity) {
+    MpWriter writer;
+    mp_writer_init(&writer, buffer, capacity);
+    
+    mp_write_map(&writer, 2);
+    mp_write_str(&writer, "service", 7);
+    mp_write_str(&writer, envelope->service, envelope->service_length);
+    mp_write_str(&writer, "data", 4);
+    mp_write_map(&writer, envelope->field_count + (uint32_t)!!envelope->has_timestamp +
+                          (uint32_t)!!envelope->has_clock);
+    
+    for (uint32_t i = 0; i < envelope->field_count; i++) {
+        const EnvelopeField *field = &envelope->fields[i];
+        mp_write_str(&writer, field->key, field->key_length);
+        encode_value(&writer, field);
+    }
+    if (envelope->has_timestamp) {
+        mp_write_str(&writer, "timestamp", 9);
+        mp_write_double(&writer, envelope->timestamp);
+    }
+    if (envelope->has_clock) {
+        mp_write_str(&writer, "clock", 5);
+        mp_write_uint64(&writer, envelope->clock);
+    }
+    
+    return writer.error ? 0 : writer.pos;
+}
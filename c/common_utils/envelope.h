@@ -0,0 +1,110 @@
+/**
+ * Codec do envelope das mensagens do BBS em C
+ *
+ * Todas as mensagens e respostas têm a forma
+ *   {service: str, data: {..., timestamp: float64, clock: uint64}}
+ * envelope_decode lê esse mapa para uma estrutura fixa sem alocar e sem
+ * copiar: strings e binários apontam para o buffer recebido, e valores
+ * compostos (mapas, arrays, ext) ficam como o objeto serializado (RAW).
+ * envelope_encode escreve no buffer do chamador; o clock sai sempre como
+ * uint64 (9 bytes) para que o broker possa reescrevê-lo no lugar.
+ *
+ * Usado pelo broker (respostas de erro) e pelos bindings Python e Node
+ * (c/bindings), que fazem create_message/create_response/parse_message.
+ */
+
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ENVELOPE_MAX_FIELDS 32    // Campos de data além de timestamp e clock
+
+// Códigos de retorno
+#define ENVELOPE_OK 0
+#define ENVELOPE_ERROR -1         // Não é um envelope válido / não coube no buffer
+#define ENVELOPE_TOO_MANY -2      // data tem mais de ENVELOPE_MAX_FIELDS campos
+
+typedef enum {
+    ENVELOPE_NIL,
+    ENVELOPE_BOOL,
+    ENVELOPE_UINT,
+    ENVELOPE_INT,                 // Inteiro negativo
+    ENVELOPE_DOUBLE,
+    ENVELOPE_STR,
+    ENVELOPE_BIN,
+    ENVELOPE_RAW                  // Objeto MessagePack já serializado
+} EnvelopeType;
+
+typedef struct {
+    const char *key;              // Não terminada em '\0'
+    uint32_t key_length;
+    EnvelopeType type;
+    union {
+        int boolean;
+        uint64_t uint;
+        int64_t sint;
+        double real;
+        struct {
+            const void *data;
+            uint32_t length;
+        } bytes;                  // STR, BIN e RAW
+    } value;
+} EnvelopeField;
+
+typedef struct {
+    const char *service;
+    uint32_t service_length;
+    int has_timestamp;
+    int has_clock;
+    double timestamp;
+    uint64_t clock;
+    uint32_t field_count;
+    EnvelopeField fields[ENVELOPE_MAX_FIELDS];
+} Envelope;
+
+/**
+ * Inicializa um envelope vazio para o serviço
+ */
+void envelope_init(Envelope *envelope, const char *service, size_t length);
+
+/**
+ * Acrescenta um campo a data (os valores não são copiados)
+ * @return Campo a preencher (key e type já definidos), ou NULL se não há espaço
+ */
+EnvelopeField *envelope_add(Envelope *envelope, const char *key, size_t length, EnvelopeType type);
+
+/**
+ * Atalhos de envelope_add para os tipos mais usados
+ * @return ENVELOPE_OK ou ENVELOPE_TOO_MANY
+ */
+int envelope_add_str(Envelope *envelope, const char *key, const char *value);
+int envelope_add_uint(Envelope *envelope, const char *key, uint64_t value);
+
+/**
+ * Procura um campo de data pela chave (timestamp e clock ficam nos campos
+ * próprios da estrutura)
+ * @return Campo ou NULL
+ */
+const EnvelopeField *envelope_get(const Envelope *envelope, const char *key, size_t length);
+
+/**
+ * Lê um envelope serializado; os ponteiros apontam para dentro de data
+ * Chaves de primeiro nível além de service e data são ignoradas
+ * @return ENVELOPE_OK, ENVELOPE_ERROR ou ENVELOPE_TOO_MANY
+ */
+int envelope_decode(Envelope *envelope, const void *data, size_t size);
+
+/**
+ * Limite superior do tamanho serializado (para dimensionar o buffer)
+ */
+size_t envelope_max_size(const Envelope *envelope);
+
+/**
+ * Serializa o envelope no buffer
+ * @return Bytes escritos, ou 0 se não coube
+ */
+size_t envelope_encode(const Envelope *envelope, void *buffer, size_t capacity);
+
+#endif /* ENVELOPE_H */
@@ -0,0 +1,88 @@
+/**
+ * Implementação do histograma log-linear
+ */
+
+#include "histogram.h"
+#include <string.h>
+
+/**
+ * Bucket de um valor: os SUB_BITS bits abaixo do bit mais significativo
+ * escolhem a faixa dentro da potência de 2
+ */
+static int bucket_index(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+    
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    
+    int shift = msb - HISTOGRAM_SUB_BITS;
+    int sub = (int)((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+/**
+ * Maior valor que cai no bucket
+ */
+static uint64_t bucket_upper_bound(int index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t)(index % HISTOGRAM_SUB_BUCKETS);
+    uint64_t low = (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+void histogram_init(Histogram *histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+void histogram_record(Histogram *histogram, uint64_t value) {
+    histogram->counts[bucket_index(value)]++;
+    histogram->total++;
+    histogram->sum += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+void histogram_merge(Histogram *dest, const Histogram *src) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dest->counts[i] += src->counts[i];
+    }
+    dest->total += src->total;
+    dest->sum += src->sum;
+    if (src->max > dest->max) {
+        dest->max = src->max;
+    }
+}
+
+uint64_t histogram_percentile(const Histogram *histogram, double percentile) {
+    if (histogram->total == 0) {
+        return 0;
+    }
+    
+    // Posição (1-based) da amostra do percentil
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > histogram->total) rank = histogram->total;
+    
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            // O último bucket acumula valores acima do limite: usa o máximo real
+            uint64_t bound = bucket_upper_bound(i);
+            if (i == HISTOGRAM_BUCKETS - 1 || bound > histogram->max) {
+                return histogram->max;
+            }
+            return bound;
+        }
+    }
+    return histogram->max;
+}
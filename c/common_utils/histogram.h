@@ -0,0 +1,50 @@
+/**
+ * Histograma de latência log-linear (estilo HDR) em C
+ * Cada potência de 2 é dividida em HISTOGRAM_SUB_BUCKETS faixas lineares,
+ * o que dá erro relativo máximo de ~6% com memória fixa e registro O(1)
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40   // Valores acima de 2^40 são registrados no último bucket
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total;   // Quantidade de amostras
+    uint64_t sum;     // Soma dos valores (para média)
+    uint64_t max;     // Maior valor registrado
+} Histogram;
+
+/**
+ * Zera o histograma
+ * @param histogram Ponteiro para a estrutura Histogram
+ */
+void histogram_init(Histogram *histogram);
+
+/**
+ * Registra uma amostra
+ * @param histogram Ponteiro para a estrutura Histogram
+ * @param value Valor da amostra (ex: latência em microssegundos)
+ */
+void histogram_record(Histogram *histogram, uint64_t value);
+
+/**
+ * Soma as amostras de src em dest
+ */
+void histogram_merge(Histogram *dest, const Histogram *src);
+
+/**
+ * Valor abaixo do qual está a fração pedida das amostras
+ * @param histogram Ponteiro para a estrutura Histogram
+ * @param percentile Percentil entre 0 e 100 (ex: 99.9)
+ * @return Limite superior do bucket do percentil (0 se vazio)
+ */
+uint64_t histogram_percentile(const Histogram *histogram, double percentile);
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,44 @@
+/**
+ * Implementação do Relógio Lógico Híbrido (HLC)
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "hybrid_clock.h"
+#include <time.h>
+
+void hybrid_clock_init(HybridClock *clock) {
+    atomic_init(&clock->last, 0);
+}
+
+uint64_t hybrid_clock_wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/**
+ * Avança o relógio para max(último + 1, floor, físico << 16)
+ * floor = 0 para eventos locais, recebido + 1 para recepção
+ */
+static uint64_t hybrid_clock_advance(HybridClock *clock, uint64_t floor) {
+    uint64_t physical = hybrid_clock_pack(hybrid_clock_wall_ms(), 0);
+    if (physical < floor) {
+        physical = floor;
+    }
+    
+    uint64_t last = atomic_load_explicit(&clock->last, memory_order_relaxed);
+    uint64_t next;
+    do {
+        next = last + 1 > physical ? last + 1 : physical;
+    } while (!atomic_compare_exchange_weak_explicit(&clock->last, &last, next,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    return next;
+}
+
+uint64_t hybrid_clock_now(HybridClock *clock) {
+    return hybrid_clock_advance(clock, 0);
+}
+
+uint64_t hybrid_clock_update(HybridClock *clock, uint64_t received) {
+    return hybrid_clock_advance(clock, received == UINT64_MAX ? received : received + 1);
+}
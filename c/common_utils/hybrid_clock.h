@@ -0,0 +1,80 @@
+/**
+ * Relógio Lógico Híbrido (HLC) em C
+ * Um único uint64_t ordena eventos distribuídos e aproxima o tempo físico:
+ * os 48 bits altos são milissegundos desde a época Unix e os 16 bits baixos
+ * um contador lógico para eventos no mesmo milissegundo.
+ *
+ * Como o contador ocupa os bits baixos, as regras do HLC viram aritmética
+ * direta sobre o inteiro empacotado:
+ *   evento local / envio: t = max(último + 1, físico << 16)
+ *   recepção:             t = max(último + 1, recebido + 1, físico << 16)
+ * Se o contador passar de 65535 no mesmo milissegundo, o "vai um" avança o
+ * tempo físico em 1 ms (a ordem continua correta).
+ *
+ * Timestamps se comparam com um único <, e continuam sendo relógios de
+ * Lamport válidos (sempre crescentes e maiores que os recebidos). Ficam
+ * acima de 2^53, então só são exatos onde o inteiro tem 64 bits (C,
+ * Python); um Number do JavaScript guarda apenas uma aproximação.
+ */
+
+#ifndef HYBRID_CLOCK_H
+#define HYBRID_CLOCK_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define HYBRID_CLOCK_LOGICAL_BITS 16
+#define HYBRID_CLOCK_LOGICAL_MASK ((UINT64_C(1) << HYBRID_CLOCK_LOGICAL_BITS) - 1)
+#define HYBRID_CLOCK_PHYSICAL_MAX ((UINT64_C(1) << 48) - 1)
+
+typedef struct {
+    _Atomic uint64_t last;   // Último timestamp emitido (empacotado)
+} HybridClock;
+
+/**
+ * Empacota tempo físico (ms) e contador lógico em um timestamp
+ */
+static inline uint64_t hybrid_clock_pack(uint64_t physical_ms, uint16_t logical) {
+    return ((physical_ms & HYBRID_CLOCK_PHYSICAL_MAX) << HYBRID_CLOCK_LOGICAL_BITS) | logical;
+}
+
+/**
+ * Milissegundos desde a época Unix de um timestamp
+ */
+static inline uint64_t hybrid_clock_physical(uint64_t timestamp) {
+    return timestamp >> HYBRID_CLOCK_LOGICAL_BITS;
+}
+
+/**
+ * Contador lógico de um timestamp
+ */
+static inline uint16_t hybrid_clock_logical(uint64_t timestamp) {
+    return (uint16_t)(timestamp & HYBRID_CLOCK_LOGICAL_MASK);
+}
+
+/**
+ * Inicializa o relógio (nenhum timestamp emitido)
+ * @param clock Ponteiro para a estrutura HybridClock
+ */
+void hybrid_clock_init(HybridClock *clock);
+
+/**
+ * Tempo físico atual em milissegundos (CLOCK_REALTIME)
+ */
+uint64_t hybrid_clock_wall_ms(void);
+
+/**
+ * Timestamp para um evento local ou envio de mensagem
+ * Seguro para várias threads (CAS sobre o último timestamp)
+ * @return Novo timestamp, maior que todos os já emitidos por este relógio
+ */
+uint64_t hybrid_clock_now(HybridClock *clock);
+
+/**
+ * Atualiza o relógio ao receber uma mensagem
+ * @param received Timestamp recebido na mensagem
+ * @return Novo timestamp, maior que o recebido e que todos os já emitidos
+ */
+uint64_t hybrid_clock_update(HybridClock *clock, uint64_t received);
+
+#endif /* HYBRID_CLOCK_H */
@@ -0,0 +1,225 @@
+/**
+ * Implementação da tabela de internação
+ *
+ * Tabela hash de sondagem linear com os ids (id + 1; 0 = vazio) e um vetor
+ * de entradas indexado pelo id; o hash de cada nome fica na entrada, então
+ * crescer a tabela não relê os nomes.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "intern.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_MIN_SLOTS 64
+#define INTERN_CHUNK_SIZE (64u * 1024)  // Bloco de nomes
+
+typedef struct {
+    const char *name;
+    uint32_t length;
+    uint32_t hash;
+} InternEntry;
+
+typedef struct InternChunk {
+    struct InternChunk *next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} InternChunk;
+
+struct InternTable {
+    pthread_rwlock_t lock;
+    InternEntry *entries;         // Indexado pelo id
+    uint32_t count;
+    uint32_t entry_capacity;
+    uint32_t *slots;              // id + 1 (0 = vazio), potência de 2
+    uint32_t slot_capacity;
+    InternChunk *chunks;          // Bloco atual primeiro
+};
+
+static uint32_t name_hash(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+InternTable *intern_create(void) {
+    InternTable *table = calloc(1, sizeof(*table));
+    if (!table) {
+        return NULL;
+    }
+    table->slots = calloc(INTERN_MIN_SLOTS, sizeof(*table->slots));
+    if (!table->slots) {
+        free(table);
+        return NULL;
+    }
+    table->slot_capacity = INTERN_MIN_SLOTS;
+    pthread_rwlock_init(&table->lock, NULL);
+    return table;
+}
+
+void intern_destroy(InternTable *table) {
+    if (!table) {
+        return;
+    }
+    while (table->chunks) {
+        InternChunk *next = table->chunks->next;
+        free(table->chunks);
+        table->chunks = next;
+    }
+    pthread_rwlock_destroy(&table->lock);
+    free(table->entries);
+    free(table->slots);
+    free(table);
+}
+
+/**
+ * Slot do nome: o que contém o id dele ou o vazio onde ele entraria
+ * Chamado com o lock
+ */
+static uint32_t *find_slot(const InternTable *table, const char *name, size_t length, uint32_t hash) {
+    uint32_t mask = table->slot_capacity - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t *slot = &table->slots[i];
+        if (*slot == 0) {
+            return slot;
+        }
+        const InternEntry *entry = &table->entries[*slot - 1];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->name, name, length) == 0) {
+            return slot;
+        }
+    }
+}
+
+static int grow_slots(InternTable *table) {
+    uint32_t capacity = 2 * table->slot_capacity;
+    uint32_t *slots = calloc(capacity, sizeof(*slots));
+    if (!slots) {
+        return -1;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slot_capacity = capacity;
+    
+    uint32_t mask = capacity - 1;
+    for (uint32_t id = 0; id < table->count; id++) {
+        uint32_t i = table->entries[id].hash & mask;
+        while (slots[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = id + 1;
+    }
+    return 0;
+}
+
+/**
+ * Copia o nome (com '\0') para o bloco atual, abrindo outro se não couber
+ */
+static const char *store_name(InternTable *table, const char *name, size_t length) {
+    InternChunk *chunk = table->chunks;
+    if (!chunk || chunk->capacity - chunk->used < length + 1) {
+        size_t capacity = length + 1 > INTERN_CHUNK_SIZE ? length + 1 : INTERN_CHUNK_SIZE;
+        chunk = malloc(sizeof(*chunk) + capacity);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        chunk->next = table->chunks;
+        table->chunks = chunk;
+    }
+    
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    chunk->used += length + 1;
+    return copy;
+}
+
+uint32_t intern_find(InternTable *table, const char *name, size_t length) {
+    if (length > INTERN_MAX_NAME) {
+        return INTERN_NONE;
+    }
+    uint32_t hash = name_hash(name, length);
+    pthread_rwlock_rdlock(&table->lock);
+    uint32_t slot = *find_slot(table, name, length, hash);
+    pthread_rwlock_unlock(&table->lock);
+    return slot ? slot - 1 : INTERN_NONE;
+}
+
+uint32_t intern(InternTable *table, const char *name, size_t length) {
+    if (length > INTERN_MAX_NAME) {
+        errno = ENAMETOOLONG;
+        return INTERN_NONE;
+    }
+    uint32_t id = intern_find(table, name, length);
+    if (id != INTERN_NONE) {
+        return id;
+    }
+    
+    uint32_t hash = name_hash(name, length);
+    pthread_rwlock_wrlock(&table->lock);
+    uint32_t *slot = find_slot(table, name, length, hash);  // Outra thread pode ter criado
+    if (*slot) {
+        id = *slot - 1;
+        pthread_rwlock_unlock(&table->lock);
+        return id;
+    }
+    
+    if (table->count == INTERN_NONE - 1 ||
+        ((uint64_t)table->count + 1) * 4 > (uint64_t)table->slot_capacity * 3) {
+        if (table->count == INTERN_NONE - 1 || grow_slots(table) < 0) {
+            pthread_rwlock_unlock(&table->lock);
+            errno = ENOMEM;
+            return INTERN_NONE;
+        }
+        slot = find_slot(table, name, length, hash);
+    }
+    if (table->count == table->entry_capacity) {
+        uint32_t capacity = table->entry_capacity ? 2 * table->entry_capacity : INTERN_MIN_SLOTS;
+        InternEntry *entries = realloc(table->entries, capacity * sizeof(*entries));
+        if (!entries) {
+            pthread_rwlock_unlock(&table->lock);
+            errno = ENOMEM;
+            return INTERN_NONE;
+        }
+        table->entries = entries;
+        table->entry_capacity = capacity;
+    }
+    const char *copy = store_name(table, name, length);
+    if (!copy) {
+        pthread_rwlock_unlock(&table->lock);
+        errno = ENOMEM;
+        return INTERN_NONE;
+    }
+    
+    id = table->count++;
+    table->entries[id] = (InternEntry){ copy, (uint32_t)length, hash };
+    *slot = id + 1;
+    pthread_rwlock_unlock(&table->lock);
+    return id;
+}
+
+const char *intern_name(InternTable *table, uint32_t id, size_t *length) {
+    pthread_rwlock_rdlock(&table->lock);
+    const char *name = NULL;
+    if (id < table->count) {
+        name = table->entries[id].name;
+        if (length) {
+            *length = table->entries[id].length;
+        }
+    }
+    pthread_rwlock_unlock(&table->lock);
+    return name;
+}
+
+uint32_t intern_count(InternTable *table) {
+    pthread_rwlock_rdlock(&table->lock);
+    uint32_t count = table->count;
+    pthread_rwlock_unlock(&table->lock);
+    return count;
+}
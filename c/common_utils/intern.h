@@ -0,0 +1,59 @@
+/**
+ * Tabela de internação de nomes (usuários e canais) em C
+ *
+ * Cada nome distinto recebe um id denso de 32 bits (0, 1, 2...) na ordem em
+ * que aparece pela primeira vez: o nome fica guardado uma única vez e
+ * comparar dois nomes internados é comparar dois inteiros. Os nomes ficam
+ * em blocos que nunca mudam de lugar, então o ponteiro de intern_name vale
+ * até intern_destroy. Seguro para várias threads (rwlock: consultas de
+ * nomes já conhecidos não se bloqueiam).
+ *
+ * Os ids só valem para a tabela que os criou: quem grava ids (ver
+ * MP_EXT_NAME em msgpack_lite.h) grava também os nomes, na ordem dos ids,
+ * e os reinterna na mesma ordem ao carregar.
+ */
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define INTERN_NONE UINT32_MAX    // Nome desconhecido / erro
+#define INTERN_MAX_NAME 65535     // Nomes maiores são recusados
+
+typedef struct InternTable InternTable;
+
+/**
+ * Cria uma tabela vazia
+ * @return Tabela, ou NULL sem memória
+ */
+InternTable *intern_create(void);
+
+void intern_destroy(InternTable *table);
+
+/**
+ * Id do nome, criando-o se ainda não existe
+ * @return Id, ou INTERN_NONE com errno (ENAMETOOLONG, ENOMEM)
+ */
+uint32_t intern(InternTable *table, const char *name, size_t length);
+
+/**
+ * Id do nome, sem criar
+ * @return Id, ou INTERN_NONE se o nome não foi internado
+ */
+uint32_t intern_find(InternTable *table, const char *name, size_t length);
+
+/**
+ * Nome do id (terminado em '\0')
+ * @param length Recebe o tamanho (pode ser NULL)
+ * @return Nome, ou NULL se o id não existe
+ */
+const char *intern_name(InternTable *table, uint32_t id, size_t *length);
+
+/**
+ * Quantidade de nomes (próximo id)
+ */
+uint32_t intern_count(InternTable *table);
+
+#endif /* INTERN_H */
@@ -1,9 +1,18 @@
 /**
  * Implementação do Relógio Lógico de Lamport em C
+ * (versões com verificação de ponteiro nulo; ver logical_clock.h)
  */
 
 #include "logical_clock.h"
 #include <stdio.h>
+#include <limits.h>
+
+/**
+ * Converte para a API int, saturando em INT_MAX
+ */
+static int clamp_time(uint64_t value) {
+    return value > INT_MAX ? INT_MAX : (int)value;
+}
 
 /**
  * Inicializa o relógio lógico com contador em 0
@@ -13,7 +22,7 @@ void logical_clock_init(LogicalClock *clock) {
         fprintf(stderr, "Erro: ponteiro de relógio nulo\n");
         return;
     }
-    clock->counter = 0;
+    atomic_init(&clock->counter, 0);
 }
 
 /**
@@ -24,8 +33,7 @@ int logical_clock_increment(LogicalClock *clock) {
         fprintf(stderr, "Erro: ponteiro de relógio nulo\n");
         return -1;
     }
-    clock->counter++;
-    return clock->counter;
+    return clamp_time(logical_clock_tick(clock));
 }
 
 /**
@@ -38,10 +46,8 @@ int logical_clock_update(LogicalClock *clock, int received_time) {
         return -1;
     }
     
-    clock->counter = (clock->counter > received_time) ? clock->counter : received_time;
-    clock->counter++;
-    
-    return clock->counter;
+    uint64_t received = received_time > 0 ? (uint64_t)received_time : 0;
+    return clamp_time(logical_clock_merge(clock, received));
 }
 
 /**
@@ -52,5 +58,5 @@ int logical_clock_get_time(LogicalClock *clock) {
         fprintf(stderr, "Erro: ponteiro de relógio nulo\n");
         return -1;
     }
-    return clock->counter;
+    return clamp_time(logical_clock_now(clock));
 }
@@ -1,15 +1,54 @@
 /**
  * Relógio Lógico de Lamport em C
  * Implementa o contador lógico para sincronização de eventos distribuídos
+ *
+ * O contador é um inteiro atômico de 64 bits: o mesmo relógio pode ser
+ * usado por várias threads sem lock e não transborda em execuções longas.
+ * As funções logical_clock_tick/merge/now são inline e sem verificação de
+ * ponteiro nulo, para o caminho quente; as funções originais (int) continuam
+ * disponíveis e saturam em INT_MAX.
  */
 
 #ifndef LOGICAL_CLOCK_H
 #define LOGICAL_CLOCK_H
 
+#include <stdint.h>
+#include <stdatomic.h>
+
 typedef struct {
-    int counter;
+    _Atomic uint64_t counter;
 } LogicalClock;
 
+/**
+ * Incrementa o contador antes de enviar uma mensagem
+ * @return Novo valor do contador
+ */
+static inline uint64_t logical_clock_tick(LogicalClock *clock) {
+    return atomic_fetch_add_explicit(&clock->counter, 1, memory_order_relaxed) + 1;
+}
+
+/**
+ * Atualiza o relógio ao receber uma mensagem: max(atual, recebido) + 1
+ * A troca é feita por CAS; em disputa, recalcula com o valor mais novo
+ * @return Novo valor do contador
+ */
+static inline uint64_t logical_clock_merge(LogicalClock *clock, uint64_t received_time) {
+    uint64_t current = atomic_load_explicit(&clock->counter, memory_order_relaxed);
+    uint64_t next;
+    do {
+        next = (current > received_time ? current : received_time) + 1;
+    } while (!atomic_compare_exchange_weak_explicit(&clock->counter, &current, next,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    return next;
+}
+
+/**
+ * Retorna o valor atual do contador sem modificá-lo
+ */
+static inline uint64_t logical_clock_now(LogicalClock *clock) {
+    return atomic_load_explicit(&clock->counter, memory_order_relaxed);
+}
+
 /**
  * Inicializa o relógio lógico
  * @param clock Ponteiro para a estrutura LogicalClock
@@ -19,7 +58,7 @@ void logical_clock_init(LogicalClock *clock);
 /**
  * Incrementa o contador antes de enviar uma mensagem
  * @param clock Ponteiro para a estrutura LogicalClock
- * @return Novo valor do contador
+ * @return Novo valor do contador (-1 se clock é nulo)
  */
 int logical_clock_increment(LogicalClock *clock);
 
@@ -27,14 +66,14 @@ int logical_clock_increment(LogicalClock *clock);
  * Atualiza o relógio ao receber uma mensagem
  * @param clock Ponteiro para a estrutura LogicalClock
  * @param received_time Valor do relógio recebido na mensagem
- * @return Novo valor do contador
+ * @return Novo valor do contador (-1 se clock é nulo)
  */
 int logical_clock_update(LogicalClock *clock, int received_time);
 
 /**
  * Retorna o valor atual do contador sem modificá-lo
  * @param clock Ponteiro para a estrutura LogicalClock
- * @return Valor atual do contador
+ * @return Valor atual do contador (-1 se clock é nulo)
  */
 int logical_clock_get_time(LogicalClock *clock);
 
@@ -0,0 +1,637 @@
+/**
+ * Implementação do leitor/escritor MessagePack leve
+ */
+
+#include "msgpack_lite.h"
+#include <string.h>
+
+/**
+ * Lê inteiros big-endian (formato de rede do MessagePack)
+ */
+static uint64_t mp_load_be(const uint8_t *p, size_t n) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < n; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+/**
+ * Escreve inteiros big-endian
+ */
+static void mp_store_be(uint8_t *p, uint64_t value, size_t n) {
+    for (size_t i = n; i > 0; i--) {
+        p[i - 1] = (uint8_t)(value & 0xff);
+        value >>= 8;
+    }
+}
+
+/**
+ * Bytes ainda não consumidos pelo leitor
+ */
+static size_t mp_remaining(const MpReader *reader) {
+    return reader->size - reader->pos;
+}
+
+/**
+ * Consome n bytes, falhando se o buffer acabar antes
+ */
+static int mp_advance(MpReader *reader, uint64_t n) {
+    if (n > mp_remaining(reader)) {
+        return MP_ERROR;
+    }
+    reader->pos += (size_t)n;
+    return MP_OK;
+}
+
+/**
+ * Lê um campo de comprimento de n bytes logo após o byte de tipo
+ */
+static int mp_read_length(MpReader *reader, size_t n, uint64_t *length) {
+    if (n > mp_remaining(reader)) {
+        return MP_ERROR;
+    }
+    *length = mp_load_be(reader->data + reader->pos, n);
+    reader->pos += n;
+    return MP_OK;
+}
+
+/**
+ * Consome o cabeçalho de um objeto
+ * Escalares, strings, bin e ext são consumidos por inteiro; para mapas e
+ * arrays apenas o cabeçalho é lido e *children recebe o número de filhos
+ * (mapas contam chave e valor separadamente)
+ */
+static int mp_read_header(MpReader *reader, uint64_t *children) {
+    *children = 0;
+    
+    if (mp_remaining(reader) == 0) {
+        return MP_ERROR;
+    }
+    
+    uint8_t type = reader->data[reader->pos++];
+    uint64_t length = 0;
+    
+    // Formatos "fix" codificados no próprio byte de tipo
+    if (type <= 0x7f || type >= 0xe0) {
+        return MP_OK;                       // positive/negative fixint
+    }
+    if (type <= 0x8f) {
+        *children = 2u * (type & 0x0f);     // fixmap
+        return MP_OK;
+    }
+    if (type <= 0x9f) {
+        *children = type & 0x0f;            // fixarray
+        return MP_OK;
+    }
+    if (type <= 0xbf) {
+        return mp_advance(reader, type & 0x1f);  // fixstr
+    }
+    
+    switch (type) {
+        case 0xc0:                          // nil
+        case 0xc2:                          // false
+        case 0xc3:                          // true
+            return MP_OK;
+        
+        case 0xcc: case 0xd0: return mp_advance(reader, 1);  // uint8/int8
+        case 0xcd: case 0xd1: return mp_advance(reader, 2);  // uint16/int16
+        case 0xce: case 0xd2: case 0xca: return mp_advance(reader, 4);  // 32 bits
+        case 0xcf: case 0xd3: case 0xcb: return mp_advance(reader, 8);  // 64 bits
+        
+        case 0xd4: return mp_advance(reader, 1 + 1);   // fixext1
+        case 0xd5: return mp_advance(reader, 1 + 2);   // fixext2
+        case 0xd6: return mp_advance(reader, 1 + 4);   // fixext4
+        case 0xd7: return mp_advance(reader, 1 + 8);   // fixext8
+        case 0xd8: return mp_advance(reader, 1 + 16);  // fixext16
+        
+        case 0xc4: case 0xd9:               // bin8/str8
+            if (mp_read_length(reader, 1, &length) < 0) return MP_ERROR;
+            return mp_advance(reader, length);
+        case 0xc5: case 0xda:               // bin16/str16
+            if (mp_read_length(reader, 2, &length) < 0) return MP_ERROR;
+            return mp_advance(reader, length);
+        case 0xc6: case 0xdb:               // bin32/str32
+            if (mp_read_length(reader, 4, &length) < 0) return MP_ERROR;
+            return mp_advance(reader, length);
+        
+        case 0xc7:                          // ext8
+            if (mp_read_length(reader, 1, &length) < 0) return MP_ERROR;
+            return mp_advance(reader, length + 1);
+        case 0xc8:                          // ext16
+            if (mp_read_length(reader, 2, &length) < 0) return MP_ERROR;
+            return mp_advance(reader, length + 1);
+        case 0xc9:                          // ext32
+            if (mp_read_length(reader, 4, &length) < 0) return MP_ERROR;
+            return mp_advance(reader, length + 1);
+        
+        case 0xdc:                          // array16
+            return mp_read_length(reader, 2, children);
+        case 0xdd:                          // array32
+            return mp_read_length(reader, 4, children);
+        case 0xde:                          // map16
+            if (mp_read_length(reader, 2, &length) < 0) return MP_ERROR;
+            *children = 2 * length;
+            return MP_OK;
+        case 0xdf:                          // map32
+            if (mp_read_length(reader, 4, &length) < 0) return MP_ERROR;
+            *children = 2 * length;
+            return MP_OK;
+        
+        default:                            // 0xc1 (nunca usado)
+            return MP_ERROR;
+    }
+}
+
+void mp_reader_init(MpReader *reader, const void *data, size_t size) {
+    reader->data = (const uint8_t *)data;
+    reader->size = data ? size : 0;
+    reader->pos = 0;
+}
+
+int mp_skip(MpReader *reader, int max_depth) {
+    // Pilha explícita de filhos pendentes por nível: sem recursão e sem
+    // alocação, com profundidade limitada
+    uint64_t pending[MP_MAX_DEPTH + 1];
+    int depth = 0;
+    
+    if (max_depth > MP_MAX_DEPTH) {
+        max_depth = MP_MAX_DEPTH;
+    }
+    
+    pending[0] = 1;
+    while (depth >= 0) {
+        if (pending[depth] == 0) {
+            depth--;
+            continue;
+        }
+        pending[depth]--;
+        
+        uint64_t children;
+        if (mp_read_header(reader, &children) < 0) {
+            return MP_ERROR;
+        }
+        
+        if (children > 0) {
+            // Cada filho ocupa pelo menos 1 byte: contagens maiores que o
+            // restante do buffer são rejeitadas antes de qualquer iteração
+            if (depth >= max_depth || children > mp_remaining(reader)) {
+                return MP_ERROR;
+            }
+            pending[++depth] = children;
+        }
+    }
+    
+    return MP_OK;
+}
+
+int mp_validate(const void *data, size_t size, int max_depth) {
+    if (!data || size == 0) {
+        return 0;
+    }
+    
+    MpReader reader;
+    mp_reader_init(&reader, data, size);
+    
+    if (mp_skip(&reader, max_depth) < 0) {
+        return 0;
+    }
+    
+    // Um frame deve conter exatamente um objeto
+    return reader.pos == reader.size;
+}
+
+int mp_read_map(MpReader *reader, uint32_t *count) {
+    if (mp_remaining(reader) == 0) {
+        return MP_ERROR;
+    }
+    
+    uint8_t type = reader->data[reader->pos];
+    uint64_t length;
+    if (type >= 0x80 && type <= 0x8f) {
+        reader->pos++;
+        *count = type & 0x0f;
+        return MP_OK;
+    }
+    if (type != 0xde && type != 0xdf) {
+        return MP_ERROR;
+    }
+    
+    reader->pos++;
+    if (mp_read_length(reader, type == 0xde ? 2 : 4, &length) < 0) {
+        return MP_ERROR;
+    }
+    *count = (uint32_t)length;
+    return MP_OK;
+}
+
+int mp_read_array(MpReader *reader, uint32_t *count) {
+    if (mp_remaining(reader) == 0) {
+        return MP_ERROR;
+    }
+    
+    uint8_t type = reader->data[reader->pos];
+    uint64_t length;
+    if (type >= 0x90 && type <= 0x9f) {
+        reader->pos++;
+        *count = type & 0x0f;
+        return MP_OK;
+    }
+    if (type != 0xdc && type != 0xdd) {
+        return MP_ERROR;
+    }
+    
+    reader->pos++;
+    if (mp_read_length(reader, type == 0xdc ? 2 : 4, &length) < 0) {
+        reader->pos--;
+        return MP_ERROR;
+    }
+    *count = (uint32_t)length;
+    return MP_OK;
+}
+
+int mp_read_str(MpReader *reader, const char **str, uint32_t *length) {
+    if (mp_remaining(reader) == 0) {
+        return MP_ERROR;
+    }
+    
+    size_t start = reader->pos;
+    uint8_t type = reader->data[reader->pos++];
+    uint64_t size;
+    if (type >= 0xa0 && type <= 0xbf) {
+        size = type & 0x1f;
+    } else if (type >= 0xd9 && type <= 0xdb) {
+        size_t n = (size_t)1 << (type - 0xd9);  // 1, 2 ou 4 bytes de comprimento
+        if (mp_read_length(reader, n, &size) < 0) {
+            reader->pos = start;
+            return MP_ERROR;
+        }
+    } else {
+        reader->pos = start;
+        return MP_ERROR;
+    }
+    
+    if (size > mp_remaining(reader)) {
+        reader->pos = start;
+        return MP_ERROR;
+    }
+    *str = (const char *)reader->data + reader->pos;
+    *length = (uint32_t)size;
+    reader->pos += (size_t)size;
+    return MP_OK;
+}
+
+int mp_find_key(MpReader *reader, uint32_t count, const char *key, size_t key_length, int max_depth) {
+    for (uint32_t i = 0; i < count; i++) {
+        const char *name;
+        uint32_t length;
+        if (mp_read_str(reader, &name, &length) == MP_OK) {
+            if (length == key_length && memcmp(name, key, key_length) == 0) {
+                return MP_OK;
+            }
+        } else if (mp_skip(reader, max_depth) < 0) {
+            return MP_ERROR;  // Chave não-string malformada
+        }
+        
+        if (mp_skip(reader, max_depth) < 0) {
+            return MP_ERROR;
+        }
+    }
+    return MP_ERROR;
+}
+
+/**
+ * Largura do valor de um inteiro sem sinal pelo byte de tipo
+ * Retorna 0 para positive fixint (valor no próprio byte) e -1 se não é uint
+ */
+static int mp_uint_width(uint8_t type) {
+    if (type <= 0x7f) return 0;
+    if (type >= 0xcc && type <= 0xcf) return 1 << (type - 0xcc);  // 1, 2, 4 ou 8 bytes
+    return -1;
+}
+
+int mp_read_uint(MpReader *reader, uint64_t *value) {
+    if (mp_remaining(reader) == 0) {
+        return MP_ERROR;
+    }
+    
+    uint8_t type = reader->data[reader->pos];
+    int width = mp_uint_width(type);
+    if (width < 0 || 1 + (size_t)width > mp_remaining(reader)) {
+        return MP_ERROR;
+    }
+    
+    *value = width == 0 ? type : mp_load_be(reader->data + reader->pos + 1, (size_t)width);
+    reader->pos += 1 + (size_t)width;
+    return MP_OK;
+}
+
+int mp_read_int(MpReader *reader, int64_t *value) {
+    if (mp_remaining(reader) == 0) {
+        return MP_ERROR;
+    }
+    
+    uint8_t type = reader->data[reader->pos];
+    if (type >= 0xe0) {
+        *value = (int8_t)type;  // negative fixint
+        reader->pos++;
+        return MP_OK;
+    }
+    if (type >= 0xd0 && type <= 0xd3) {
+        size_t width = (size_t)1 << (type - 0xd0);  // 1, 2, 4 ou 8 bytes
+        if (1 + width > mp_remaining(reader)) {
+            return MP_ERROR;
+        }
+        uint64_t bits = mp_load_be(reader->data + reader->pos + 1, width);
+        // Estende o sinal do valor de width bytes
+        uint64_t sign = (uint64_t)1 << (8 * width - 1);
+        *value = width == 8 ? (int64_t)bits : (int64_t)((bits ^ sign) - sign);
+        reader->pos += 1 + width;
+        return MP_OK;
+    }
+    
+    size_t start = reader->pos;
+    uint64_t unsigned_value;
+    if (mp_read_uint(reader, &unsigned_value) < 0) {
+        return MP_ERROR;
+    }
+    if (unsigned_value > INT64_MAX) {
+        reader->pos = start;
+        return MP_ERROR;
+    }
+    *value = (int64_t)unsigned_value;
+    return MP_OK;
+}
+
+int mp_read_double(MpReader *reader, double *value) {
+    if (mp_remaining(reader) == 0) {
+        return MP_ERROR;
+    }
+    
+    uint8_t type = reader->data[reader->pos];
+    size_t width = type == 0xca ? 4 : type == 0xcb ? 8 : 0;
+    if (width == 0 || 1 + width > mp_remaining(reader)) {
+        return MP_ERROR;
+    }
+    
+    uint64_t bits = mp_load_be(reader->data + reader->pos + 1, width);
+    if (width == 4) {
+        uint32_t bits32 = (uint32_t)bits;
+        float single;
+        memcpy(&single, &bits32, sizeof(single));
+        *value = single;
+    } else {
+        memcpy(value, &bits, sizeof(*value));
+    }
+    reader->pos += 1 + width;
+    return MP_OK;
+}
+
+int mp_read_bool(MpReader *reader, int *value) {
+    if (mp_remaining(reader) == 0) {
+        return MP_ERROR;
+    }
+    uint8_t type = reader->data[reader->pos];
+    if (type != 0xc2 && type != 0xc3) {
+        return MP_ERROR;
+    }
+    *value = type == 0xc3;
+    reader->pos++;
+    return MP_OK;
+}
+
+int mp_read_nil(MpReader *reader) {
+    if (mp_remaining(reader) == 0 || reader->data[reader->pos] != 0xc0) {
+        return MP_ERROR;
+    }
+    reader->pos++;
+    return MP_OK;
+}
+
+int mp_read_bin(MpReader *reader, const void **bin, uint32_t *length) {
+    if (mp_remaining(reader) == 0) {
+        return MP_ERROR;
+    }
+    
+    size_t start = reader->pos;
+    uint8_t type = reader->data[reader->pos++];
+    uint64_t size;
+    if (type < 0xc4 || type > 0xc6 ||
+        mp_read_length(reader, (size_t)1 << (type - 0xc4), &size) < 0 ||
+        size > mp_remaining(reader)) {
+        reader->pos = start;
+        return MP_ERROR;
+    }
+    *bin = reader->data + reader->pos;
+    *length = (uint32_t)size;
+    reader->pos += (size_t)size;
+    return MP_OK;
+}
+
+int mp_read_ext(MpReader *reader, int8_t *type, const void **data, uint32_t *length) {
+    if (mp_remaining(reader) == 0) {
+        return MP_ERROR;
+    }
+    
+    size_t start = reader->pos;
+    uint8_t format = reader->data[reader->pos++];
+    uint64_t size;
+    if (format >= 0xd4 && format <= 0xd8) {
+        size = (uint64_t)1 << (format - 0xd4);  // fixext1..16
+    } else if (format < 0xc7 || format > 0xc9 ||
+               mp_read_length(reader, (size_t)1 << (format - 0xc7), &size) < 0) {
+        reader->pos = start;
+        return MP_ERROR;
+    }
+    if (size + 1 > mp_remaining(reader)) {
+        reader->pos = start;
+        return MP_ERROR;
+    }
+    *type = (int8_t)reader->data[reader->pos];
+    *data = reader->data + reader->pos + 1;
+    *length = (uint32_t)size;
+    reader->pos += 1 + (size_t)size;
+    return MP_OK;
+}
+
+int mp_read_name_id(MpReader *reader, uint32_t *id) {
+    size_t start = reader->pos;
+    int8_t type;
+    const void *data;
+    uint32_t length;
+    if (mp_read_ext(reader, &type, &data, &length) != MP_OK) {
+        return MP_ERROR;
+    }
+    if (type != MP_EXT_NAME || length != 4) {
+        reader->pos = start;
+        return MP_ERROR;
+    }
+    *id = (uint32_t)mp_load_be(data, 4);
+    return MP_OK;
+}
+
+int mp_patch_uint(void *object, size_t size, uint64_t value) {
+    uint8_t *p = (uint8_t *)object;
+    int width = size > 0 ? mp_uint_width(p[0]) : -1;
+    if (width < 0 || 1 + (size_t)width > size) {
+        return MP_ERROR;
+    }
+    
+    if (width == 0) {
+        if (value > 0x7f) return MP_ERROR;
+        p[0] = (uint8_t)value;
+        return MP_OK;
+    }
+    if (width < 8 && value >> (8 * width) != 0) {
+        return MP_ERROR;
+    }
+    mp_store_be(p + 1, value, (size_t)width);
+    return MP_OK;
+}
+
+void mp_writer_init(MpWriter *writer, void *data, size_t capacity) {
+    writer->data = (uint8_t *)data;
+    writer->capacity = data ? capacity : 0;
+    writer->pos = 0;
+    writer->error = 0;
+}
+
+/**
+ * Escreve um byte de tipo seguido de um valor big-endian de n bytes
+ */
+static int mp_write_header(MpWriter *writer, uint8_t type, uint64_t value, size_t n) {
+    if (writer->error || writer->capacity - writer->pos < 1 + n) {
+        writer->error = 1;
+        return MP_ERROR;
+    }
+    writer->data[writer->pos++] = type;
+    mp_store_be(writer->data + writer->pos, value, n);
+    writer->pos += n;
+    return MP_OK;
+}
+
+int mp_write_map(MpWriter *writer, uint32_t count) {
+    if (count <= 15) return mp_write_header(writer, (uint8_t)(0x80 | count), 0, 0);
+    if (count <= 0xffff) return mp_write_header(writer, 0xde, count, 2);
+    return mp_write_header(writer, 0xdf, count, 4);
+}
+
+int mp_write_array(MpWriter *writer, uint32_t count) {
+    if (count <= 15) return mp_write_header(writer, (uint8_t)(0x90 | count), 0, 0);
+    if (count <= 0xffff) return mp_write_header(writer, 0xdc, count, 2);
+    return mp_write_header(writer, 0xdd, count, 4);
+}
+
+int mp_write_str(MpWriter *writer, const char *str, size_t length) {
+    int rc;
+    if (length <= 31) rc = mp_write_header(writer, (uint8_t)(0xa0 | length), 0, 0);
+    else if (length <= 0xff) rc = mp_write_header(writer, 0xd9, length, 1);
+    else if (length <= 0xffff) rc = mp_write_header(writer, 0xda, length, 2);
+    else if (length <= 0xffffffffu) rc = mp_write_header(writer, 0xdb, length, 4);
+    else rc = MP_ERROR;
+    
+    if (rc < 0 || writer->capacity - writer->pos < length) {
+        writer->error = 1;
+        return MP_ERROR;
+    }
+    memcpy(writer->data + writer->pos, str, length);
+    writer->pos += length;
+    return MP_OK;
+}
+
+int mp_write_uint(MpWriter *writer, uint64_t value) {
+    if (value <= 0x7f) return mp_write_header(writer, (uint8_t)value, 0, 0);
+    if (value <= 0xff) return mp_write_header(writer, 0xcc, value, 1);
+    if (value <= 0xffff) return mp_write_header(writer, 0xcd, value, 2);
+    if (value <= 0xffffffffu) return mp_write_header(writer, 0xce, value, 4);
+    return mp_write_header(writer, 0xcf, value, 8);
+}
+
+int mp_write_uint64(MpWriter *writer, uint64_t value) {
+    return mp_write_header(writer, 0xcf, value, 8);
+}
+
+int mp_write_int(MpWriter *writer, int64_t value) {
+    if (value >= 0) return mp_write_uint(writer, (uint64_t)value);
+    if (value >= -32) return mp_write_header(writer, (uint8_t)value, 0, 0);  // negative fixint
+    if (value >= INT8_MIN) return mp_write_header(writer, 0xd0, (uint64_t)value & 0xff, 1);
+    if (value >= INT16_MIN) return mp_write_header(writer, 0xd1, (uint64_t)value & 0xffff, 2);
+    if (value >= INT32_MIN) return mp_write_header(writer, 0xd2, (uint64_t)value & 0xffffffffu, 4);
+    return mp_write_header(writer, 0xd3, (uint64_t)value, 8);
+}
+
+int mp_write_double(MpWriter *writer, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return mp_write_header(writer, 0xcb, bits, 8);
+}
+
+int mp_write_bool(MpWriter *writer, int value) {
+    return mp_write_header(writer, value ? 0xc3 : 0xc2, 0, 0);
+}
+
+int mp_write_nil(MpWriter *writer) {
+    return mp_write_header(writer, 0xc0, 0, 0);
+}
+
+/**
+ * Copia length bytes para a saída
+ */
+static int mp_write_bytes(MpWriter *writer, const void *data, size_t length) {
+    if (writer->error || writer->capacity - writer->pos < length) {
+        writer->error = 1;
+        return MP_ERROR;
+    }
+    if (length > 0) {
+        memcpy(writer->data + writer->pos, data, length);
+    }
+    writer->pos += length;
+    return MP_OK;
+}
+
+int mp_write_bin(MpWriter *writer, const void *data, size_t length) {
+    int rc;
+    if (length <= 0xff) rc = mp_write_header(writer, 0xc4, length, 1);
+    else if (length <= 0xffff) rc = mp_write_header(writer, 0xc5, length, 2);
+    else if (length <= 0xffffffffu) rc = mp_write_header(writer, 0xc6, length, 4);
+    else rc = MP_ERROR;
+    
+    if (rc < 0) {
+        writer->error = 1;
+        return MP_ERROR;
+    }
+    return mp_write_bytes(writer, data, length);
+}
+
+int mp_write_ext(MpWriter *writer, int8_t type, const void *data, size_t length) {
+    int rc;
+    switch (length) {
+        case 1: rc = mp_write_header(writer, 0xd4, (uint8_t)type, 1); break;
+        case 2: rc = mp_write_header(writer, 0xd5, (uint8_t)type, 1); break;
+        case 4: rc = mp_write_header(writer, 0xd6, (uint8_t)type, 1); break;
+        case 8: rc = mp_write_header(writer, 0xd7, (uint8_t)type, 1); break;
+        case 16: rc = mp_write_header(writer, 0xd8, (uint8_t)type, 1); break;
+        default:
+            // Comprimento e tipo juntos: ext8/16/32 [comprimento][tipo]
+            if (length <= 0xff) rc = mp_write_header(writer, 0xc7, (uint64_t)length << 8 | (uint8_t)type, 2);
+            else if (length <= 0xffff) rc = mp_write_header(writer, 0xc8, (uint64_t)length << 8 | (uint8_t)type, 3);
+            else if (length <= 0xffffffffu) rc = mp_write_header(writer, 0xc9, (uint64_t)length << 8 | (uint8_t)type, 5);
+            else rc = MP_ERROR;
+    }
+    
+    if (rc < 0) {
+        writer->error = 1;
+        return MP_ERROR;
+    }
+    return mp_write_bytes(writer, data, length);
+}
+
+int mp_write_name_id(MpWriter *writer, uint32_t id) {
+    uint8_t data[4];
+    mp_store_be(data, id, 4);
+    return mp_write_ext(writer, MP_EXT_NAME, data, 4);
+}
+
+int mp_write_raw(MpWriter *writer, const void *data, size_t length) {
+    return mp_write_bytes(writer, data, length);
+}
@@ -0,0 +1,227 @@
+/**
+ * Leitor/escritor MessagePack leve em C
+ * Percorre o buffer serializado diretamente, sem montar árvore de objetos
+ * e sem alocar memória. Usado pelo broker para validar e inspecionar frames
+ * e para montar respostas curtas em buffers fornecidos pelo chamador.
+ */
+
+#ifndef MSGPACK_LITE_H
+#define MSGPACK_LITE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Profundidade máxima de aninhamento aceita (mapas/arrays dentro de mapas/arrays)
+#define MP_MAX_DEPTH 32
+
+// Códigos de retorno
+#define MP_OK 0
+#define MP_ERROR -1
+
+// Tipo de extensão com o id de um nome internado (intern.h): fixext4 com o
+// id em big-endian, 6 bytes em vez do nome. Só faz sentido para quem tem a
+// mesma tabela (o id é local a ela)
+#define MP_EXT_NAME 1
+
+typedef struct {
+    const uint8_t *data;  // Início do buffer (não pertence ao leitor)
+    size_t size;          // Tamanho total do buffer
+    size_t pos;           // Posição atual de leitura
+} MpReader;
+
+typedef struct {
+    uint8_t *data;        // Buffer de saída (não pertence ao escritor)
+    size_t capacity;      // Capacidade do buffer
+    size_t pos;           // Bytes já escritos
+    int error;            // 1 se alguma escrita não coube no buffer
+} MpWriter;
+
+/**
+ * Inicializa um leitor sobre um buffer MessagePack
+ * @param reader Ponteiro para a estrutura MpReader
+ * @param data Buffer serializado
+ * @param size Tamanho do buffer em bytes
+ */
+void mp_reader_init(MpReader *reader, const void *data, size_t size);
+
+/**
+ * Pula um objeto completo (incluindo filhos de mapas/arrays)
+ * Trabalho é linear no tamanho do buffer: todo comprimento declarado é
+ * conferido contra os bytes restantes antes de ser aceito
+ * @param reader Ponteiro para a estrutura MpReader
+ * @param max_depth Profundidade máxima de aninhamento (limitada a MP_MAX_DEPTH)
+ * @return MP_OK se o objeto é estruturalmente válido, MP_ERROR caso contrário
+ */
+int mp_skip(MpReader *reader, int max_depth);
+
+/**
+ * Verifica se o buffer contém exatamente um objeto MessagePack válido
+ * @param data Buffer serializado
+ * @param size Tamanho do buffer em bytes
+ * @param max_depth Profundidade máxima de aninhamento
+ * @return 1 se válido, 0 se inválido (truncado, malformado ou com bytes extras)
+ */
+int mp_validate(const void *data, size_t size, int max_depth);
+
+/**
+ * Lê o cabeçalho de um mapa
+ * @param count Recebe o número de pares chave/valor
+ * @return MP_OK ou MP_ERROR se o objeto atual não é um mapa
+ */
+int mp_read_map(MpReader *reader, uint32_t *count);
+
+/**
+ * Lê o cabeçalho de um array
+ * @param count Recebe o número de elementos
+ * @return MP_OK ou MP_ERROR se o objeto atual não é um array
+ */
+int mp_read_array(MpReader *reader, uint32_t *count);
+
+/**
+ * Lê uma string sem copiá-la: *str aponta para dentro do buffer original
+ * (não terminada em '\0')
+ * @return MP_OK ou MP_ERROR se o objeto atual não é uma string
+ */
+int mp_read_str(MpReader *reader, const char **str, uint32_t *length);
+
+/**
+ * Procura uma chave string entre os count pares de um mapa cujo cabeçalho
+ * acabou de ser lido; pula os valores das demais chaves sem decodificá-los
+ * @return MP_OK com o leitor posicionado no valor, ou MP_ERROR se não encontrou
+ */
+int mp_find_key(MpReader *reader, uint32_t count, const char *key, size_t key_length, int max_depth);
+
+/**
+ * Lê um inteiro não negativo (positive fixint ou uint8/16/32/64)
+ * @return MP_OK ou MP_ERROR se o objeto atual não é um inteiro sem sinal
+ */
+int mp_read_uint(MpReader *reader, uint64_t *value);
+
+/**
+ * Lê um inteiro com sinal (negative fixint, int8/16/32/64; também aceita
+ * inteiros sem sinal que cabem em int64)
+ * @return MP_OK ou MP_ERROR se o objeto atual não é um inteiro representável
+ */
+int mp_read_int(MpReader *reader, int64_t *value);
+
+/**
+ * Lê um número de ponto flutuante (float32 ou float64)
+ * @return MP_OK ou MP_ERROR se o objeto atual não é float
+ */
+int mp_read_double(MpReader *reader, double *value);
+
+/**
+ * Lê um booleano
+ * @return MP_OK ou MP_ERROR se o objeto atual não é true/false
+ */
+int mp_read_bool(MpReader *reader, int *value);
+
+/**
+ * Consome um nil
+ * @return MP_OK ou MP_ERROR se o objeto atual não é nil
+ */
+int mp_read_nil(MpReader *reader);
+
+/**
+ * Lê um binário sem copiá-lo: *bin aponta para dentro do buffer original
+ * @return MP_OK ou MP_ERROR se o objeto atual não é bin8/16/32
+ */
+int mp_read_bin(MpReader *reader, const void **bin, uint32_t *length);
+
+/**
+ * Lê uma extensão sem copiá-la: *data aponta para dentro do buffer original
+ * @return MP_OK ou MP_ERROR se o objeto atual não é fixext/ext8/16/32
+ */
+int mp_read_ext(MpReader *reader, int8_t *type, const void **data, uint32_t *length);
+
+/**
+ * Lê o id de um nome internado (extensão MP_EXT_NAME)
+ * @return MP_OK ou MP_ERROR se o objeto atual não é um MP_EXT_NAME
+ */
+int mp_read_name_id(MpReader *reader, uint32_t *id);
+
+/**
+ * Reescreve no lugar o inteiro sem sinal que começa em object, mantendo a
+ * largura da codificação original (o buffer não é remontado)
+ * @param size Bytes disponíveis a partir de object
+ * @return MP_OK, ou MP_ERROR se não é um inteiro sem sinal ou o valor não cabe
+ */
+int mp_patch_uint(void *object, size_t size, uint64_t value);
+
+/**
+ * Inicializa um escritor sobre um buffer fornecido pelo chamador
+ * As funções mp_write_* retornam MP_ERROR se o valor não couber; o erro
+ * fica registrado em writer->error, então basta conferi-lo no final
+ * @param writer Ponteiro para a estrutura MpWriter
+ * @param data Buffer de saída
+ * @param capacity Capacidade do buffer em bytes
+ */
+void mp_writer_init(MpWriter *writer, void *data, size_t capacity);
+
+/**
+ * Escreve o cabeçalho de um mapa com count pares chave/valor
+ */
+int mp_write_map(MpWriter *writer, uint32_t count);
+
+/**
+ * Escreve o cabeçalho de um array com count elementos
+ */
+int mp_write_array(MpWriter *writer, uint32_t count);
+
+/**
+ * Escreve uma string UTF-8 (str8/16/32 ou fixstr)
+ */
+int mp_write_str(MpWriter *writer, const char *str, size_t length);
+
+/**
+ * Escreve um inteiro sem sinal na codificação mais compacta
+ */
+int mp_write_uint(MpWriter *writer, uint64_t value);
+
+/**
+ * Escreve um inteiro sem sinal sempre como uint64 (9 bytes), para que possa
+ * ser reescrito no lugar com qualquer valor (mp_patch_uint)
+ */
+int mp_write_uint64(MpWriter *writer, uint64_t value);
+
+/**
+ * Escreve um inteiro com sinal na codificação mais compacta
+ */
+int mp_write_int(MpWriter *writer, int64_t value);
+
+/**
+ * Escreve um número de ponto flutuante (float64)
+ */
+int mp_write_double(MpWriter *writer, double value);
+
+/**
+ * Escreve true ou false
+ */
+int mp_write_bool(MpWriter *writer, int value);
+
+/**
+ * Escreve nil
+ */
+int mp_write_nil(MpWriter *writer);
+
+/**
+ * Escreve um binário (bin8/16/32)
+ */
+int mp_write_bin(MpWriter *writer, const void *data, size_t length);
+
+/**
+ * Escreve uma extensão (fixext quando o tamanho permite, senão ext8/16/32)
+ */
+int mp_write_ext(MpWriter *writer, int8_t type, const void *data, size_t length);
+
+/**
+ * Escreve o id de um nome internado (extensão MP_EXT_NAME)
+ */
+int mp_write_name_id(MpWriter *writer, uint32_t id);
+
+/**
+ * Copia um objeto já serializado (não é conferido)
+ */
+int mp_write_raw(MpWriter *writer, const void *data, size_t length);
+
+#endif /* MSGPACK_LITE_H */
@@ -0,0 +1,852 @@
+/**
+ * Implementação do transporte de replicação em lotes
+ *
+ * O log em memória é um anel de registros (posições base..end-1) protegido
+ * pelo lock, assim como as posições de cada peer. Os sockets só são usados
+ * pela thread dona: os DEALER pela thread de envio (que também os cria e
+ * fecha quando repl_set_peers muda a lista) e o ROUTER pela de recepção.
+ * repl_send só copia o registro e acorda a thread de envio por um pipe.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "replication.h"
+#include "../common_utils/msgpack_lite.h"
+#include <zmq.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPL_MAX_WINDOW 64
+#define REPL_MAX_SOURCES 64        // Origens acompanhadas pela recepção
+#define REPL_BATCH_OVERHEAD 160    // Chaves e números do lote, fora a origem e os registros
+#define REPL_ACK_SIZE 128
+#define REPL_RECV_POLL_MS 100      // Intervalo para a recepção notar repl_close
+#define REPL_MAX_DEPTH 8
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} ReplRecord;
+
+typedef struct {
+    uint64_t batch;
+    uint64_t end;                  // Posição seguinte ao último registro do lote
+    uint64_t sent_ns;
+} InFlight;
+
+typedef struct {
+    char name[REPL_NAME_SIZE];
+    char endpoint[REPL_ENDPOINT_SIZE];
+    void *socket;                  // DEALER (thread de envio; NULL = ainda não conectado)
+    int removed;                   // Fora da lista: a thread de envio fecha o socket
+    uint64_t next;                 // Próxima posição a enviar
+    uint64_t acked;                // Próxima posição que o peer espera
+    int resync;                    // Registros antes de next foram descartados sem ack
+    uint64_t batch;                // Último lote enviado
+    uint64_t rewind_batch;         // Acks de lotes anteriores a este são ignorados
+    InFlight inflight[REPL_MAX_WINDOW];
+    int inflight_head;
+    int inflight_count;
+} Peer;
+
+typedef struct {
+    char name[REPL_NAME_SIZE];
+    uint64_t epoch;
+    uint64_t next;                 // Próxima posição esperada da origem
+    uint64_t seen_ns;              // Último lote (substituição com a tabela cheia)
+} Source;
+
+struct ReplLink {
+    char name[REPL_NAME_SIZE];
+    ReplOptions options;
+    uint64_t epoch;
+    ReplApplyFn apply;
+    ReplResyncFn resync;
+    void *arg;
+    
+    void *context;
+    void *router;
+    pthread_t sender;
+    pthread_t receiver;
+    int threads;                   // Threads iniciadas (para o join)
+    atomic_int running;
+    int wake[2];                   // Pipe que acorda a thread de envio
+    
+    pthread_mutex_t lock;
+    ReplRecord *records;           // Anel: posição p em records[p & (capacity - 1)]
+    size_t capacity;
+    uint64_t base;
+    uint64_t end;
+    size_t pending_bytes;
+    int wake_pending;
+    Peer peers[2 * REPL_MAX_PEERS];  // Removidos ocupam o slot até a thread de envio fechar o socket
+    int peer_count;
+    ReplStats stats;
+    
+    Source sources[REPL_MAX_SOURCES];  // Só a thread de recepção
+    int source_count;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static ReplRecord *record_at(ReplLink *link, uint64_t offset) {
+    return &link->records[offset & (link->capacity - 1)];
+}
+
+static void wake_sender(ReplLink *link) {
+    if (!link->wake_pending) {
+        link->wake_pending = 1;
+        char byte = 1;
+        if (write(link->wake[1], &byte, 1) < 0) {
+            link->wake_pending = 0;
+        }
+    }
+}
+
+void repl_default_options(ReplOptions *options) {
+    options->batch_records = REPL_DEFAULT_BATCH_RECORDS;
+    options->batch_bytes = REPL_DEFAULT_BATCH_BYTES;
+    options->window = REPL_DEFAULT_WINDOW;
+    options->retransmit_ms = REPL_DEFAULT_RETRANSMIT_MS;
+    options->max_pending = REPL_DEFAULT_MAX_PENDING;
+}
+
+/* ---- log em memória (com o lock) ---- */
+
+/**
+ * Volta o envio do peer à posição confirmada; lotes em trânsito deixam de valer
+ */
+static void peer_rewind(Peer *peer) {
+    peer->next = peer->acked;
+    peer->inflight_count = 0;
+    peer->rewind_batch = peer->batch + 1;
+}
+
+/**
+ * Libera os registros já confirmados por todos os peers
+ */
+static void log_trim(ReplLink *link) {
+    uint64_t keep = link->end;
+    for (int i = 0; i < link->peer_count; i++) {
+        if (!link->peers[i].removed && link->peers[i].acked < keep) {
+            keep = link->peers[i].acked;
+        }
+    }
+    while (link->base < keep) {
+        ReplRecord *record = record_at(link, link->base++);
+        link->pending_bytes -= record->size;
+        free(record->data);
+        record->data = NULL;
+    }
+}
+
+/**
+ * Descarta o registro mais antigo ainda sem confirmação de algum peer
+ */
+static void log_drop_oldest(ReplLink *link) {
+    ReplRecord *record = record_at(link, link->base++);
+    link->pending_bytes -= record->size;
+    free(record->data);
+    record->data = NULL;
+    link->stats.dropped++;
+    
+    for (int i = 0; i < link->peer_count; i++) {
+        Peer *peer = &link->peers[i];
+        if (peer->acked < link->base) {
+            peer->acked = link->base;
+            peer->resync = 1;
+            if (peer->next < link->base) {
+                peer_rewind(peer);
+            }
+        }
+    }
+}
+
+static int log_grow(ReplLink *link) {
+    size_t capacity = link->capacity ? link->capacity * 2 : 1024;
+    ReplRecord *records = calloc(capacity, sizeof(ReplRecord));
+    if (!records) {
+        return -1;
+    }
+    for (uint64_t offset = link->base; offset < link->end; offset++) {
+        records[offset & (capacity - 1)] = *record_at(link, offset);
+    }
+    free(link->records);
+    link->records = records;
+    link->capacity = capacity;
+    return 0;
+}
+
+int64_t repl_send(ReplLink *link, const void *data, size_t size) {
+    if (size > UINT32_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    uint8_t *copy = malloc(size ? size : 1);
+    if (!copy) {
+        return -1;
+    }
+    memcpy(copy, data, size);
+    
+    pthread_mutex_lock(&link->lock);
+    if (link->end - link->base == link->capacity && log_grow(link) < 0) {
+        pthread_mutex_unlock(&link->lock);
+        free(copy);
+        errno = ENOMEM;
+        return -1;
+    }
+    uint64_t offset = link->end++;
+    *record_at(link, offset) = (ReplRecord){ copy, size };
+    link->pending_bytes += size;
+    link->stats.records++;
+    
+    log_trim(link);  // Sem peers o registro não fica retido
+    while (link->pending_bytes > link->options.max_pending && link->base < offset) {
+        log_drop_oldest(link);
+    }
+    wake_sender(link);
+    pthread_mutex_unlock(&link->lock);
+    return (int64_t)offset;
+}
+
+/* ---- thread de envio ---- */
+
+static void free_buffer(void *data, void *hint) {
+    (void)hint;
+    free(data);
+}
+
+/**
+ * Monta o próximo lote do peer e o registra como em trânsito (com o lock)
+ * @return Buffer do lote (free) ou NULL se não há o que enviar agora
+ */
+static uint8_t *batch_build(ReplLink *link, Peer *peer, size_t *size) {
+    if (peer->removed || peer->next >= link->end || peer->inflight_count >= link->options.window) {
+        return NULL;
+    }
+    
+    size_t capacity = REPL_BATCH_OVERHEAD + strlen(link->name);
+    size_t bytes = 0;
+    uint32_t count = 0;
+    while (peer->next + count < link->end && count < (uint32_t)link->options.batch_records &&
+           (count == 0 || bytes < link->options.batch_bytes)) {
+        size_t record = record_at(link, peer->next + count)->size;
+        bytes += record;
+        capacity += record + 5;  // bin32: marcador + tamanho
+        count++;
+    }
+    
+    uint8_t *buffer = malloc(capacity);
+    if (!buffer) {
+        return NULL;
+    }
+    MpWriter writer;
+    mp_writer_init(&writer, buffer, capacity);
+    mp_write_map(&writer, 2);
+    mp_write_str(&writer, "service", 7);
+    mp_write_str(&writer, "replicate_batch", 15);
+    mp_write_str(&writer, "data", 4);
+    mp_write_map(&writer, 6);
+    mp_write_str(&writer, "source", 6);
+    mp_write_str(&writer, link->name, strlen(link->name));
+    mp_write_str(&writer, "epoch", 5);
+    mp_write_uint(&writer, link->epoch);
+    mp_write_str(&writer, "batch", 5);
+    mp_write_uint(&writer, peer->batch + 1);
+    mp_write_str(&writer, "first", 5);
+    mp_write_uint(&writer, peer->next);
+    mp_write_str(&writer, "resync", 6);
+    mp_write_bool(&writer, peer->resync);
+    mp_write_str(&writer, "records", 7);
+    mp_write_array(&writer, count);
+    for (uint32_t i = 0; i < count; i++) {
+        ReplRecord *record = record_at(link, peer->next + i);
+        mp_write_bin(&writer, record->data, record->size);
+    }
+    if (writer.error) {
+        free(buffer);
+        return NULL;
+    }
+    
+    peer->batch++;
+    peer->next += count;
+    int slot = (peer->inflight_head + peer->inflight_count++) % REPL_MAX_WINDOW;
+    peer->inflight[slot] = (InFlight){ peer->batch, peer->next, now_ns() };
+    link->stats.batches++;
+    *size = writer.pos;
+    return buffer;
+}
+
+/**
+ * Envia lotes ao peer até a janela encher ou o log acabar
+ */
+static void peer_send(ReplLink *link, Peer *peer) {
+    while (1) {
+        size_t size;
+        pthread_mutex_lock(&link->lock);
+        uint8_t *buffer = batch_build(link, peer, &size);
+        pthread_mutex_unlock(&link->lock);
+        if (!buffer) {
+            return;
+        }
+        
+        // zmq_msg_init_data: o lote vai ao socket sem outra cópia
+        zmq_msg_t msg;
+        if (zmq_msg_init_data(&msg, buffer, size, free_buffer, NULL) != 0) {
+            free(buffer);
+            return;
+        }
+        if (zmq_msg_send(&msg, peer->socket, ZMQ_DONTWAIT) < 0) {
+            zmq_msg_close(&msg);
+            pthread_mutex_lock(&link->lock);
+            peer_rewind(peer);  // Fila cheia: volta a tentar no próximo ciclo
+            pthread_mutex_unlock(&link->lock);
+            return;
+        }
+    }
+}
+
+/**
+ * Ack {epoch, batch, offset} de um lote (com o lock)
+ */
+static void peer_ack(ReplLink *link, Peer *peer, uint64_t epoch, uint64_t batch, uint64_t offset) {
+    if (epoch != link->epoch || offset > link->end) {
+        return;
+    }
+    if (offset > peer->acked) {
+        // Vale mesmo de um lote anterior a uma volta: o peer já aplicou até offset
+        peer->acked = offset;
+        peer->resync = 0;
+        if (peer->next < offset) {
+            peer->next = offset;
+        }
+        while (peer->inflight_count > 0 && peer->inflight[peer->inflight_head].end <= offset) {
+            peer->inflight_head = (peer->inflight_head + 1) % REPL_MAX_WINDOW;
+            peer->inflight_count--;
+        }
+    } else if (batch >= peer->rewind_batch && peer->inflight_count > 0) {
+        // O peer não aceitou o lote (perdido antes dele ou recusado): go-back-N
+        peer_rewind(peer);
+        link->stats.retransmits++;
+    }
+}
+
+/**
+ * Lê o data de {service, data} e devolve os campos uint pedidos
+ * @return MP_OK se todos os campos foram encontrados
+ */
+static int parse_ack(const void *data, size_t size, uint64_t *epoch, uint64_t *batch, uint64_t *offset) {
+    MpReader reader;
+    uint32_t count;
+    mp_reader_init(&reader, data, size);
+    if (mp_read_map(&reader, &count) < 0 ||
+        mp_find_key(&reader, count, "data", 4, REPL_MAX_DEPTH) < 0 ||
+        mp_read_map(&reader, &count) < 0) {
+        return MP_ERROR;
+    }
+    
+    int found = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const char *key;
+        uint32_t length;
+        if (mp_read_str(&reader, &key, &length) < 0) {
+            return MP_ERROR;
+        }
+        uint64_t *field = NULL;
+        if (length == 5 && memcmp(key, "epoch", 5) == 0) field = epoch;
+        else if (length == 5 && memcmp(key, "batch", 5) == 0) field = batch;
+        else if (length == 6 && memcmp(key, "offset", 6) == 0) field = offset;
+        
+        if (field) {
+            if (mp_read_uint(&reader, field) < 0) {
+                return MP_ERROR;
+            }
+            found++;
+        } else if (mp_skip(&reader, REPL_MAX_DEPTH) < 0) {
+            return MP_ERROR;
+        }
+    }
+    return found == 3 ? MP_OK : MP_ERROR;
+}
+
+static void peer_receive(ReplLink *link, Peer *peer) {
+    zmq_msg_t msg;
+    zmq_msg_init(&msg);
+    while (zmq_msg_recv(&msg, peer->socket, ZMQ_DONTWAIT) >= 0) {
+        uint64_t epoch, batch, offset;
+        if (parse_ack(zmq_msg_data(&msg), zmq_msg_size(&msg), &epoch, &batch, &offset) == MP_OK) {
+            pthread_mutex_lock(&link->lock);
+            peer_ack(link, peer, epoch, batch, offset);
+            pthread_mutex_unlock(&link->lock);
+        }
+    }
+    zmq_msg_close(&msg);
+}
+
+/**
+ * Fecha sockets de peers removidos e conecta os novos (com o lock)
+ */
+static void peers_reconcile(ReplLink *link) {
+    int kept = 0;
+    for (int i = 0; i < link->peer_count; i++) {
+        Peer *peer = &link->peers[i];
+        if (peer->removed) {
+            if (peer->socket) zmq_close(peer->socket);
+            continue;
+        }
+        if (!peer->socket) {
+            peer->socket = zmq_socket(link->context, ZMQ_DEALER);
+            if (peer->socket) {
+                // Sem conexão o envio falha (EAGAIN) em vez de enfileirar; a
+                // fila não passa de duas janelas mesmo depois de uma volta
+                int linger = 0, immediate = 1, hwm = 2 * link->options.window;
+                zmq_setsockopt(peer->socket, ZMQ_LINGER, &linger, sizeof(linger));
+                zmq_setsockopt(peer->socket, ZMQ_IMMEDIATE, &immediate, sizeof(immediate));
+                zmq_setsockopt(peer->socket, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+                if (zmq_connect(peer->socket, peer->endpoint) != 0) {
+                    fprintf(stderr, "[REPLICATION] Endpoint %s inválido: %s\n",
+                            peer->endpoint, zmq_strerror(errno));
+                    zmq_close(peer->socket);
+                    peer->socket = NULL;
+                    peer->removed = 1;
+                }
+            }
+        }
+        if (kept != i) {
+            link->peers[kept] = *peer;
+        }
+        kept++;
+    }
+    link->peer_count = kept;
+    log_trim(link);
+}
+
+static void *sender_main(void *arg) {
+    ReplLink *link = arg;
+    zmq_pollitem_t items[1 + 2 * REPL_MAX_PEERS];
+    Peer *polled[2 * REPL_MAX_PEERS];
+    int timeout = link->options.retransmit_ms / 4 > 10 ? link->options.retransmit_ms / 4 : 10;
+    uint64_t retransmit = (uint64_t)link->options.retransmit_ms * 1000000u;
+    
+    while (atomic_load(&link->running)) {
+        pthread_mutex_lock(&link->lock);
+        peers_reconcile(link);
+        int count = 0;
+        items[0] = (zmq_pollitem_t){ NULL, link->wake[0], ZMQ_POLLIN, 0 };
+        for (int i = 0; i < link->peer_count; i++) {
+            if (link->peers[i].socket) {
+                polled[count] = &link->peers[i];
+                items[1 + count++] = (zmq_pollitem_t){ link->peers[i].socket, 0, ZMQ_POLLIN, 0 };
+            }
+        }
+        pthread_mutex_unlock(&link->lock);
+        
+        if (zmq_poll(items, 1 + count, timeout) < 0 && errno != EINTR) {
+            break;  // Contexto encerrado
+        }
+        if (items[0].revents & ZMQ_POLLIN) {
+            char drain[64];
+            pthread_mutex_lock(&link->lock);
+            while (read(link->wake[0], drain, sizeof(drain)) > 0) {
+            }
+            link->wake_pending = 0;
+            pthread_mutex_unlock(&link->lock);
+        }
+        
+        uint64_t now = now_ns();
+        for (int i = 0; i < count; i++) {
+            Peer *peer = polled[i];
+            if (items[1 + i].revents & ZMQ_POLLIN) {
+                peer_receive(link, peer);
+            }
+            
+            pthread_mutex_lock(&link->lock);
+            if (peer->inflight_count > 0 &&
+                now - peer->inflight[peer->inflight_head].sent_ns > retransmit) {
+                peer_rewind(peer);
+                link->stats.retransmits++;
+            }
+            pthread_mutex_unlock(&link->lock);
+            peer_send(link, peer);
+        }
+        
+        pthread_mutex_lock(&link->lock);
+        log_trim(link);
+        pthread_mutex_unlock(&link->lock);
+    }
+    
+    pthread_mutex_lock(&link->lock);
+    for (int i = 0; i < link->peer_count; i++) {
+        if (link->peers[i].socket) zmq_close(link->peers[i].socket);
+        link->peers[i].socket = NULL;
+    }
+    pthread_mutex_unlock(&link->lock);
+    return NULL;
+}
+
+int repl_set_peers(ReplLink *link, const char *const *names, const char *const *endpoints, int count) {
+    if (count < 0 || count > REPL_MAX_PEERS) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (strlen(names[i]) >= REPL_NAME_SIZE || strlen(endpoints[i]) >= REPL_ENDPOINT_SIZE) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    
+    pthread_mutex_lock(&link->lock);
+    int previous = link->peer_count;
+    for (int i = 0; i < previous; i++) {
+        link->peers[i].removed = 1;
+    }
+    for (int i = 0; i < count; i++) {
+        Peer *peer = NULL;
+        for (int j = 0; j < previous && !peer; j++) {
+            if (strcmp(link->peers[j].name, names[i]) == 0 &&
+                strcmp(link->peers[j].endpoint, endpoints[i]) == 0) {
+                peer = &link->peers[j];
+            }
+        }
+        if (peer) {
+            peer->removed = 0;
+            continue;
+        }
+        if (link->peer_count == 2 * REPL_MAX_PEERS) {
+            continue;  // Removidos ainda não fechados: entra na próxima chamada
+        }
+        
+        peer = &link->peers[link->peer_count++];
+        memset(peer, 0, sizeof(*peer));
+        snprintf(peer->name, sizeof(peer->name), "%s", names[i]);
+        snprintf(peer->endpoint, sizeof(peer->endpoint), "%s", endpoints[i]);
+        peer->next = link->end;
+        peer->acked = link->end;
+    }
+    wake_sender(link);
+    pthread_mutex_unlock(&link->lock);
+    return 0;
+}
+
+/* ---- thread de recepção ---- */
+
+static Source *source_find(ReplLink *link, const char *name, uint32_t length, int *created) {
+    *created = 0;
+    for (int i = 0; i < link->source_count; i++) {
+        if (strlen(link->sources[i].name) == length && memcmp(link->sources[i].name, name, length) == 0) {
+            return &link->sources[i];
+        }
+    }
+    if (length >= REPL_NAME_SIZE) {
+        return NULL;
+    }
+    
+    // Tabela cheia: a origem sem lotes há mais tempo volta a ser desconhecida
+    int index = link->source_count;
+    if (index < REPL_MAX_SOURCES) {
+        link->source_count++;
+    } else {
+        index = 0;
+        for (int i = 1; i < REPL_MAX_SOURCES; i++) {
+            if (link->sources[i].seen_ns < link->sources[index].seen_ns) {
+                index = i;
+            }
+        }
+    }
+    Source *source = &link->sources[index];
+    memcpy(source->name, name, length);
+    source->name[length] = '\0';
+    *created = 1;
+    return source;
+}
+
+/**
+ * Aplica os registros de um lote em ordem
+ * @return Próxima posição esperada da origem (o ack), ou -1 se o lote é inválido
+ */
+static int64_t batch_apply(ReplLink *link, const void *data, size_t size, uint64_t *epoch, uint64_t *batch) {
+    MpReader reader;
+    uint32_t count;
+    mp_reader_init(&reader, data, size);
+    if (mp_read_map(&reader, &count) < 0 ||
+        mp_find_key(&reader, count, "data", 4, REPL_MAX_DEPTH) < 0 ||
+        mp_read_map(&reader, &count) < 0) {
+        return -1;
+    }
+    
+    const char *name = NULL;
+    uint32_t name_length = 0;
+    uint64_t first = 0;
+    int resync = 0;
+    int fields = 0;
+    MpReader records = reader;
+    int has_records = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const char *key;
+        uint32_t length;
+        if (mp_read_str(&reader, &key, &length) < 0) {
+            return -1;
+        }
+        int rc = MP_OK;
+        if (length == 6 && memcmp(key, "source", 6) == 0) {
+            rc = mp_read_str(&reader, &name, &name_length);
+            fields++;
+        } else if (length == 5 && memcmp(key, "epoch", 5) == 0) {
+            rc = mp_read_uint(&reader, epoch);
+            fields++;
+        } else if (length == 5 && memcmp(key, "batch", 5) == 0) {
+            rc = mp_read_uint(&reader, batch);
+            fields++;
+        } else if (length == 5 && memcmp(key, "first", 5) == 0) {
+            rc = mp_read_uint(&reader, &first);
+            fields++;
+        } else if (length == 6 && memcmp(key, "resync", 6) == 0) {
+            rc = mp_read_bool(&reader, &resync);
+        } else if (length == 7 && memcmp(key, "records", 7) == 0) {
+            records = reader;
+            has_records = 1;
+            rc = mp_skip(&reader, REPL_MAX_DEPTH);
+        } else {
+            rc = mp_skip(&reader, REPL_MAX_DEPTH);
+        }
+        if (rc < 0) {
+            return -1;
+        }
+    }
+    if (fields != 4 || !has_records || mp_read_array(&records, &count) < 0) {
+        return -1;
+    }
+    
+    int created;
+    Source *source = source_find(link, name, name_length, &created);
+    if (!source) {
+        return -1;
+    }
+    // Lacuna que a origem não vai reenviar: o chamador a recupera por
+    // sincronização de estado. Uma origem nova começa no fim do log dela; uma
+    // reiniciada pode ter perdido registros ainda não confirmados
+    uint64_t gap_from = 0;
+    int gap = 0;
+    source->seen_ns = now_ns();
+    if (created || source->epoch != *epoch) {
+        gap = !created;
+        source->epoch = *epoch;  // Origem nova ou reiniciada: aceita a partir deste lote
+        source->next = first;
+    } else if (resync && first > source->next) {
+        gap = 1;
+        gap_from = source->next;
+        source->next = first;  // A origem descartou o intervalo
+    }
+    if (gap && link->resync) {
+        link->resync(link->arg, source->name, gap_from, first);
+    }
+    
+    uint64_t received = 0, duplicates = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const void *record;
+        uint32_t length;
+        if (mp_read_bin(&records, &record, &length) < 0) {
+            break;
+        }
+        uint64_t offset = first + i;
+        if (offset < source->next) {
+            duplicates++;
+            continue;
+        }
+        if (offset > source->next || link->apply(link->arg, source->name, offset, record, length) != 0) {
+            break;  // Lacuna (lote anterior perdido) ou recusado: o ack pede o reenvio
+        }
+        source->next++;
+        received++;
+    }
+    
+    pthread_mutex_lock(&link->lock);
+    link->stats.received += received;
+    link->stats.duplicates += duplicates;
+    link->stats.resyncs += (uint64_t)gap;
+    pthread_mutex_unlock(&link->lock);
+    return (int64_t)source->next;
+}
+
+static void send_ack(ReplLink *link, zmq_msg_t *identity, uint64_t epoch, uint64_t batch, uint64_t offset) {
+    uint8_t buffer[REPL_ACK_SIZE];
+    MpWriter writer;
+    mp_writer_init(&writer, buffer, sizeof(buffer));
+    mp_write_map(&writer, 2);
+    mp_write_str(&writer, "service", 7);
+    mp_write_str(&writer, "replicate_ack", 13);
+    mp_write_str(&writer, "data", 4);
+    mp_write_map(&writer, 3);
+    mp_write_str(&writer, "epoch", 5);
+    mp_write_uint(&writer, epoch);
+    mp_write_str(&writer, "batch", 5);
+    mp_write_uint(&writer, batch);
+    mp_write_str(&writer, "offset", 6);
+    mp_write_uint(&writer, offset);
+    if (writer.error) {
+        return;
+    }
+    
+    if (zmq_msg_send(identity, link->router, ZMQ_SNDMORE | ZMQ_DONTWAIT) >= 0) {
+        zmq_send(link->router, buffer, writer.pos, ZMQ_DONTWAIT);
+    }
+}
+
+static void *receiver_main(void *arg) {
+    ReplLink *link = arg;
+    zmq_pollitem_t item = { link->router, 0, ZMQ_POLLIN, 0 };
+    
+    while (atomic_load(&link->running)) {
+        int rc = zmq_poll(&item, 1, REPL_RECV_POLL_MS);
+        if (rc < 0 && errno != EINTR) {
+            break;
+        }
+        if (rc <= 0) {
+            continue;
+        }
+        
+        // [identidade do DEALER][lote]; outros formatos são descartados
+        zmq_msg_t identity, payload;
+        zmq_msg_init(&identity);
+        zmq_msg_init(&payload);
+        while (zmq_msg_recv(&identity, link->router, ZMQ_DONTWAIT) >= 0) {
+            int valid = zmq_msg_more(&identity) && zmq_msg_recv(&payload, link->router, 0) >= 0;
+            int more = valid ? zmq_msg_more(&payload) : zmq_msg_more(&identity);
+            while (more) {
+                zmq_msg_t excess;
+                zmq_msg_init(&excess);
+                more = zmq_msg_recv(&excess, link->router, 0) >= 0 && zmq_msg_more(&excess);
+                zmq_msg_close(&excess);
+                valid = 0;
+            }
+            
+            uint64_t epoch = 0, batch = 0;
+            int64_t next = valid ? batch_apply(link, zmq_msg_data(&payload), zmq_msg_size(&payload),
+                                               &epoch, &batch) : -1;
+            if (next >= 0) {
+                send_ack(link, &identity, epoch, batch, (uint64_t)next);
+            }
+        }
+        zmq_msg_close(&identity);
+        zmq_msg_close(&payload);
+    }
+    
+    zmq_close(link->router);
+    return NULL;
+}
+
+/* ---- ciclo de vida ---- */
+
+static void link_free(ReplLink *link) {
+    for (uint64_t offset = link->base; link->records && offset < link->end; offset++) {
+        free(record_at(link, offset)->data);
+    }
+    free(link->records);
+    if (link->wake[0] >= 0) close(link->wake[0]);
+    if (link->wake[1] >= 0) close(link->wake[1]);
+    pthread_mutex_destroy(&link->lock);
+    free(link);
+}
+
+ReplLink *repl_open(const char *name, const char *bind_endpoint, const ReplOptions *options,
+                    ReplApplyFn apply, ReplResyncFn resync, void *arg) {
+    if (strlen(name) >= REPL_NAME_SIZE || !apply) {
+        errno = EINVAL;
+        return NULL;
+    }
+    
+    ReplLink *link = calloc(1, sizeof(*link));
+    if (!link) {
+        return NULL;
+    }
+    snprintf(link->name, sizeof(link->name), "%s", name);
+    if (options) {
+        link->options = *options;
+    } else {
+        repl_default_options(&link->options);
+    }
+    if (link->options.window <= 0 || link->options.window > REPL_MAX_WINDOW) {
+        link->options.window = link->options.window <= 0 ? REPL_DEFAULT_WINDOW : REPL_MAX_WINDOW;
+    }
+    if (link->options.batch_records <= 0) link->options.batch_records = REPL_DEFAULT_BATCH_RECORDS;
+    if (link->options.retransmit_ms <= 0) link->options.retransmit_ms = REPL_DEFAULT_RETRANSMIT_MS;
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    link->epoch = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    link->apply = apply;
+    link->resync = resync;
+    link->arg = arg;
+    link->wake[0] = link->wake[1] = -1;
+    pthread_mutex_init(&link->lock, NULL);
+    atomic_init(&link->running, 1);
+    
+    if (pipe(link->wake) < 0) {
+        link_free(link);
+        return NULL;
+    }
+    fcntl(link->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(link->wake[1], F_SETFL, O_NONBLOCK);
+    
+    int linger = 0;
+    link->context = zmq_ctx_new();
+    link->router = link->context ? zmq_socket(link->context, ZMQ_ROUTER) : NULL;
+    if (!link->router ||
+        zmq_setsockopt(link->router, ZMQ_LINGER, &linger, sizeof(linger)) != 0 ||
+        zmq_bind(link->router, bind_endpoint) != 0) {
+        int err = errno;
+        if (link->router) zmq_close(link->router);
+        if (link->context) zmq_ctx_term(link->context);
+        link_free(link);
+        errno = err;
+        return NULL;
+    }
+    
+    if (pthread_create(&link->receiver, NULL, receiver_main, link) != 0) {
+        zmq_close(link->router);
+        zmq_ctx_term(link->context);
+        link_free(link);
+        errno = EAGAIN;
+        return NULL;
+    }
+    link->threads = 1;
+    if (pthread_create(&link->sender, NULL, sender_main, link) != 0) {
+        repl_close(link);
+        errno = EAGAIN;
+        return NULL;
+    }
+    link->threads = 2;
+    return link;
+}
+
+void repl_stats(ReplLink *link, ReplStats *stats) {
+    pthread_mutex_lock(&link->lock);
+    *stats = link->stats;
+    stats->pending = link->end - link->base;
+    pthread_mutex_unlock(&link->lock);
+}
+
+void repl_close(ReplLink *link) {
+    atomic_store(&link->running, 0);
+    pthread_mutex_lock(&link->lock);
+    wake_sender(link);
+    pthread_mutex_unlock(&link->lock);
+    
+    // Cada thread fecha os seus sockets antes de terminar; LINGER 0 não
+    // deixa zmq_ctx_term esperar por lotes na fila
+    if (link->threads >= 2) pthread_join(link->sender, NULL);
+    if (link->threads >= 1) pthread_join(link->receiver, NULL);
+    zmq_ctx_term(link->context);
+    link_free(link);
+}
@@ -0,0 +1,117 @@
+/**
+ * Transporte de replicação entre servidores em C
+ *
+ * Cada servidor mantém uma conexão DEALER persistente com cada peer e envia
+ * os registros replicados (payloads MessagePack opacos) em lotes:
+ *
+ *   {service: 'replicate_batch',
+ *    data: {source, epoch, batch, first, resync, records: [bin, ...]}}
+ *
+ * Os registros recebem posições consecutivas a partir de 0 (epoch muda a
+ * cada repl_open). Até window lotes por peer ficam em trânsito sem esperar
+ * resposta; o peer aplica os registros em ordem (ReplApplyFn, na thread de
+ * recepção) e responde a cada lote com a próxima posição que espera:
+ *
+ *   {service: 'replicate_ack', data: {epoch, batch, offset}}
+ *
+ * Um ack que não avança (lote perdido ou aplicação recusada) ou a falta de
+ * ack por retransmit_ms fazem o envio voltar à posição confirmada
+ * (go-back-N). Registros ficam em memória até todos os peers confirmarem,
+ * até max_pending bytes: além disso os mais antigos são descartados e o peer
+ * atrasado continua do primeiro registro retido (resync), contado em
+ * ReplStats.dropped; o peer avisa o chamador (ReplResyncFn) para recuperar
+ * a lacuna por sincronização de estado. Um peer novo começa no fim do log.
+ *
+ * Cada ReplLink tem duas threads: envio (sockets DEALER) e recepção
+ * (socket ROUTER no endpoint de bind). As funções públicas são seguras para
+ * várias threads.
+ */
+
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REPL_DEFAULT_BATCH_RECORDS 256                // Registros por lote
+#define REPL_DEFAULT_BATCH_BYTES (1u * 1024 * 1024)   // Lote fecha ao passar deste tamanho
+#define REPL_DEFAULT_WINDOW 8                         // Lotes sem ack em trânsito por peer
+#define REPL_DEFAULT_RETRANSMIT_MS 1000               // Sem ack por este tempo: reenvia
+#define REPL_DEFAULT_MAX_PENDING (64u * 1024 * 1024)  // Bytes retidos aguardando acks
+#define REPL_MAX_PEERS 32
+#define REPL_NAME_SIZE 64                             // Nome de servidor (com o '\0')
+#define REPL_ENDPOINT_SIZE 256
+
+typedef struct {
+    int batch_records;
+    size_t batch_bytes;
+    int window;
+    int retransmit_ms;
+    size_t max_pending;
+} ReplOptions;
+
+typedef struct {
+    uint64_t records;       // Registros acrescentados com repl_send
+    uint64_t batches;       // Lotes enviados (incluindo reenvios)
+    uint64_t retransmits;   // Voltas à posição confirmada
+    uint64_t dropped;       // Registros descartados sem confirmação de algum peer
+    uint64_t pending;       // Registros retidos aguardando acks
+    uint64_t received;      // Registros recebidos e aplicados
+    uint64_t duplicates;    // Registros recebidos de novo e ignorados
+    uint64_t resyncs;       // Lacunas de uma origem passadas ao chamador (ReplResyncFn)
+} ReplStats;
+
+/**
+ * Aplica um registro recebido de source (thread de recepção, em ordem)
+ * @return 0 se aplicado; diferente de 0 para recusar (o peer reenvia)
+ */
+typedef int (*ReplApplyFn)(void *arg, const char *source, uint64_t offset, const void *data, size_t size);
+
+/**
+ * Registros de source que não vão chegar (thread de recepção): a origem os
+ * descartou antes da confirmação (resync) ou reiniciou (novo epoch) com
+ * registros ainda não confirmados. O chamador deve buscá-los por
+ * sincronização de estado
+ * @param from Primeira posição perdida (0 se a origem reiniciou)
+ * @param to Posição a partir da qual os registros voltam a chegar
+ */
+typedef void (*ReplResyncFn)(void *arg, const char *source, uint64_t from, uint64_t to);
+
+typedef struct ReplLink ReplLink;
+
+/**
+ * Preenche as opções padrão
+ */
+void repl_default_options(ReplOptions *options);
+
+/**
+ * Inicia o transporte do servidor name, recebendo lotes em bind_endpoint
+ * @param options NULL para as opções padrão
+ * @param resync NULL se o chamador não recupera lacunas
+ * @return Transporte ou NULL com errno em erro
+ */
+ReplLink *repl_open(const char *name, const char *bind_endpoint, const ReplOptions *options,
+                    ReplApplyFn apply, ReplResyncFn resync, void *arg);
+
+/**
+ * Define os peers (substitui a lista anterior); conexões de peers que
+ * continuam na lista são mantidas
+ * @return 0 em sucesso, -1 com errno (EINVAL: count, nome ou endpoint inválido)
+ */
+int repl_set_peers(ReplLink *link, const char *const *names, const char *const *endpoints, int count);
+
+/**
+ * Acrescenta um registro para todos os peers atuais, sem esperar o envio
+ * @return Posição do registro, ou -1 com errno em erro
+ */
+int64_t repl_send(ReplLink *link, const void *data, size_t size);
+
+void repl_stats(ReplLink *link, ReplStats *stats);
+
+/**
+ * Para as threads, fecha as conexões e libera o transporte
+ * Registros ainda não confirmados são descartados
+ */
+void repl_close(ReplLink *link);
+
+#endif /* REPLICATION_H */
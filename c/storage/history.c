@@ -0,0 +1,575 @@
+/**
+ * Implementação do índice de histórico
+ *
+ * Canais e usuários são internados (intern.h): a chave é (tipo, id do
+ * nome) e as listas ficam em dois vetores indexados pelo id, sem hash nem
+ * comparação de strings, e cada nome é guardado uma vez. Os nomes vão para
+ * o arquivo <índice>.names, na ordem dos ids, como [MP_EXT_NAME id, nome,
+ * crc32c do nome]; entradas do índice com ids que o arquivo de nomes não
+ * tem (queda entre as duas escritas) são refeitas a partir do log.
+ * Escritas (history_append) e leituras (history_page) usam um rwlock, então
+ * consultas simultâneas não se bloqueiam.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "history.h"
+#include "../common_utils/crc32c.h"
+#include "../common_utils/intern.h"
+#include "../common_utils/msgpack_lite.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HISTORY_MAGIC "BBSHIX02"
+#define HISTORY_MAGIC_SIZE 8
+#define HISTORY_NAMES_MAGIC "BBSNAM01"
+#define HISTORY_NAMES_SUFFIX ".names"
+#define HISTORY_PATH_SIZE 4096
+#define HISTORY_MIN_LISTS 64      // Capacidade inicial dos vetores de listas
+#define HISTORY_KINDS 2           // HISTORY_CHANNEL e HISTORY_USER
+#define HISTORY_NAME_RECORD (INTERN_MAX_NAME + 16)  // [ext id][str][crc] no pior caso
+
+// Entrada do arquivo de índice (ordem de bytes da máquina: o arquivo é local
+// e pode sempre ser refeito a partir do log)
+typedef struct {
+    uint32_t name;                // Id do nome (arquivo .names)
+    uint32_t kind;
+    uint64_t clock;
+    uint64_t sequence;
+    uint64_t segment;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t crc;                 // crc32c dos campos anteriores
+} IndexEntry;
+
+typedef struct {
+    uint64_t clock;
+    uint64_t sequence;
+    WalPosition position;
+} Posting;
+
+typedef struct {
+    Posting *postings;            // Ordenadas por (clock, sequence)
+    size_t count;
+    size_t capacity;
+} PostingList;
+
+struct HistoryIndex {
+    Wal *wal;
+    int fd;                       // Arquivo de índice (O_APPEND)
+    int file_error;               // Escrita no arquivo falhou: para de acrescentar
+    int error;                    // errno de uma indexação que falhou (0 = ok)
+    pthread_rwlock_t lock;
+    
+    InternTable *names;
+    int names_fd;                 // Arquivo de nomes (O_APPEND)
+    PostingList *lists[HISTORY_KINDS];  // Indexadas pelo id do nome
+    size_t list_capacity;
+};
+
+// Chave do índice: tipo e id do nome
+typedef struct {
+    uint32_t kind;
+    uint32_t name;
+} HistoryKey;
+
+// Campos da mensagem usados pelo índice (strings apontam para o registro)
+typedef struct {
+    const char *type, *channel, *src, *dst;
+    uint32_t type_length, channel_length, src_length, dst_length;
+    uint64_t clock;
+} MessageFields;
+
+static int str_equals(const char *str, uint32_t length, const char *text, size_t text_length) {
+    return str && length == text_length && memcmp(str, text, length) == 0;
+}
+
+/**
+ * Lê type, channel, src, dst e clock do mapa da mensagem
+ * @return 0 em sucesso, -1 se o registro não é um mapa válido
+ */
+static int parse_message(const void *data, size_t size, MessageFields *fields) {
+    memset(fields, 0, sizeof(*fields));
+    
+    MpReader reader;
+    uint32_t count;
+    mp_reader_init(&reader, data, size);
+    if (mp_read_map(&reader, &count) != MP_OK) {
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        const char *key;
+        uint32_t key_length;
+        if (mp_read_str(&reader, &key, &key_length) != MP_OK) {
+            return -1;
+        }
+        
+        const char **str = NULL;
+        uint32_t *str_length = NULL;
+        if (str_equals(key, key_length, "type", 4)) {
+            str = &fields->type;
+            str_length = &fields->type_length;
+        } else if (str_equals(key, key_length, "channel", 7)) {
+            str = &fields->channel;
+            str_length = &fields->channel_length;
+        } else if (str_equals(key, key_length, "src", 3)) {
+            str = &fields->src;
+            str_length = &fields->src_length;
+        } else if (str_equals(key, key_length, "dst", 3)) {
+            str = &fields->dst;
+            str_length = &fields->dst_length;
+        } else if (str_equals(key, key_length, "clock", 5) &&
+                   mp_read_uint(&reader, &fields->clock) == MP_OK) {
+            continue;
+        }
+        
+        if (str && mp_read_str(&reader, str, str_length) == MP_OK) {
+            continue;
+        }
+        if (mp_skip(&reader, MP_MAX_DEPTH) != MP_OK) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Grava o nome de um id novo no arquivo de nomes (chamado com o lock de escrita)
+ */
+static void write_name(HistoryIndex *index, uint32_t id) {
+    size_t length;
+    const char *name = intern_name(index->names, id, &length);
+    uint8_t buffer[HISTORY_NAME_RECORD];
+    MpWriter writer;
+    mp_writer_init(&writer, buffer, sizeof(buffer));
+    mp_write_array(&writer, 3);
+    mp_write_name_id(&writer, id);
+    mp_write_str(&writer, name, length);
+    mp_write_uint(&writer, crc32c_update(0, name, length));
+    
+    if (index->file_error || (!writer.error && write(index->names_fd, buffer, writer.pos) == (ssize_t)writer.pos)) {
+        return;
+    }
+    // Entradas com este id não podem ir para o arquivo de índice
+    index->file_error = 1;
+}
+
+/**
+ * Interna um nome de mensagem, gravando-o se for novo
+ * @return Id, ou INTERN_NONE (nome longo demais ou sem memória)
+ */
+static uint32_t intern_key(HistoryIndex *index, const char *name, uint32_t length, int persist) {
+    uint32_t known = intern_count(index->names);
+    uint32_t id = intern(index->names, name, length);
+    if (id != INTERN_NONE && id >= known && persist) {
+        write_name(index, id);
+    }
+    return id;
+}
+
+/**
+ * Chaves em que a mensagem aparece (nomes longos demais ficam de fora)
+ * @return Quantidade de chaves escritas em keys (0 a 2)
+ */
+static int message_keys(HistoryIndex *index, const MessageFields *fields, HistoryKey keys[2], int persist) {
+    const char *names[2];
+    uint32_t lengths[2];
+    uint32_t kind;
+    int count = 0;
+    
+    if (str_equals(fields->type, fields->type_length, "publish", 7) && fields->channel) {
+        kind = HISTORY_CHANNEL;
+        names[count] = fields->channel;
+        lengths[count++] = fields->channel_length;
+    } else if (str_equals(fields->type, fields->type_length, "message", 7)) {
+        kind = HISTORY_USER;
+        if (fields->src) {
+            names[count] = fields->src;
+            lengths[count++] = fields->src_length;
+        }
+        if (fields->dst && !str_equals(fields->src, fields->src_length, fields->dst, fields->dst_length)) {
+            names[count] = fields->dst;
+            lengths[count++] = fields->dst_length;
+        }
+    } else {
+        return 0;
+    }
+    
+    int keys_count = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t id = intern_key(index, names[i], lengths[i], persist);
+        if (id != INTERN_NONE) {
+            keys[keys_count++] = (HistoryKey){ kind, id };
+        }
+    }
+    return keys_count;
+}
+
+/**
+ * Lista da chave, crescendo os vetores até o id se create
+ * @return Lista, ou NULL se não existe (ou sem memória com create)
+ */
+static PostingList *get_list(HistoryIndex *index, HistoryKey key, int create) {
+    if (key.name >= index->list_capacity) {
+        if (!create) {
+            return NULL;
+        }
+        size_t capacity = index->list_capacity ? index->list_capacity : HISTORY_MIN_LISTS;
+        while (capacity <= key.name) {
+            capacity *= 2;
+        }
+        for (int kind = 0; kind < HISTORY_KINDS; kind++) {
+            PostingList *lists = realloc(index->lists[kind], capacity * sizeof(*lists));
+            if (!lists) {
+                return NULL;  // Os vetores já crescidos ficam assim (capacidade é a menor)
+            }
+            memset(lists + index->list_capacity, 0, (capacity - index->list_capacity) * sizeof(*lists));
+            index->lists[kind] = lists;
+        }
+        index->list_capacity = capacity;
+    }
+    return &index->lists[key.kind][key.name];
+}
+
+/**
+ * Insere a posição na lista da chave mantendo a ordem por (clock, sequence)
+ * Mensagens chegam quase sempre em ordem, então a inserção é no final
+ */
+static int add_posting(HistoryIndex *index, HistoryKey key, const Posting *posting) {
+    PostingList *list = get_list(index, key, 1);
+    if (!list) {
+        return -1;
+    }
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? 2 * list->capacity : 8;
+        Posting *postings = realloc(list->postings, capacity * sizeof(*postings));
+        if (!postings) {
+            return -1;
+        }
+        list->postings = postings;
+        list->capacity = capacity;
+    }
+    
+    size_t i = list->count++;
+    while (i > 0 && (list->postings[i - 1].clock > posting->clock ||
+                     (list->postings[i - 1].clock == posting->clock &&
+                      list->postings[i - 1].sequence > posting->sequence))) {
+        list->postings[i] = list->postings[i - 1];
+        i--;
+    }
+    list->postings[i] = *posting;
+    return 0;
+}
+
+static uint32_t entry_crc(const IndexEntry *entry) {
+    return crc32c_update(0, entry, offsetof(IndexEntry, crc));
+}
+
+static void write_entries(HistoryIndex *index, const IndexEntry *entries, int count) {
+    size_t size = (size_t)count * sizeof(*entries);
+    if (index->file_error || write(index->fd, entries, size) == (ssize_t)size) {
+        return;
+    }
+    // O arquivo precisa continuar um prefixo do log: o resto é refeito na
+    // próxima abertura
+    index->file_error = 1;
+}
+
+/**
+ * Indexa um registro do log (chamado com o lock de escrita)
+ * Registros que não são mensagens com canal/usuário são ignorados
+ */
+static int index_record(HistoryIndex *index, uint64_t sequence, const WalPosition *position,
+                        const void *data, size_t size, int persist) {
+    MessageFields fields;
+    HistoryKey keys[2];
+    if (parse_message(data, size, &fields) < 0) {
+        return 0;
+    }
+    int count = message_keys(index, &fields, keys, persist);
+    
+    IndexEntry entries[2];
+    Posting posting = { fields.clock, sequence, *position };
+    for (int i = 0; i < count; i++) {
+        if (add_posting(index, keys[i], &posting) < 0) {
+            return -1;
+        }
+        IndexEntry *entry = &entries[i];
+        memset(entry, 0, sizeof(*entry));
+        entry->name = keys[i].name;
+        entry->kind = keys[i].kind;
+        entry->clock = fields.clock;
+        entry->sequence = sequence;
+        entry->segment = position->segment;
+        entry->offset = position->offset;
+        entry->size = position->size;
+        entry->crc = entry_crc(entry);
+    }
+    if (persist && count > 0) {
+        write_entries(index, entries, count);
+    }
+    return 0;
+}
+
+static int catch_up_record(void *arg, uint64_t sequence, const WalPosition *position,
+                           const void *data, size_t size) {
+    HistoryIndex *index = (HistoryIndex *)arg;
+    if (index_record(index, sequence, position, data, size, 1) < 0) {
+        index->error = errno ? errno : ENOMEM;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Reinterna os nomes do arquivo de nomes, na ordem dos ids, e descarta o
+ * que vier depois do primeiro registro inválido
+ */
+static int load_names(HistoryIndex *index) {
+    struct stat st;
+    if (fstat(index->names_fd, &st) < 0) {
+        return -1;
+    }
+    
+    char magic[HISTORY_MAGIC_SIZE];
+    if ((size_t)st.st_size < HISTORY_MAGIC_SIZE ||
+        pread(index->names_fd, magic, HISTORY_MAGIC_SIZE, 0) != HISTORY_MAGIC_SIZE ||
+        memcmp(magic, HISTORY_NAMES_MAGIC, HISTORY_MAGIC_SIZE) != 0) {
+        if (ftruncate(index->names_fd, 0) < 0 ||
+            write(index->names_fd, HISTORY_NAMES_MAGIC, HISTORY_MAGIC_SIZE) != HISTORY_MAGIC_SIZE) {
+            return -1;
+        }
+        return 0;
+    }
+    if ((size_t)st.st_size == HISTORY_MAGIC_SIZE) {
+        return 0;
+    }
+    
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, index->names_fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    MpReader reader;
+    mp_reader_init(&reader, map, (size_t)st.st_size);
+    reader.pos = HISTORY_MAGIC_SIZE;
+    size_t valid = reader.pos;
+    while (reader.pos < reader.size) {
+        uint32_t fields, id, length;
+        const char *name;
+        uint64_t crc;
+        if (mp_read_array(&reader, &fields) != MP_OK || fields != 3 ||
+            mp_read_name_id(&reader, &id) != MP_OK || id != intern_count(index->names) ||
+            mp_read_str(&reader, &name, &length) != MP_OK ||
+            mp_read_uint(&reader, &crc) != MP_OK || crc != crc32c_update(0, name, length) ||
+            intern(index->names, name, length) != id) {
+            break;
+        }
+        valid = reader.pos;
+    }
+    munmap(map, (size_t)st.st_size);
+    
+    return valid < (size_t)st.st_size ? ftruncate(index->names_fd, (off_t)valid) : 0;
+}
+
+/**
+ * Carrega as entradas válidas do arquivo de índice e descarta o resto
+ * @param next Recebe a sequência do primeiro registro do log a indexar
+ */
+static int load_index_file(HistoryIndex *index, uint64_t *next) {
+    *next = 0;
+    struct stat st;
+    if (fstat(index->fd, &st) < 0) {
+        return -1;
+    }
+    
+    char magic[HISTORY_MAGIC_SIZE];
+    if ((size_t)st.st_size < HISTORY_MAGIC_SIZE ||
+        pread(index->fd, magic, HISTORY_MAGIC_SIZE, 0) != HISTORY_MAGIC_SIZE ||
+        memcmp(magic, HISTORY_MAGIC, HISTORY_MAGIC_SIZE) != 0) {
+        if (ftruncate(index->fd, 0) < 0 ||
+            write(index->fd, HISTORY_MAGIC, HISTORY_MAGIC_SIZE) != HISTORY_MAGIC_SIZE) {
+            return -1;
+        }
+        return 0;
+    }
+    
+    size_t total = ((size_t)st.st_size - HISTORY_MAGIC_SIZE) / sizeof(IndexEntry);
+    if (total == 0) {
+        return ftruncate(index->fd, HISTORY_MAGIC_SIZE);
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, index->fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    const IndexEntry *entries = (const IndexEntry *)((const uint8_t *)map + HISTORY_MAGIC_SIZE);
+    
+    // Prefixo válido: CRC certo, nome conhecido, sequências crescentes e
+    // presentes no log
+    uint64_t count = wal_count(index->wal);
+    uint32_t names = intern_count(index->names);
+    size_t valid = 0;
+    while (valid < total) {
+        const IndexEntry *entry = &entries[valid];
+        if (entry->crc != entry_crc(entry) || entry->kind >= HISTORY_KINDS || entry->name >= names ||
+            entry->sequence >= count ||
+            (valid > 0 && entry->sequence < entries[valid - 1].sequence)) {
+            break;
+        }
+        valid++;
+    }
+    
+    // As entradas do último registro podem estar incompletas: ele é refeito
+    size_t kept = valid;
+    if (kept > 0) {
+        *next = entries[kept - 1].sequence;
+        while (kept > 0 && entries[kept - 1].sequence == *next) {
+            kept--;
+        }
+    }
+    
+    int rc = 0;
+    for (size_t i = 0; i < kept && rc == 0; i++) {
+        Posting posting = {
+            entries[i].clock, entries[i].sequence,
+            { entries[i].segment, entries[i].offset, entries[i].size }
+        };
+        rc = add_posting(index, (HistoryKey){ entries[i].kind, entries[i].name }, &posting);
+    }
+    
+    int err = errno;
+    munmap(map, (size_t)st.st_size);
+    if (rc == 0) {
+        rc = ftruncate(index->fd, (off_t)(HISTORY_MAGIC_SIZE + kept * sizeof(IndexEntry)));
+    }
+    errno = err;
+    return rc;
+}
+
+static void history_free(HistoryIndex *index) {
+    for (int kind = 0; kind < HISTORY_KINDS; kind++) {
+        for (size_t i = 0; i < index->list_capacity; i++) {
+            free(index->lists[kind][i].postings);
+        }
+        free(index->lists[kind]);
+    }
+    intern_destroy(index->names);
+    if (index->names_fd >= 0) close(index->names_fd);
+    if (index->fd >= 0) close(index->fd);
+    pthread_rwlock_destroy(&index->lock);
+    free(index);
+}
+
+HistoryIndex *history_open(Wal *wal, const char *path) {
+    HistoryIndex *index = calloc(1, sizeof(*index));
+    if (!index) {
+        return NULL;
+    }
+    index->wal = wal;
+    index->fd = -1;
+    index->names_fd = -1;
+    pthread_rwlock_init(&index->lock, NULL);
+    
+    char names_path[HISTORY_PATH_SIZE];
+    if ((size_t)snprintf(names_path, sizeof(names_path), "%s%s", path, HISTORY_NAMES_SUFFIX) >=
+        sizeof(names_path)) {
+        history_free(index);
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    
+    uint64_t next = 0;
+    index->names = intern_create();
+    index->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (index->fd >= 0) {
+        index->names_fd = open(names_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    }
+    if (!index->names || index->names_fd < 0 || load_names(index) < 0 ||
+        load_index_file(index, &next) < 0 ||
+        wal_scan(wal, next, catch_up_record, index) < 0 || index->error) {
+        int err = index->error ? index->error : errno;
+        history_free(index);
+        errno = err;
+        return NULL;
+    }
+    return index;
+}
+
+int64_t history_append(HistoryIndex *index, const void *data, size_t size) {
+    pthread_rwlock_wrlock(&index->lock);
+    
+    WalPosition position;
+    int64_t sequence = wal_append_at(index->wal, data, size, &position);
+    int err = errno;
+    if (sequence >= 0 && !index->error &&
+        index_record(index, (uint64_t)sequence, &position, data, size, 1) < 0) {
+        // O registro já está no log: só o índice fica inutilizável
+        index->error = errno ? errno : ENOMEM;
+    }
+    
+    pthread_rwlock_unlock(&index->lock);
+    errno = err;
+    return sequence;
+}
+
+int64_t history_page(HistoryIndex *index, int kind, const char *name, size_t length,
+                     uint64_t before, size_t limit, HistoryRecord *records) {
+    pthread_rwlock_rdlock(&index->lock);
+    if (index->error) {
+        int err = index->error;
+        pthread_rwlock_unlock(&index->lock);
+        errno = err;
+        return -1;
+    }
+    
+    uint32_t id = intern_find(index->names, name, length);
+    PostingList *list = NULL;
+    if ((kind == HISTORY_CHANNEL || kind == HISTORY_USER) && id != INTERN_NONE) {
+        list = get_list(index, (HistoryKey){ (uint32_t)kind, id }, 0);
+    }
+    size_t end = 0;
+    if (list) {
+        // Primeira posição com clock >= before
+        size_t high = list->count;
+        while (end < high) {
+            size_t middle = end + (high - end) / 2;
+            if (list->postings[middle].clock < before) {
+                end = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+    }
+    
+    // Percorre de trás para frente preenchendo o final de records
+    size_t got = 0;
+    for (size_t i = end; i > 0 && got < limit; i--) {
+        const Posting *posting = &list->postings[i - 1];
+        const void *data = wal_record(index->wal, &posting->position);
+        if (!data) {
+            int err = errno;
+            pthread_rwlock_unlock(&index->lock);
+            errno = err;
+            return -1;
+        }
+        HistoryRecord *record = &records[limit - 1 - got++];
+        record->data = data;
+        record->size = posting->position.size;
+        record->clock = posting->clock;
+        record->sequence = posting->sequence;
+    }
+    
+    pthread_rwlock_unlock(&index->lock);
+    memmove(records, records + (limit - got), got * sizeof(*records));
+    return (int64_t)got;
+}
+
+void history_close(HistoryIndex *index) {
+    history_free(index);
+}
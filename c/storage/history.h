@@ -0,0 +1,66 @@
+/**
+ * Índice de histórico sobre o log de mensagens
+ *
+ * Para cada canal (mensagens "publish") e cada usuário (mensagens privadas
+ * "message", como remetente ou destinatário) o índice guarda a lista das
+ * posições dos registros no log, ordenada por (clock, sequência). Uma página
+ * do histórico é uma busca binária mais a leitura dos registros da página,
+ * direto do mmap dos segmentos: o custo é proporcional à página, não ao
+ * histórico.
+ *
+ * As entradas também são acrescentadas a um arquivo de índice, lido (mmap)
+ * na abertura para não decodificar o log inteiro; o arquivo é derivado do
+ * log e não é sincronizado: entradas perdidas ou inválidas são refeitas a
+ * partir do log ao abrir.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "wal.h"
+
+// Tipo da chave consultada
+#define HISTORY_CHANNEL 0         // Publicações em um canal
+#define HISTORY_USER 1            // Mensagens privadas enviadas ou recebidas
+
+typedef struct HistoryIndex HistoryIndex;
+
+typedef struct {
+    const void *data;             // Registro MessagePack (dentro do mmap do log)
+    size_t size;
+    uint64_t clock;
+    uint64_t sequence;
+} HistoryRecord;
+
+/**
+ * Abre o índice do log, refazendo o que faltar no arquivo de índice
+ * @param path Arquivo de índice (criado se não existe)
+ * @return Índice aberto, ou NULL com errno em erro
+ */
+HistoryIndex *history_open(Wal *wal, const char *path);
+
+/**
+ * Acrescenta um registro ao log e o indexa
+ * Todas as escritas no log devem passar por aqui enquanto o índice está aberto
+ * @return Número de sequência do registro, ou -1 com errno em erro
+ */
+int64_t history_append(HistoryIndex *index, const void *data, size_t size);
+
+/**
+ * Lê uma página do histórico: os últimos limit registros da chave com clock
+ * menor que before (UINT64_MAX para os mais recentes), em ordem crescente
+ * Os ponteiros em records valem até wal_close
+ * @param kind HISTORY_CHANNEL ou HISTORY_USER
+ * @return Registros escritos em records, ou -1 com errno em erro
+ */
+int64_t history_page(HistoryIndex *index, int kind, const char *name, size_t length,
+                     uint64_t before, size_t limit, HistoryRecord *records);
+
+/**
+ * Fecha o índice (o log continua aberto)
+ */
+void history_close(HistoryIndex *index);
+
+#endif /* HISTORY_H */
@@ -0,0 +1,203 @@
+/**
+ * Implementação do anel io_uring (syscalls diretas)
+ *
+ * Os índices dos anéis são compartilhados com o kernel: a cauda da fila de
+ * submissão é publicada com release depois de preencher as entradas, e a
+ * cauda da fila de conclusão é lida com acquire antes de ler os resultados.
+ */
+
+#define _GNU_SOURCE
+#include "uring.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define URING_SUPPORTED 1
+#endif
+#endif
+
+#ifdef URING_SUPPORTED
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 4           // Escrita + fdatasync por submissão
+#define URING_WRITE 1             // user_data das duas operações
+#define URING_SYNC 2
+
+int uring_init(Uring *ring) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+    
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        goto fail;
+    }
+    if (single) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto fail;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto fail;
+    }
+    
+    uint8_t *sq = ring->sq_ring;
+    uint8_t *cq = ring->cq_ring;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = cq + params.cq_off.cqes;
+    ring->fd = fd;
+    return 0;
+    
+fail:;
+    int err = errno;
+    ring->fd = fd;
+    uring_close(ring);
+    errno = err;
+    return -1;
+}
+
+static void push_sqe(Uring *ring, uint8_t opcode, uint8_t flags, int fd, const void *addr,
+                     unsigned len, uint64_t offset, uint32_t op_flags, uint64_t user_data) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)ring->sqes)[index];
+    
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->flags = flags;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->fsync_flags = op_flags;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+int uring_write_sync(Uring *ring, int fd, const struct iovec *iov, int count, uint64_t offset,
+                     size_t *written) {
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += iov[i].iov_len;
+    }
+    *written = 0;
+    
+    push_sqe(ring, IORING_OP_WRITEV, IOSQE_IO_LINK, fd, iov, (unsigned)count, offset, 0, URING_WRITE);
+    push_sqe(ring, IORING_OP_FSYNC, 0, fd, NULL, 0, 0, IORING_FSYNC_DATASYNC, URING_SYNC);
+    
+    unsigned submit = 2;
+    int pending = 2;
+    int write_res = 0, sync_res = 0;
+    while (pending > 0) {
+        unsigned head = *ring->cq_head;
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            // Envia as duas operações (na primeira volta) e espera as conclusões
+            int rc = (int)syscall(__NR_io_uring_enter, ring->fd, submit, (unsigned)pending,
+                                  IORING_ENTER_GETEVENTS, NULL, 0);
+            if (rc < 0 && errno == EINTR) {
+                continue;
+            }
+            if (rc < 0) {
+                // Entradas não enviadas ficariam na fila (apontando para
+                // buffers do chamador) ou operações ficariam sem conclusão:
+                // o anel é abandonado
+                int err = errno;
+                int sent = submit < 2;
+                uring_close(ring);
+                errno = err;
+                return sent ? -1 : 2;
+            }
+            submit -= (unsigned)rc < submit ? (unsigned)rc : submit;
+            continue;
+        }
+        
+        const struct io_uring_cqe *cqe = &((const struct io_uring_cqe *)ring->cqes)[head & *ring->cq_mask];
+        if (cqe->user_data == URING_WRITE) {
+            write_res = cqe->res;
+        } else {
+            sync_res = cqe->res;
+        }
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+        pending--;
+    }
+    
+    if (write_res < 0) {
+        errno = -write_res;
+        return -1;
+    }
+    *written = (size_t)write_res;
+    if (*written < total) {
+        return 1;  // Parcial: o fdatasync ligado foi cancelado
+    }
+    if (sync_res < 0) {
+        errno = -sync_res;
+        return -1;
+    }
+    return 0;
+}
+
+void uring_close(Uring *ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+#else
+
+int uring_init(Uring *ring) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+int uring_write_sync(Uring *ring, int fd, const struct iovec *iov, int count, uint64_t offset,
+                     size_t *written) {
+    (void)ring; (void)fd; (void)iov; (void)count; (void)offset;
+    *written = 0;
+    errno = ENOSYS;
+    return -1;
+}
+
+void uring_close(Uring *ring) {
+    ring->fd = -1;
+}
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ * Anel io_uring mínimo para o writer do log (sem liburing)
+ *
+ * Só o necessário para o group commit: uma escrita vetorizada ligada
+ * (IOSQE_IO_LINK) a um fdatasync, enviadas com uma única chamada ao kernel.
+ * Em kernels sem io_uring, ou quando ele está bloqueado (seccomp do
+ * container, kernel.io_uring_disabled), uring_init falha e o writer usa
+ * writev + fdatasync. Um anel é usado por uma única thread.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+typedef struct {
+    int fd;                       // -1 = indisponível
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;                // Igual a sq_ring com IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    void *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    void *cqes;
+} Uring;
+
+/**
+ * Cria o anel
+ * @return 0 em sucesso, -1 com errno (ENOSYS sem suporte a io_uring)
+ */
+int uring_init(Uring *ring);
+
+/**
+ * Escreve os buffers em fd a partir de offset e faz fdatasync, na mesma
+ * submissão
+ * @param written Recebe os bytes escritos
+ * @return 0 se tudo foi escrito e sincronizado; 1 se a escrita foi parcial
+ *         (o fdatasync é cancelado); 2 se nada foi enviado (o anel foi
+ *         fechado, escrever por outro caminho); -1 com errno em erro
+ */
+int uring_write_sync(Uring *ring, int fd, const struct iovec *iov, int count, uint64_t offset,
+                     size_t *written);
+
+void uring_close(Uring *ring);
+
+#endif /* URING_H */
@@ -0,0 +1,1194 @@
+/**
+ * Implementação do log de registros append-only
+ *
+ * As escritas acontecem na thread de quem chama wal_append (write() direto
+ * no segmento, sob o lock); a thread de sincronização só faz fdatasync, fora
+ * do lock, para que escritas não esperem pelo disco. Um fdatasync que falha
+ * deixa o log em erro permanente: depois dele o kernel pode ter descartado
+ * páginas sujas, então não há como saber o que chegou ao disco.
+ *
+ * Registros de wal_submit vão para uma fila; a thread do writer pega tudo
+ * o que estiver na fila, grava de uma vez (uma escrita vetorizada por
+ * segmento) e sincroniza, então o tamanho do lote acompanha a latência do
+ * disco sem janela fixa. Com io_uring (uring.h) escrita e fdatasync saem
+ * numa única submissão; sem ele, writev + fdatasync. Enquanto há registros
+ * na fila ou um lote em andamento, wal_append também passa pela fila (e
+ * espera a gravação), para manter a ordem das sequências. O writer grava
+ * fora do lock: nesse tempo ninguém mais escreve no segmento nem o troca.
+ * Uma escrita que falha no writer deixa o log em erro permanente, já que as
+ * sequências dos registros seguintes já foram entregues.
+ *
+ * Cada segmento é mapeado uma única vez, na primeira leitura por wal_record,
+ * com tamanho suficiente para o maior segmento possível: o segmento atual
+ * continua crescendo dentro do mesmo mapeamento, e os ponteiros entregues
+ * valem até wal_close.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "wal.h"
+#include "uring.h"
+#include "../common_utils/crc32c.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WAL_MAGIC "BBSWAL01"
+#define WAL_MAGIC_SIZE 8
+#define WAL_RECORD_HEADER 8       // tamanho u32 + crc32c u32
+#define WAL_PATH_SIZE 4096
+#define WAL_NAME_DIGITS 20        // Nome do segmento: sequência com zeros à esquerda
+#define WAL_DIRECTORY_SIZE (WAL_PATH_SIZE - WAL_NAME_DIGITS - 5)  // Cabe "/<dígitos>.wal"
+#define WAL_WRITER_IOV 1024       // Buffers por escrita do writer (IOV_MAX)
+#define WAL_MAX_QUEUED (64u * 1024 * 1024)  // Bytes na fila antes de wal_submit esperar
+#define WAL_CHECKPOINT_INTERVAL 1024        // Registros entre posições lembradas para wal_scan
+
+// Resultado da leitura de um segmento
+#define SCAN_END 0                // Terminou em um limite de registro
+#define SCAN_TORN 1               // Registro incompleto ou com CRC errado em valid_end
+#define SCAN_STOPPED 2            // Callback pediu para parar
+#define SCAN_ERROR -1             // Erro de I/O (errno)
+#define SCAN_BAD_MAGIC -2         // Cabeçalho do segmento ausente ou inválido
+
+// Registro na fila do writer
+typedef struct WalEntry {
+    struct WalEntry *next;
+    const void *data;             // Cópia logo após a estrutura (wal_submit) ou do chamador
+    uint32_t size;
+    uint8_t header[WAL_RECORD_HEADER];
+    int waiting;                  // wal_append_at esperando (entrada na pilha dele)
+    int done;                     // 1 gravado, -1 erro (com waiting)
+    WalPosition position;
+} WalEntry;
+
+// Início (cabeçalho) de um registro no seu segmento: wal_scan começa do
+// ponto lembrado mais próximo, sem ler o segmento desde o começo
+typedef struct {
+    uint64_t sequence;
+    uint64_t offset;
+} WalCheckpoint;
+
+typedef struct {
+    const uint8_t *base;          // mmap do segmento (NULL = ainda não mapeado)
+    size_t length;
+    uint64_t bytes;               // Tamanho do segmento se já fechado (0 = atual)
+} WalMapping;
+
+struct Wal {
+    char directory[WAL_DIRECTORY_SIZE];
+    WalOptions options;
+    
+    pthread_mutex_t lock;
+    pthread_cond_t wake;          // Acorda a thread de sincronização
+    pthread_cond_t synced;        // Um fdatasync terminou
+    pthread_t thread;
+    int thread_started;
+    int running;
+    int sync_requested;
+    int syncing;                  // fdatasync em andamento fora do lock
+    int error;                    // errno de um fdatasync que falhou (0 = ok)
+    
+    WalEntry *queue_head;         // Fila do writer (wal_submit)
+    WalEntry *queue_tail;
+    size_t queued_bytes;
+    pthread_cond_t queued;        // Acorda o writer
+    pthread_cond_t written;       // Um lote do writer terminou
+    pthread_t writer;
+    int writer_started;
+    int writer_running;
+    int writing;                  // Lote do writer em andamento fora do lock
+    Uring ring;                   // ring.fd < 0: writev + fdatasync
+    WalDurableFn durable_fn;
+    void *durable_arg;
+    uint64_t reported;            // Último valor entregue a durable_fn
+    
+    int fd;                       // Segmento atual (O_APPEND)
+    uint64_t segment_first;       // Sequência do primeiro registro do segmento atual
+    uint64_t segment_bytes;       // Tamanho do segmento atual
+    uint64_t *segments;           // Primeiro registro de cada segmento, em ordem
+    WalMapping *maps;             // Mapeamento de cada segmento (paralelo a segments)
+    size_t segment_count;
+    size_t segment_capacity;
+    WalCheckpoint *checkpoints;   // Um a cada WAL_CHECKPOINT_INTERVAL registros, por sequência
+    size_t checkpoint_count;
+    size_t checkpoint_capacity;
+    
+    uint64_t count;               // Registros gravados no segmento
+    uint64_t next;                // Próxima sequência (count + fila do writer)
+    uint64_t durable;             // Registros já em disco
+};
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/**
+ * CRC do registro: cobre o campo de tamanho e o payload
+ */
+static uint32_t record_crc(const uint8_t *size_field, const void *data, size_t size) {
+    return crc32c_update(crc32c_update(0, size_field, 4), data, size);
+}
+
+static void segment_path(const Wal *wal, uint64_t first, char *path) {
+    snprintf(path, WAL_PATH_SIZE, "%s/%0*llu.wal", wal->directory, WAL_NAME_DIGITS,
+             (unsigned long long)first);
+}
+
+/**
+ * Descarta dos buffers os primeiros written bytes
+ */
+static void skip_written(struct iovec **iov, int *count, size_t written) {
+    while (*count > 0 && written >= (*iov)->iov_len) {
+        written -= (*iov)->iov_len;
+        (*iov)++;
+        (*count)--;
+    }
+    if (*count > 0) {
+        (*iov)->iov_base = (uint8_t *)(*iov)->iov_base + written;
+        (*iov)->iov_len -= written;
+    }
+}
+
+/**
+ * Escreve todos os bytes dos buffers, continuando após escritas parciais
+ */
+static int write_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        skip_written(&iov, &count, (size_t)written);
+    }
+    return 0;
+}
+
+/**
+ * fsync do diretório: torna durável a criação de um segmento
+ */
+static int sync_directory(const Wal *wal) {
+    int fd = open(wal->directory, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+static int add_segment(Wal *wal, uint64_t first) {
+    if (wal->segment_count == wal->segment_capacity) {
+        size_t capacity = wal->segment_capacity ? 2 * wal->segment_capacity : 16;
+        uint64_t *segments = realloc(wal->segments, capacity * sizeof(*segments));
+        if (!segments) {
+            return -1;
+        }
+        wal->segments = segments;
+        WalMapping *maps = realloc(wal->maps, capacity * sizeof(*maps));
+        if (!maps) {
+            return -1;
+        }
+        wal->maps = maps;
+        wal->segment_capacity = capacity;
+    }
+    memset(&wal->maps[wal->segment_count], 0, sizeof(*wal->maps));
+    wal->segments[wal->segment_count++] = first;
+    return 0;
+}
+
+/**
+ * Cria um segmento vazio (só o cabeçalho) e o torna o segmento atual
+ */
+static int create_segment(Wal *wal, uint64_t first) {
+    char path[WAL_PATH_SIZE];
+    segment_path(wal, first, path);
+    
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct iovec iov = { (void *)WAL_MAGIC, WAL_MAGIC_SIZE };
+    if (write_all(fd, &iov, 1) < 0 || fdatasync(fd) < 0 || sync_directory(wal) < 0 ||
+        add_segment(wal, first) < 0) {
+        int err = errno;
+        close(fd);
+        unlink(path);
+        errno = err;
+        return -1;
+    }
+    
+    wal->fd = fd;
+    wal->segment_first = first;
+    wal->segment_bytes = WAL_MAGIC_SIZE;
+    return 0;
+}
+
+/**
+ * Lembra o início do registro sequence (só a cada WAL_CHECKPOINT_INTERVAL)
+ * Chamada com o lock; sem memória o ponto é só esquecido
+ */
+static void checkpoint_add(Wal *wal, uint64_t sequence, uint64_t offset) {
+    if (sequence % WAL_CHECKPOINT_INTERVAL != 0) {
+        return;
+    }
+    
+    size_t low = wal->checkpoint_count;
+    if (low > 0 && wal->checkpoints[low - 1].sequence >= sequence) {
+        // Fora de ordem só quando um scan passa por segmentos antigos
+        low = 0;
+        size_t high = wal->checkpoint_count;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (wal->checkpoints[middle].sequence < sequence) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        if (low < wal->checkpoint_count && wal->checkpoints[low].sequence == sequence) {
+            return;
+        }
+    }
+    
+    if (wal->checkpoint_count == wal->checkpoint_capacity) {
+        size_t capacity = wal->checkpoint_capacity ? 2 * wal->checkpoint_capacity : 64;
+        WalCheckpoint *checkpoints = realloc(wal->checkpoints, capacity * sizeof(*checkpoints));
+        if (!checkpoints) {
+            return;
+        }
+        wal->checkpoints = checkpoints;
+        wal->checkpoint_capacity = capacity;
+    }
+    memmove(&wal->checkpoints[low + 1], &wal->checkpoints[low],
+            (wal->checkpoint_count - low) * sizeof(*wal->checkpoints));
+    wal->checkpoints[low] = (WalCheckpoint){ sequence, offset };
+    wal->checkpoint_count++;
+}
+
+/**
+ * Ponto lembrado mais próximo antes de from no segmento que começa em first
+ * Chamada com o lock
+ * @return Ponto encontrado, ou { first, WAL_MAGIC_SIZE } (início do segmento)
+ */
+static WalCheckpoint checkpoint_find(const Wal *wal, uint64_t first, uint64_t from) {
+    WalCheckpoint found = { first, WAL_MAGIC_SIZE };
+    size_t low = 0, high = wal->checkpoint_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (wal->checkpoints[middle].sequence <= from) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low > 0 && wal->checkpoints[low - 1].sequence >= first) {
+        found = wal->checkpoints[low - 1];
+    }
+    return found;
+}
+
+/**
+ * Lê um segmento registro a registro, conferindo tamanho e CRC
+ * A leitura começa em start (um registro do segmento, ou o início dele) e
+ * os registros com sequência em [from, limit) são entregues a fn (se não
+ * NULL); os pontos a cada WAL_CHECKPOINT_INTERVAL registros ficam lembrados
+ * @param records Recebe quantos registros válidos há a partir de start (até parar)
+ * @param valid_end Recebe o fim do último registro válido
+ */
+static int scan_segment(Wal *wal, const char *path, uint64_t segment, WalCheckpoint start,
+                        uint64_t from, uint64_t limit,
+                        WalScanFn fn, void *arg, uint64_t *records, uint64_t *valid_end) {
+    uint64_t first = start.sequence;
+    *records = 0;
+    *valid_end = 0;
+    
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return SCAN_ERROR;
+    }
+    
+    char magic[WAL_MAGIC_SIZE];
+    if (fread(magic, 1, WAL_MAGIC_SIZE, file) != WAL_MAGIC_SIZE ||
+        memcmp(magic, WAL_MAGIC, WAL_MAGIC_SIZE) != 0) {
+        fclose(file);
+        return SCAN_BAD_MAGIC;
+    }
+    *valid_end = WAL_MAGIC_SIZE;
+    if (start.offset > WAL_MAGIC_SIZE) {
+        if (fseeko(file, (off_t)start.offset, SEEK_SET) != 0) {
+            int err = errno;
+            fclose(file);
+            errno = err;
+            return SCAN_ERROR;
+        }
+        *valid_end = start.offset;
+    }
+    
+    uint8_t *payload = NULL;
+    size_t capacity = 0;
+    int status = SCAN_END;
+    
+    while (first + *records < limit) {
+        uint8_t header[WAL_RECORD_HEADER];
+        size_t got = fread(header, 1, WAL_RECORD_HEADER, file);
+        if (got == 0 && feof(file)) {
+            break;  // Fim exato de um registro
+        }
+        if (got != WAL_RECORD_HEADER) {
+            status = ferror(file) ? SCAN_ERROR : SCAN_TORN;
+            break;
+        }
+        
+        uint32_t size = get_u32(header);
+        if (size > WAL_MAX_RECORD_SIZE) {
+            status = SCAN_TORN;
+            break;
+        }
+        if (size > capacity) {
+            uint8_t *grown = realloc(payload, size);
+            if (!grown) {
+                status = SCAN_ERROR;
+                break;
+            }
+            payload = grown;
+            capacity = size;
+        }
+        if (fread(payload, 1, size, file) != size) {
+            status = ferror(file) ? SCAN_ERROR : SCAN_TORN;
+            break;
+        }
+        if (record_crc(header, payload, size) != get_u32(header + 4)) {
+            status = SCAN_TORN;
+            break;
+        }
+        
+        uint64_t sequence = first + *records;
+        WalPosition position = { segment, *valid_end + WAL_RECORD_HEADER, size };
+        if (sequence % WAL_CHECKPOINT_INTERVAL == 0) {
+            pthread_mutex_lock(&wal->lock);
+            checkpoint_add(wal, sequence, *valid_end);
+            pthread_mutex_unlock(&wal->lock);
+        }
+        (*records)++;
+        *valid_end += WAL_RECORD_HEADER + size;
+        if (fn && sequence >= from && fn(arg, sequence, &position, payload, size) != 0) {
+            status = SCAN_STOPPED;
+            break;
+        }
+    }
+    
+    int err = errno;
+    free(payload);
+    fclose(file);
+    errno = err;
+    return status;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Lista os segmentos do diretório (nomes <20 dígitos>.wal), em ordem
+ */
+static int list_segments(Wal *wal) {
+    DIR *dir = opendir(wal->directory);
+    if (!dir) {
+        return -1;
+    }
+    
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (strlen(name) != WAL_NAME_DIGITS + 4 || strcmp(name + WAL_NAME_DIGITS, ".wal") != 0) {
+            continue;
+        }
+        
+        uint64_t first = 0;
+        int digits = 1;
+        for (int i = 0; i < WAL_NAME_DIGITS && digits; i++) {
+            digits = name[i] >= '0' && name[i] <= '9';
+            first = first * 10 + (uint64_t)(name[i] - '0');
+        }
+        if (digits && add_segment(wal, first) < 0) {
+            closedir(dir);
+            return -1;
+        }
+    }
+    closedir(dir);
+    
+    if (wal->segment_count > 1) {
+        qsort(wal->segments, wal->segment_count, sizeof(*wal->segments), compare_u64);
+    }
+    return 0;
+}
+
+/**
+ * Reabre o último segmento para escrita, descartando um final incompleto
+ */
+static int recover_last_segment(Wal *wal) {
+    uint64_t first = wal->segments[wal->segment_count - 1];
+    char path[WAL_PATH_SIZE];
+    segment_path(wal, first, path);
+    
+    uint64_t records, valid_end;
+    WalCheckpoint start = { first, WAL_MAGIC_SIZE };
+    int status = scan_segment(wal, path, first, start, UINT64_MAX, UINT64_MAX, NULL, NULL,
+                              &records, &valid_end);
+    if (status == SCAN_ERROR) {
+        return -1;
+    }
+    if (status == SCAN_BAD_MAGIC) {
+        // Queda logo após criar o arquivo: recria o segmento vazio
+        wal->segment_count--;
+        return create_segment(wal, first);
+    }
+    
+    int fd = open(path, O_WRONLY | O_APPEND);
+    if (fd < 0) {
+        return -1;
+    }
+    if (status == SCAN_TORN && (ftruncate(fd, (off_t)valid_end) < 0 || fdatasync(fd) < 0)) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    
+    wal->fd = fd;
+    wal->segment_first = first;
+    wal->segment_bytes = valid_end;
+    wal->count = first + records;
+    return 0;
+}
+
+/**
+ * fdatasync do segmento atual fora do lock (chamado com o lock)
+ * Os registros escritos até aqui passam a contar como duráveis
+ */
+static void sync_locked(Wal *wal) {
+    uint64_t target = wal->count;
+    int fd = wal->fd;
+    wal->syncing = 1;
+    wal->sync_requested = 0;
+    
+    pthread_mutex_unlock(&wal->lock);
+    int rc = fdatasync(fd);
+    int err = errno;
+    pthread_mutex_lock(&wal->lock);
+    
+    wal->syncing = 0;
+    if (rc < 0) {
+        wal->error = err;
+    } else if (target > wal->durable) {
+        wal->durable = target;
+    }
+    pthread_cond_broadcast(&wal->synced);
+}
+
+/**
+ * Thread do group commit: sincroniza a cada intervalo ou quando pedido
+ */
+static void *sync_main(void *arg) {
+    Wal *wal = (Wal *)arg;
+    
+    pthread_mutex_lock(&wal->lock);
+    while (wal->running) {
+        if (!wal->sync_requested) {
+            if (wal->options.sync_mode == WAL_SYNC_BATCH) {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                long ns = deadline.tv_nsec + (long)wal->options.sync_interval_ms * 1000000L;
+                deadline.tv_sec += ns / 1000000000L;
+                deadline.tv_nsec = ns % 1000000000L;
+                pthread_cond_timedwait(&wal->wake, &wal->lock, &deadline);
+            } else {
+                pthread_cond_wait(&wal->wake, &wal->lock);
+            }
+        }
+        
+        if (wal->count > wal->durable && !wal->error) {
+            sync_locked(wal);
+        } else {
+            wal->sync_requested = 0;
+            pthread_cond_broadcast(&wal->synced);
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return NULL;
+}
+
+void wal_default_options(WalOptions *options) {
+    options->segment_size = WAL_DEFAULT_SEGMENT_SIZE;
+    options->sync_interval_ms = WAL_DEFAULT_SYNC_INTERVAL_MS;
+    options->sync_mode = WAL_SYNC_BATCH;
+}
+
+static void wal_free(Wal *wal) {
+    if (wal->fd >= 0) close(wal->fd);
+    for (size_t i = 0; i < wal->segment_count; i++) {
+        if (wal->maps[i].base) munmap((void *)wal->maps[i].base, wal->maps[i].length);
+    }
+    uring_close(&wal->ring);
+    pthread_cond_destroy(&wal->written);
+    pthread_cond_destroy(&wal->queued);
+    pthread_cond_destroy(&wal->synced);
+    pthread_cond_destroy(&wal->wake);
+    pthread_mutex_destroy(&wal->lock);
+    free(wal->segments);
+    free(wal->maps);
+    free(wal->checkpoints);
+    free(wal);
+}
+
+Wal *wal_open(const char *directory, const WalOptions *options) {
+    if (strlen(directory) >= WAL_DIRECTORY_SIZE) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    if (mkdir(directory, 0755) < 0 && errno != EEXIST) {
+        return NULL;
+    }
+    
+    Wal *wal = calloc(1, sizeof(*wal));
+    if (!wal) {
+        return NULL;
+    }
+    snprintf(wal->directory, sizeof(wal->directory), "%s", directory);
+    if (options) {
+        wal->options = *options;
+    } else {
+        wal_default_options(&wal->options);
+    }
+    if (wal->options.sync_interval_ms <= 0) {
+        wal->options.sync_interval_ms = WAL_DEFAULT_SYNC_INTERVAL_MS;
+    }
+    wal->fd = -1;
+    wal->ring.fd = -1;
+    pthread_mutex_init(&wal->lock, NULL);
+    pthread_cond_init(&wal->wake, NULL);
+    pthread_cond_init(&wal->synced, NULL);
+    pthread_cond_init(&wal->queued, NULL);
+    pthread_cond_init(&wal->written, NULL);
+    
+    int rc = list_segments(wal);
+    if (rc == 0) {
+        rc = wal->segment_count == 0 ? create_segment(wal, 0) : recover_last_segment(wal);
+    }
+    if (rc < 0) {
+        int err = errno;
+        wal_free(wal);
+        errno = err;
+        return NULL;
+    }
+    wal->next = wal->count;
+    wal->durable = wal->count;
+    
+    if (wal->options.sync_mode != WAL_SYNC_ALWAYS) {
+        wal->running = 1;
+        if (pthread_create(&wal->thread, NULL, sync_main, wal) != 0) {
+            wal_free(wal);
+            errno = EAGAIN;
+            return NULL;
+        }
+        wal->thread_started = 1;
+    }
+    return wal;
+}
+
+/**
+ * Fecha o segmento atual (já sincronizado) e abre o próximo
+ * Chamado com o lock
+ */
+static int rotate_segment(Wal *wal) {
+    while (wal->syncing) {
+        pthread_cond_wait(&wal->synced, &wal->lock);  // O fd atual está em uso
+    }
+    if (fdatasync(wal->fd) < 0) {
+        wal->error = errno;
+        return -1;
+    }
+    wal->durable = wal->count;
+    
+    int old = wal->fd;
+    uint64_t old_bytes = wal->segment_bytes;
+    if (create_segment(wal, wal->count) < 0) {
+        return -1;  // Continua no segmento antigo
+    }
+    wal->maps[wal->segment_count - 2].bytes = old_bytes;
+    close(old);
+    return 0;
+}
+
+static void record_header(uint8_t *header, const void *data, size_t size) {
+    put_u32(header, (uint32_t)size);
+    put_u32(header + 4, record_crc(header, data, size));
+}
+
+/**
+ * Põe a entrada na fila do writer (chamado com o lock)
+ * @return Sequência do registro
+ */
+static int64_t enqueue_locked(Wal *wal, WalEntry *entry) {
+    entry->next = NULL;
+    if (wal->queue_tail) {
+        wal->queue_tail->next = entry;
+    } else {
+        wal->queue_head = entry;
+    }
+    wal->queue_tail = entry;
+    wal->queued_bytes += WAL_RECORD_HEADER + entry->size;
+    pthread_cond_signal(&wal->queued);
+    return (int64_t)wal->next++;
+}
+
+/**
+ * Conclui as entradas de [entry, end): acorda quem espera e libera as cópias
+ * Chamado com o lock
+ */
+static void finish_entries(WalEntry *entry, WalEntry *end, int done) {
+    while (entry != end) {
+        WalEntry *next = entry->next;
+        if (entry->waiting) {
+            entry->done = done;  // A entrada pode sumir assim que o lock for solto
+        } else {
+            free(entry);
+        }
+        entry = next;
+    }
+}
+
+/**
+ * Grava e sincroniza os buffers de um lote (chamado sem o lock)
+ * @return 0 em sucesso, -1 com errno
+ */
+static int write_batch(Wal *wal, int fd, struct iovec *iov, int count, uint64_t offset) {
+    if (wal->ring.fd >= 0) {
+        size_t written;
+        int rc = uring_write_sync(&wal->ring, fd, iov, count, offset, &written);
+        if (rc <= 0) {
+            return rc;
+        }
+        if (rc == 1) {
+            skip_written(&iov, &count, written);
+        }
+        // Escrita parcial ou anel fechado: o restante por writev
+    }
+    if (write_all(fd, iov, count) < 0) {
+        return -1;
+    }
+    return fdatasync(fd);
+}
+
+/**
+ * Thread do writer: grava a fila em lotes, um por segmento, e sincroniza
+ */
+static void *writer_main(void *arg) {
+    Wal *wal = (Wal *)arg;
+    
+    pthread_mutex_lock(&wal->lock);
+    for (;;) {
+        while (wal->writer_running && !wal->queue_head) {
+            pthread_cond_wait(&wal->queued, &wal->lock);
+        }
+        if (!wal->queue_head) {
+            break;  // Fechando, com a fila vazia
+        }
+        
+        WalEntry *entry = wal->queue_head;
+        wal->queue_head = wal->queue_tail = NULL;
+        wal->queued_bytes = 0;
+        wal->writing = 1;
+        pthread_cond_broadcast(&wal->written);  // wal_submit esperando espaço na fila
+        
+        int err = wal->error;
+        while (entry && !err) {
+            if (wal->segment_bytes > WAL_MAGIC_SIZE &&
+                wal->segment_bytes + WAL_RECORD_HEADER + entry->size > wal->options.segment_size &&
+                rotate_segment(wal) < 0) {
+                err = errno;
+                break;
+            }
+            
+            // Registros que cabem no segmento atual (pelo menos um)
+            struct iovec iov[WAL_WRITER_IOV];
+            int count = 0;
+            uint64_t offset = wal->segment_bytes;
+            uint64_t bytes = offset;
+            WalEntry *end = entry;
+            do {
+                iov[count].iov_base = end->header;
+                iov[count++].iov_len = WAL_RECORD_HEADER;
+                iov[count].iov_base = (void *)end->data;
+                iov[count++].iov_len = end->size;
+                bytes += WAL_RECORD_HEADER + end->size;
+                end = end->next;
+            } while (end && count + 2 <= WAL_WRITER_IOV &&
+                     bytes + WAL_RECORD_HEADER + end->size <= wal->options.segment_size);
+            
+            int fd = wal->fd;
+            pthread_mutex_unlock(&wal->lock);
+            int rc = write_batch(wal, fd, iov, count, offset);
+            int write_err = errno;
+            pthread_mutex_lock(&wal->lock);
+            if (rc < 0) {
+                err = write_err;  // O final incompleto é truncado ao reabrir
+                break;
+            }
+            
+            for (WalEntry *done = entry; done != end; done = done->next) {
+                checkpoint_add(wal, wal->count, wal->segment_bytes);
+                done->position.segment = wal->segment_first;
+                done->position.offset = wal->segment_bytes + WAL_RECORD_HEADER;
+                done->position.size = done->size;
+                wal->segment_bytes += WAL_RECORD_HEADER + done->size;
+                wal->count++;
+            }
+            if (wal->count > wal->durable) {
+                wal->durable = wal->count;
+            }
+            finish_entries(entry, end, 1);
+            entry = end;
+        }
+        if (err) {
+            wal->error = err;
+            finish_entries(entry, NULL, -1);
+        }
+        wal->writing = 0;
+        pthread_cond_broadcast(&wal->written);
+        pthread_cond_broadcast(&wal->synced);
+        
+        if (wal->durable_fn && (wal->durable > wal->reported || err)) {
+            WalDurableFn fn = wal->durable_fn;
+            void *fn_arg = wal->durable_arg;
+            uint64_t durable = wal->durable;
+            wal->reported = durable;
+            pthread_mutex_unlock(&wal->lock);
+            fn(fn_arg, durable, err);
+            pthread_mutex_lock(&wal->lock);
+        }
+    }
+    pthread_mutex_unlock(&wal->lock);
+    return NULL;
+}
+
+/**
+ * Inicia o writer na primeira chamada de wal_submit (chamado com o lock)
+ */
+static int start_writer(Wal *wal) {
+    if (uring_init(&wal->ring) < 0) {
+        wal->ring.fd = -1;  // Sem io_uring: writev + fdatasync
+    }
+    wal->writer_running = 1;
+    if (pthread_create(&wal->writer, NULL, writer_main, wal) != 0) {
+        uring_close(&wal->ring);
+        wal->writer_running = 0;
+        errno = EAGAIN;
+        return -1;
+    }
+    wal->writer_started = 1;
+    return 0;
+}
+
+int64_t wal_append(Wal *wal, const void *data, size_t size) {
+    return wal_append_at(wal, data, size, NULL);
+}
+
+int64_t wal_submit(Wal *wal, const void *data, size_t size) {
+    if (size > WAL_MAX_RECORD_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    
+    WalEntry *entry = malloc(sizeof(*entry) + size);
+    if (!entry) {
+        return -1;
+    }
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry + 1, data, size);
+    entry->data = entry + 1;
+    entry->size = (uint32_t)size;
+    record_header(entry->header, entry->data, size);
+    
+    pthread_mutex_lock(&wal->lock);
+    int err = wal->writer_started || start_writer(wal) == 0 ? 0 : errno;
+    while (!err && !wal->error && wal->queued_bytes >= WAL_MAX_QUEUED) {
+        pthread_cond_wait(&wal->written, &wal->lock);  // O disco não acompanha
+    }
+    if (!err && wal->error) {
+        err = wal->error;
+    }
+    if (err) {
+        pthread_mutex_unlock(&wal->lock);
+        free(entry);
+        errno = err;
+        return -1;
+    }
+    
+    int64_t sequence = enqueue_locked(wal, entry);
+    pthread_mutex_unlock(&wal->lock);
+    return sequence;
+}
+
+int64_t wal_append_at(Wal *wal, const void *data, size_t size, WalPosition *position) {
+    if (size > WAL_MAX_RECORD_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    
+    uint8_t header[WAL_RECORD_HEADER];
+    record_header(header, data, size);
+    
+    pthread_mutex_lock(&wal->lock);
+    if (wal->error) {
+        errno = wal->error;
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+    
+    if (wal->writing || wal->queue_head) {
+        // Registros de wal_submit ainda não gravados vêm antes: este entra
+        // na fila do writer, sem cópia, e espera a gravação
+        WalEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.data = data;
+        entry.size = (uint32_t)size;
+        entry.waiting = 1;
+        memcpy(entry.header, header, WAL_RECORD_HEADER);
+        int64_t sequence = enqueue_locked(wal, &entry);
+        while (!entry.done) {
+            pthread_cond_wait(&wal->written, &wal->lock);
+        }
+        int err = wal->error;
+        pthread_mutex_unlock(&wal->lock);
+        if (entry.done < 0) {
+            errno = err;
+            return -1;
+        }
+        if (position) {
+            *position = entry.position;
+        }
+        return sequence;
+    }
+    
+    if (wal->segment_bytes > WAL_MAGIC_SIZE &&
+        wal->segment_bytes + WAL_RECORD_HEADER + size > wal->options.segment_size &&
+        rotate_segment(wal) < 0) {
+        int err = errno;
+        pthread_mutex_unlock(&wal->lock);
+        errno = err;
+        return -1;
+    }
+    
+    struct iovec iov[2] = { { header, WAL_RECORD_HEADER }, { (void *)data, size } };
+    if (write_all(wal->fd, iov, 2) < 0) {
+        // Remove o que tiver sido escrito pela metade
+        int err = errno;
+        if (ftruncate(wal->fd, (off_t)wal->segment_bytes) < 0) {
+            wal->error = err;
+        }
+        pthread_mutex_unlock(&wal->lock);
+        errno = err;
+        return -1;
+    }
+    
+    if (position) {
+        position->segment = wal->segment_first;
+        position->offset = wal->segment_bytes + WAL_RECORD_HEADER;
+        position->size = (uint32_t)size;
+    }
+    checkpoint_add(wal, wal->count, wal->segment_bytes);
+    int64_t sequence = (int64_t)wal->count++;
+    wal->next++;
+    wal->segment_bytes += WAL_RECORD_HEADER + size;
+    
+    if (wal->options.sync_mode == WAL_SYNC_ALWAYS) {
+        if (fdatasync(wal->fd) < 0) {
+            wal->error = errno;
+        } else {
+            wal->durable = wal->count;
+        }
+    }
+    
+    pthread_mutex_unlock(&wal->lock);
+    return sequence;
+}
+
+/**
+ * Espera até os registros com sequência menor que target estarem em disco
+ * Chamado com o lock
+ */
+static int wait_durable_locked(Wal *wal, uint64_t target) {
+    while (wal->durable < target && !wal->error) {
+        // Registros da fila do writer são sincronizados por ele; os gravados
+        // por wal_append, pela thread de sincronização ou aqui
+        if (wal->count > wal->durable && !wal->thread_started) {
+            if (!wal->syncing) {
+                sync_locked(wal);
+                continue;
+            }
+        } else if (wal->count > wal->durable) {
+            // Várias threads esperando dividem o mesmo fdatasync
+            wal->sync_requested = 1;
+            pthread_cond_signal(&wal->wake);
+        }
+        pthread_cond_wait(&wal->synced, &wal->lock);
+    }
+    
+    if (wal->durable < target) {
+        errno = wal->error;
+        return -1;
+    }
+    return 0;
+}
+
+int wal_sync(Wal *wal) {
+    pthread_mutex_lock(&wal->lock);
+    int rc = wait_durable_locked(wal, wal->next);
+    int err = errno;
+    pthread_mutex_unlock(&wal->lock);
+    errno = err;
+    return rc;
+}
+
+int wal_wait(Wal *wal, uint64_t sequence) {
+    pthread_mutex_lock(&wal->lock);
+    if (sequence >= wal->next) {
+        pthread_mutex_unlock(&wal->lock);
+        errno = EINVAL;
+        return -1;
+    }
+    int rc = wait_durable_locked(wal, sequence + 1);
+    int err = errno;
+    pthread_mutex_unlock(&wal->lock);
+    errno = err;
+    return rc;
+}
+
+void wal_on_durable(Wal *wal, WalDurableFn fn, void *arg) {
+    pthread_mutex_lock(&wal->lock);
+    wal->durable_fn = fn;
+    wal->durable_arg = arg;
+    wal->reported = wal->durable;
+    pthread_mutex_unlock(&wal->lock);
+}
+
+typedef struct {
+    WalRecordFn fn;
+    void *arg;
+} ReplayAdapter;
+
+static int replay_record(void *arg, uint64_t sequence, const WalPosition *position,
+                         const void *data, size_t size) {
+    (void)position;
+    ReplayAdapter *adapter = (ReplayAdapter *)arg;
+    return adapter->fn(adapter->arg, sequence, data, size);
+}
+
+int64_t wal_replay(Wal *wal, uint64_t from_sequence, WalRecordFn fn, void *arg) {
+    ReplayAdapter adapter = { fn, arg };
+    return wal_scan(wal, from_sequence, fn ? replay_record : NULL, &adapter);
+}
+
+int64_t wal_scan(Wal *wal, uint64_t from_sequence, WalScanFn fn, void *arg) {
+    // Retrato do log: registros e segmentos posteriores ficam de fora
+    pthread_mutex_lock(&wal->lock);
+    uint64_t limit = wal->count;
+    size_t count = wal->segment_count;
+    uint64_t *segments = malloc(count * sizeof(*segments));
+    if (segments) {
+        memcpy(segments, wal->segments, count * sizeof(*segments));
+    }
+    pthread_mutex_unlock(&wal->lock);
+    if (!segments) {
+        return -1;
+    }
+    
+    // Último segmento que começa antes de from_sequence
+    size_t start = 0;
+    while (start + 1 < count && segments[start + 1] <= from_sequence) {
+        start++;
+    }
+    
+    int64_t delivered = 0;
+    int rc = 0;
+    for (size_t i = start; i < count && rc == 0; i++) {
+        char path[WAL_PATH_SIZE];
+        uint64_t records, valid_end;
+        segment_path(wal, segments[i], path);
+        
+        // Só o primeiro segmento começa no meio, do ponto lembrado mais próximo
+        WalCheckpoint begin = { segments[i], WAL_MAGIC_SIZE };
+        if (i == start) {
+            pthread_mutex_lock(&wal->lock);
+            begin = checkpoint_find(wal, segments[i], from_sequence);
+            pthread_mutex_unlock(&wal->lock);
+        }
+        
+        int status = scan_segment(wal, path, segments[i], begin, from_sequence, limit, fn, arg,
+                                  &records, &valid_end);
+        uint64_t end = begin.sequence + records;
+        if (end > from_sequence) {
+            delivered += (int64_t)(end - (begin.sequence > from_sequence ? begin.sequence : from_sequence));
+        }
+        
+        if (status == SCAN_STOPPED) {
+            break;
+        }
+        if (status == SCAN_ERROR) {
+            rc = -1;
+        } else if (status != SCAN_END || (i + 1 < count && end != segments[i + 1])) {
+            errno = EILSEQ;  // Segmento antigo corrompido ou incompleto
+            rc = -1;
+        }
+    }
+    
+    int err = errno;
+    free(segments);
+    errno = err;
+    return rc < 0 ? -1 : delivered;
+}
+
+/**
+ * Mapeia o segmento de índice i (chamado com o lock)
+ */
+static int map_segment(Wal *wal, size_t i) {
+    char path[WAL_PATH_SIZE];
+    segment_path(wal, wal->segments[i], path);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    uint64_t largest = wal->options.segment_size > (uint64_t)st.st_size ?
+                       wal->options.segment_size : (uint64_t)st.st_size;
+    size_t length = (size_t)largest + WAL_RECORD_HEADER + WAL_MAX_RECORD_SIZE;
+    
+    void *base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+        errno = err;
+        return -1;
+    }
+    
+    WalMapping *map = &wal->maps[i];
+    map->base = base;
+    map->length = length;
+    if (i + 1 < wal->segment_count) {
+        map->bytes = (uint64_t)st.st_size;
+    }
+    return 0;
+}
+
+const void *wal_record(Wal *wal, const WalPosition *position) {
+    pthread_mutex_lock(&wal->lock);
+    
+    // Busca binária do segmento
+    size_t low = 0, high = wal->segment_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (wal->segments[middle] < position->segment) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == wal->segment_count || wal->segments[low] != position->segment) {
+        pthread_mutex_unlock(&wal->lock);
+        errno = ENOENT;
+        return NULL;
+    }
+    if (!wal->maps[low].base && map_segment(wal, low) < 0) {
+        int err = errno;
+        pthread_mutex_unlock(&wal->lock);
+        errno = err;
+        return NULL;
+    }
+    
+    const uint8_t *base = wal->maps[low].base;
+    uint64_t end = low + 1 == wal->segment_count ? wal->segment_bytes : wal->maps[low].bytes;
+    pthread_mutex_unlock(&wal->lock);
+    
+    if (position->offset < WAL_MAGIC_SIZE + WAL_RECORD_HEADER || position->offset > end ||
+        position->size > end - position->offset) {
+        errno = EILSEQ;
+        return NULL;
+    }
+    const uint8_t *header = base + position->offset - WAL_RECORD_HEADER;
+    const uint8_t *data = base + position->offset;
+    if (get_u32(header) != position->size ||
+        record_crc(header, data, position->size) != get_u32(header + 4)) {
+        errno = EILSEQ;
+        return NULL;
+    }
+    return data;
+}
+
+uint64_t wal_count(Wal *wal) {
+    pthread_mutex_lock(&wal->lock);
+    uint64_t count = wal->next;
+    pthread_mutex_unlock(&wal->lock);
+    return count;
+}
+
+uint64_t wal_durable_count(Wal *wal) {
+    pthread_mutex_lock(&wal->lock);
+    uint64_t durable = wal->durable;
+    pthread_mutex_unlock(&wal->lock);
+    return durable;
+}
+
+int wal_close(Wal *wal) {
+    if (wal->writer_started) {
+        // O writer termina de gravar a fila antes de sair
+        pthread_mutex_lock(&wal->lock);
+        wal->writer_running = 0;
+        pthread_cond_signal(&wal->queued);
+        pthread_mutex_unlock(&wal->lock);
+        pthread_join(wal->writer, NULL);
+    }
+    
+    int rc = wal_sync(wal);
+    int err = errno;
+    
+    if (wal->thread_started) {
+        pthread_mutex_lock(&wal->lock);
+        wal->running = 0;
+        pthread_cond_signal(&wal->wake);
+        pthread_mutex_unlock(&wal->lock);
+        pthread_join(wal->thread, NULL);
+    }
+    
+    wal_free(wal);
+    if (rc < 0) {
+        errno = err;
+    }
+    return rc;
+}
@@ -0,0 +1,178 @@
+/**
+ * Log de registros append-only (write-ahead log) em C
+ *
+ * Um diretório guarda uma sequência de segmentos <primeiro registro>.wal.
+ * Cada registro é [tamanho u32][crc32c u32][payload] (little-endian; o CRC
+ * cobre o tamanho e o payload) e recebe um número de sequência a partir de
+ * 0. Gravar um registro custa o tamanho dele, não o do histórico.
+ *
+ * Durabilidade (WalSyncMode):
+ *   WAL_SYNC_BATCH  - group commit: uma thread faz fdatasync a cada
+ *                     sync_interval_ms se houve escrita; wal_sync() acorda
+ *                     a thread e espera, e chamadas simultâneas de várias
+ *                     threads compartilham o mesmo fdatasync
+ *   WAL_SYNC_ALWAYS - fdatasync a cada wal_append
+ *   WAL_SYNC_NONE   - só em wal_sync(), na rotação e no fechamento
+ *
+ * wal_submit não espera nem a escrita: o registro vai para a fila de uma
+ * thread writer, que grava tudo o que acumulou enquanto o lote anterior ia
+ * para o disco e sincroniza (io_uring quando disponível, senão writev +
+ * fdatasync), em qualquer modo. A durabilidade é informada pela sequência:
+ * wal_wait(sequência), wal_durable_count ou o callback de wal_on_durable.
+ *
+ * Ao abrir, o final do último segmento é conferido: um registro incompleto
+ * ou com CRC errado (queda no meio da escrita) é truncado. Segmentos antigos
+ * só são lidos em wal_replay, que falha se encontrar corrupção neles.
+ * O log lembra o início de um registro a cada 1024 (nas escritas e nas
+ * leituras), e wal_replay/wal_scan começam do ponto lembrado mais próximo:
+ * ler os registros novos custa eles, não o segmento desde o começo.
+ * Todas as funções são seguras para várias threads.
+ *
+ * wal_record lê um registro pela posição devolvida em wal_append_at/wal_scan
+ * sem cópia: os segmentos são mapeados (mmap) e o ponteiro aponta para o
+ * page cache.
+ */
+
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WAL_DEFAULT_SEGMENT_SIZE (64u * 1024 * 1024)  // Rotação do segmento (bytes)
+#define WAL_DEFAULT_SYNC_INTERVAL_MS 10               // Janela do group commit
+#define WAL_MAX_RECORD_SIZE (16u * 1024 * 1024)       // Registros maiores são recusados
+
+typedef enum {
+    WAL_SYNC_NONE,
+    WAL_SYNC_BATCH,
+    WAL_SYNC_ALWAYS
+} WalSyncMode;
+
+typedef struct {
+    uint64_t segment_size;
+    int sync_interval_ms;
+    WalSyncMode sync_mode;
+} WalOptions;
+
+typedef struct Wal Wal;
+
+/**
+ * Posição de um registro: segmento (sequência do primeiro registro dele) e
+ * deslocamento do payload no arquivo
+ */
+typedef struct {
+    uint64_t segment;
+    uint64_t offset;
+    uint32_t size;
+} WalPosition;
+
+/**
+ * Chamada para cada registro em wal_replay
+ * @return 0 para continuar, diferente de 0 para parar
+ */
+typedef int (*WalRecordFn)(void *arg, uint64_t sequence, const void *data, size_t size);
+
+/**
+ * Chamada para cada registro em wal_scan (com a posição do registro)
+ * @return 0 para continuar, diferente de 0 para parar
+ */
+typedef int (*WalScanFn)(void *arg, uint64_t sequence, const WalPosition *position,
+                         const void *data, size_t size);
+
+/**
+ * Chamada pela thread do writer depois de cada lote: os registros com
+ * sequência menor que durable estão em disco
+ * @param error errno se o log entrou em erro (0 = ok)
+ */
+typedef void (*WalDurableFn)(void *arg, uint64_t durable, int error);
+
+/**
+ * Preenche as opções padrão (segmentos de 64 MiB, group commit de 10 ms)
+ */
+void wal_default_options(WalOptions *options);
+
+/**
+ * Abre (ou cria) o log no diretório
+ * @param options NULL para as opções padrão
+ * @return Log aberto, ou NULL com errno em erro
+ */
+Wal *wal_open(const char *directory, const WalOptions *options);
+
+/**
+ * Acrescenta um registro (durável de acordo com o modo de sincronização)
+ * @return Número de sequência do registro, ou -1 com errno em erro
+ */
+int64_t wal_append(Wal *wal, const void *data, size_t size);
+
+/**
+ * Como wal_append, devolvendo também a posição do registro
+ * @param position Recebe a posição (pode ser NULL)
+ */
+int64_t wal_append_at(Wal *wal, const void *data, size_t size, WalPosition *position);
+
+/**
+ * Acrescenta um registro sem esperar a escrita (cópia na fila do writer)
+ * Espera apenas se a fila passar de 64 MiB
+ * @return Número de sequência do registro, ou -1 com errno em erro
+ */
+int64_t wal_submit(Wal *wal, const void *data, size_t size);
+
+/**
+ * Espera até o registro sequence estar em disco
+ * @return 0 em sucesso, -1 com errno (EINVAL se a sequência ainda não existe)
+ */
+int wal_wait(Wal *wal, uint64_t sequence);
+
+/**
+ * Registra fn para ser chamada pelo writer a cada avanço da durabilidade
+ * (NULL remove); fn roda sem o lock do log, mas não deve chamar wal_close
+ */
+void wal_on_durable(Wal *wal, WalDurableFn fn, void *arg);
+
+/**
+ * Espera até todos os registros já acrescentados estarem em disco
+ * @return 0 em sucesso, -1 com errno em erro
+ */
+int wal_sync(Wal *wal);
+
+/**
+ * Percorre os registros a partir de from_sequence, em ordem
+ * Registros acrescentados durante a leitura, ou ainda na fila do writer,
+ * não são incluídos
+ * @return Quantidade de registros entregues, ou -1 com errno em erro
+ *         (EILSEQ se um registro de um segmento antigo está corrompido)
+ */
+int64_t wal_replay(Wal *wal, uint64_t from_sequence, WalRecordFn fn, void *arg);
+
+/**
+ * Como wal_replay, entregando também a posição de cada registro
+ */
+int64_t wal_scan(Wal *wal, uint64_t from_sequence, WalScanFn fn, void *arg);
+
+/**
+ * Payload do registro na posição, sem cópia (CRC conferido)
+ * O ponteiro continua válido até wal_close
+ * @return Ponteiro para position->size bytes, ou NULL com errno
+ *         (ENOENT se o segmento não existe, EILSEQ se o CRC não confere)
+ */
+const void *wal_record(Wal *wal, const WalPosition *position);
+
+/**
+ * Número de registros no log (sequência do próximo registro), incluindo os
+ * ainda na fila do writer
+ */
+uint64_t wal_count(Wal *wal);
+
+/**
+ * Número de registros já em disco (fdatasync concluído)
+ */
+uint64_t wal_durable_count(Wal *wal);
+
+/**
+ * Sincroniza e fecha o log, liberando a estrutura
+ * @return 0 em sucesso, -1 com errno se a última sincronização falhou
+ */
+int wal_close(Wal *wal);
+
+#endif /* WAL_H */
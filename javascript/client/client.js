@@ -2,16 +2,25 @@
  * Cliente BBS
  * Interface interativa para o usuário se comunicar com o sistema
  * Conecta ao broker (5555) e ao proxy (5558)
+ *
+ * Com vários brokers (BROKER_FRONTENDS) o cliente usa o broker do seu nome
+ * no anel de hash consistente; se ele não responder em
+ * BROKER_REQUEST_TIMEOUT ms, passa ao próximo do anel
  */
 
 const zmq = require('zeromq');
 const readline = require('readline');
-const { LogicalClock, createMessage, parseMessage, updateLogicalClock } = require('../common_utils');
+const { LogicalClock, createMessage, parseMessage, updateLogicalClock, BrokerRing, endpointsFromEnv } = require('../common_utils');
 
 // Configurações
-const BROKER_FRONTEND = 'tcp://broker:5555';
+const BROKER_FRONTENDS = endpointsFromEnv('BROKER_FRONTENDS', 'tcp://broker:5555');
+const BROKER_REQUEST_TIMEOUT = parseInt(process.env.BROKER_REQUEST_TIMEOUT || '5000', 10); // ms
 const PROXY_FRONTEND = 'tcp://proxy:5558';
 
+// Serviços que podem ser repetidos em outro broker depois de um timeout (um
+// publish ou login pode ter sido executado sem que a resposta chegasse)
+const IDEMPOTENT_SERVICES = new Set(['users', 'channels', 'get_history', 'get_private_history']);
+
 class BBSClient {
   /**
    * Inicializa o cliente BBS
@@ -21,8 +30,10 @@ class BBSClient {
     this.username = null;
     this.subscribedChannels = new Set();
     
-    // Sockets ZeroMQ
-    this.reqSocket = new zmq.Request();
+    // Sockets ZeroMQ (o Request é criado em connectBroker, pelo nome do usuário)
+    this.ring = new BrokerRing(BROKER_FRONTENDS);
+    this.broker = null;
+    this.reqSocket = null;
     this.subSocket = new zmq.Subscriber();
     
     // Interface readline
@@ -42,10 +53,6 @@ class BBSClient {
    */
   async connect() {
     try {
-      // Conecta ao broker para requisições
-      this.reqSocket.connect(BROKER_FRONTEND);
-      console.log(`[CLIENT] Conectado ao broker em ${BROKER_FRONTEND}`);
-      
       // Conecta ao proxy para assinaturas
       this.subSocket.connect(PROXY_FRONTEND);
       console.log(`[CLIENT] Conectado ao proxy em ${PROXY_FRONTEND}`);
@@ -81,6 +88,48 @@ class BBSClient {
     })();
   }
 
+  /**
+   * (Re)cria o socket de requisições conectado a endpoint; um Request sem
+   * resposta não aceita novo envio, então o socket antigo é descartado
+   */
+  connectBroker(endpoint) {
+    if (this.reqSocket) {
+      this.reqSocket.linger = 0;
+      this.reqSocket.close();
+    }
+    this.reqSocket = new zmq.Request({ receiveTimeout: BROKER_REQUEST_TIMEOUT });
+    this.reqSocket.connect(endpoint);
+    this.broker = endpoint;
+    console.log(`[CLIENT] Conectado ao broker em ${endpoint}`);
+  }
+
+  /**
+   * Envia uma requisição ao broker do usuário e retorna a resposta crua
+   * Se o broker não responder a tempo, é marcado como fora do ar e a
+   * requisição vai ao próximo do anel (só para serviços idempotentes)
+   */
+  async request(service, message, username = this.username) {
+    for (let attempt = 0; attempt < this.ring.endpoints.length; attempt++) {
+      // Volta ao broker do usuário quando ele sai do estado fora do ar
+      const endpoint = this.ring.pick(username);
+      if (endpoint !== this.broker) {
+        this.connectBroker(endpoint);
+      }
+      await this.reqSocket.send(message);
+      try {
+        const [rawResponse] = await this.reqSocket.receive();
+        return rawResponse;
+      } catch (error) {
+        if (error.code !== 'EAGAIN') throw error;
+        console.log(`[CLIENT] Broker ${this.broker} não respondeu em ${BROKER_REQUEST_TIMEOUT} ms`);
+        this.ring.markDown(this.broker);
+        this.connectBroker(this.ring.pick(username));
+        if (!IDEMPOTENT_SERVICES.has(service)) break;
+      }
+    }
+    throw new Error('broker não respondeu');
+  }
+
   /**
    * Realiza login do usuário
    */
@@ -89,9 +138,7 @@ class BBSClient {
       const data = { user: username };
       const message = createMessage('login', data, this.clock);
       
-      await this.reqSocket.send(message);
-      
-      const [rawResponse] = await this.reqSocket.receive();
+      const rawResponse = await this.request('login', message, username);
       const response = parseMessage(rawResponse);
       
       if (response && response.data) {
@@ -123,9 +170,7 @@ class BBSClient {
   async listUsers() {
     try {
       const message = createMessage('users', {}, this.clock);
-      await this.reqSocket.send(message);
-      
-      const [rawResponse] = await this.reqSocket.receive();
+      const rawResponse = await this.request('users', message);
       const response = parseMessage(rawResponse);
       
       if (response && response.data) {
@@ -150,9 +195,7 @@ class BBSClient {
       const data = { channel: channelName };
       const message = createMessage('channel', data, this.clock);
       
-      await this.reqSocket.send(message);
-      
-      const [rawResponse] = await this.reqSocket.receive();
+      const rawResponse = await this.request('channel', message);
       const response = parseMessage(rawResponse);
       
       if (response && response.data) {
@@ -180,9 +223,7 @@ class BBSClient {
   async listChannels() {
     try {
       const message = createMessage('channels', {}, this.clock);
-      await this.reqSocket.send(message);
-      
-      const [rawResponse] = await this.reqSocket.receive();
+      const rawResponse = await this.request('channels', message);
       const response = parseMessage(rawResponse);
       
       if (response && response.data) {
@@ -232,9 +273,7 @@ class BBSClient {
       };
       const message = createMessage('publish', data, this.clock);
       
-      await this.reqSocket.send(message);
-      
-      const [rawResponse] = await this.reqSocket.receive();
+      const rawResponse = await this.request('publish', message);
       const response = parseMessage(rawResponse);
       
       if (response && response.data) {
@@ -268,9 +307,7 @@ class BBSClient {
       };
       const message = createMessage('message', data, this.clock);
       
-      await this.reqSocket.send(message);
-      
-      const [rawResponse] = await this.reqSocket.receive();
+      const rawResponse = await this.request('message', message);
       const response = parseMessage(rawResponse);
       
       if (response && response.data) {
@@ -333,9 +370,7 @@ class BBSClient {
       const data = { channel: channelName, limit: limit };
       const message = createMessage('get_history', data, this.clock);
       
-      await this.reqSocket.send(message);
-      
-      const [rawResponse] = await this.reqSocket.receive();
+      const rawResponse = await this.request('get_history', message);
       const response = parseMessage(rawResponse);
       
       if (response && response.data) {
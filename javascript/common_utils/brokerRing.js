@@ -0,0 +1,108 @@
+/**
+ * Anel de Hash Consistente dos Brokers
+ * Distribui os clientes entre os brokers do cluster pelo nome do usuário
+ * Mesmo hash de python/common_utils/broker_ring.py: o cliente Node e o bot
+ * escolhem o mesmo broker para o mesmo nome
+ */
+
+const VIRTUAL_NODES = 64;
+const DOWN_INTERVAL_MS = 30000; // até tentar de novo um broker que não respondeu
+
+/**
+ * Hash de 32 bits de uma string (FNV-1a sobre UTF-8 + mistura final do murmur3)
+ * @param {string} key - Chave
+ * @returns {number} Hash sem sinal
+ */
+function ringHash(key) {
+  let value = 2166136261;
+  for (const byte of Buffer.from(key, 'utf8')) {
+    value = Math.imul(value ^ byte, 16777619) >>> 0;
+  }
+  value ^= value >>> 16;
+  value = Math.imul(value, 0x85ebca6b) >>> 0;
+  value ^= value >>> 13;
+  value = Math.imul(value, 0xc2b2ae35) >>> 0;
+  value ^= value >>> 16;
+  return value >>> 0;
+}
+
+/**
+ * Lista de endpoints separados por vírgula de uma variável de ambiente
+ * @param {string} name - Nome da variável
+ * @param {string} fallback - Valor padrão
+ * @returns {string[]} Endpoints
+ */
+function endpointsFromEnv(name, fallback) {
+  return (process.env[name] || fallback).split(',').map(endpoint => endpoint.trim()).filter(Boolean);
+}
+
+class BrokerRing {
+  /**
+   * Monta o anel: cada broker ocupa virtualNodes pontos (hash de "endpoint#i")
+   * @param {string[]} endpoints - Endpoints dos brokers (ex: tcp://broker:5555)
+   * @param {number} virtualNodes - Pontos de cada broker no anel
+   */
+  constructor(endpoints, virtualNodes = VIRTUAL_NODES) {
+    if (!endpoints.length) {
+      throw new Error('BrokerRing sem endpoints');
+    }
+    this.endpoints = [...endpoints];
+    const points = [];
+    for (const endpoint of this.endpoints) {
+      for (let i = 0; i < virtualNodes; i++) {
+        points.push([ringHash(`${endpoint}#${i}`), endpoint]);
+      }
+    }
+    points.sort((a, b) => a[0] - b[0] || (a[1] < b[1] ? -1 : a[1] > b[1] ? 1 : 0));
+    this.hashes = points.map(point => point[0]);
+    this.owners = points.map(point => point[1]);
+    this.downUntil = new Map();
+  }
+
+  /**
+   * Brokers na ordem do anel a partir do hash da chave: o primeiro é o
+   * broker do usuário, os demais são os substitutos
+   * @param {string} key - Nome do usuário
+   * @returns {string[]} Endpoints
+   */
+  candidates(key) {
+    const hash = ringHash(key);
+    let low = 0;
+    let high = this.hashes.length;
+    while (low < high) {
+      const middle = (low + high) >>> 1;
+      if (this.hashes[middle] < hash) low = middle + 1; else high = middle;
+    }
+    const order = [];
+    for (let i = 0; i < this.owners.length && order.length < this.endpoints.length; i++) {
+      const owner = this.owners[(low + i) % this.owners.length];
+      if (!order.includes(owner)) order.push(owner);
+    }
+    return order;
+  }
+
+  /**
+   * Primeiro broker da chave que não está marcado como fora do ar
+   * @param {string} key - Nome do usuário
+   * @returns {string} Endpoint
+   */
+  pick(key) {
+    const now = Date.now();
+    const order = this.candidates(key);
+    const up = order.find(endpoint => (this.downUntil.get(endpoint) || 0) <= now);
+    if (up) return up;
+    // Todos fora do ar: o que volta primeiro
+    return order.reduce((a, b) => (this.downUntil.get(a) <= this.downUntil.get(b) ? a : b));
+  }
+
+  /**
+   * O broker não respondeu: evitado por intervalMs
+   * @param {string} endpoint - Endpoint do broker
+   * @param {number} intervalMs - Duração em ms
+   */
+  markDown(endpoint, intervalMs = DOWN_INTERVAL_MS) {
+    this.downUntil.set(endpoint, Date.now() + intervalMs);
+  }
+}
+
+module.exports = { BrokerRing, ringHash, endpointsFromEnv };
@@ -9,11 +9,14 @@ const {
   createResponse,
   updateLogicalClock
 } = require('./messaging');
+const { BrokerRing, endpointsFromEnv } = require('./brokerRing');
 
 module.exports = {
   LogicalClock,
   createMessage,
   parseMessage,
   createResponse,
-  updateLogicalClock
+  updateLogicalClock,
+  BrokerRing,
+  endpointsFromEnv
 };
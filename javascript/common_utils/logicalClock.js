@@ -22,7 +22,10 @@ class LogicalClock {
 
   /**
    * Atualiza o relógio ao receber uma mensagem
-   * Usa o máximo entre o contador atual e o recebido, depois incrementa
+   * Usa o máximo entre o contador atual e o recebido, depois incrementa.
+   * Com BROKER_CLOCK=hlc o valor recebido passa de Number.MAX_SAFE_INTEGER:
+   * chega arredondado e o + 1 se perde, então o contador deixa de crescer
+   * (o broker recarimba a requisição com um valor maior de qualquer forma)
    * @param {number} receivedTime - Valor do relógio recebido na mensagem
    * @returns {number} Novo valor do contador
    */
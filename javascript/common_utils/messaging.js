@@ -5,6 +5,32 @@
 
 const msgpack = require('msgpack-lite');
 
+// Codec nativo do envelope (c/bindings, bbs_envelope.node); sem ele as
+// mensagens são montadas com msgpack-lite, no mesmo formato
+let envelope = null;
+try {
+  envelope = require(process.env.BBS_ENVELOPE_ADDON || './bbs_envelope.node');
+} catch (error) {
+  envelope = null;
+}
+
+/**
+ * Serializa {service, data}, pelo codec nativo quando disponível
+ * @param {string} service - Nome do serviço
+ * @param {Object} data - Dados da mensagem
+ * @returns {Buffer} Mensagem serializada
+ */
+function encodeEnvelope(service, data) {
+  if (envelope) {
+    try {
+      return envelope.encode(service, data, msgpack.encode);
+    } catch (error) {
+      // Campos demais ou tipos não suportados: caminho genérico
+    }
+  }
+  return msgpack.encode({ service: service, data: data });
+}
+
 /**
  * Cria uma mensagem serializada com MessagePack
  * @param {string} service - Nome do serviço
@@ -20,12 +46,7 @@ function createMessage(service, data, logicalClock) {
   data.timestamp = Date.now() / 1000;
   data.clock = clockValue;
   
-  const message = {
-    service: service,
-    data: data
-  };
-  
-  return msgpack.encode(message);
+  return encodeEnvelope(service, data);
 }
 
 /**
@@ -34,6 +55,14 @@ function createMessage(service, data, logicalClock) {
  * @returns {Object} Objeto com a mensagem deserializada
  */
 function parseMessage(rawMessage) {
+  if (envelope) {
+    try {
+      return envelope.decode(rawMessage, msgpack.decode);
+    } catch (error) {
+      // Não tem a forma {service, data}: decodifica genericamente
+    }
+  }
+  
   try {
     return msgpack.decode(rawMessage);
   } catch (error) {
@@ -65,12 +94,7 @@ function createResponse(service, status, data, logicalClock, description = null)
     responseData.description = description;
   }
   
-  const response = {
-    service: service,
-    data: responseData
-  };
-  
-  return msgpack.encode(response);
+  return encodeEnvelope(service, responseData);
 }
 
 /**
@@ -3,6 +3,10 @@
 Bot - Cliente Automático
 Gera mensagens automaticamente em canais públicos
 Conecta ao broker (5555) e ao proxy (5558)
+
+Com vários brokers (BROKER_FRONTENDS) o bot fica no broker do seu nome no
+anel de hash consistente; se ele não responder em BROKER_REQUEST_TIMEOUT ms,
+passa ao próximo do anel
 """
 
 import zmq
@@ -16,11 +20,20 @@ sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'common_utils')
 
 from logical_clock import LogicalClock
 from messaging import create_message, parse_message, update_logical_clock
+from broker_ring import BrokerRing, endpoints_from_env
 
 # Configurações
-BROKER_FRONTEND = "tcp://broker:5555"
+BROKER_FRONTENDS = endpoints_from_env('BROKER_FRONTENDS', 'tcp://broker:5555')
+BROKER_REQUEST_TIMEOUT = int(os.environ.get('BROKER_REQUEST_TIMEOUT', '5000'))  # ms
 PROXY_FRONTEND = "tcp://proxy:5558"
 
+# Tentativas quando o broker responde ocupado (data.retry_after)
+BUSY_RETRIES = 5
+
+# Serviços que podem ser repetidos em outro broker depois de um timeout (um
+# publish ou login pode ter sido executado sem que a resposta chegasse)
+IDEMPOTENT_SERVICES = {'users', 'channels', 'get_history', 'get_private_history'}
+
 # Mensagens padrão que o bot pode enviar
 BOT_MESSAGES = [
     "Olá a todos! 👋",
@@ -66,8 +79,10 @@ class BBSBot:
         # Contexto ZeroMQ
         self.context = zmq.Context()
         
-        # Socket REQ para broker
-        self.req_socket = self.context.socket(zmq.REQ)
+        # Socket REQ para broker (criado em _connect_broker)
+        self.ring = BrokerRing(BROKER_FRONTENDS)
+        self.broker = None
+        self.req_socket = None
         
         # Socket SUB para proxy (para ouvir canais)
         self.sub_socket = self.context.socket(zmq.SUB)
@@ -80,9 +95,8 @@ class BBSBot:
     def connect(self):
         """Conecta aos serviços"""
         try:
-            # Conecta ao broker
-            self.req_socket.connect(BROKER_FRONTEND)
-            print(f"[BOT:{self.username}] Conectado ao broker em {BROKER_FRONTEND}")
+            # Conecta ao broker do bot no anel
+            self._connect_broker(self.ring.pick(self.username))
             
             # Conecta ao proxy
             self.sub_socket.connect(PROXY_FRONTEND)
@@ -93,22 +107,67 @@ class BBSBot:
             print(f"[BOT:{self.username}] Erro ao conectar: {e}")
             return False
     
+    def _connect_broker(self, endpoint):
+        """
+        (Re)cria o socket REQ conectado a endpoint; um REQ sem resposta não
+        aceita novo envio, então o socket antigo é descartado
+        """
+        if self.req_socket is not None:
+            self.req_socket.close(linger=0)
+        self.req_socket = self.context.socket(zmq.REQ)
+        self.req_socket.setsockopt(zmq.RCVTIMEO, BROKER_REQUEST_TIMEOUT)
+        self.req_socket.connect(endpoint)
+        self.broker = endpoint
+        print(f"[BOT:{self.username}] Conectado ao broker em {endpoint}")
+    
+    def _exchange(self, service, data):
+        """
+        Uma ida e volta com o broker; se ele não responder a tempo, é marcado
+        como fora do ar e a requisição vai ao próximo do anel (só para
+        serviços idempotentes)
+        """
+        for _ in range(len(self.ring.endpoints)):
+            # Volta ao broker do bot quando ele sai do estado fora do ar
+            endpoint = self.ring.pick(self.username)
+            if endpoint != self.broker:
+                self._connect_broker(endpoint)
+            self.req_socket.send(create_message(service, data, self.clock))
+            try:
+                return parse_message(self.req_socket.recv())
+            except zmq.Again:
+                print(f"[BOT:{self.username}] Broker {self.broker} não respondeu em {BROKER_REQUEST_TIMEOUT} ms")
+                self.ring.mark_down(self.broker)
+                self._connect_broker(self.ring.pick(self.username))
+                if service not in IDEMPOTENT_SERVICES:
+                    return None
+        return None
+    
+    def request(self, service, data):
+        """
+        Envia uma requisição ao broker e retorna data da resposta
+        
+        Se o broker recusar por limite (status 'erro' com retry_after em ms),
+        espera o tempo indicado e repete, até BUSY_RETRIES vezes
+        """
+        for _ in range(BUSY_RETRIES + 1):
+            response = self._exchange(service, data)
+            if not response or not response.get('data'):
+                return None
+            
+            data_response = response['data']
+            update_logical_clock(self.clock, data_response.get('clock', 0))
+            retry_after = data_response.get('retry_after')
+            if data_response.get('status') != 'erro' or not retry_after:
+                return data_response
+            time.sleep(retry_after / 1000.0)
+        return data_response
+    
     def login(self):
         """Realiza login do bot"""
         try:
-            data = {'user': self.username}
-            message = create_message('login', data, self.clock)
-            
-            self.req_socket.send(message)
+            data = self.request('login', {'user': self.username})
             
-            # Recebe resposta
-            raw_response = self.req_socket.recv()
-            response = parse_message(raw_response)
-            
-            if response and response.get('data'):
-                data = response['data']
-                update_logical_clock(self.clock, data.get('clock', 0))
-                
+            if data:
                 if data.get('status') == 'sucesso':
                     print(f"[BOT:{self.username}] Login realizado com sucesso")
                     return True
@@ -125,17 +184,9 @@ class BBSBot:
     def get_channels(self):
         """Obtém lista de canais disponíveis"""
         try:
-            message = create_message('channels', {}, self.clock)
-            self.req_socket.send(message)
-            
-            # Recebe resposta
-            raw_response = self.req_socket.recv()
-            response = parse_message(raw_response)
+            data = self.request('channels', {})
             
-            if response and response.get('data'):
-                data = response['data']
-                update_logical_clock(self.clock, data.get('clock', 0))
-                
+            if data:
                 if data.get('channels'):
                     self.channels = data['channels']
                     print(f"[BOT:{self.username}] {len(self.channels)} canais encontrados")
@@ -153,19 +204,9 @@ class BBSBot:
         
         for channel in default_channels:
             try:
-                data = {'channel': channel}
-                message = create_message('channel', data, self.clock)
-                
-                self.req_socket.send(message)
+                data = self.request('channel', {'channel': channel})
                 
-                # Recebe resposta
-                raw_response = self.req_socket.recv()
-                response = parse_message(raw_response)
-                
-                if response and response.get('data'):
-                    data = response['data']
-                    update_logical_clock(self.clock, data.get('clock', 0))
-                    
+                if data:
                     if data.get('status') == 'sucesso':
                         print(f"[BOT:{self.username}] Canal #{channel} criado")
                 
@@ -192,18 +233,9 @@ class BBSBot:
                 'channel': channel,
                 'message': message_text
             }
-            message = create_message('publish', data, self.clock)
+            data = self.request('publish', data)
             
-            self.req_socket.send(message)
-            
-            # Recebe resposta
-            raw_response = self.req_socket.recv()
-            response = parse_message(raw_response)
-            
-            if response and response.get('data'):
-                data = response['data']
-                update_logical_clock(self.clock, data.get('clock', 0))
-                
+            if data:
                 if data.get('status') == 'OK':
                     return True
             
@@ -290,7 +322,8 @@ class BBSBot:
         except KeyboardInterrupt:
             print(f"\n[BOT:{self.username}] Encerrando bot...")
         finally:
-            self.req_socket.close()
+            if self.req_socket is not None:
+                self.req_socket.close()
             self.sub_socket.close()
             self.context.term()
 
@@ -0,0 +1,86 @@
+"""
+Anel de Hash Consistente dos Brokers
+Distribui os clientes entre os brokers do cluster pelo nome do usuário
+
+Cada broker ocupa VIRTUAL_NODES pontos do anel (hash de "endpoint#i") e o
+usuário vai ao primeiro ponto a partir do hash do seu nome: o mesmo usuário
+cai sempre no mesmo broker, e acrescentar ou remover um broker só move os
+usuários dos pontos dele. O hash (FNV-1a seguido da mistura final do
+murmur3) é o mesmo de javascript/common_utils/brokerRing.js, então o bot e
+o cliente Node escolhem o mesmo broker para o mesmo nome.
+
+Um broker que não responde é marcado como fora do ar por DOWN_INTERVAL
+segundos: o usuário passa ao próximo broker do anel e volta ao seu depois.
+"""
+
+import bisect
+import os
+import time
+from typing import Dict, List
+
+VIRTUAL_NODES = 64
+DOWN_INTERVAL = 30.0  # segundos até tentar de novo um broker que não respondeu
+
+def ring_hash(key: str) -> int:
+    """Hash de 32 bits de uma string (UTF-8)"""
+    value = 2166136261
+    for byte in key.encode('utf-8'):
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    value ^= value >> 16
+    value = (value * 0x85EBCA6B) & 0xFFFFFFFF
+    value ^= value >> 13
+    value = (value * 0xC2B2AE35) & 0xFFFFFFFF
+    value ^= value >> 16
+    return value
+
+def endpoints_from_env(name: str, default: str) -> List[str]:
+    """Lista de endpoints separados por vírgula de uma variável de ambiente"""
+    return [endpoint.strip() for endpoint in os.environ.get(name, default).split(',')
+            if endpoint.strip()]
+
+class BrokerRing:
+    """Anel de hash consistente sobre os endpoints dos brokers"""
+
+    def __init__(self, endpoints: List[str], virtual_nodes: int = VIRTUAL_NODES):
+        """
+        Args:
+            endpoints: Endpoints dos brokers (ex: frontends tcp://broker:5555)
+            virtual_nodes: Pontos de cada broker no anel
+        """
+        if not endpoints:
+            raise ValueError('BrokerRing sem endpoints')
+        self.endpoints = list(endpoints)
+        points = sorted((ring_hash(f"{endpoint}#{i}"), endpoint)
+                        for endpoint in self.endpoints for i in range(virtual_nodes))
+        self._hashes = [point[0] for point in points]
+        self._owners = [point[1] for point in points]
+        self._down_until: Dict[str, float] = {}
+
+    def candidates(self, key: str) -> List[str]:
+        """
+        Brokers na ordem do anel a partir do hash da chave: o primeiro é o
+        broker do usuário, os demais são os substitutos
+        """
+        start = bisect.bisect_left(self._hashes, ring_hash(key))
+        order = []
+        for i in range(len(self._owners)):
+            owner = self._owners[(start + i) % len(self._owners)]
+            if owner not in order:
+                order.append(owner)
+                if len(order) == len(self.endpoints):
+                    break
+        return order
+
+    def pick(self, key: str) -> str:
+        """Primeiro broker da chave que não está marcado como fora do ar"""
+        now = time.time()
+        order = self.candidates(key)
+        for endpoint in order:
+            if self._down_until.get(endpoint, 0) <= now:
+                return endpoint
+        # Todos fora do ar: o que volta primeiro
+        return min(order, key=lambda endpoint: self._down_until[endpoint])
+
+    def mark_down(self, endpoint: str, interval: float = DOWN_INTERVAL):
+        """O broker não respondeu: evitado por interval segundos"""
+        self._down_until[endpoint] = time.time() + interval
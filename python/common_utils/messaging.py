@@ -4,9 +4,58 @@ Funções auxiliares para criação e serialização de mensagens com MessagePac
 """
 
 import msgpack
+import struct
 import time
 from typing import Any, Dict
 
+# Codec nativo do envelope (c/bindings, módulo bbs_envelope); sem ele as
+# mensagens são montadas com msgpack, no mesmo formato
+try:
+    import bbs_envelope
+except ImportError:
+    bbs_envelope = None
+
+def _pack_value(value: Any) -> bytes:
+    return msgpack.packb(value, use_bin_type=True)
+
+def _unpack_value(raw: bytes) -> Any:
+    return msgpack.unpackb(raw, raw=False)
+
+# O clock é sempre serializado como uint64 (0xcf + 8 bytes) para que o broker
+# (BROKER_CLOCK=stamp) possa reescrevê-lo no lugar sem remontar a mensagem:
+# a mensagem é empacotada com um valor reservado que só cabe em uint64 e os
+# 8 bytes são trocados pelo valor real
+_CLOCK_SLOT = 0xFFFFFFFFFFFFFFFF
+_CLOCK_MARKER = msgpack.packb('clock') + msgpack.packb(_CLOCK_SLOT)
+
+def _pack_with_clock(message: Dict) -> bytes:
+    """
+    Serializa a mensagem com data['clock'] em largura fixa (uint64)
+    
+    Args:
+        message: Mensagem {service, data} com data['clock'] já definido
+    
+    Returns:
+        Mensagem serializada em bytes
+    """
+    data = message['data']
+    if bbs_envelope is not None:
+        try:
+            return bbs_envelope.encode(message['service'], data, _pack_value)
+        except (TypeError, ValueError):
+            pass  # Chaves não-str ou campos demais: caminho genérico
+    
+    clock_value = data['clock']
+    data['clock'] = _CLOCK_SLOT
+    try:
+        packed = bytearray(msgpack.packb(message, use_bin_type=True))
+    finally:
+        data['clock'] = clock_value
+    
+    slot = packed.rfind(_CLOCK_MARKER)
+    struct.pack_into('>Q', packed, slot + len(_CLOCK_MARKER) - 8, clock_value)
+    return bytes(packed)
+
 def create_message(service: str, data: Dict, logical_clock) -> bytes:
     """
     Cria uma mensagem serializada com MessagePack
@@ -31,7 +80,7 @@ def create_message(service: str, data: Dict, logical_clock) -> bytes:
         'data': data
     }
     
-    return msgpack.packb(message, use_bin_type=True)
+    return _pack_with_clock(message)
 
 def parse_message(raw_message: bytes) -> Dict[str, Any]:
     """
@@ -43,6 +92,12 @@ def parse_message(raw_message: bytes) -> Dict[str, Any]:
     Returns:
         Dicionário com a mensagem deserializada
     """
+    if bbs_envelope is not None:
+        try:
+            return bbs_envelope.decode(raw_message, _unpack_value)
+        except Exception:
+            pass  # Não tem a forma {service, data}: decodifica genericamente
+    
     try:
         return msgpack.unpackb(raw_message, raw=False)
     except Exception as e:
@@ -82,7 +137,7 @@ def create_response(service: str, status: str, data: Dict, logical_clock, descri
         'data': response_data
     }
     
-    return msgpack.packb(response, use_bin_type=True)
+    return _pack_with_clock(response)
 
 def update_logical_clock(logical_clock, received_clock: int):
     """
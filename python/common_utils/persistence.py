@@ -1,12 +1,70 @@
 """
 Módulo de Persistência Local
 Gerencia leitura e escrita de dados em arquivos JSON
+
+As mensagens (messages.json) ficam em um log append-only de registros
+MessagePack (libbbs_wal, ver wal.py) no diretório messages.wal: gravar uma
+mensagem custa a mensagem, não o histórico inteiro, e o índice de histórico
+(messages.wal/history.idx) serve páginas por canal/usuário sem percorrer as
+demais mensagens. BBS_STORAGE=json (ou a biblioteca ausente) mantém o
+arquivo JSON reescrito a cada gravação.
 """
 
 import json
 import os
+import shutil
+import threading
+import uuid
 from pathlib import Path
-from typing import Any, Dict, List
+from typing import Any, Dict, List, Optional, Tuple
+
+import msgpack
+
+try:
+    from . import wal
+except ImportError:
+    import wal
+
+HISTORY_CHANNEL = wal.HISTORY_CHANNEL
+HISTORY_USER = wal.HISTORY_USER
+
+# Arquivos guardados no log de registros (uma lista, um registro por item)
+LOG_FILES = ('messages.json',)
+
+class _RecordLog:
+    """Estado de um arquivo guardado no log de registros"""
+    
+    def __init__(self, directory: Path):
+        self.directory = directory
+        
+        # Identifica esta cópia do log: uma compactação cria outra (novo
+        # epoch), e posições de um epoch não valem no outro
+        epoch_file = directory / 'epoch'
+        if not epoch_file.exists():
+            epoch_file.parent.mkdir(parents=True, exist_ok=True)
+            epoch_file.write_text(uuid.uuid4().hex)
+        self.epoch = epoch_file.read_text().strip()
+        
+        self.wal = wal.WriteAheadLog(str(directory))
+        self.count = self.wal.count()
+        # Último registro gravado (bytes), para detectar gravações que só
+        # acrescentam itens
+        records = self.wal.replay(self.count - 1) if self.count else []
+        self.last = records[-1] if records else None
+        try:
+            self.history = wal.HistoryIndex(self.wal, str(directory / 'history.idx'))
+        except OSError:
+            self.wal.close()
+            raise
+    
+    def append(self, record: bytes) -> None:
+        self.history.append(record)
+        self.count += 1
+        self.last = record
+    
+    def close(self) -> None:
+        self.history.close()
+        self.wal.close()
 
 class DataStore:
     """Gerenciador de persistência local em JSON"""
@@ -24,6 +82,84 @@ class DataStore:
         # Subdiretório para replicação
         self.replication_dir = self.data_dir / "replication"
         self.replication_dir.mkdir(parents=True, exist_ok=True)
+        
+        # Logs de registros abertos (por nome de arquivo)
+        self.use_wal = os.environ.get('BBS_STORAGE', 'wal') != 'json'
+        self._logs: Dict[str, _RecordLog] = {}
+        self._logs_lock = threading.Lock()
+    
+    def _wal_directory(self, filename: str) -> Path:
+        return self.data_dir / (Path(filename).stem + '.wal')
+    
+    def _log(self, filename: str):
+        """
+        Retorna o log de registros do arquivo, abrindo-o na primeira vez
+        (None se o arquivo fica em JSON). Deve ser chamada com _logs_lock
+        """
+        if not self.use_wal or filename not in LOG_FILES:
+            return None
+        if filename in self._logs:
+            return self._logs[filename]
+        if not wal.available():
+            print(f"[STORAGE] libbbs_wal não encontrada, {filename} fica em JSON")
+            self.use_wal = False
+            return None
+        
+        directory = self._wal_directory(filename)
+        staging = directory.with_name(directory.name + '.new')
+        previous = directory.with_name(directory.name + '.old')
+        
+        # Compactação interrompida: .new incompleto é descartado; se o log
+        # antigo já tinha saído do lugar, ele volta
+        if staging.exists():
+            shutil.rmtree(staging)
+        if not directory.exists() and previous.exists():
+            previous.rename(directory)
+        elif previous.exists():
+            shutil.rmtree(previous)
+        
+        # Primeiro uso: migra o JSON existente para o log
+        if not directory.exists():
+            legacy = self._load_json(filename, [])
+            if not isinstance(legacy, list):
+                legacy = [legacy]
+            self._write_log(staging, legacy)
+            staging.rename(directory)
+            if legacy:
+                print(f"[STORAGE] {filename}: {len(legacy)} registros migrados para {directory.name}")
+        
+        log = _RecordLog(directory)
+        self._logs[filename] = log
+        return log
+    
+    def _write_log(self, directory: Path, items: List) -> None:
+        """Cria um log novo com os itens e espera estarem em disco"""
+        with wal.WriteAheadLog(str(directory)) as log:
+            for item in items:
+                log.append(msgpack.packb(item, use_bin_type=True))
+            log.sync()
+    
+    def _compact_log(self, filename: str, log: _RecordLog, items: List) -> None:
+        """Substitui o conteúdo do log pelos itens (gravação fora de ordem)"""
+        staging = log.directory.with_name(log.directory.name + '.new')
+        previous = log.directory.with_name(log.directory.name + '.old')
+        if staging.exists():
+            shutil.rmtree(staging)
+        self._write_log(staging, items)
+        
+        log.close()
+        del self._logs[filename]
+        log.directory.rename(previous)
+        staging.rename(log.directory)
+        shutil.rmtree(previous)
+        self._logs[filename] = _RecordLog(log.directory)
+    
+    def close(self) -> None:
+        """Sincroniza e fecha os logs de registros"""
+        with self._logs_lock:
+            for log in self._logs.values():
+                log.close()
+            self._logs.clear()
     
     def load(self, filename: str, default: Any = None) -> Any:
         """
@@ -36,6 +172,21 @@ class DataStore:
         Returns:
             Dados carregados ou valor padrão
         """
+        with self._logs_lock:
+            try:
+                log = self._log(filename)
+                if log is not None:
+                    records = log.wal.replay()
+                    log.count = len(records)
+                    log.last = records[-1] if records else None
+                    return [msgpack.unpackb(record, raw=False) for record in records]
+            except (OSError, ValueError) as e:
+                print(f"Erro ao carregar {filename}: {e}")
+                return default if default is not None else []
+        
+        return self._load_json(filename, default)
+    
+    def _load_json(self, filename: str, default: Any) -> Any:
         filepath = self.data_dir / filename
         
         if not filepath.exists():
@@ -59,6 +210,23 @@ class DataStore:
         Returns:
             True se salvo com sucesso, False caso contrário
         """
+        with self._logs_lock:
+            try:
+                log = self._log(filename)
+                if log is not None:
+                    items = data if isinstance(data, list) else [data]
+                    # Lista que só cresceu desde a última gravação: grava só
+                    # o que falta; qualquer outra mudança reescreve o log
+                    if len(items) >= log.count and (log.count == 0 or
+                            msgpack.packb(items[log.count - 1], use_bin_type=True) == log.last):
+                        self._append_records(log, items[log.count:])
+                    else:
+                        self._compact_log(filename, log, items)
+                    return True
+            except (OSError, ValueError, TypeError) as e:
+                print(f"Erro ao salvar {filename}: {e}")
+                return False
+        
         filepath = self.data_dir / filename
         
         try:
@@ -80,12 +248,120 @@ class DataStore:
         Returns:
             True se adicionado com sucesso
         """
+        with self._logs_lock:
+            try:
+                log = self._log(filename)
+                if log is not None:
+                    self._append_records(log, [item])
+                    return True
+            except (OSError, ValueError, TypeError) as e:
+                print(f"Erro ao salvar {filename}: {e}")
+                return False
+        
         data = self.load(filename, default=[])
         if not isinstance(data, list):
             data = [data]
         data.append(item)
         return self.save(filename, data)
     
+    def _append_records(self, log: _RecordLog, items: List) -> None:
+        for item in items:
+            log.append(msgpack.packb(item, use_bin_type=True))
+    
+    def log_position(self, filename: str) -> Optional[Tuple[str, int]]:
+        """
+        Posição atual do log do arquivo
+        
+        Returns:
+            (epoch, quantidade de registros), ou None se o arquivo fica em JSON
+        """
+        with self._logs_lock:
+            try:
+                log = self._log(filename)
+            except (OSError, ValueError) as e:
+                print(f"Erro ao abrir log de {filename}: {e}")
+                return None
+            return (log.epoch, log.count) if log is not None else None
+    
+    def read_records(self, filename: str, offset: int, limit: int,
+                     max_bytes: int) -> Optional[Tuple[str, List[bytes], int]]:
+        """
+        Lê registros brutos (MessagePack) do log a partir de offset
+        
+        Args:
+            filename: Arquivo guardado no log
+            offset: Primeiro registro
+            limit: Máximo de registros
+            max_bytes: Para depois de juntar pelo menos este total de bytes
+        
+        Returns:
+            (epoch, registros, quantidade total de registros), ou None se o
+            arquivo fica em JSON
+        """
+        with self._logs_lock:
+            try:
+                log = self._log(filename)
+                if log is None:
+                    return None
+                return log.epoch, log.wal.replay(offset, limit, max_bytes), log.count
+            except (OSError, ValueError) as e:
+                print(f"Erro ao ler registros de {filename}: {e}")
+                return None
+    
+    def extend(self, filename: str, items: List) -> bool:
+        """
+        Adiciona vários itens a uma lista existente
+        
+        Args:
+            filename: Nome do arquivo
+            items: Itens a serem adicionados
+        
+        Returns:
+            True se adicionados com sucesso
+        """
+        with self._logs_lock:
+            try:
+                log = self._log(filename)
+                if log is not None:
+                    self._append_records(log, items)
+                    return True
+            except (OSError, ValueError, TypeError) as e:
+                print(f"Erro ao salvar {filename}: {e}")
+                return False
+        
+        data = self.load(filename, default=[])
+        if not isinstance(data, list):
+            data = [data]
+        data.extend(items)
+        return self.save(filename, data)
+    
+    def history(self, filename: str, kind: int, name: str, limit: int,
+                before: Any = None) -> Optional[List]:
+        """
+        Lê uma página do histórico pelo índice do log
+        
+        Args:
+            filename: Arquivo guardado no log (ex: 'messages.json')
+            kind: HISTORY_CHANNEL (publicações no canal) ou HISTORY_USER
+                  (mensagens privadas enviadas ou recebidas pelo usuário)
+            name: Canal ou usuário
+            limit: Quantidade máxima de mensagens (as mais recentes)
+            before: Só mensagens com clock menor que este (None = sem limite)
+        
+        Returns:
+            Mensagens em ordem de clock, ou None se o arquivo não tem índice
+        """
+        with self._logs_lock:
+            try:
+                log = self._log(filename)
+                if log is None:
+                    return None
+                records = log.history.page(kind, name, limit, before)
+            except (OSError, ValueError, TypeError) as e:
+                print(f"Erro ao ler histórico de {filename}: {e}")
+                return None
+        return [msgpack.unpackb(record, raw=False) for record in records]
+    
     def save_replication(self, server_name: str, data: Dict) -> bool:
         """
         Salva dados de replicação específicos de um servidor
@@ -0,0 +1,182 @@
+"""
+Módulo do Transporte de Replicação
+Binding ctypes da biblioteca C libbbs_replication (c/replication): conexões
+DEALER persistentes com cada servidor, registros enviados em lotes sem
+esperar resposta e confirmados pela posição no log do servidor de origem
+"""
+
+import ctypes
+import os
+from typing import Callable, Dict, Optional
+
+# Caminhos procurados quando BBS_REPLICATION_LIBRARY não está definido
+_LIBRARY_PATHS = [
+    '/usr/local/lib/libbbs_replication.so',
+    os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'c', 'replication',
+                 'libbbs_replication.so'),
+]
+
+class _ReplOptions(ctypes.Structure):
+    _fields_ = [
+        ('batch_records', ctypes.c_int),
+        ('batch_bytes', ctypes.c_size_t),
+        ('window', ctypes.c_int),
+        ('retransmit_ms', ctypes.c_int),
+        ('max_pending', ctypes.c_size_t),
+    ]
+
+class _ReplStats(ctypes.Structure):
+    _fields_ = [(name, ctypes.c_uint64) for name in
+                ('records', 'batches', 'retransmits', 'dropped', 'pending', 'received', 'duplicates',
+                 'resyncs')]
+
+_APPLY_FN = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64,
+                             ctypes.c_void_p, ctypes.c_size_t)
+_RESYNC_FN = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_uint64, ctypes.c_uint64)
+
+_library = None
+
+def _load_library():
+    """Carrega a biblioteca uma única vez (None se não encontrada)"""
+    global _library
+    if _library is not None:
+        return _library or None
+
+    paths = ([os.environ['BBS_REPLICATION_LIBRARY']] if os.environ.get('BBS_REPLICATION_LIBRARY')
+             else _LIBRARY_PATHS)
+    for path in paths:
+        try:
+            lib = ctypes.CDLL(path, use_errno=True)
+        except OSError:
+            continue
+
+        lib.repl_default_options.argtypes = [ctypes.POINTER(_ReplOptions)]
+        lib.repl_default_options.restype = None
+        lib.repl_open.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.POINTER(_ReplOptions),
+                                  _APPLY_FN, _RESYNC_FN, ctypes.c_void_p]
+        lib.repl_open.restype = ctypes.c_void_p
+        lib.repl_set_peers.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_char_p),
+                                       ctypes.POINTER(ctypes.c_char_p), ctypes.c_int]
+        lib.repl_set_peers.restype = ctypes.c_int
+        lib.repl_send.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+        lib.repl_send.restype = ctypes.c_int64
+        lib.repl_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(_ReplStats)]
+        lib.repl_stats.restype = None
+        lib.repl_close.argtypes = [ctypes.c_void_p]
+        lib.repl_close.restype = None
+        _library = lib
+        return lib
+
+    _library = False
+    return None
+
+def available() -> bool:
+    """Indica se a biblioteca libbbs_replication foi encontrada"""
+    return _load_library() is not None
+
+def _raise_errno(what: str):
+    err = ctypes.get_errno()
+    raise OSError(err, f"{what}: {os.strerror(err)}")
+
+class ReplicationLink:
+    """Envio em lotes para os peers e recepção dos lotes deles"""
+
+    def __init__(self, name: str, bind_endpoint: str, apply: Callable[[str, int, bytes], bool],
+                 resync: Optional[Callable[[str, int, int], None]] = None,
+                 batch_records: Optional[int] = None, window: Optional[int] = None,
+                 retransmit_ms: Optional[int] = None, max_pending: Optional[int] = None):
+        """
+        Inicia o transporte
+
+        Args:
+            name: Nome deste servidor (origem dos registros enviados)
+            bind_endpoint: Endpoint onde os peers entregam lotes (ex.: tcp://*:6002)
+            apply: apply(origem, posição, registro) -> True se aplicado; chamada
+                   por uma thread da biblioteca, um registro por vez, em ordem.
+                   False faz a origem reenviar a partir deste registro
+            resync: resync(origem, de, até): registros de origem nas posições
+                    de..até-1 não vão chegar (descartados pela origem antes da
+                    confirmação, ou perdidos quando ela reiniciou: de = 0);
+                    chamada pela thread da biblioteca, sem bloquear
+            batch_records: Registros por lote
+            window: Lotes sem confirmação em trânsito por peer
+            retransmit_ms: Tempo sem confirmação antes de reenviar
+            max_pending: Bytes retidos aguardando confirmação (além disso os
+                         mais antigos são descartados)
+        """
+        lib = _load_library()
+        if lib is None:
+            raise OSError("libbbs_replication não encontrada (defina BBS_REPLICATION_LIBRARY)")
+
+        options = _ReplOptions()
+        lib.repl_default_options(ctypes.byref(options))
+        if batch_records is not None:
+            options.batch_records = batch_records
+        if window is not None:
+            options.window = window
+        if retransmit_ms is not None:
+            options.retransmit_ms = retransmit_ms
+        if max_pending is not None:
+            options.max_pending = max_pending
+
+        def on_record(_arg, source, offset, data, size):
+            try:
+                return 0 if apply(source.decode('utf-8'), offset, ctypes.string_at(data, size)) else 1
+            except Exception as e:
+                # Um registro que falha sempre travaria a origem: é descartado
+                print(f"[REPLICATION] Erro ao aplicar registro {offset} de {source!r}: {e}")
+                return 0
+
+        def on_resync(_arg, source, first, end):
+            try:
+                resync(source.decode('utf-8'), first, end)
+            except Exception as e:
+                print(f"[REPLICATION] Erro ao tratar lacuna {first}..{end} de {source!r}: {e}")
+
+        self._lib = lib
+        # Referências mantidas enquanto a biblioteca as chama
+        self._apply = _APPLY_FN(on_record)
+        self._resync = _RESYNC_FN(on_resync) if resync else _RESYNC_FN()
+        self._handle = lib.repl_open(name.encode('utf-8'), bind_endpoint.encode('utf-8'),
+                                     ctypes.byref(options), self._apply, self._resync, None)
+        if not self._handle:
+            _raise_errno(f"repl_open({bind_endpoint})")
+
+    def set_peers(self, peers: Dict[str, str]):
+        """
+        Define os peers: {nome: endpoint}; conexões dos que continuam são mantidas
+        """
+        names = (ctypes.c_char_p * max(1, len(peers)))(*[n.encode('utf-8') for n in peers])
+        endpoints = (ctypes.c_char_p * max(1, len(peers)))(*[e.encode('utf-8') for e in peers.values()])
+        if self._lib.repl_set_peers(self._handle, names, endpoints, len(peers)) != 0:
+            _raise_errno("repl_set_peers")
+
+    def send(self, record: bytes) -> int:
+        """
+        Acrescenta um registro para todos os peers, sem esperar o envio
+
+        Returns:
+            Posição do registro no log deste servidor
+        """
+        offset = self._lib.repl_send(self._handle, record, len(record))
+        if offset < 0:
+            _raise_errno("repl_send")
+        return offset
+
+    def stats(self) -> Dict[str, int]:
+        """Contadores do transporte (registros, lotes, reenvios, descartes...)"""
+        stats = _ReplStats()
+        self._lib.repl_stats(self._handle, ctypes.byref(stats))
+        return {name: getattr(stats, name) for name, _ in _ReplStats._fields_}
+
+    def close(self):
+        """Para o transporte; registros ainda não confirmados são descartados"""
+        if self._handle:
+            handle, self._handle = self._handle, None
+            self._lib.repl_close(handle)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
@@ -0,0 +1,278 @@
+"""
+Módulo do Log de Registros
+Binding ctypes da biblioteca C libbbs_wal (c/storage): log append-only de
+registros com CRC, group commit e rotação de segmentos, e o índice de
+histórico por canal/usuário sobre ele
+"""
+
+import ctypes
+import os
+from typing import List, Optional
+
+# Caminhos procurados quando BBS_WAL_LIBRARY não está definido
+_LIBRARY_PATHS = [
+    '/usr/local/lib/libbbs_wal.so',
+    os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', 'c', 'storage', 'libbbs_wal.so'),
+]
+
+# Modos de sincronização (WalSyncMode em wal.h)
+SYNC_NONE = 0
+SYNC_BATCH = 1
+SYNC_ALWAYS = 2
+
+# Tipos de chave do índice de histórico (history.h)
+HISTORY_CHANNEL = 0
+HISTORY_USER = 1
+
+# Maior página que o índice devolve por consulta
+MAX_HISTORY_PAGE = 1000
+
+class _WalOptions(ctypes.Structure):
+    _fields_ = [
+        ('segment_size', ctypes.c_uint64),
+        ('sync_interval_ms', ctypes.c_int),
+        ('sync_mode', ctypes.c_int),
+    ]
+
+class _HistoryRecord(ctypes.Structure):
+    _fields_ = [
+        ('data', ctypes.c_void_p),
+        ('size', ctypes.c_size_t),
+        ('clock', ctypes.c_uint64),
+        ('sequence', ctypes.c_uint64),
+    ]
+
+_RECORD_FN = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_uint64,
+                              ctypes.c_void_p, ctypes.c_size_t)
+
+_library = None
+
+def _load_library():
+    """Carrega a biblioteca uma única vez (None se não encontrada)"""
+    global _library
+    if _library is not None:
+        return _library or None
+
+    paths = [os.environ['BBS_WAL_LIBRARY']] if os.environ.get('BBS_WAL_LIBRARY') else _LIBRARY_PATHS
+    for path in paths:
+        try:
+            lib = ctypes.CDLL(path, use_errno=True)
+        except OSError:
+            continue
+
+        lib.wal_default_options.argtypes = [ctypes.POINTER(_WalOptions)]
+        lib.wal_default_options.restype = None
+        lib.wal_open.argtypes = [ctypes.c_char_p, ctypes.POINTER(_WalOptions)]
+        lib.wal_open.restype = ctypes.c_void_p
+        lib.wal_append.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+        lib.wal_append.restype = ctypes.c_int64
+        lib.wal_submit.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+        lib.wal_submit.restype = ctypes.c_int64
+        lib.wal_wait.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+        lib.wal_wait.restype = ctypes.c_int
+        lib.wal_sync.argtypes = [ctypes.c_void_p]
+        lib.wal_sync.restype = ctypes.c_int
+        lib.wal_replay.argtypes = [ctypes.c_void_p, ctypes.c_uint64, _RECORD_FN, ctypes.c_void_p]
+        lib.wal_replay.restype = ctypes.c_int64
+        lib.wal_count.argtypes = [ctypes.c_void_p]
+        lib.wal_count.restype = ctypes.c_uint64
+        lib.wal_durable_count.argtypes = [ctypes.c_void_p]
+        lib.wal_durable_count.restype = ctypes.c_uint64
+        lib.wal_close.argtypes = [ctypes.c_void_p]
+        lib.wal_close.restype = ctypes.c_int
+        lib.history_open.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+        lib.history_open.restype = ctypes.c_void_p
+        lib.history_append.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+        lib.history_append.restype = ctypes.c_int64
+        lib.history_page.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t,
+                                     ctypes.c_uint64, ctypes.c_size_t, ctypes.POINTER(_HistoryRecord)]
+        lib.history_page.restype = ctypes.c_int64
+        lib.history_close.argtypes = [ctypes.c_void_p]
+        lib.history_close.restype = None
+        _library = lib
+        return lib
+
+    _library = False
+    return None
+
+def available() -> bool:
+    """Indica se a biblioteca libbbs_wal foi encontrada"""
+    return _load_library() is not None
+
+def _raise_errno(what: str):
+    err = ctypes.get_errno()
+    raise OSError(err, f"{what}: {os.strerror(err)}")
+
+class WriteAheadLog:
+    """Log append-only de registros binários (um diretório de segmentos)"""
+
+    def __init__(self, directory: str, sync_mode: int = SYNC_BATCH,
+                 segment_size: Optional[int] = None, sync_interval_ms: Optional[int] = None):
+        """
+        Abre (ou cria) o log
+
+        Args:
+            directory: Diretório dos segmentos
+            sync_mode: SYNC_NONE, SYNC_BATCH (group commit) ou SYNC_ALWAYS
+            segment_size: Tamanho de rotação dos segmentos (bytes)
+            sync_interval_ms: Janela do group commit
+        """
+        lib = _load_library()
+        if lib is None:
+            raise OSError("libbbs_wal não encontrada (defina BBS_WAL_LIBRARY)")
+
+        options = _WalOptions()
+        lib.wal_default_options(ctypes.byref(options))
+        options.sync_mode = sync_mode
+        if segment_size is not None:
+            options.segment_size = segment_size
+        if sync_interval_ms is not None:
+            options.sync_interval_ms = sync_interval_ms
+
+        self._lib = lib
+        self._handle = lib.wal_open(os.fsencode(directory), ctypes.byref(options))
+        if not self._handle:
+            _raise_errno(f"wal_open({directory})")
+
+    def append(self, record: bytes) -> int:
+        """
+        Acrescenta um registro
+
+        Returns:
+            Número de sequência do registro
+        """
+        sequence = self._lib.wal_append(self._handle, record, len(record))
+        if sequence < 0:
+            _raise_errno("wal_append")
+        return sequence
+
+    def submit(self, record: bytes) -> int:
+        """
+        Acrescenta um registro sem esperar a escrita: a thread do writer o
+        grava e sincroniza junto com os outros que chegarem no mesmo lote
+
+        Returns:
+            Número de sequência do registro (ver wait e durable_count)
+        """
+        sequence = self._lib.wal_submit(self._handle, record, len(record))
+        if sequence < 0:
+            _raise_errno("wal_submit")
+        return sequence
+
+    def wait(self, sequence: int):
+        """Espera até o registro sequence estar em disco"""
+        if self._lib.wal_wait(self._handle, sequence) != 0:
+            _raise_errno("wal_wait")
+
+    def sync(self):
+        """Espera até todos os registros acrescentados estarem em disco"""
+        if self._lib.wal_sync(self._handle) != 0:
+            _raise_errno("wal_sync")
+
+    def replay(self, from_sequence: int = 0, limit: Optional[int] = None,
+               max_bytes: Optional[int] = None) -> List[bytes]:
+        """
+        Lê os registros a partir de from_sequence
+
+        Args:
+            from_sequence: Primeiro registro
+            limit: Máximo de registros (None = até o fim)
+            max_bytes: Para depois de juntar pelo menos este total de bytes
+
+        Returns:
+            Lista com o conteúdo dos registros, em ordem
+        """
+        records = []
+        total = [0]
+
+        def collect(_arg, _sequence, data, size):
+            records.append(ctypes.string_at(data, size))
+            total[0] += size
+            if limit is not None and len(records) >= limit:
+                return 1
+            return 1 if max_bytes is not None and total[0] >= max_bytes else 0
+
+        if self._lib.wal_replay(self._handle, from_sequence, _RECORD_FN(collect), None) < 0:
+            _raise_errno("wal_replay")
+        return records
+
+    def count(self) -> int:
+        """Número de registros no log"""
+        return self._lib.wal_count(self._handle)
+
+    def durable_count(self) -> int:
+        """Número de registros já em disco"""
+        return self._lib.wal_durable_count(self._handle)
+
+    def close(self):
+        """Sincroniza e fecha o log"""
+        if self._handle:
+            handle, self._handle = self._handle, None
+            if self._lib.wal_close(handle) != 0:
+                _raise_errno("wal_close")
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+class HistoryIndex:
+    """Índice de histórico (canal/usuário, ordenado por clock) sobre um log aberto"""
+
+    def __init__(self, log: WriteAheadLog, path: str):
+        """
+        Abre o índice, refazendo a partir do log o que faltar no arquivo
+
+        Args:
+            log: Log indexado; enquanto o índice está aberto, as escritas no
+                 log devem passar por HistoryIndex.append
+            path: Arquivo de índice
+        """
+        self._lib = log._lib
+        self._handle = self._lib.history_open(log._handle, os.fsencode(path))
+        if not self._handle:
+            _raise_errno(f"history_open({path})")
+
+    def append(self, record: bytes) -> int:
+        """
+        Acrescenta um registro ao log e o indexa
+
+        Returns:
+            Número de sequência do registro
+        """
+        sequence = self._lib.history_append(self._handle, record, len(record))
+        if sequence < 0:
+            _raise_errno("history_append")
+        return sequence
+
+    def page(self, kind: int, name: str, limit: int, before: Optional[int] = None) -> List[bytes]:
+        """
+        Lê os últimos limit registros da chave com clock menor que before
+
+        Args:
+            kind: HISTORY_CHANNEL ou HISTORY_USER
+            name: Canal ou usuário
+            limit: Tamanho da página (no máximo MAX_HISTORY_PAGE)
+            before: Clock limite (exclusivo); None para os mais recentes
+
+        Returns:
+            Registros em ordem crescente de clock
+        """
+        limit = max(0, min(int(limit), MAX_HISTORY_PAGE))
+        if limit == 0:
+            return []
+        encoded = name.encode('utf-8')
+        records = (_HistoryRecord * limit)()
+        count = self._lib.history_page(self._handle, kind, encoded, len(encoded),
+                                       0xFFFFFFFFFFFFFFFF if before is None else max(0, int(before)),
+                                       limit, records)
+        if count < 0:
+            _raise_errno("history_page")
+        return [ctypes.string_at(records[i].data, records[i].size) for i in range(count)]
+
+    def close(self):
+        """Fecha o índice (o log continua aberto)"""
+        if self._handle:
+            handle, self._handle = self._handle, None
+            self._lib.history_close(handle)
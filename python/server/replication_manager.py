@@ -4,12 +4,39 @@ Módulo de Gerenciamento de Replicação
 Gerencia sincronização de dados entre servidores distribuídos
 """
 
+import hashlib
+import os
 import zmq
 import time
+import zlib
+import struct
 import msgpack
-from typing import Dict, List, Any
+from collections import OrderedDict
+from typing import Dict, List, Any, Optional
 from threading import Thread, Lock
 
+import replication_link
+
+# Transferência de estado (sync_begin + sync_chunk): as mensagens vêm do log
+# do coordenador em blocos, a partir da última posição já recebida
+SYNC_CHUNK_RECORDS = 500          # Registros por bloco
+SYNC_CHUNK_BYTES = 1 << 20        # Bloco fecha ao passar deste tamanho
+SYNC_TIMEOUT_MS = 5000            # Timeout de cada bloco
+SYNC_RETRIES = 3                  # Tentativas por bloco antes de desistir
+SYNC_RESETS = 3                   # Recomeços seguidos (log do coordenador trocado)
+SYNC_PENDING_MAX = 50000          # Mensagens locais ainda não casadas guardadas com a posição
+
+# Mensagens replicadas são acrescentadas ao log local sem reler o histórico:
+# as repetidas são descartadas pelos resumos das últimas SEEN_MAX mensagens
+# do log, lidas a partir da última posição vista
+SEEN_MAX = 100000
+REPLICATION_LOG_MAX = 1000        # Entradas guardadas em replication/<servidor>.json
+REPLICATION_LOG_SAVE_INTERVAL = 1.0  # segundos entre gravações desse arquivo
+
+# Transporte em lotes (libbbs_replication): `replicate` sem um REQ por
+# registro e por servidor; BBS_REPLICATION=req volta ao envio antigo
+REPLICATION_BATCH_PORT = 6002
+
 class ReplicationManager:
     """
     Gerenciador de replicação de dados entre servidores
@@ -41,9 +68,23 @@ class ReplicationManager:
         # Socket REP para receber requisições de replicação (porta 6000)
         self.rep_socket = self.context.socket(zmq.REP)
         
+        # Transporte em lotes (None = um REQ por envio)
+        self.link = None
+        
         # Histórico de replicação
         self.replication_log = []
         self.log_lock = Lock()
+        self.log_saved = 0.0
+        
+        # Resumos das mensagens recentes do log local (dedup da replicação)
+        self.seen = OrderedDict()
+        self.seen_epoch = None
+        self.seen_offset = 0
+        self.merge_lock = Lock()
+        
+        # Servidores com sincronização de estado em curso
+        self.syncing = set()
+        self.sync_lock = Lock()
         
         print(f"[REPLICATION:{self.server_name}] Gerenciador inicializado (rank {rank})")
     
@@ -59,6 +100,52 @@ class ReplicationManager:
             
         except Exception as e:
             print(f"[REPLICATION:{self.server_name}] Erro ao iniciar servidor de replicação: {e}")
+        
+        self._start_link()
+    
+    def _start_link(self):
+        """Inicia o transporte em lotes, se disponível"""
+        if os.environ.get('BBS_REPLICATION', 'batch') == 'req':
+            return
+        if not replication_link.available():
+            print(f"[REPLICATION:{self.server_name}] libbbs_replication não encontrada, replicação por REQ")
+            return
+        
+        try:
+            self.link = replication_link.ReplicationLink(
+                self.server_name, f"tcp://*:{REPLICATION_BATCH_PORT}", self._apply_replicated,
+                resync=self._resync_from)
+        except OSError as e:
+            print(f"[REPLICATION:{self.server_name}] Transporte em lotes indisponível ({e}), replicação por REQ")
+            return
+        
+        with self.servers_lock:
+            self._update_link_peers()
+        print(f"[REPLICATION:{self.server_name}] Replicação em lotes na porta {REPLICATION_BATCH_PORT}")
+    
+    def _update_link_peers(self):
+        """Conexões do transporte com os servidores conhecidos (com servers_lock)"""
+        if self.link:
+            self.link.set_peers({s['name']: f"tcp://{s['name']}:{REPLICATION_BATCH_PORT}"
+                                 for s in self.known_servers})
+    
+    def _apply_replicated(self, source: str, offset: int, record: bytes) -> bool:
+        """
+        Registro recebido pelo transporte em lotes (thread da biblioteca, em
+        ordem de posição por origem): o mesmo data do serviço 'replicate'
+        """
+        self._handle_replicate(msgpack.unpackb(record, raw=False))
+        return True
+    
+    def _resync_from(self, source: str, first: int, end: int):
+        """
+        Registros de source que o transporte não vai entregar (thread da
+        biblioteca): a lacuna é recuperada do log de source por
+        sync_from_coordinator, em outra thread
+        """
+        print(f"[REPLICATION:{self.server_name}] Registros {first}..{end} de {source} perdidos "
+              f"pelo transporte, sincronizando estado")
+        Thread(target=self.sync_from_coordinator, args=(source,), daemon=True).start()
     
     def _handle_replication_requests(self):
         """Thread que processa requisições de replicação"""
@@ -80,6 +167,10 @@ class ReplicationManager:
                     response = self._handle_apply_offset(data)
                 elif service == 'sync_state':
                     response = self._handle_sync_state(data)
+                elif service == 'sync_begin':
+                    response = self._handle_sync_begin(data)
+                elif service == 'sync_chunk':
+                    response = self._handle_sync_chunk(data)
                 else:
                     response = {
                         'service': service,
@@ -127,7 +218,8 @@ class ReplicationManager:
                     'data': {'status': 'error', 'message': f'Tipo desconhecido: {data_type}'}
                 }
             
-            # Registra no log
+            # Registra no log (só as últimas entradas, gravadas no máximo uma
+            # vez por intervalo: o arquivo é reescrito a cada gravação)
             with self.log_lock:
                 log_entry = {
                     'timestamp': time.time(),
@@ -136,12 +228,10 @@ class ReplicationManager:
                     'records': len(payload) if isinstance(payload, list) else 1
                 }
                 self.replication_log.append(log_entry)
+                del self.replication_log[:-REPLICATION_LOG_MAX]
                 
-                # Salva log de replicação
-                self.datastore.save_replication(self.server_name, {
-                    'server': self.server_name,
-                    'log': self.replication_log
-                })
+                if log_entry['timestamp'] - self.log_saved >= REPLICATION_LOG_SAVE_INTERVAL:
+                    self._save_replication_log()
             
             print(f"[REPLICATION:{self.server_name}] Dados replicados com sucesso ({len(payload) if isinstance(payload, list) else 1} registros)")
             
@@ -157,6 +247,14 @@ class ReplicationManager:
                 'data': {'status': 'error', 'message': str(e)}
             }
     
+    def _save_replication_log(self):
+        """Salva log de replicação (com log_lock)"""
+        self.datastore.save_replication(self.server_name, {
+            'server': self.server_name,
+            'log': self.replication_log
+        })
+        self.log_saved = time.time()
+    
     def _handle_get_time(self, data: Dict) -> Dict:
         """Retorna timestamp local (para sincronização Berkeley)"""
         return {
@@ -205,6 +303,65 @@ class ReplicationManager:
                 'data': {'status': 'error', 'message': str(e)}
             }
     
+    def _handle_sync_begin(self, data: Dict) -> Dict:
+        """
+        Início de uma transferência: logins e canais completos (pequenos) e a
+        posição atual do log de mensagens (epoch, count)
+        """
+        position = self.datastore.log_position('messages.json')
+        if position is None:
+            return {'service': 'sync_begin', 'data': {'status': 'unsupported'}}
+        
+        epoch, count = position
+        return {
+            'service': 'sync_begin',
+            'data': {
+                'status': 'success',
+                'epoch': epoch,
+                'count': count,
+                'logins': self.datastore.load('logins.json', default=[]),
+                'channels': self.datastore.load('channels.json', default=[])
+            }
+        }
+    
+    def _handle_sync_chunk(self, data: Dict) -> Dict:
+        """
+        Bloco de registros do log de mensagens a partir de offset, enviados
+        como estão no log (MessagePack), com checksum
+        """
+        offset = max(0, int(data.get('offset', 0)))
+        limit = max(1, min(int(data.get('limit', SYNC_CHUNK_RECORDS)), SYNC_CHUNK_RECORDS))
+        
+        result = self.datastore.read_records('messages.json', offset, limit, SYNC_CHUNK_BYTES)
+        if result is None:
+            return {'service': 'sync_chunk', 'data': {'status': 'unsupported'}}
+        
+        epoch, records, count = result
+        if epoch != data.get('epoch'):
+            # Log compactado desde o sync_begin: posições antigas não valem
+            return {'service': 'sync_chunk', 'data': {'status': 'reset', 'epoch': epoch, 'count': count}}
+        
+        return {
+            'service': 'sync_chunk',
+            'data': {
+                'status': 'success',
+                'epoch': epoch,
+                'offset': offset,
+                'records': records,
+                'checksum': self._records_checksum(records),
+                'count': count
+            }
+        }
+    
+    @staticmethod
+    def _records_checksum(records: List[bytes]) -> int:
+        """CRC32 dos registros, cada um precedido do seu tamanho"""
+        checksum = 0
+        for record in records:
+            checksum = zlib.crc32(struct.pack('>I', len(record)), checksum)
+            checksum = zlib.crc32(record, checksum)
+        return checksum
+    
     def _merge_logins(self, new_logins: List[Dict]):
         """
         Mescla logins replicados com logins locais
@@ -259,37 +416,79 @@ class ReplicationManager:
         """
         Mescla mensagens replicadas com mensagens locais
         Remove duplicatas baseado em (timestamp, clock, user, channel/dst)
-        Mantém ordem por timestamp e clock
+        As novas vão para o fim do log local, na ordem de chegada: o índice de
+        histórico ordena por clock, e o log nunca é reescrito (nem ganha outro
+        epoch) por causa da replicação
         """
         try:
-            # Carrega mensagens existentes
-            existing = self.datastore.load('messages.json', default=[])
-            
-            # Cria conjunto de identificadores únicos das mensagens existentes
-            existing_ids = set()
-            for msg in existing:
-                msg_id = self._get_message_id(msg)
-                existing_ids.add(msg_id)
-            
-            # Adiciona apenas mensagens novas
-            added = 0
-            for msg in new_messages:
-                msg_id = self._get_message_id(msg)
-                if msg_id not in existing_ids:
-                    existing.append(msg)
-                    existing_ids.add(msg_id)
-                    added += 1
-            
-            # Ordena por timestamp e clock para manter consistência
-            existing.sort(key=lambda m: (m.get('timestamp', 0), m.get('clock', 0)))
-            
-            # Salva resultado mesclado
-            self.datastore.save('messages.json', existing)
-            print(f"[REPLICATION:{self.server_name}] Mensagens mescladas: {added} novas, {len(existing)} total")
+            added = self._append_messages(new_messages)
+            print(f"[REPLICATION:{self.server_name}] Mensagens mescladas: {len(added)} novas")
             
         except Exception as e:
             print(f"[REPLICATION:{self.server_name}] Erro ao mesclar mensagens: {e}")
     
+    def _append_messages(self, messages: List[Dict]) -> List[Dict]:
+        """
+        Acrescenta ao log local as mensagens que ele ainda não tem
+        
+        Returns:
+            Mensagens acrescentadas
+        """
+        with self.merge_lock:
+            self._refresh_seen()
+            added = []
+            for msg in messages:
+                digest = self._message_digest(msg)
+                if digest not in self.seen:
+                    self.seen[digest] = None
+                    added.append(msg)
+            
+            if added and not self.datastore.extend('messages.json', added):
+                for msg in added:
+                    self.seen.pop(self._message_digest(msg), None)
+                raise OSError('falha ao gravar mensagens no log local')
+            
+            # Sem outra gravação no meio, os registros novos são estes: não
+            # precisam ser relidos
+            position = self.datastore.log_position('messages.json')
+            if position and position == (self.seen_epoch, self.seen_offset + len(added)):
+                self.seen_offset = position[1]
+            
+            while len(self.seen) > SEEN_MAX:
+                self.seen.popitem(last=False)
+            return added
+    
+    def _refresh_seen(self):
+        """
+        Acrescenta a seen os resumos das mensagens gravadas no log local desde
+        a última leitura, venham de requisições, da replicação ou de uma
+        sincronização (com merge_lock)
+        """
+        position = self.datastore.log_position('messages.json')
+        if position is None:
+            # Mensagens em JSON: o arquivo já é relido a cada gravação
+            messages = self.datastore.load('messages.json', default=[])
+            self.seen = OrderedDict((self._message_digest(msg), None) for msg in messages[-SEEN_MAX:])
+            return
+        
+        epoch, count = position
+        if epoch != self.seen_epoch or count < self.seen_offset:
+            # Primeira leitura ou log local trocado: só o final interessa
+            self.seen.clear()
+            self.seen_epoch = epoch
+            self.seen_offset = max(0, count - SEEN_MAX)
+        
+        while self.seen_offset < count:
+            result = self.datastore.read_records('messages.json', self.seen_offset,
+                                                 SYNC_CHUNK_RECORDS, SYNC_CHUNK_BYTES)
+            if result is None or result[0] != epoch or not result[1]:
+                return
+            for record in result[1]:
+                digest = self._message_digest(msgpack.unpackb(record, raw=False))
+                self.seen[digest] = None
+                self.seen.move_to_end(digest)
+            self.seen_offset += len(result[1])
+    
     def _get_message_id(self, msg: Dict) -> tuple:
         """
         Gera identificador único para uma mensagem
@@ -309,6 +508,10 @@ class ReplicationManager:
         
         return (timestamp, clock, msg_type, user, target, message_text)
     
+    def _message_digest(self, msg: Dict) -> str:
+        """Resumo do identificador da mensagem, para guardar junto da posição"""
+        return hashlib.blake2b(msgpack.packb(self._get_message_id(msg)), digest_size=16).hexdigest()
+    
     def update_server_list(self, servers: List[Dict]):
         """
         Atualiza lista de servidores conhecidos
@@ -318,6 +521,7 @@ class ReplicationManager:
         """
         with self.servers_lock:
             self.known_servers = [s for s in servers if s['name'] != self.server_name]
+            self._update_link_peers()
         
         print(f"[REPLICATION:{self.server_name}] Lista de servidores atualizada: {len(self.known_servers)} servidores")
     
@@ -338,6 +542,17 @@ class ReplicationManager:
         
         print(f"[REPLICATION:{self.server_name}] Replicando {data_type} para {len(servers)} servidores")
         
+        if self.link:
+            # Um registro para todos os peers; o envio acontece em lotes na thread
+            # do transporte, sem esperar a confirmação de cada servidor
+            self.link.send(msgpack.packb({
+                'source_server': self.server_name,
+                'type': data_type,
+                'payload': payload,
+                'timestamp': time.time()
+            }))
+            return
+        
         for server in servers:
             self._replicate_to_server(server['name'], data_type, payload)
     
@@ -387,7 +602,209 @@ class ReplicationManager:
     
     def sync_from_coordinator(self, coordinator_name: str) -> bool:
         """
-        Sincroniza estado completo de um coordenador
+        Sincroniza o estado de um coordenador (ou de outro servidor, para
+        recuperar uma lacuna do transporte em lotes); uma sincronização já em
+        curso com o mesmo servidor não é repetida, pois ela segue até o fim do
+        log dele
+        
+        Returns:
+            True se sincronização foi bem-sucedida
+        """
+        with self.sync_lock:
+            if coordinator_name in self.syncing:
+                print(f"[REPLICATION:{self.server_name}] Sincronização com {coordinator_name} já em curso")
+                return False
+            self.syncing.add(coordinator_name)
+        try:
+            return self._sync_incremental(coordinator_name)
+        finally:
+            with self.sync_lock:
+                self.syncing.discard(coordinator_name)
+    
+    def _sync_incremental(self, coordinator_name: str) -> bool:
+        """
+        Sincroniza o estado de um coordenador
+        
+        As mensagens vêm do log do coordenador em blocos (sync_chunk) a partir
+        da última posição recebida dele, guardada em
+        replication/sync_progress_<servidor>_<coordenador>.json (uma por
+        origem: também é usada para recuperar lacunas do transporte em lotes
+        a partir de qualquer servidor): uma transferência
+        interrompida continua de onde parou, e um servidor que volta só
+        recebe o que perdeu. A transferência segue até alcançar o fim do log,
+        incluindo o que foi gravado durante ela.
+        
+        Args:
+            coordinator_name: Nome do servidor coordenador
+        
+        Returns:
+            True se sincronização foi bem-sucedida
+        """
+        progress_name = f'sync_progress_{self.server_name}_{coordinator_name}'
+        socket = None
+        
+        def request(service: str, payload: Dict) -> Optional[Dict]:
+            nonlocal socket
+            for attempt in range(SYNC_RETRIES):
+                if socket is None:
+                    socket = self.context.socket(zmq.REQ)
+                    socket.setsockopt(zmq.RCVTIMEO, SYNC_TIMEOUT_MS)
+                    socket.setsockopt(zmq.SNDTIMEO, SYNC_TIMEOUT_MS)
+                    socket.setsockopt(zmq.LINGER, 0)
+                    socket.connect(f"tcp://{coordinator_name}:6000")
+                try:
+                    socket.send(msgpack.packb({'service': service, 'data': payload}))
+                    return msgpack.unpackb(socket.recv(), raw=False).get('data', {})
+                except zmq.ZMQError as e:
+                    # REQ fica travado após timeout: recria o socket
+                    print(f"[REPLICATION:{self.server_name}] {service} para {coordinator_name} falhou "
+                          f"(tentativa {attempt + 1}/{SYNC_RETRIES}): {e}")
+                    socket.close()
+                    socket = None
+            return None
+        
+        try:
+            begin = request('sync_begin', {'requester': self.server_name})
+            if begin is None:
+                return False
+            if begin.get('status') == 'unsupported':
+                return self._sync_full_state(coordinator_name)
+            if begin.get('status') != 'success':
+                return False
+            
+            self._merge_logins(begin.get('logins', []))
+            self._merge_channels(begin.get('channels', []))
+            
+            epoch = begin['epoch']
+            progress = self.datastore.load_replication(progress_name)
+            offset = 0
+            if progress.get('coordinator') == coordinator_name and progress.get('epoch') == epoch:
+                offset = progress.get('offset', 0)
+            print(f"[REPLICATION:{self.server_name}] Sincronizando mensagens de {coordinator_name}: "
+                  f"registros {offset}..{begin['count']}")
+            
+            # Registros repetidos (já recebidos por replicação) são ignorados.
+            # Só as mensagens gravadas aqui desde a última posição salva podem
+            # repetir registros ainda não recebidos do coordenador: elas ficam
+            # em pending (digest -> posição local), salvo junto da posição,
+            # e o log local é lido só a partir de local_offset
+            local = self.datastore.log_position('messages.json')
+            pending: Dict[str, int] = {}
+            local_offset = 0
+            if local is None:
+                # Log local em JSON: não há posição, compara com todas
+                pending = {self._message_digest(msg): 0
+                           for msg in self.datastore.load('messages.json', default=[])}
+            elif offset and progress.get('local_epoch') == local[0]:
+                pending = dict(progress.get('pending', {}))
+                local_offset = min(progress.get('local_offset', 0), local[1])
+            local_epoch = local[0] if local else None
+            written = set()  # Acrescentadas por esta sincronização
+            
+            def scan_local():
+                """Acrescenta a pending as mensagens locais a partir de local_offset"""
+                nonlocal local_offset, local_epoch
+                while local is not None:
+                    result = self.datastore.read_records('messages.json', local_offset,
+                                                         SYNC_CHUNK_RECORDS, SYNC_CHUNK_BYTES)
+                    if result is None:
+                        return
+                    epoch_now, local_records, _ = result
+                    if epoch_now != local_epoch:
+                        # Log local compactado: as posições mudaram, relê do início
+                        local_epoch, local_offset = epoch_now, 0
+                        pending.clear()
+                        continue
+                    if not local_records:
+                        return
+                    for record in local_records:
+                        digest = self._message_digest(msgpack.unpackb(record, raw=False))
+                        if digest in written:
+                            written.discard(digest)
+                        else:
+                            pending[digest] = local_offset
+                        local_offset += 1
+            
+            received = 0
+            resets = 0
+            retries = 0
+            
+            while True:
+                chunk = request('sync_chunk', {'requester': self.server_name, 'epoch': epoch,
+                                               'offset': offset, 'limit': SYNC_CHUNK_RECORDS})
+                if chunk is None:
+                    return False
+                
+                if chunk.get('status') == 'reset':
+                    resets += 1
+                    if resets > SYNC_RESETS:
+                        return False
+                    epoch, offset = chunk['epoch'], 0
+                    print(f"[REPLICATION:{self.server_name}] Log de {coordinator_name} compactado, recomeçando")
+                    continue
+                if chunk.get('status') != 'success':
+                    return False
+                
+                records = chunk.get('records', [])
+                if chunk.get('offset') != offset or self._records_checksum(records) != chunk.get('checksum'):
+                    retries += 1
+                    print(f"[REPLICATION:{self.server_name}] Bloco {offset} com checksum inválido "
+                          f"(tentativa {retries}/{SYNC_RETRIES})")
+                    if retries >= SYNC_RETRIES:
+                        return False
+                    continue
+                retries = 0
+                resets = 0
+                
+                scan_local()
+                new_messages = []
+                for record in records:
+                    msg = msgpack.unpackb(record, raw=False)
+                    digest = self._message_digest(msg)
+                    # Cada mensagem aparece uma vez no log do coordenador:
+                    # depois de casada, a local não precisa mais ser lembrada
+                    if pending.pop(digest, None) is None:
+                        written.add(digest)
+                        new_messages.append(msg)
+                # Também descarta as que chegaram pela replicação desde scan_local
+                added = self._append_messages(new_messages) if new_messages else []
+                scan_local()  # Passa das que acabaram de ser acrescentadas
+                
+                received += len(added)
+                offset += len(records)
+                
+                # Locais que o coordenador nunca recebeu não crescem sem limite
+                if len(pending) > SYNC_PENDING_MAX:
+                    for digest, _ in sorted(pending.items(), key=lambda item: item[1])[:len(pending) - SYNC_PENDING_MAX]:
+                        del pending[digest]
+                self.datastore.save_replication(progress_name, {
+                    'coordinator': coordinator_name,
+                    'epoch': epoch,
+                    'offset': offset,
+                    'local_epoch': local_epoch,
+                    'local_offset': local_offset,
+                    'pending': pending if local is not None else {},
+                    'timestamp': time.time()
+                })
+                
+                if not records or offset >= chunk.get('count', 0):
+                    break
+            
+            print(f"[REPLICATION:{self.server_name}] Estado sincronizado de {coordinator_name} "
+                  f"({received} mensagens novas, posição {offset})")
+            return True
+            
+        except Exception as e:
+            print(f"[REPLICATION:{self.server_name}] Erro ao sincronizar de {coordinator_name}: {e}")
+            return False
+        finally:
+            if socket is not None:
+                socket.close()
+    
+    def _sync_full_state(self, coordinator_name: str) -> bool:
+        """
+        Sincroniza estado completo de um coordenador em uma única resposta
+        (coordenador sem log de mensagens, BBS_STORAGE=json)
         
         Args:
             coordinator_name: Nome do servidor coordenador
@@ -418,10 +835,11 @@ class ReplicationManager:
             if response.get('data', {}).get('status') == 'success':
                 state = response['data']['state']
                 
-                # Aplica estado localmente
+                # Aplica estado localmente; as mensagens só são acrescentadas,
+                # para o log local não ser reescrito
                 self.datastore.save('logins.json', state.get('logins', []))
                 self.datastore.save('channels.json', state.get('channels', []))
-                self.datastore.save('messages.json', state.get('messages', []))
+                self._append_messages(state.get('messages', []))
                 
                 print(f"[REPLICATION:{self.server_name}] Estado sincronizado de {coordinator_name}")
                 socket.close()
@@ -441,5 +859,10 @@ class ReplicationManager:
     
     def cleanup(self):
         """Limpa recursos"""
+        if self.link:
+            self.link.close()
+        with self.log_lock:
+            if self.replication_log:
+                self._save_replication_log()
         self.rep_socket.close()
         self.context.term()
@@ -2,7 +2,7 @@
 """
 Servidor de Mensagens BBS
 Gerencia login, canais, mensagens, sincronização e replicação
-Conecta ao broker (5556) e ao proxy (5557)
+Conecta aos brokers (5556) e ao proxy (5557)
 """
 
 import zmq
@@ -10,6 +10,7 @@ import time
 import sys
 import os
 import random
+import queue
 from threading import Thread, Lock
 from datetime import datetime
 
@@ -17,8 +18,9 @@ from datetime import datetime
 sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', 'common_utils'))
 
 from logical_clock import LogicalClock
-from persistence import DataStore
+from persistence import DataStore, HISTORY_CHANNEL, HISTORY_USER
 from messaging import create_message, parse_message, create_response, update_logical_clock
+from broker_ring import endpoints_from_env
 
 # Importa módulos de sincronização, replicação e eleição
 from berkeley_sync import BerkeleySynchronizer
@@ -26,13 +28,18 @@ from replication_manager import ReplicationManager
 from election_manager import ElectionManager
 
 # Configurações
-BROKER_BACKEND = "tcp://broker:5556"
+# Backends dos brokers do cluster, separados por vírgula: o servidor atende
+# todos e responde cada requisição pelo broker que a enviou
+BROKER_BACKENDS = endpoints_from_env('BROKER_BACKENDS', 'tcp://broker:5556')
 PROXY_BACKEND = "tcp://proxy:5557"
 REFERENCE_SERVER = "tcp://reference:5559"
 HEARTBEAT_INTERVAL = 10  # segundos
 SYNC_INTERVAL = 10  # a cada 10 mensagens
 CLOCK_SYNC_INTERVAL = 10  # a cada 10 mensagens
 ELECTION_TIMEOUT = 15  # timeout para detectar falha do coordenador
+READY_INTERVAL = 5  # segundos entre anúncios 'ready' ao broker
+REPLICATION_CHUNK_RECORDS = 500  # mensagens lidas do log por vez ao replicar
+REPLICATION_CHUNK_BYTES = 1 << 20
 
 class MessageServer:
     """Servidor de mensagens do sistema BBS"""
@@ -72,13 +79,31 @@ class MessageServer:
         # Dados locais
         self.users = set()
         self.channels = set()
-        self.messages = []
+        self.messages = []            # Só com BBS_STORAGE=json (ver _load_state)
+        self.messages_in_log = False
+        self.replicated_offset = 0    # Mensagens do log já replicadas
         
         # Contexto ZeroMQ
         self.context = zmq.Context()
         
-        # Socket REQ para broker (requisições dos clientes)
-        self.req_socket = self.context.socket(zmq.REP)
+        # Um socket DEALER por broker (requisições dos clientes)
+        # A identidade é o nome do servidor: cada broker escalona por carga e
+        # endereça cada requisição ao servidor escolhido. Um único DEALER
+        # conectado a vários brokers distribuiria as respostas em round-robin
+        self.req_sockets = []
+        for _ in BROKER_BACKENDS:
+            req_socket = self.context.socket(zmq.DEALER)
+            req_socket.setsockopt_string(zmq.IDENTITY, self.server_name)
+            self.req_sockets.append(req_socket)
+        self.last_ready = 0
+        
+        # Requisições vão a uma thread de processamento; o loop dos sockets
+        # só recebe, responde os pings na hora e devolve as respostas que ela
+        # manda pelo PULL inproc (sockets ZeroMQ não são compartilhados entre threads)
+        self.requests = queue.Queue()
+        self.replies_endpoint = f"inproc://replies-{self.server_name}"
+        self.reply_socket = self.context.socket(zmq.PULL)
+        self.pong_clock = LogicalClock()
         
         # Socket PUB para proxy (publicações)
         self.pub_socket = self.context.socket(zmq.PUB)
@@ -107,11 +132,23 @@ class MessageServer:
         channels_data = self.datastore.load('channels.json', default=[])
         self.channels = set([entry['channel'] for entry in channels_data if 'channel' in entry])
         
-        # Carrega mensagens
-        self.messages = self.datastore.load('messages.json', default=[])
+        # Mensagens: com o log, o histórico é servido pelo índice e a lista
+        # não fica em memória; em JSON ela é carregada inteira
+        position = self.datastore.log_position('messages.json')
+        self.messages_in_log = position is not None
+        if self.messages_in_log:
+            # As anteriores chegam aos outros pela sincronização de estado
+            self.replicated_offset = position[1]
+        else:
+            self.messages = self.datastore.load('messages.json', default=[])
         
         print(f"[SERVER:{self.server_name}] Estado carregado: {len(self.users)} usuários, "
-              f"{len(self.channels)} canais, {len(self.messages)} mensagens")
+              f"{len(self.channels)} canais, {self._message_total()} mensagens")
+    
+    def _message_total(self) -> int:
+        """Quantidade de mensagens guardadas (posição do log, sem lê-lo)"""
+        position = self.datastore.log_position('messages.json') if self.messages_in_log else None
+        return position[1] if position else len(self.messages)
     
     def _reload_users_and_channels(self):
         """Recarrega usuários e canais do disco (após replicação)"""
@@ -126,12 +163,14 @@ class MessageServer:
             with self.channels_lock:
                 self.channels = set([entry['channel'] for entry in channels_data if 'channel' in entry])
             
-            # Recarrega mensagens
-            with self.messages_lock:
-                self.messages = self.datastore.load('messages.json', default=[])
+            # Recarrega mensagens: com o log não há o que reler (a replicação
+            # acrescenta direto nele e o índice já as serve)
+            if not self.messages_in_log:
+                with self.messages_lock:
+                    self.messages = self.datastore.load('messages.json', default=[])
             
             print(f"[SERVER:{self.server_name}] Estado recarregado: {len(self.users)} usuários, "
-                  f"{len(self.channels)} canais, {len(self.messages)} mensagens")
+                  f"{len(self.channels)} canais, {self._message_total()} mensagens")
         except Exception as e:
             print(f"[SERVER:{self.server_name}] Erro ao recarregar estado: {e}")
     
@@ -145,8 +184,10 @@ class MessageServer:
         channels_data = [{'channel': channel, 'timestamp': time.time()} for channel in self.channels]
         self.datastore.save('channels.json', channels_data)
         
-        # Salva mensagens
-        self.datastore.save('messages.json', self.messages)
+        # Mensagens já são gravadas uma a uma (append): regravar a lista da
+        # memória perderia as replicadas desde a última recarga e trocaria o
+        # log de mensagens (outro epoch), invalidando as posições das
+        # sincronizações incrementais
     
     def register_with_reference(self):
         """Registra o servidor no servidor de referência e obtém rank"""
@@ -292,6 +333,15 @@ class MessageServer:
                 # Atualiza Berkeley
                 if self.berkeley_sync:
                     self.berkeley_sync.is_coordinator = (new_coordinator == self.server_name)
+                
+                # Ao entrar (ou voltar) no sistema, recupera o que perdeu
+                if old_coordinator is None and new_coordinator != self.server_name and self.replication_manager:
+                    Thread(target=self._sync_from_coordinator, args=(new_coordinator,), daemon=True).start()
+    
+    def _sync_from_coordinator(self, coordinator: str):
+        """Sincroniza estado do coordenador e recarrega o estado local"""
+        if self.replication_manager.sync_from_coordinator(coordinator):
+            self._reload_users_and_channels()
     
     def _monitor_coordinator(self):
         """Thread que monitora saúde do coordenador e inicia eleição se necessário"""
@@ -353,7 +403,10 @@ class MessageServer:
                 channels_data = [{'channel': channel, 'timestamp': time.time()} for channel in self.channels]
             
             with self.messages_lock:
-                messages_data = list(self.messages)
+                if self.messages_in_log:
+                    messages_data = self._unreplicated_messages()
+                else:
+                    messages_data = list(self.messages)
             
             # Replica cada tipo de dado
             self.replication_manager.replicate_to_all('logins', users_data)
@@ -365,6 +418,26 @@ class MessageServer:
         except Exception as e:
             print(f"[SERVER:{self.server_name}] Erro ao replicar estado: {e}")
     
+    def _unreplicated_messages(self) -> list:
+        """Lê do log só as mensagens acrescentadas desde a última replicação (com messages_lock)"""
+        import msgpack
+        
+        messages = []
+        while True:
+            result = self.datastore.read_records('messages.json', self.replicated_offset,
+                                                 REPLICATION_CHUNK_RECORDS, REPLICATION_CHUNK_BYTES)
+            if result is None:
+                return messages
+            _, records, count = result
+            if self.replicated_offset > count:
+                # Log recomeçou (arquivo apagado): segue do início dele
+                self.replicated_offset = 0
+                continue
+            messages.extend(msgpack.unpackb(record, raw=False) for record in records)
+            self.replicated_offset += len(records)
+            if not records or self.replicated_offset >= count:
+                return messages
+    
     def _run_berkeley_sync(self):
         """Executa sincronização Berkeley"""
         try:
@@ -508,8 +581,9 @@ class MessageServer:
                 'timestamp': time.time(),
                 'clock': self.clock.get_time()
             }
-            self.messages.append(message_entry)
-            self.datastore.save('messages.json', self.messages)
+            if not self.messages_in_log:
+                self.messages.append(message_entry)
+            self.datastore.append('messages.json', message_entry)
         
         if self.replication_manager:
             Thread(target=lambda: self.replication_manager.replicate_to_all(
@@ -557,8 +631,9 @@ class MessageServer:
                 'timestamp': time.time(),
                 'clock': self.clock.get_time()
             }
-            self.messages.append(message_entry)
-            self.datastore.save('messages.json', self.messages)
+            if not self.messages_in_log:
+                self.messages.append(message_entry)
+            self.datastore.append('messages.json', message_entry)
         
         # Replica imediatamente mensagens para garantir consistência
         if self.replication_manager:
@@ -577,13 +652,15 @@ class MessageServer:
         Retorna histórico de mensagens de um canal específico
         
         Args:
-            data: Dados da requisição com 'channel' e opcionalmente 'limit'
+            data: Dados da requisição com 'channel' e opcionalmente 'limit' e
+                  'before' (só mensagens com clock menor, para paginar)
         
         Returns:
             Resposta com histórico de mensagens
         """
         channel = data.get('channel', '')
         limit = data.get('limit', 50)  # Padrão: últimas 50 mensagens
+        before = data.get('before')
         
         if not channel:
             return create_response('get_history', 'erro', {}, self.clock,
@@ -594,20 +671,30 @@ class MessageServer:
                 return create_response('get_history', 'erro', {}, self.clock,
                                      'Canal não existe')
         
-        # Filtra mensagens do canal
-        with self.messages_lock:
-            channel_messages = [
-                msg for msg in self.messages
-                if msg.get('type') == 'publish' and msg.get('channel') == channel
-            ]
-            
-            # Ordena por timestamp (e relógio lógico como desempate) para garantir
-            # que o histórico retornado esteja em ordem cronológica.
-            channel_messages.sort(key=lambda m: (m.get('timestamp', 0), m.get('clock', 0)))
-
-            # Limita quantidade (últimas N mensagens)
-            if len(channel_messages) > limit:
-                channel_messages = channel_messages[-limit:]
+        # Página lida pelo índice do log, sem percorrer as demais mensagens
+        channel_messages = self.datastore.history('messages.json', HISTORY_CHANNEL,
+                                                  channel, limit, before)
+        
+        if channel_messages is None and self.messages_in_log:
+            return create_response('get_history', 'erro', {}, self.clock,
+                                 'Histórico indisponível')
+        
+        # Sem índice (BBS_STORAGE=json): filtra mensagens do canal
+        if channel_messages is None:
+            with self.messages_lock:
+                channel_messages = [
+                    msg for msg in self.messages
+                    if msg.get('type') == 'publish' and msg.get('channel') == channel and
+                       (before is None or msg.get('clock', 0) < before)
+                ]
+                
+                # Ordena por timestamp (e relógio lógico como desempate) para garantir
+                # que o histórico retornado esteja em ordem cronológica.
+                channel_messages.sort(key=lambda m: (m.get('timestamp', 0), m.get('clock', 0)))
+                
+                # Limita quantidade (últimas N mensagens)
+                if len(channel_messages) > limit:
+                    channel_messages = channel_messages[-limit:]
         
         print(f"[SERVER:{self.server_name}] Histórico solicitado para #{channel}: {len(channel_messages)} mensagens")
         return create_response('get_history', 'sucesso', 
@@ -619,29 +706,44 @@ class MessageServer:
         Retorna histórico de mensagens privadas de um usuário
         
         Args:
-            data: Dados da requisição com 'user' e opcionalmente 'limit'
+            data: Dados da requisição com 'user' e opcionalmente 'limit' e
+                  'before' (só mensagens com clock menor, para paginar)
         
         Returns:
             Resposta com histórico de mensagens privadas
         """
         user = data.get('user', '')
         limit = data.get('limit', 50)
+        before = data.get('before')
         
         if not user:
             return create_response('get_private_history', 'erro', {}, self.clock,
                                  'Nome do usuário não fornecido')
         
-        # Filtra mensagens privadas (enviadas ou recebidas)
-        with self.messages_lock:
-            private_messages = [
-                msg for msg in self.messages
-                if msg.get('type') == 'message' and 
-                   (msg.get('src') == user or msg.get('dst') == user)
-            ]
-            
-            # Limita quantidade
-            if len(private_messages) > limit:
-                private_messages = private_messages[-limit:]
+        # Página lida pelo índice do log, sem percorrer as demais mensagens
+        private_messages = self.datastore.history('messages.json', HISTORY_USER,
+                                                  user, limit, before)
+        
+        if private_messages is None and self.messages_in_log:
+            return create_response('get_private_history', 'erro', {}, self.clock,
+                                 'Histórico indisponível')
+        
+        # Sem índice (BBS_STORAGE=json): filtra mensagens privadas (enviadas ou recebidas)
+        if private_messages is None:
+            with self.messages_lock:
+                private_messages = [
+                    msg for msg in self.messages
+                    if msg.get('type') == 'message' and 
+                       (msg.get('src') == user or msg.get('dst') == user) and
+                       (before is None or msg.get('clock', 0) < before)
+                ]
+                
+                # A replicação acrescenta na ordem de chegada: ordena como o canal
+                private_messages.sort(key=lambda m: (m.get('timestamp', 0), m.get('clock', 0)))
+                
+                # Limita quantidade
+                if len(private_messages) > limit:
+                    private_messages = private_messages[-limit:]
         
         print(f"[SERVER:{self.server_name}] Histórico privado solicitado para @{user}: {len(private_messages)} mensagens")
         return create_response('get_private_history', 'sucesso',
@@ -697,6 +799,110 @@ class MessageServer:
                 print(f"[SERVER:{self.server_name}] Erro ao processar tópico 'servers': {e}")
                 time.sleep(1)
     
+    def _send_ready(self):
+        """
+        Anuncia a todos os brokers que o servidor está pronto para receber
+        requisições. Reenviado periodicamente para que um broker reiniciado
+        volte a conhecer o servidor
+        """
+        ready = create_message('ready', {'server': self.server_name}, self.clock)
+        for req_socket in self.req_sockets:
+            req_socket.send_multipart([b'', ready])
+        self.last_ready = time.time()
+    
+    def _send_reply(self, req_socket, envelope, response):
+        """Envia a resposta ao broker que enviou a requisição, com o envelope do cliente"""
+        req_socket.send_multipart(envelope + [response])
+    
+    def _receive_request(self, index):
+        """
+        Recebe uma requisição de um broker (loop dos sockets). O ping do
+        broker é respondido aqui, sem esperar as requisições na fila, para
+        que uma requisição demorada não faça o servidor parecer morto
+        """
+        # Requisição do broker: [cliente..., b'', dados]
+        req_socket = self.req_sockets[index]
+        frames = req_socket.recv_multipart()
+        envelope, raw_message = frames[:-1], frames[-1]
+        message = parse_message(raw_message)
+        
+        # Heartbeat do broker: responde logo, sem tocar no relógio nem no estado
+        if message and message.get('service') == 'ping':
+            self._send_reply(req_socket, envelope, create_response('pong', 'sucesso', {}, self.pong_clock))
+            return
+        
+        self.requests.put((index, envelope, message))
+    
+    def _process_requests(self):
+        """Thread que processa as requisições na ordem em que chegaram"""
+        reply_socket = self.context.socket(zmq.PUSH)
+        reply_socket.connect(self.replies_endpoint)
+        try:
+            while True:
+                request = self.requests.get()
+                if request is None:
+                    return
+                index, envelope, message = request
+                response = self._handle_request(message)
+                reply_socket.send_multipart([index.to_bytes(1, 'big')] + envelope + [response])
+                
+                # CORREÇÃO: Verifica sincronização após cada requisição processada
+                # Sincroniza (Berkeley + Replicação) a cada SYNC_INTERVAL mensagens
+                if message:
+                    self._check_sync()
+        finally:
+            reply_socket.close(linger=0)
+    
+    def _forward_reply(self):
+        """Envia ao broker de origem uma resposta da thread de processamento"""
+        frames = self.reply_socket.recv_multipart()
+        self._send_reply(self.req_sockets[frames[0][0]], frames[1:-1], frames[-1])
+    
+    def _handle_request(self, message):
+        """Processa uma requisição recebida de um broker e retorna a resposta"""
+        if not message:
+            # Erro se mensagem inválida
+            return create_response('error', 'erro', {}, self.clock,
+                                 'Mensagem inválida')
+        
+        service = message.get('service', '')
+        data = message.get('data', {})
+        
+        # Atualiza relógio lógico
+        received_clock = data.get('clock', 0)
+        update_logical_clock(self.clock, received_clock)
+        
+        # Processa requisição baseado no serviço
+        if service == 'login':
+            response = self.handle_login(data)
+            self.message_count += 1
+        elif service == 'users':
+            response = self.handle_list_users(data)
+            self.message_count += 1
+        elif service == 'channel':
+            response = self.handle_create_channel(data)
+            self.message_count += 1
+        elif service == 'channels':
+            response = self.handle_list_channels(data)
+            self.message_count += 1
+        elif service == 'publish':
+            response = self.handle_publish(data)
+            # publish já incrementa message_count e chama _check_sync()
+        elif service == 'message':
+            response = self.handle_message(data)
+            # message já incrementa message_count e chama _check_sync()
+        elif service == 'get_history':
+            response = self.handle_get_history(data)
+            self.message_count += 1
+        elif service == 'get_private_history':
+            response = self.handle_get_private_history(data)
+            self.message_count += 1
+        else:
+            response = create_response(service, 'erro', {}, self.clock,
+                                     f'Serviço desconhecido: {service}')
+        
+        return response
+    
     def run(self):
         """Executa o loop principal do servidor"""
         print(f"[SERVER:{self.server_name}] Iniciando servidor de mensagens...")
@@ -707,8 +913,17 @@ class MessageServer:
             return
         
         # Conecta aos sockets
-        self.req_socket.connect(BROKER_BACKEND)
-        print(f"[SERVER:{self.server_name}] Conectado ao broker em {BROKER_BACKEND}")
+        poller = zmq.Poller()
+        for req_socket, endpoint in zip(self.req_sockets, BROKER_BACKENDS):
+            req_socket.connect(endpoint)
+            poller.register(req_socket, zmq.POLLIN)
+            print(f"[SERVER:{self.server_name}] Conectado ao broker em {endpoint}")
+        
+        # Respostas da thread de processamento (bind antes do connect dela)
+        self.reply_socket.bind(self.replies_endpoint)
+        poller.register(self.reply_socket, zmq.POLLIN)
+        request_thread = Thread(target=self._process_requests, daemon=True)
+        request_thread.start()
         
         self.pub_socket.connect(PROXY_BACKEND)
         print(f"[SERVER:{self.server_name}] Conectado ao proxy em {PROXY_BACKEND}")
@@ -727,67 +942,32 @@ class MessageServer:
         heartbeat_thread.start()
         
         print(f"[SERVER:{self.server_name}] Servidor pronto para receber requisições")
+        self._send_ready()
         
         try:
             while True:
-                # Recebe requisição do broker
-                raw_message = self.req_socket.recv()
-                message = parse_message(raw_message)
-                
-                if not message:
-                    # Envia erro se mensagem inválida
-                    error = create_response('error', 'erro', {}, self.clock,
-                                          'Mensagem inválida')
-                    self.req_socket.send(error)
-                    continue
-                
-                service = message.get('service', '')
-                data = message.get('data', {})
+                # Aguarda requisição de algum broker. O 'ready' é reenviado no
+                # intervalo mesmo com tráfego: os pings de um broker vivo nunca
+                # deixam o poll ocioso, e um broker reiniciado precisa do anúncio
+                ready_sockets = dict(poller.poll(1000))
+                if time.time() - self.last_ready >= READY_INTERVAL:
+                    self._send_ready()
                 
-                # Atualiza relógio lógico
-                received_clock = data.get('clock', 0)
-                update_logical_clock(self.clock, received_clock)
-                
-                # Processa requisição baseado no serviço
-                if service == 'login':
-                    response = self.handle_login(data)
-                    self.message_count += 1
-                elif service == 'users':
-                    response = self.handle_list_users(data)
-                    self.message_count += 1
-                elif service == 'channel':
-                    response = self.handle_create_channel(data)
-                    self.message_count += 1
-                elif service == 'channels':
-                    response = self.handle_list_channels(data)
-                    self.message_count += 1
-                elif service == 'publish':
-                    response = self.handle_publish(data)
-                    # publish já incrementa message_count e chama _check_sync()
-                elif service == 'message':
-                    response = self.handle_message(data)
-                    # message já incrementa message_count e chama _check_sync()
-                elif service == 'get_history':
-                    response = self.handle_get_history(data)
-                    self.message_count += 1
-                elif service == 'get_private_history':
-                    response = self.handle_get_private_history(data)
-                    self.message_count += 1
-                else:
-                    response = create_response(service, 'erro', {}, self.clock,
-                                             f'Serviço desconhecido: {service}')
+                if self.reply_socket in ready_sockets:
+                    self._forward_reply()
                 
-                # Envia resposta
-                self.req_socket.send(response)
-                
-                # CORREÇÃO: Verifica sincronização após cada requisição processada
-                # Sincroniza (Berkeley + Replicação) a cada SYNC_INTERVAL mensagens
-                self._check_sync()
+                # Uma requisição por broker pronto a cada volta (nenhum monopoliza o servidor)
+                for index, req_socket in enumerate(self.req_sockets):
+                    if req_socket in ready_sockets:
+                        self._receive_request(index)
                 
         except KeyboardInterrupt:
             print(f"\n[SERVER:{self.server_name}] Encerrando servidor...")
         finally:
+            self.requests.put(None)
+            request_thread.join()
             self._save_state()
+            self.datastore.close()
             
             # Cleanup de replicação
             if self.replication_manager:
@@ -797,7 +977,9 @@ class MessageServer:
             if self.election_manager:
                 self.election_manager.cleanup()
             
-            self.req_socket.close()
+            for req_socket in self.req_sockets:
+                req_socket.close()
+            self.reply_socket.close()
             self.pub_socket.close()
             self.ref_socket.close()
             self.sub_socket.close()